@@ -0,0 +1,394 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "binary_tree.h"
+#include "bench_engines.h"
+#include "whiskey_tree.h"
+
+void* bench_key_to_data(NODE_KEY key)
+{
+    return (void*)((uintptr_t)key + 1);
+}
+
+// Binary tree engine
+
+static void* tree_engine_create(size_t key_space)
+{
+    (void)key_space;
+    return binary_tree_create();
+}
+
+static void tree_engine_destroy(void* engine)
+{
+    binary_tree_destroy((BINARY_TREE_HANDLE)engine);
+}
+
+static int tree_engine_insert(void* engine, NODE_KEY key, void* data)
+{
+    return binary_tree_insert((BINARY_TREE_HANDLE)engine, key, data);
+}
+
+static int tree_engine_remove(void* engine, NODE_KEY key)
+{
+    return binary_tree_remove((BINARY_TREE_HANDLE)engine, key, NULL);
+}
+
+static void* tree_engine_find(void* engine, NODE_KEY key)
+{
+    return binary_tree_find((BINARY_TREE_HANDLE)engine, key);
+}
+
+// Mutex wrapped tree, the concurrent baseline.  Every call is serialized so
+// it shows what the tree's own locking gains over a single lock
+
+typedef struct TREE_MUTEX_ENGINE_TAG
+{
+    BINARY_TREE_HANDLE tree_handle;
+    pthread_mutex_t lock;
+} TREE_MUTEX_ENGINE;
+
+static void* tree_mutex_engine_create(size_t key_space)
+{
+    TREE_MUTEX_ENGINE* result = (TREE_MUTEX_ENGINE*)malloc(sizeof(TREE_MUTEX_ENGINE));
+    (void)key_space;
+    if (result != NULL)
+    {
+        if ((result->tree_handle = binary_tree_create()) == NULL)
+        {
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            (void)pthread_mutex_init(&result->lock, NULL);
+        }
+    }
+    return result;
+}
+
+static void tree_mutex_engine_destroy(void* engine)
+{
+    TREE_MUTEX_ENGINE* tree_mutex_engine = (TREE_MUTEX_ENGINE*)engine;
+    binary_tree_destroy(tree_mutex_engine->tree_handle);
+    (void)pthread_mutex_destroy(&tree_mutex_engine->lock);
+    free(tree_mutex_engine);
+}
+
+static int tree_mutex_engine_insert(void* engine, NODE_KEY key, void* data)
+{
+    int result;
+    TREE_MUTEX_ENGINE* tree_mutex_engine = (TREE_MUTEX_ENGINE*)engine;
+    (void)pthread_mutex_lock(&tree_mutex_engine->lock);
+    result = binary_tree_insert(tree_mutex_engine->tree_handle, key, data);
+    (void)pthread_mutex_unlock(&tree_mutex_engine->lock);
+    return result;
+}
+
+static int tree_mutex_engine_remove(void* engine, NODE_KEY key)
+{
+    int result;
+    TREE_MUTEX_ENGINE* tree_mutex_engine = (TREE_MUTEX_ENGINE*)engine;
+    (void)pthread_mutex_lock(&tree_mutex_engine->lock);
+    result = binary_tree_remove(tree_mutex_engine->tree_handle, key, NULL);
+    (void)pthread_mutex_unlock(&tree_mutex_engine->lock);
+    return result;
+}
+
+static void* tree_mutex_engine_find(void* engine, NODE_KEY key)
+{
+    void* result;
+    TREE_MUTEX_ENGINE* tree_mutex_engine = (TREE_MUTEX_ENGINE*)engine;
+    (void)pthread_mutex_lock(&tree_mutex_engine->lock);
+    result = binary_tree_find(tree_mutex_engine->tree_handle, key);
+    (void)pthread_mutex_unlock(&tree_mutex_engine->lock);
+    return result;
+}
+
+// The same tree specialized at compile time, NODE_KEY keys compared inline
+// and the data stored in the node
+
+WHISKEY_TREE_DEFINE(typed_tree, NODE_KEY, void*, WHISKEY_TREE_COMPARE_SCALAR)
+
+static void* typed_tree_engine_create(size_t key_space)
+{
+    typed_tree_tree* result = (typed_tree_tree*)malloc(sizeof(typed_tree_tree));
+    (void)key_space;
+    if (result != NULL)
+    {
+        typed_tree_init(result);
+    }
+    return result;
+}
+
+static void typed_tree_engine_destroy(void* engine)
+{
+    typed_tree_clear((typed_tree_tree*)engine);
+    free(engine);
+}
+
+static int typed_tree_engine_insert(void* engine, NODE_KEY key, void* data)
+{
+    return typed_tree_insert((typed_tree_tree*)engine, key, data);
+}
+
+static int typed_tree_engine_remove(void* engine, NODE_KEY key)
+{
+    return typed_tree_remove((typed_tree_tree*)engine, key, NULL);
+}
+
+static void* typed_tree_engine_find(void* engine, NODE_KEY key)
+{
+    void** value = typed_tree_find((typed_tree_tree*)engine, key);
+    return value == NULL ? NULL : *value;
+}
+
+// Sorted array baseline, binary search with memmove on insert and remove
+
+typedef struct SORTED_ARRAY_TAG
+{
+    NODE_KEY* keys;
+    void** values;
+    size_t count;
+} SORTED_ARRAY;
+
+static void sorted_array_destroy(void* engine)
+{
+    SORTED_ARRAY* sorted_array = (SORTED_ARRAY*)engine;
+    if (sorted_array != NULL)
+    {
+        free(sorted_array->keys);
+        free(sorted_array->values);
+        free(sorted_array);
+    }
+}
+
+static void* sorted_array_create(size_t key_space)
+{
+    SORTED_ARRAY* result = (SORTED_ARRAY*)calloc(1, sizeof(SORTED_ARRAY));
+    if (result != NULL)
+    {
+        result->keys = (NODE_KEY*)malloc(key_space * sizeof(NODE_KEY));
+        result->values = (void**)malloc(key_space * sizeof(void*));
+        if (result->keys == NULL || result->values == NULL)
+        {
+            sorted_array_destroy(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+// Index of the first key not less than key
+static size_t sorted_array_lower_bound(const SORTED_ARRAY* sorted_array, NODE_KEY key)
+{
+    size_t low = 0;
+    size_t high = sorted_array->count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (sorted_array->keys[middle] < key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static int sorted_array_insert(void* engine, NODE_KEY key, void* data)
+{
+    int result;
+    SORTED_ARRAY* sorted_array = (SORTED_ARRAY*)engine;
+    size_t index = sorted_array_lower_bound(sorted_array, key);
+    if (index < sorted_array->count && sorted_array->keys[index] == key)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        memmove(&sorted_array->keys[index + 1], &sorted_array->keys[index], (sorted_array->count - index) * sizeof(NODE_KEY));
+        memmove(&sorted_array->values[index + 1], &sorted_array->values[index], (sorted_array->count - index) * sizeof(void*));
+        sorted_array->keys[index] = key;
+        sorted_array->values[index] = data;
+        sorted_array->count++;
+        result = 0;
+    }
+    return result;
+}
+
+static int sorted_array_remove(void* engine, NODE_KEY key)
+{
+    int result;
+    SORTED_ARRAY* sorted_array = (SORTED_ARRAY*)engine;
+    size_t index = sorted_array_lower_bound(sorted_array, key);
+    if (index == sorted_array->count || sorted_array->keys[index] != key)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        sorted_array->count--;
+        memmove(&sorted_array->keys[index], &sorted_array->keys[index + 1], (sorted_array->count - index) * sizeof(NODE_KEY));
+        memmove(&sorted_array->values[index], &sorted_array->values[index + 1], (sorted_array->count - index) * sizeof(void*));
+        result = 0;
+    }
+    return result;
+}
+
+static void* sorted_array_find(void* engine, NODE_KEY key)
+{
+    SORTED_ARRAY* sorted_array = (SORTED_ARRAY*)engine;
+    size_t index = sorted_array_lower_bound(sorted_array, key);
+    return index < sorted_array->count && sorted_array->keys[index] == key ? sorted_array->values[index] : NULL;
+}
+
+// Hash table baseline, open addressing with linear probing and backward
+// shift deletion, sized to stay at most half full
+
+typedef struct HASH_SLOT_TAG
+{
+    NODE_KEY key;
+    void* data;
+    int used;
+} HASH_SLOT;
+
+typedef struct HASH_TABLE_TAG
+{
+    HASH_SLOT* slots;
+    size_t mask;
+} HASH_TABLE;
+
+static void hash_table_destroy(void* engine)
+{
+    HASH_TABLE* hash_table = (HASH_TABLE*)engine;
+    if (hash_table != NULL)
+    {
+        free(hash_table->slots);
+        free(hash_table);
+    }
+}
+
+static void* hash_table_create(size_t key_space)
+{
+    HASH_TABLE* result = (HASH_TABLE*)malloc(sizeof(HASH_TABLE));
+    if (result != NULL)
+    {
+        size_t capacity = 2;
+        while (capacity < key_space * 2)
+        {
+            capacity <<= 1;
+        }
+        result->mask = capacity - 1;
+        if ((result->slots = (HASH_SLOT*)calloc(capacity, sizeof(HASH_SLOT))) == NULL)
+        {
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+static size_t hash_table_home(const HASH_TABLE* hash_table, NODE_KEY key)
+{
+    return (size_t)(((uint64_t)key * 0x9e3779b97f4a7c15ULL) >> 32) & hash_table->mask;
+}
+
+static HASH_SLOT* hash_table_lookup(HASH_TABLE* hash_table, NODE_KEY key)
+{
+    size_t index = hash_table_home(hash_table, key);
+    while (hash_table->slots[index].used && hash_table->slots[index].key != key)
+    {
+        index = (index + 1) & hash_table->mask;
+    }
+    return &hash_table->slots[index];
+}
+
+static int hash_table_insert(void* engine, NODE_KEY key, void* data)
+{
+    int result;
+    HASH_SLOT* slot = hash_table_lookup((HASH_TABLE*)engine, key);
+    if (slot->used)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        slot->key = key;
+        slot->data = data;
+        slot->used = 1;
+        result = 0;
+    }
+    return result;
+}
+
+static int hash_table_remove(void* engine, NODE_KEY key)
+{
+    int result;
+    HASH_TABLE* hash_table = (HASH_TABLE*)engine;
+    HASH_SLOT* slot = hash_table_lookup(hash_table, key);
+    if (!slot->used)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        size_t hole = (size_t)(slot - hash_table->slots);
+        size_t index = hole;
+        for (;;)
+        {
+            index = (index + 1) & hash_table->mask;
+            if (!hash_table->slots[index].used)
+            {
+                break;
+            }
+            // Move the entry back if the hole sits between its home and it
+            size_t home = hash_table_home(hash_table, hash_table->slots[index].key);
+            if (((index - home) & hash_table->mask) >= ((index - hole) & hash_table->mask))
+            {
+                hash_table->slots[hole] = hash_table->slots[index];
+                hole = index;
+            }
+        }
+        hash_table->slots[hole].used = 0;
+        result = 0;
+    }
+    return result;
+}
+
+static void* hash_table_find(void* engine, NODE_KEY key)
+{
+    HASH_SLOT* slot = hash_table_lookup((HASH_TABLE*)engine, key);
+    return slot->used ? slot->data : NULL;
+}
+
+const BENCH_ENGINE BENCH_ENGINES[BENCH_ENGINE_COUNT] =
+{
+    { "tree", tree_engine_create, tree_engine_destroy, tree_engine_insert, tree_engine_remove, tree_engine_find, 1 },
+    { "tree_mutex", tree_mutex_engine_create, tree_mutex_engine_destroy, tree_mutex_engine_insert, tree_mutex_engine_remove, tree_mutex_engine_find, 1 },
+    { "tree_typed", typed_tree_engine_create, typed_tree_engine_destroy, typed_tree_engine_insert, typed_tree_engine_remove, typed_tree_engine_find, 0 },
+    { "sorted_array", sorted_array_create, sorted_array_destroy, sorted_array_insert, sorted_array_remove, sorted_array_find, 0 },
+    { "hash_table", hash_table_create, hash_table_destroy, hash_table_insert, hash_table_remove, hash_table_find, 0 }
+};
+
+const BENCH_ENGINE* bench_engine_find(const char* name)
+{
+    const BENCH_ENGINE* result = NULL;
+    for (size_t index = 0; index < BENCH_ENGINE_COUNT && name != NULL; index++)
+    {
+        if (strcmp(name, BENCH_ENGINES[index].name) == 0)
+        {
+            result = &BENCH_ENGINES[index];
+            break;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef BENCH_ENGINES_H
+#define BENCH_ENGINES_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+#include "binary_tree.h"
+
+// Every engine, the tree and the baselines, is driven through this
+typedef struct BENCH_ENGINE_TAG
+{
+    const char* name;
+    void* (*create)(size_t key_space);
+    void (*destroy)(void* engine);
+    int (*insert)(void* engine, NODE_KEY key, void* data);
+    int (*remove)(void* engine, NODE_KEY key);
+    void* (*find)(void* engine, NODE_KEY key);
+    // Whether the concurrent sweep can share one instance between threads
+    int thread_safe;
+} BENCH_ENGINE;
+
+#define BENCH_ENGINE_COUNT      5
+
+// The tree, the mutex wrapped tree, the tree specialized through
+// whiskey_tree.h and the sorted array and hash table baselines
+extern const BENCH_ENGINE BENCH_ENGINES[BENCH_ENGINE_COUNT];
+
+// NULL when no engine has that name
+extern const BENCH_ENGINE* bench_engine_find(const char* name);
+
+// The data stored with key, never NULL so a find hit can be told from a miss
+extern void* bench_key_to_data(NODE_KEY key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* BENCH_ENGINES_H */
@@ -4,19 +4,210 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "binary_tree.h"
+#include "memory_tracker.h"
+#include "stat_page.h"
+#include "op_trace.h"
+#include "checksum.h"
+#include "paged_tree.h"
+#include "wal.h"
+#include "stopwatch.h"
+#include "timer_wheel.h"
 #include "logging.h"
 
 #define USE_RECURSION
-#define NUM_OF_CHARS    8
+// Hex digits of the widest key
+#define NUM_OF_CHARS    16
+
+// Subtrees this high or lower (at most 63 nodes) are not worth the
+// cost of a steal and are walked serially by the thread that owns them
+#ifndef PARALLEL_SERIAL_CUTOFF_HEIGHT
+#define PARALLEL_SERIAL_CUTOFF_HEIGHT   6
+#endif
+// Each worker only pushes the right children along its current path,
+// so the deque never needs to be deeper than the tree is high
+#define PARALLEL_DEQUE_SIZE             128
+#define PARALLEL_MAX_THREADS            64
+
+#define DEFAULT_COMPACTION_RATIO        50
+
+// String key bytes packed into the node's integer key
+#define KEY_INLINE_BYTES                8
+// Shorter common prefixes don't pay for the shared copy
+#define KEY_PREFIX_MIN_SHARED           16
+
+// binary_tree_save images
+#define TREE_IMAGE_MAGIC                "WSKTREE"
+#define TREE_IMAGE_VERSION              1
+// Written as is, a machine of the other byte order reads it swapped
+#define TREE_IMAGE_BYTE_ORDER           0x01020304
+#define TREE_IMAGE_NO_NODE              UINT32_MAX
+// Key bytes and payloads start on this boundary so payloads can be read in place
+#define TREE_IMAGE_ALIGNMENT            8
+// Saved trees are perfectly balanced, so 33 would do for 2^32 entries
+#define TREE_IMAGE_MAX_HEIGHT           64
+#define TREE_IMAGE_WRITE_BUFFER         65536
+// Logged operations start on this boundary
+#define TREE_LOG_ALIGNMENT              8
+
+#define MERKLE_HASH_SEED                0x9e3779b97f4a7c15ULL
+#define MERKLE_HASH_PRIME               0x100000001b3ULL
+
+// binary_tree_insert_ttl expiry times are kept to the millisecond
+#define TTL_TICK_NS                     1000000
+
+// How often an exporting tree publishes to its stat page
+#define STATS_EXPORT_INTERVAL_MS        100
+// Operation latencies are bucketed four to a power of two of nanoseconds
+#define EXPORT_LATENCY_SUB_BITS         2
+#define EXPORT_LATENCY_SUB_COUNT        (1u << EXPORT_LATENCY_SUB_BITS)
+#define EXPORT_LATENCY_BUCKETS          (64 * EXPORT_LATENCY_SUB_COUNT)
+
+// What each tracked allocation is charged to
+typedef enum TREE_MEMORY_TAG
+{
+    TREE_MEMORY_NODES,
+    // MVCC node histories and persistent tree versions
+    TREE_MEMORY_VERSIONS,
+    // Handles, stats slots, reader lists and transactions
+    TREE_MEMORY_BOOKKEEPING,
+    // Lists that only live for the duration of one call
+    TREE_MEMORY_SCRATCH
+} TREE_MEMORY;
+
 static const char LEFT_PARENTHESIS = '(';
 static const char RIGHT_PARENTHESIS = ')';
 
 
+#ifdef ENABLE_TREE_STATS
+#define TREE_STATS_SLOTS                16
+
+typedef enum TREE_STAT_TAG
+{
+    TREE_STAT_FINDS,
+    TREE_STAT_FIND_HITS,
+    TREE_STAT_FIND_MISSES,
+    TREE_STAT_COMPARISONS,
+    TREE_STAT_NODES_VISITED,
+    TREE_STAT_SINGLE_ROTATIONS,
+    TREE_STAT_DOUBLE_ROTATIONS,
+    TREE_STAT_SUBTREE_REBUILDS,
+    TREE_STAT_NODE_ALLOCATIONS,
+    TREE_STAT_NODE_FREES,
+    TREE_STAT_COUNT
+} TREE_STAT;
+
+// Threads are spread over the slots of a tree by a per-thread index, each
+// slot on its own cache lines.  Two threads only share a slot once there
+// are more threads than slots
+typedef struct TREE_STATS_SLOT_TAG
+{
+    _Alignas(64) atomic_uint_least64_t counters[TREE_STAT_COUNT];
+    atomic_uint_least64_t depth_histogram[BINARY_TREE_STATS_MAX_DEPTH];
+} TREE_STATS_SLOT;
+
+// The slot of the tree the calling thread is working on.  Public functions
+// set it on the way in and restore the previous one on the way out, so the
+// internals don't have to pass it around and callbacks may use other trees
+static _Thread_local TREE_STATS_SLOT* g_stats_slot;
+static _Thread_local size_t g_stats_thread_index = SIZE_MAX;
+static atomic_size_t g_stats_thread_count;
+
+#define STATS_ENTER(tree_info)      TREE_STATS_SLOT* previous_stats_slot = g_stats_slot; g_stats_slot = get_stats_slot(tree_info)
+#define STATS_LEAVE()               g_stats_slot = previous_stats_slot
+#define STATS_ADD(stat, value)      do { if (g_stats_slot != NULL) (void)atomic_fetch_add_explicit(&g_stats_slot->counters[stat], (value), memory_order_relaxed); } while (0)
+#define STATS_RECORD_DEPTH(depth)   do { if (g_stats_slot != NULL) (void)atomic_fetch_add_explicit(&g_stats_slot->depth_histogram[(depth) < BINARY_TREE_STATS_MAX_DEPTH ? (depth) : BINARY_TREE_STATS_MAX_DEPTH - 1], 1, memory_order_relaxed); } while (0)
+#else
+#define STATS_ENTER(tree_info)
+#define STATS_LEAVE()
+#define STATS_ADD(stat, value)
+#define STATS_RECORD_DEPTH(depth)
+#endif
+
+// The allocation tracker of the tree the calling thread is working on, set
+// the same way as the stats slot so node and version helpers deep in the
+// call tree charge the right handle
+static _Thread_local MEMORY_TRACKER_HANDLE g_tree_memory;
+
+#define TREE_ENTER(tree_info)       MEMORY_TRACKER_HANDLE previous_tree_memory = g_tree_memory; g_tree_memory = (tree_info)->memory; STATS_ENTER(tree_info)
+#define TREE_LEAVE()                STATS_LEAVE(); g_tree_memory = previous_tree_memory
+
+// One entry in a MVCC node's history, newest first
+typedef struct NODE_VERSION_TAG
+{
+    void* data;
+    uint64_t commit_ts;
+    int removed;
+    // Set on a version that a remove superseded, called with data once
+    // no reader can see the version anymore
+    tree_remove_callback remove_callback;
+    struct NODE_VERSION_TAG* older;
+} NODE_VERSION;
+
+// Leading bytes that string keys share under prefix compression, freed
+// with the last node using them
+typedef struct KEY_PREFIX_TAG
+{
+    atomic_size_t ref_count;
+    size_t length;
+    unsigned char bytes[];
+} KEY_PREFIX;
+
+// A key as passed in by the caller, integer keys only use prefix
+typedef struct TREE_KEY_TAG
+{
+    // The integer key, or the first KEY_INLINE_BYTES of a string key packed
+    // big endian and zero padded, so comparing them as integers orders like
+    // memcmp and most string comparisons are settled without touching bytes
+    uint64_t prefix;
+    const unsigned char* bytes;
+    size_t length;
+} TREE_KEY;
+
+// One lookup of a key.  Remembers how far the key matched the last shared
+// prefix it met so nodes using the same prefix skip those bytes
+typedef struct KEY_SEARCH_TAG
+{
+    const TREE_KEY* key;
+    const KEY_PREFIX* prefix;
+    size_t prefix_matched;
+} KEY_SEARCH;
+
+// Expires an entry of binary_tree_insert_ttl.  The node points at it and
+// it has its own copy of the key to find the node again
+typedef struct TREE_TIMER_TAG
+{
+    TIMER_WHEEL_ENTRY entry;
+    // binary_tree_expire took it out of the wheel and is removing the
+    // entry.  orphaned is set once the entry left the tree, whoever holds
+    // a due timer frees it
+    int due;
+    int orphaned;
+    TREE_KEY key;
+    unsigned char key_bytes[];
+} TREE_TIMER;
+
 typedef struct NODE_INFO_TAG
 {
-    NODE_KEY key;
+    // The TREE_KEY prefix
+    uint64_t key;
+    // String keys only.  The bytes past the inline ones are in key_tail at
+    // the end of the node, except the first shared_length which are in
+    // shared_prefix
+    size_t key_length;
+    size_t shared_length;
+    KEY_PREFIX* shared_prefix;
     void* data;
     struct NODE_INFO_TAG* parent;
     struct NODE_INFO_TAG* right;
@@ -26,15 +217,271 @@ typedef struct NODE_INFO_TAG
     // child on left = +1
     int balance_factor;
     size_t height;
+    // Persistent mode only: number of versions or nodes pointing at
+    // this node and the write that created it
+    atomic_size_t ref_count;
+    size_t generation;
+    // MVCC mode only: the history of data, node data mirrors the newest
+    // version.  tombstone is set while the newest version is a remove, or
+    // in lazy delete mode while the removed node waits for compaction
+    NODE_VERSION* versions;
+    int tombstone;
+    // Set on every node whose subtree changed since the last rebalance
+    int dirty;
+    // OPTION_MERKLE_HASH only: the hash of this entry and the sum of every
+    // entry hash in the subtree, kept along with the height
+    uint64_t entry_hash;
+    uint64_t subtree_hash;
+    // binary_tree_insert_ttl entries only
+    TREE_TIMER* timer;
+    // binary_tree_create_bounded only: set by finds, cleared by the CLOCK hand
+    atomic_int referenced;
+    unsigned char key_tail[];
 } NODE_INFO;
 
+// An immutable root shared by the live handle and any snapshots taken
+// from it.  Freed when the last reference is released
+typedef struct TREE_VERSION_TAG
+{
+    NODE_INFO* root_node;
+    size_t items;
+    atomic_size_t ref_count;
+} TREE_VERSION;
+
+typedef enum EXPORT_COUNTER_TAG
+{
+    EXPORT_COUNTER_INSERTS,
+    EXPORT_COUNTER_REMOVES,
+    EXPORT_COUNTER_FINDS,
+    EXPORT_COUNTER_COUNT
+} EXPORT_COUNTER;
+
+// Allocated the first time export is turned on and kept until the tree is
+// destroyed, so an operation that saw exporting set never touches freed memory
+typedef struct STATS_EXPORT_TAG
+{
+    // Only used by the gc thread, and swapped while it is stopped
+    STAT_PAGE_HANDLE stat_page;
+    atomic_uint_least64_t counters[EXPORT_COUNTER_COUNT];
+    atomic_uint_least64_t latency_buckets[EXPORT_LATENCY_BUCKETS];
+    // Bucket counts at the previous publish
+    uint64_t published_buckets[EXPORT_LATENCY_BUCKETS];
+} STATS_EXPORT;
+
+// A saved tree is this header, the nodes in key order, the key bytes and
+// payloads they point at and a trailer.  It holds no pointers, so it can
+// be served from wherever it is mapped
+typedef struct TREE_IMAGE_HEADER_TAG
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t key_mode;
+    uint32_t node_size;
+    uint64_t node_count;
+    uint64_t root_index;
+    uint64_t height;
+    uint64_t bytes_size;
+    uint32_t reserved;
+    // Of the header up to here
+    uint32_t header_checksum;
+} TREE_IMAGE_HEADER;
+
+// Offsets are into the bytes after the nodes, children are node indexes
+typedef struct TREE_IMAGE_NODE_TAG
+{
+    // The TREE_KEY prefix, string keys also have all their bytes stored
+    uint64_t key;
+    uint64_t key_offset;
+    uint64_t payload_offset;
+    uint32_t key_length;
+    uint32_t payload_length;
+    uint32_t left;
+    uint32_t right;
+} TREE_IMAGE_NODE;
+
+typedef struct TREE_IMAGE_TRAILER_TAG
+{
+    // Of the nodes and bytes
+    uint32_t checksum;
+    uint32_t reserved;
+} TREE_IMAGE_TRAILER;
+
+// A log record is one applied batch of operations: this header, then per
+// operation a TREE_LOG_OPERATION followed by the key bytes and the payload
+// the serializer wrote, padded to TREE_LOG_ALIGNMENT
+typedef struct TREE_LOG_BATCH_TAG
+{
+    uint32_t key_mode;
+    uint32_t operation_count;
+} TREE_LOG_BATCH;
+
+typedef struct TREE_LOG_OPERATION_TAG
+{
+    // The TREE_KEY prefix, string keys also have all their bytes logged
+    uint64_t key;
+    uint32_t type;
+    uint32_t key_length;
+    uint32_t payload_length;
+    uint32_t reserved;
+} TREE_LOG_OPERATION;
+
+// OPTION_WAL state
+typedef struct TREE_LOG_TAG
+{
+    WAL_WRITER_HANDLE writer;
+    tree_serialize_callback serializer;
+    void* context;
+} TREE_LOG;
+
+// The record of one apply_operations call, encoded before the tree is locked
+typedef struct LOG_BATCH_TAG
+{
+    TREE_LOG* log;
+    unsigned char* bytes;
+    size_t size;
+    // Where the record ended in the log, 0 until it is appended
+    uint64_t position;
+} LOG_BATCH;
+
 typedef struct BINARY_TREE_INFO_TAG
 {
     size_t items;
     size_t height;
     NODE_INFO* root_node;
+
+    int persistent;
+    int read_only;
+    size_t write_generation;
+    TREE_VERSION* version;
+    // Serializes writers while they path copy
+    pthread_mutex_t write_lock;
+    // Only held to swap or pin the published version
+    pthread_mutex_t version_lock;
+
+    int mvcc;
+    // Last commit timestamp that is fully linked into the tree
+    atomic_uint_least64_t commit_clock;
+    pthread_rwlock_t tree_lock;
+    pthread_mutex_t reader_lock;
+    uint64_t* active_readers;
+    size_t active_reader_count;
+    size_t active_reader_capacity;
+    BINARY_TREE_KEY_MODE key_mode;
+    int prefix_compression;
+    int merkle_hash;
+    tree_hash_callback data_hash;
+    void* data_hash_context;
+    // binary_tree_create_bounded only.  A CLOCK hand sweeps the keys in
+    // order from clock_hand and evicts the first entry no find referenced
+    // since the last sweep, until the tree is back within its bounds
+    int bounded;
+    BINARY_TREE_BOUNDS bounds;
+    size_t entry_bytes;
+    int clock_hand_set;
+    TREE_KEY clock_hand;
+    unsigned char* clock_hand_bytes;
+    size_t clock_hand_size;
+    int lazy_delete;
+    size_t tombstones;
+    // Percentage of tombstoned nodes that triggers a compaction, 0 disables
+    size_t compaction_ratio;
+    int background_compaction;
+    int compact_requested;
+    // Background version garbage collection, compaction and stats export
+    int gc_running;
+    size_t gc_interval_ms;
+    uint64_t last_gc_ns;
+    atomic_int exporting;
+    STATS_EXPORT* stats_export;
+    // OPTION_TRACE_FILE recorder.  Replaced ones are closed, which frees
+    // their queues, but the handles are only freed with the tree, an
+    // operation may still hold them
+    _Atomic(OP_TRACE_WRITER_HANDLE) trace_writer;
+    OP_TRACE_WRITER_HANDLE* retired_traces;
+    size_t retired_trace_count;
+    // OPTION_WAL log, replaced ones are closed and freed with the tree too
+    _Atomic(TREE_LOG*) log;
+    TREE_LOG** retired_logs;
+    size_t retired_log_count;
+    // binary_tree_insert_ttl timers, the wheel comes with the first one.
+    // Timers are started and cancelled by writers holding their lock and
+    // ttl_lock, binary_tree_expire only takes ttl_lock to collect what is due
+    _Atomic(TIMER_WHEEL*) ttl_wheel;
+    pthread_mutex_t ttl_lock;
+    pthread_t gc_thread;
+    pthread_mutex_t gc_lock;
+    pthread_cond_t gc_cond;
+#ifdef ENABLE_TREE_STATS
+    TREE_STATS_SLOT* stats_slots;
+#endif
+    // Shared with every snapshot taken from the tree, they free each other's nodes
+    MEMORY_TRACKER_HANDLE memory;
+    // binary_tree_open_mapped only, the file the tree is served from
+    const TREE_IMAGE_HEADER* image;
+    size_t image_size;
+    // binary_tree_open_paged only, the engine every entry lives in
+    PAGED_TREE_HANDLE paged;
 } BINARY_TREE_INFO;
 
+typedef enum TXN_OPERATION_TYPE_TAG
+{
+    TXN_OPERATION_INSERT,
+    TXN_OPERATION_REMOVE
+} TXN_OPERATION_TYPE;
+
+typedef struct TXN_OPERATION_TAG
+{
+    TXN_OPERATION_TYPE type;
+    // String bytes belong to the caller, they are copied into the new node.
+    // A transaction keeps its own copy until it is committed or aborted
+    TREE_KEY key;
+    void* data;
+    tree_remove_callback remove_callback;
+    // Allocated up front so applying an insert can't fail half way through
+    // a commit.  Set to NULL once the tree owns it
+    NODE_INFO* new_node;
+    NODE_VERSION* version;
+    // Inserts: the timer to start once the entry is in.  Removes: the timer
+    // of the removed entry, set beforehand by binary_tree_expire to the one
+    // the entry must still have
+    TREE_TIMER* timer;
+} TXN_OPERATION;
+
+typedef struct BINARY_TREE_TXN_TAG
+{
+    BINARY_TREE_INFO* tree_info;
+    TXN_OPERATION* operation_list;
+    size_t operation_count;
+    size_t operation_capacity;
+} BINARY_TREE_TXN;
+
+#ifdef ENABLE_TREE_STATS
+static TREE_STATS_SLOT* get_stats_slot(BINARY_TREE_INFO* tree_info)
+{
+    if (g_stats_thread_index == SIZE_MAX)
+    {
+        g_stats_thread_index = atomic_fetch_add(&g_stats_thread_count, 1);
+    }
+    return tree_info == NULL || tree_info->stats_slots == NULL ? NULL : &tree_info->stats_slots[g_stats_thread_index % TREE_STATS_SLOTS];
+}
+#endif
+
+static void* tree_alloc(TREE_MEMORY category, size_t size)
+{
+    return memory_tracker_malloc(g_tree_memory, category, size);
+}
+
+static void* tree_realloc(TREE_MEMORY category, void* block, size_t old_size, size_t new_size)
+{
+    return memory_tracker_realloc(g_tree_memory, category, block, old_size, new_size);
+}
+
+static void tree_free(TREE_MEMORY category, void* block, size_t size)
+{
+    memory_tracker_free(g_tree_memory, category, block, size);
+}
+
 static int construct_visual_representation(const NODE_INFO* node_info, char* visualization, size_t pos)
 {
     /*
@@ -51,8 +498,8 @@ static int construct_visual_representation(const NODE_INFO* node_info, char* vis
 
     if (node_info != NULL)
     {
-        char temp[8];
-        int len = sprintf(temp, "%x", node_info->key);
+        char temp[NUM_OF_CHARS + 1];
+        int len = sprintf(temp, "%llx", (unsigned long long)node_info->key);
         memcpy(visualization+pos, temp, len);
         pos += len;
         if (node_info->left != NULL)
@@ -75,138 +522,274 @@ static int construct_visual_representation(const NODE_INFO* node_info, char* vis
     return pos;
 }
 
-static int calculate_balance_factor(const NODE_INFO* node_info)
+static size_t count_nodes(const NODE_INFO* node_info)
 {
-    int result;
-    result = node_info->left == NULL ? 0 : node_info->left->height;
-    result -= node_info->right == NULL ? 0 : node_info->right->height;
+    size_t result = 0;
+    while (node_info != NULL)
+    {
+        result += count_nodes(node_info->left) + 1;
+        node_info = node_info->right;
+    }
     return result;
 }
 
-static NODE_INFO* create_new_node(NODE_KEY key_value, void* data)
+static size_t get_tail_start(size_t shared_length)
+{
+    return shared_length > KEY_INLINE_BYTES ? shared_length : KEY_INLINE_BYTES;
+}
+
+static size_t get_node_size(size_t key_length, size_t shared_length)
+{
+    size_t tail_start = get_tail_start(shared_length);
+    return sizeof(NODE_INFO) + (key_length > tail_start ? key_length - tail_start : 0);
+}
+
+// Writes the whole string key of node_info to buffer
+static void copy_node_key(const NODE_INFO* node_info, unsigned char* buffer)
+{
+    size_t tail_start = get_tail_start(node_info->shared_length);
+    for (size_t index = 0; index < KEY_INLINE_BYTES && index < node_info->key_length; index++)
+    {
+        buffer[index] = (unsigned char)(node_info->key >> (8 * (KEY_INLINE_BYTES - 1 - index)));
+    }
+    if (node_info->shared_length > KEY_INLINE_BYTES)
+    {
+        memcpy(buffer + KEY_INLINE_BYTES, node_info->shared_prefix->bytes + KEY_INLINE_BYTES, node_info->shared_length - KEY_INLINE_BYTES);
+    }
+    if (node_info->key_length > tail_start)
+    {
+        memcpy(buffer + tail_start, node_info->key_tail, node_info->key_length - tail_start);
+    }
+}
+
+static NODE_INFO* create_new_node(const TREE_KEY* key, void* data)
 {
     NODE_INFO* result;
-    if ((result = (NODE_INFO*)malloc(sizeof(NODE_INFO))) == NULL)
+    if ((result = (NODE_INFO*)tree_alloc(TREE_MEMORY_NODES, get_node_size(key->length, 0))) == NULL)
     {
         LogError("Failure allocating tree node");
     }
     else
     {
         memset(result, 0, sizeof(NODE_INFO));
-        result->key = key_value;
+        result->key = key->prefix;
+        result->key_length = key->length;
+        if (key->length > KEY_INLINE_BYTES)
+        {
+            memcpy(result->key_tail, key->bytes + KEY_INLINE_BYTES, key->length - KEY_INLINE_BYTES);
+        }
         result->data = data;
+        STATS_ADD(TREE_STAT_NODE_ALLOCATIONS, 1);
     }
     return result;
 }
 
+static void release_key_prefix(KEY_PREFIX* prefix)
+{
+    if (prefix != NULL && atomic_fetch_sub(&prefix->ref_count, 1) == 1)
+    {
+        tree_free(TREE_MEMORY_NODES, prefix, sizeof(KEY_PREFIX) + prefix->length);
+    }
+}
+
+static void free_node(NODE_INFO* node_info)
+{
+    STATS_ADD(TREE_STAT_NODE_FREES, 1);
+    release_key_prefix(node_info->shared_prefix);
+    tree_free(TREE_MEMORY_NODES, node_info, get_node_size(node_info->key_length, node_info->shared_length));
+}
+
 static void print_tree(const NODE_INFO* node_info, size_t indent_level)
 {
     if (node_info != NULL)
     {
         for (size_t index = 0; index < indent_level; index++)
             printf("\t");
-        printf("%d\n", node_info->key);
+        printf("%llu\n", (unsigned long long)node_info->key);
         print_tree(node_info->left, indent_level + 1);
         print_tree(node_info->right, indent_level + 1);
     }
 }
 
-static void rotate_right(NODE_INFO* node_info)
+static size_t get_node_height(const NODE_INFO* node_info)
+{
+    return node_info == NULL ? 0 : node_info->height;
+}
+
+static uint64_t get_subtree_hash(const NODE_INFO* node_info)
+{
+    return node_info == NULL ? 0 : node_info->subtree_hash;
+}
+
+// Every change to the shape goes through here, so the subtree hashes stay
+// right through rotations and rebuilds for free.  They are all zero when
+// OPTION_MERKLE_HASH is off
+static void update_node_height(NODE_INFO* node_info)
 {
-    NODE_INFO* tpm_node = node_info;
+    size_t left_height = get_node_height(node_info->left);
+    size_t right_height = get_node_height(node_info->right);
+    node_info->height = (left_height > right_height ? left_height : right_height) + 1;
+    node_info->balance_factor = (int)left_height - (int)right_height;
+    node_info->subtree_hash = get_subtree_hash(node_info->left) + node_info->entry_hash + get_subtree_hash(node_info->right);
+}
 
-    node_info->parent->left = node_info->left;
-    node_info->parent->left->balance_factor = 0;
-    node_info->parent->left->parent = node_info->parent;
-    node_info->parent->balance_factor++;
-    if (node_info->parent->left->right == NULL)
+// Returns the link that points at node_info, either in its parent or the root
+static NODE_INFO** get_parent_link(NODE_INFO** root_node, const NODE_INFO* node_info)
+{
+    NODE_INFO** result;
+    if (node_info->parent == NULL)
     {
-        node_info->parent->left->right = tpm_node;
-        tpm_node->parent = node_info->parent->left;
-        tpm_node->left = tpm_node->right = NULL;
-        tpm_node->balance_factor = 0;
+        result = root_node;
+    }
+    else if (node_info->parent->left == node_info)
+    {
+        result = &node_info->parent->left;
     }
     else
     {
-        tpm_node->left = node_info->parent->left->right;
-        tpm_node->right = NULL;
-        node_info->parent->left->right = tpm_node;
-        tpm_node->balance_factor = -1;
+        result = &node_info->parent->right;
+    }
+    return result;
+}
+
+// Flags the path from node_info to the root for the next rebalance pass.  The
+// dirty nodes always form paths up to the root, so marking stops at the
+// first node that is already flagged and overlapping paths are only walked once
+static void mark_dirty_path(NODE_INFO* node_info)
+{
+    while (node_info != NULL && !node_info->dirty)
+    {
+        node_info->dirty = 1;
+        node_info = node_info->parent;
+    }
+}
+
+static void rotate_right(NODE_INFO** target_node)
+{
+    NODE_INFO* node_info = *target_node;
+    NODE_INFO* pivot = node_info->left;
+
+    node_info->left = pivot->right;
+    if (pivot->right != NULL)
+    {
+        pivot->right->parent = node_info;
+    }
+    pivot->right = node_info;
+    pivot->parent = node_info->parent;
+    node_info->parent = pivot;
+    update_node_height(node_info);
+    update_node_height(pivot);
+    *target_node = pivot;
+}
+
+static void rotate_left(NODE_INFO** target_node)
+{
+    NODE_INFO* node_info = *target_node;
+    NODE_INFO* pivot = node_info->right;
+
+    node_info->right = pivot->left;
+    if (pivot->left != NULL)
+    {
+        pivot->left->parent = node_info;
     }
+    pivot->left = node_info;
+    pivot->parent = node_info->parent;
+    node_info->parent = pivot;
+    update_node_height(node_info);
+    update_node_height(pivot);
+    *target_node = pivot;
 }
 
-static void rotate_left(NODE_INFO* node_info)
+static void flatten_subtree(NODE_INFO* node_info, NODE_INFO** node_list, size_t* index)
 {
-    NODE_INFO* tpm_node = node_info;
+    while (node_info != NULL)
+    {
+        flatten_subtree(node_info->left, node_list, index);
+        node_list[(*index)++] = node_info;
+        node_info = node_info->right;
+    }
+}
 
-    node_info->parent->right = node_info->right;
-    // The current node gets moved down
-    node_info->height--;
+static NODE_INFO* build_subtree(NODE_INFO** node_list, size_t count, NODE_INFO* parent)
+{
+    NODE_INFO* result;
+    if (count == 0)
+    {
+        result = NULL;
+    }
+    else
+    {
+        size_t middle = count / 2;
+        result = node_list[middle];
+        result->parent = parent;
+        result->left = build_subtree(node_list, middle, result);
+        result->right = build_subtree(node_list + middle + 1, count - middle - 1, result);
+        update_node_height(result);
+    }
+    return result;
+}
 
-    node_info->parent->right->balance_factor = 0;
-    node_info->parent->right->parent = node_info->parent;
-    node_info->parent->balance_factor++;
-    tpm_node->parent = node_info->parent->right;
-    if (node_info->parent->right->left == NULL)
+// A batch of changes can leave a subtree more than one level out of
+// balance, which single rotations can't repair, so it is rebuilt instead
+static void rebuild_subtree(NODE_INFO** target_node)
+{
+    size_t count = count_nodes(*target_node);
+    NODE_INFO** node_list = (NODE_INFO**)tree_alloc(TREE_MEMORY_SCRATCH, count * sizeof(NODE_INFO*));
+    if (node_list == NULL)
     {
-        node_info->parent->left = tpm_node;
-        tpm_node->right = tpm_node->left = NULL;
-        tpm_node->balance_factor = 0;
-        tpm_node->height = tpm_node->parent->height-1;
+        // Still a valid search tree, just not a balanced one
+        LogError("Failure allocating rebuild list");
     }
     else
     {
-        tpm_node->right = node_info->parent->left->right;
-        tpm_node->left = NULL;
-        tpm_node->height = tpm_node->parent->height - 1;
-        node_info->parent->right->left = tpm_node;
-        tpm_node->balance_factor = 1;
+        size_t index = 0;
+        flatten_subtree(*target_node, node_list, &index);
+        *target_node = build_subtree(node_list, count, (*target_node)->parent);
+        tree_free(TREE_MEMORY_SCRATCH, node_list, count * sizeof(NODE_INFO*));
     }
 }
 
-static int rebalance_if_neccessary(NODE_INFO* node_info)
+// Restores the AVL property at target_node once both children are balanced
+static int rebalance_if_neccessary(NODE_INFO** target_node)
 {
     int result;
-    if (node_info->balance_factor < -1 && node_info->right->balance_factor == -1)
+    NODE_INFO* node_info = *target_node;
+    update_node_height(node_info);
+    if (node_info->balance_factor > 2 || node_info->balance_factor < -2)
     {
-        rotate_left(node_info);
-        result = 1;
-        LogDebug("rotate right");
-    }
-    else if (node_info->balance_factor > 1 && node_info->left->balance_factor == 1)
-    {
-        rotate_right(node_info);
-        result = -1;
-        LogDebug("rotate left");
-    }
-    else if (node_info->balance_factor < -1 && node_info->right->balance_factor == 1)
-    {
-        // Do Left right rotation
-        // Make the left child, a child of the left's right node
-        node_info->right->left->right = node_info->right;
-        node_info->right->left->right->height--;
-        node_info->right->parent = node_info->right->left;
-        node_info->right->left->parent = node_info;
-        node_info->right = node_info->right->left;
-        node_info->right->height++;
-        node_info->right->right->left = NULL;
-        // Do the left rotation
-        rotate_left(node_info);
+        rebuild_subtree(target_node);
+        STATS_ADD(TREE_STAT_SUBTREE_REBUILDS, 1);
+        result = 2;
+    }
+    else if (node_info->balance_factor == 2)
+    {
+        if (node_info->left->balance_factor < 0)
+        {
+            // Left right case
+            rotate_left(&node_info->left);
+            STATS_ADD(TREE_STAT_DOUBLE_ROTATIONS, 1);
+        }
+        else
+        {
+            STATS_ADD(TREE_STAT_SINGLE_ROTATIONS, 1);
+        }
+        rotate_right(target_node);
         result = 1;
     }
-    else if (node_info->balance_factor > 1 && node_info->left->balance_factor == -1)
+    else if (node_info->balance_factor == -2)
     {
-        // Do right left rotation
-        node_info->left->right->left = node_info->left;
-        node_info->left->right->left->height--;
-        node_info->left->parent = node_info->left->right;
-        node_info->left->right->parent = node_info;
-        node_info->left = node_info->left->right;
-        node_info->left->height++;
-        node_info->left->left->right = NULL;
-        // Now do a right rotation
-        rotate_right(node_info);
-        result = -1;
+        if (node_info->right->balance_factor > 0)
+        {
+            // Right left case
+            rotate_right(&node_info->right);
+            STATS_ADD(TREE_STAT_DOUBLE_ROTATIONS, 1);
+        }
+        else
+        {
+            STATS_ADD(TREE_STAT_SINGLE_ROTATIONS, 1);
+        }
+        rotate_left(target_node);
+        result = 1;
     }
     else
     {
@@ -215,14 +798,115 @@ static int rebalance_if_neccessary(NODE_INFO* node_info)
     return result;
 }
 
-static int compare_node_values(const NODE_KEY* value_1, const NODE_KEY* value_2)
+// Single pass over every path flagged since the last call, bottom up
+static void rebalance_dirty_paths(NODE_INFO** target_node)
+{
+    NODE_INFO* node_info = *target_node;
+    if (node_info != NULL && node_info->dirty)
+    {
+        node_info->dirty = 0;
+        rebalance_dirty_paths(&node_info->left);
+        rebalance_dirty_paths(&node_info->right);
+        (void)rebalance_if_neccessary(target_node);
+    }
+}
+
+static TREE_KEY make_integer_key(uint64_t value)
+{
+    TREE_KEY result = { value, NULL, 0 };
+    return result;
+}
+
+static TREE_KEY make_string_key(const void* value, size_t length)
+{
+    TREE_KEY result = { 0, (const unsigned char*)value, length };
+    for (size_t index = 0; index < KEY_INLINE_BYTES; index++)
+    {
+        result.prefix = (result.prefix << 8) | (index < length ? result.bytes[index] : 0);
+    }
+    return result;
+}
+
+static int compare_lengths(size_t length_1, size_t length_2)
+{
+    return length_1 < length_2 ? -1 : (length_1 > length_2 ? 1 : 0);
+}
+
+static int compare_keys(const TREE_KEY* key_1, const TREE_KEY* key_2)
+{
+    int result;
+    if (key_1->prefix != key_2->prefix)
+    {
+        result = key_1->prefix < key_2->prefix ? -1 : 1;
+    }
+    else
+    {
+        size_t common = key_1->length < key_2->length ? key_1->length : key_2->length;
+        result = common > KEY_INLINE_BYTES ? memcmp(key_1->bytes + KEY_INLINE_BYTES, key_2->bytes + KEY_INLINE_BYTES, common - KEY_INLINE_BYTES) : 0;
+        if (result == 0)
+        {
+            result = compare_lengths(key_1->length, key_2->length);
+        }
+    }
+    return result;
+}
+
+// Orders the key against a node whose integer key is the same, only string
+// keys that go past the inline bytes have anything left to compare
+static int compare_key_tail(KEY_SEARCH* search, const NODE_INFO* node_info)
+{
+    int result = 0;
+    const TREE_KEY* key = search->key;
+    size_t common = key->length < node_info->key_length ? key->length : node_info->key_length;
+    size_t start = KEY_INLINE_BYTES;
+    if (node_info->shared_prefix != NULL && common > KEY_INLINE_BYTES)
+    {
+        const KEY_PREFIX* prefix = node_info->shared_prefix;
+        if (search->prefix != prefix)
+        {
+            size_t limit = key->length < prefix->length ? key->length : prefix->length;
+            size_t matched = KEY_INLINE_BYTES;
+            while (matched < limit && key->bytes[matched] == prefix->bytes[matched])
+            {
+                matched++;
+            }
+            search->prefix = prefix;
+            search->prefix_matched = matched;
+        }
+
+        if (search->prefix_matched < node_info->shared_length)
+        {
+            // The keys part inside the shared bytes
+            size_t position = search->prefix_matched;
+            result = position == key->length || key->bytes[position] < prefix->bytes[position] ? -1 : 1;
+        }
+        else
+        {
+            start = node_info->shared_length;
+        }
+    }
+
+    if (result == 0 && common > start)
+    {
+        result = memcmp(key->bytes + start, node_info->key_tail + (start - get_tail_start(node_info->shared_length)), common - start);
+    }
+    if (result == 0)
+    {
+        result = compare_lengths(key->length, node_info->key_length);
+    }
+    return result;
+}
+
+// Negative when the key sorts before the node.  Integer keys and string keys
+// that differ in the inline bytes are settled right here
+static int compare_search_key(KEY_SEARCH* search, const NODE_INFO* node_info)
 {
-    if (*value_1 > *value_2) return 1;
-    else if (*value_1 < *value_2) return -1;
-    else return 0;
+    uint64_t prefix = search->key->prefix;
+    return prefix != node_info->key ? (prefix < node_info->key ? -1 : 1) : compare_key_tail(search, node_info);
 }
 
-static NODE_INFO* find_node(NODE_INFO* node_info, const NODE_KEY* value)
+// depth is that of node_info, only used for the stats
+static NODE_INFO* find_node_from(NODE_INFO* node_info, KEY_SEARCH* search, size_t depth)
 {
     NODE_INFO* result;
     if (node_info == NULL)
@@ -232,17 +916,20 @@ static NODE_INFO* find_node(NODE_INFO* node_info, const NODE_KEY* value)
     else
     {
 #ifdef USE_RECURSION
-        int compare_value = compare_node_values(&node_info->key, value);
-        if (compare_value > 0)
+        int compare_value = compare_search_key(search, node_info);
+        STATS_ADD(TREE_STAT_NODES_VISITED, 1);
+        STATS_ADD(TREE_STAT_COMPARISONS, 1);
+        if (compare_value < 0)
         {
-            result = find_node(node_info->left, value);
+            result = find_node_from(node_info->left, search, depth + 1);
         }
-        else if (compare_value < 0)
+        else if (compare_value > 0)
         {
-            result = find_node(node_info->right, value);
+            result = find_node_from(node_info->right, search, depth + 1);
         }
         else
         {
+            STATS_RECORD_DEPTH(depth);
             result = node_info;
         }
 #else
@@ -250,359 +937,218 @@ static NODE_INFO* find_node(NODE_INFO* node_info, const NODE_KEY* value)
         NODE_INFO* compare_node = node_info;
 
         result = NULL;
-        while (compare_node != NULL)
+        while (compare_node != NULL && result == NULL)
         {
-            compare_value = compare_node_values(&compare_node->key, value);
-            if (compare_value > 0)
+            compare_value = compare_search_key(search, compare_node);
+            STATS_ADD(TREE_STAT_NODES_VISITED, 1);
+            STATS_ADD(TREE_STAT_COMPARISONS, 1);
+            if (compare_value < 0)
             {
                 compare_node = compare_node->left;
+                depth++;
             }
-            else if (compare_value < 0)
+            else if (compare_value > 0)
             {
                 compare_node = compare_node->right;
+                depth++;
             }
             else
             {
+                STATS_RECORD_DEPTH(depth);
                 result = compare_node;
             }
         }
 #endif
     }
+    (void)depth;
+    return result;
+}
+
+static NODE_INFO* find_node(NODE_INFO* node_info, const TREE_KEY* key)
+{
+    KEY_SEARCH search = { key, NULL, 0 };
+    return find_node_from(node_info, &search, 0);
+}
+
+// Number of leading bytes key has in common with a node whose integer key is
+// the same, so at least the inline ones when both are that long
+static size_t get_common_prefix_length(const TREE_KEY* key, const NODE_INFO* node_info)
+{
+    size_t limit = key->length < node_info->key_length ? key->length : node_info->key_length;
+    size_t tail_start = get_tail_start(node_info->shared_length);
+    size_t result = limit < KEY_INLINE_BYTES ? limit : KEY_INLINE_BYTES;
+    while (result < limit && key->bytes[result] == (result < node_info->shared_length ? node_info->shared_prefix->bytes[result] : node_info->key_tail[result - tail_start]))
+    {
+        result++;
+    }
+    return result;
+}
+
+// Rebuilds the unlinked new_node to take the first length bytes of its key,
+// which closest_node has too, from a shared prefix.  The prefix of
+// closest_node is reused when it has one, otherwise a new one is made that
+// later keys can share.  Returns new_node as it was if memory runs out
+static NODE_INFO* share_key_prefix(NODE_INFO* new_node, const TREE_KEY* key, const NODE_INFO* closest_node, size_t length)
+{
+    NODE_INFO* result = new_node;
+    KEY_PREFIX* prefix = closest_node->shared_prefix;
+    if (prefix != NULL)
+    {
+        // Only the part closest_node itself uses is known to match
+        length = length < closest_node->shared_length ? length : closest_node->shared_length;
+        (void)atomic_fetch_add(&prefix->ref_count, 1);
+    }
+    else if ((prefix = (KEY_PREFIX*)tree_alloc(TREE_MEMORY_NODES, sizeof(KEY_PREFIX) + length)) != NULL)
+    {
+        atomic_init(&prefix->ref_count, 1);
+        prefix->length = length;
+        memcpy(prefix->bytes, key->bytes, length);
+    }
+
+    if (prefix == NULL)
+    {
+        LogError("Failure allocating shared key prefix");
+    }
+    else if ((result = (NODE_INFO*)tree_alloc(TREE_MEMORY_NODES, get_node_size(key->length, length))) == NULL)
+    {
+        LogError("Failure allocating prefix compressed node");
+        release_key_prefix(prefix);
+        result = new_node;
+    }
+    else
+    {
+        STATS_ADD(TREE_STAT_NODE_ALLOCATIONS, 1);
+        memcpy(result, new_node, sizeof(NODE_INFO));
+        result->shared_prefix = prefix;
+        result->shared_length = length;
+        memcpy(result->key_tail, key->bytes + length, key->length - length);
+        free_node(new_node);
+    }
     return result;
 }
 
 typedef enum INSERT_NODE_TYPE_TAG
 {
     INSERT_NODE_INSERTED,
-    INSERT_NODE_NO_OP,
-    INSERT_NODE_REBALANCE,
     INSERT_NODE_FAILED
 } INSERT_NODE_TYPE;
 
-static INSERT_NODE_TYPE insert_into_tree(NODE_INFO** target_node, NODE_INFO* new_node)
+// Links new_node, holding key, in as a leaf and flags its path.  The tree
+// isn't rebalanced until rebalance_dirty_paths runs, so several changes can
+// share one pass.  With prefix compression new_node may be replaced, the
+// tree owns it either way once this succeeds
+static INSERT_NODE_TYPE insert_into_tree(NODE_INFO** root_node, NODE_INFO* new_node, const TREE_KEY* key, int prefix_compression)
 {
-    INSERT_NODE_TYPE result = INSERT_NODE_FAILED;
-#ifdef USE_RECURSION
-    if (*target_node == NULL)
-    {
-        *target_node = new_node;
-        (*target_node)->height = 1;
-        result = INSERT_NODE_INSERTED;
-    }
-    else if (new_node->key > (*target_node)->key)
+    INSERT_NODE_TYPE result = INSERT_NODE_INSERTED;
+    KEY_SEARCH search = { key, NULL, 0 };
+    NODE_INFO* parent_node = NULL;
+    NODE_INFO** target_node = root_node;
+    // Both neighbours of the new key are on the way down, so the longest
+    // prefix it has in common with any key is with one of these nodes
+    const NODE_INFO* closest_node = NULL;
+    size_t closest_length = 0;
+    while (*target_node != NULL)
     {
-        if ((result = insert_into_tree(&(*target_node)->right, new_node)) != INSERT_NODE_FAILED)
+        int compare_value = compare_search_key(&search, *target_node);
+        if (compare_value == 0)
         {
-            // Increment the height
-            if ((*target_node)->height <= (*target_node)->right->height || result == INSERT_NODE_REBALANCE)
-            {
-                // Or rebalance the height changes should reverberate up the tree
-                (*target_node)->height = (*target_node)->right->height + 1;
-            }
-            // If you inserted a direct child increment
-            // the balance factor
-            if (result == INSERT_NODE_INSERTED)
-            {
-                // Set parent node
-                (*target_node)->right->parent = *target_node;
-
-                // Only return inserted for 
-                result = INSERT_NODE_NO_OP;
-            }
+            result = INSERT_NODE_FAILED;
+            break;
         }
-    }
-    else if (new_node->key < (*target_node)->key)
-    {
-        if ((result = insert_into_tree(&(*target_node)->left, new_node)) != INSERT_NODE_FAILED)
+        parent_node = *target_node;
+        if (prefix_compression && parent_node->key == key->prefix)
         {
-            // Increment the height
-            if ((*target_node)->height <= (*target_node)->left->height)
+            size_t common_length = get_common_prefix_length(key, parent_node);
+            if (common_length > closest_length)
             {
-                (*target_node)->height = (*target_node)->left->height + 1;
-            }
-
-            // If you inserted a direct child increment
-            // the balance factor
-            if (result == INSERT_NODE_INSERTED)
-            {
-                // Set parent node
-                (*target_node)->left->parent = *target_node;
-
-                // Only return inserted for 
-                result = INSERT_NODE_NO_OP;
+                closest_node = parent_node;
+                closest_length = common_length;
             }
         }
+        target_node = compare_value < 0 ? &parent_node->left : &parent_node->right;
     }
-#else
-    int continue_run = 1;
-    result = INSERT_NODE_INSERTED;
-    if (*target_node == NULL)
+
+    if (result == INSERT_NODE_INSERTED)
     {
+        if (closest_length >= KEY_PREFIX_MIN_SHARED)
+        {
+            new_node = share_key_prefix(new_node, key, closest_node, closest_length);
+        }
+        new_node->parent = parent_node;
+        new_node->left = new_node->right = NULL;
+        new_node->height = 1;
+        new_node->balance_factor = 0;
+        new_node->subtree_hash = new_node->entry_hash;
         *target_node = new_node;
-        (*target_node)->height++;
+        mark_dirty_path(parent_node);
     }
-    else
-    {
-        NODE_INFO* increment_node = NULL;
-        NODE_INFO* prev_node = NULL;
-        NODE_INFO* current_node = prev_node = *target_node;
-        do
-        {
-            if (new_node->key > current_node->key)
-            {
-                if (current_node->right == NULL)
-                {
-                    current_node->right = new_node;
-                    current_node->right->parent = current_node;
-                    current_node->right->height = 1;
-                    continue_run = 0;
-                    // If the current_node->left is NULL then increment height
-                    if (current_node->left == NULL)
-                    {
-                        increment_node = current_node->right;
-                    }
-                }
-                else
-                {
-                    prev_node = current_node;
-                    current_node = current_node->right;
-                }
-            }
-            else if (new_node->key < current_node->key)
-            {
-                if (current_node->left == NULL)
-                {
-                    current_node->left = new_node;
-                    current_node->left->parent = current_node;
-                    current_node->left->height = 1;
-                    continue_run = 0;
-                }
-                else
-                {
-                    prev_node = current_node;
-                    current_node = current_node->left;
-                }
-                // If the current_node->left is NULL then increment height
-                if (current_node->right == NULL)
-                {
-                    increment_node = current_node->left;
-                }
-            }
-            else
-            {
-                // Failure 
-                continue_run = 0;
-                result = INSERT_NODE_FAILED;
-            }
-        } while (continue_run != 0);
-
+    return result;
+}
 
-        if (increment_node != NULL)
+// Takes node_info out of the tree without freeing it and flags the
+// path that needs rebalancing
+static void unlink_node(NODE_INFO** root_node, NODE_INFO* node_info)
+{
+    NODE_INFO** parent_link = get_parent_link(root_node, node_info);
+    if (node_info->left == NULL || node_info->right == NULL)
+    {
+        NODE_INFO* child_node = node_info->left != NULL ? node_info->left : node_info->right;
+        *parent_link = child_node;
+        if (child_node != NULL)
         {
-            NODE_INFO* parent_node = increment_node->parent;
-            // Go up the tree and increment height of parents
-            while (parent_node != NULL)
-            {
-                parent_node->height++;
-                parent_node = parent_node->parent;
-            }
+            child_node->parent = node_info->parent;
         }
+        mark_dirty_path(node_info->parent);
     }
-
-#endif
-    if (result != INSERT_NODE_FAILED)
+    else
     {
-        // If a decendant has been added then calculate 
-        // the balance factor by addition
-        (*target_node)->balance_factor = calculate_balance_factor(*target_node);
+        // Two children, the in order successor takes the node's place
+        NODE_INFO* retrace_node;
+        NODE_INFO* successor = node_info->right;
+        while (successor->left != NULL)
+        {
+            successor = successor->left;
+        }
 
-        if (rebalance_if_neccessary(*target_node) != 0)
+        if (successor->parent == node_info)
         {
-            result = INSERT_NODE_REBALANCE;
+            retrace_node = successor;
         }
+        else
+        {
+            retrace_node = successor->parent;
+            retrace_node->left = successor->right;
+            if (successor->right != NULL)
+            {
+                successor->right->parent = retrace_node;
+            }
+            successor->right = node_info->right;
+            successor->right->parent = successor;
+        }
+        successor->left = node_info->left;
+        successor->left->parent = successor;
+        successor->parent = node_info->parent;
+        successor->dirty = node_info->dirty;
+        *parent_link = successor;
+        mark_dirty_path(retrace_node);
     }
-    return result;
 }
 
-static int remove_node(NODE_INFO** root_node, const NODE_KEY* node_key, tree_remove_callback remove_callback)
+// The data goes back through removed_data, the caller hands it on
+static int remove_node(NODE_INFO** root_node, const TREE_KEY* node_key, void** removed_data)
 {
     int result;
-    NODE_INFO* node_info = *root_node;
-    NODE_INFO* current_node = find_node(node_info, node_key);
+    NODE_INFO* current_node = find_node(*root_node, node_key);
     if (current_node == NULL)
     {
         result = __LINE__;
     }
     else
     {
-        NODE_INFO* previous_node = current_node->parent;
-
-        if (remove_callback != NULL)
-        {
-            remove_callback(current_node->data);
-        }
-
-        // Remove the node
+        *removed_data = current_node->data;
+        unlink_node(root_node, current_node);
+        free_node(current_node);
         result = 0;
-        // Does the node have a single child
-        if ((current_node->left != NULL && current_node->right == NULL) || (current_node->right != NULL && current_node->left == NULL))
-        {
-            // The right node is there
-            if (current_node->left == NULL && current_node->right != NULL)
-            {
-                // If previous_node's left tree equals Node n
-                if (previous_node->left == current_node)
-                {
-                    // then predecessor's left tree becomes n's right tree
-                    // and delete n
-                    previous_node->left = current_node->right;
-                    current_node->right->parent = previous_node;
-                    free(current_node);
-                    current_node = NULL;
-                    previous_node->balance_factor--;
-                }
-                // If predecessor's right tree equals Node n
-                else
-                {
-                    // then predecessor's right tree becomes n's right tree
-                    // and delete n
-                    previous_node->right = current_node->right;
-                    current_node->right->parent = previous_node;
-                    free(current_node);
-                    current_node = NULL;
-                    previous_node->balance_factor++;
-                }
-            }
-            else // Left node Present, No Right node Present
-            {
-                if (previous_node->left == current_node)
-                {
-                    previous_node->left = current_node->left;
-                    free(current_node);
-                    current_node = NULL;
-                    previous_node->balance_factor--;
-                }
-                else
-                {
-                    previous_node->right = current_node->left;
-                    current_node->left->parent = previous_node;
-                    free(current_node);
-                    current_node = NULL;
-                    previous_node->balance_factor++;
-                }
-            }
-        }
-        else if (current_node->left == NULL && current_node->right == NULL)
-        {
-            if (previous_node->left == current_node)
-            {
-                previous_node->left = NULL;
-                previous_node->balance_factor--;
-            }
-            else
-            {
-                previous_node->right = NULL;
-                previous_node->balance_factor++;
-            }
-            free(current_node);
-        }
-        // CASE 3: Node has two children
-        // Replace Node with smallest value in right subtree
-        else if (current_node->left != NULL && current_node->right != NULL)
-        {
-            // If the node's right child has a left child
-            // Move all the way down left to locate smallest element
-            if ((current_node->right)->left != NULL)
-            {
-                NODE_INFO* left_current;
-                NODE_INFO* left_current_prev;
-                left_current_prev = current_node->right;
-                left_current = (current_node->right)->left;
-                while (left_current->left != NULL)
-                {
-                    left_current_prev = left_current;
-                    left_current = left_current->left;
-                }
-                current_node->data = left_current->data;
-                free(left_current);
-                left_current_prev->left = NULL;
-            }
-            else
-            {
-                NODE_INFO* temp = current_node;
-                if (temp->parent == NULL)
-                {
-                    // deleting the root
-                    // Find the min key in the right subtree 
-                    NODE_INFO* min_node;
-                    NODE_INFO* observe_node = min_node = temp->right->left;
-                    if (observe_node == NULL)
-                    {
-                        min_node = temp->right;
-                    }
-                    else
-                    {
-                        do
-                        {
-                            if (observe_node->key < min_node->key)
-                            {
-                                min_node = observe_node;
-                            }
-                            observe_node = observe_node->left;
-                        } while (observe_node != NULL);
-                    }
-                    if (min_node->right != NULL)
-                    {
-                        // Exchange the min_node->right with min_node
-                        if (min_node->parent != current_node)
-                        {
-                            min_node->parent->left = min_node->right;
-                        }
-                        min_node->right->parent = min_node->parent;
-                        min_node->right->height = min_node->height;
-                    }
-                    else if (min_node->parent != current_node && min_node->parent->left != NULL)
-                    {
-                        min_node->parent->left = NULL;
-                    }
-                    min_node->parent = NULL;
-                    min_node->height = current_node->height;
-                    if (current_node->right != NULL && min_node != current_node->right)
-                    {
-                        min_node->right = current_node->right;
-                        current_node->right->parent = min_node;
-                    }
-                    if (current_node->left != NULL && min_node != current_node->left)
-                    {
-                        min_node->left = current_node->left;
-                        current_node->left->parent = min_node;
-                    }
-                    *root_node = min_node;
-                    free(current_node);
-                }
-                else
-                {
-                    // Find the parent node that points to this
-                    // and change it
-                    if (temp->parent->right == temp)
-                    {
-                        temp->parent->right = temp->right;
-                        temp->parent->balance_factor--;
-                    }
-                    else
-                    {
-                        temp->parent->left = temp->right;
-                        temp->parent->balance_factor++;
-                    }
-                    current_node->right->parent = temp->parent;
-                    current_node->right->left = temp->left;
-                    current_node = temp->right;
-                    current_node->balance_factor--;
-                    //current_node->parent = current_node->parent;
-                    free(temp);
-                }
-            }
-        }
     }
     return result;
 }
@@ -614,13 +1160,13 @@ static void clear_tree(NODE_INFO* node_info)
     if (node_info->right != NULL)
     {
         clear_tree(node_info->right);
-        free(node_info->right);
+        free_node(node_info->right);
     }
     // Clear left
     if (node_info->left != NULL)
     {
         clear_tree(node_info->left);
-        free(node_info->left);
+        free_node(node_info->left);
     }
 #else
     NODE_INFO* target_node = node_info;
@@ -659,176 +1205,4494 @@ static void clear_tree(NODE_INFO* node_info)
 #endif
 }
 
-BINARY_TREE_HANDLE binary_tree_create()
+static void release_persistent_node(NODE_INFO* node_info)
 {
-    BINARY_TREE_INFO* result = (BINARY_TREE_INFO*)malloc(sizeof(BINARY_TREE_INFO));
-    if (result == NULL)
+    while (node_info != NULL && atomic_fetch_sub(&node_info->ref_count, 1) == 1)
     {
-        LogError("FAILURE: unable to allocate Binary tree info");
-        result = NULL;
+        NODE_INFO* right_node = node_info->right;
+        release_persistent_node(node_info->left);
+        free_node(node_info);
+        node_info = right_node;
     }
-    else
+}
+
+static void acquire_persistent_node(NODE_INFO* node_info)
+{
+    if (node_info != NULL)
     {
-        memset(result, 0, sizeof(BINARY_TREE_INFO));
+        atomic_fetch_add(&node_info->ref_count, 1);
     }
-    return result;
 }
 
-void binary_tree_destroy(BINARY_TREE_HANDLE handle)
+static void release_version(TREE_VERSION* version)
 {
-    if (handle != NULL)
+    if (version != NULL && atomic_fetch_sub(&version->ref_count, 1) == 1)
     {
-        if (handle->root_node != NULL)
-        {
-            clear_tree(handle->root_node);
-            free(handle->root_node);
-        }
-        free(handle);
+        release_persistent_node(version->root_node);
+        tree_free(TREE_MEMORY_VERSIONS, version, sizeof(TREE_VERSION));
     }
 }
 
-int binary_tree_insert(BINARY_TREE_HANDLE handle, NODE_KEY value, void* data)
+static TREE_VERSION* pin_version(BINARY_TREE_INFO* tree_info)
 {
-    int result;
-    if (handle == NULL)
+    TREE_VERSION* result;
+    (void)pthread_mutex_lock(&tree_info->version_lock);
+    result = tree_info->version;
+    atomic_fetch_add(&result->ref_count, 1);
+    (void)pthread_mutex_unlock(&tree_info->version_lock);
+    return result;
+}
+
+// Returns the root readers should search.  Live persistent trees pin the
+// current version so a concurrent writer cannot free it underneath them
+static const NODE_INFO* pin_root(BINARY_TREE_INFO* tree_info, TREE_VERSION** pinned_version)
+{
+    const NODE_INFO* result;
+    if (tree_info->persistent && !tree_info->read_only)
     {
-        LogError("FAILURE: Invalid handle specified on insert");
-        result = __LINE__;
+        *pinned_version = pin_version(tree_info);
+        result = (*pinned_version)->root_node;
     }
     else
     {
-        size_t current_height = 0;
-        NODE_INFO* new_node = create_new_node(value, data);
-        if (new_node == NULL)
-        {
-            LogError("FAILURE: Creating new node on insert");
-            result = __LINE__;
-        }
-        else if (insert_into_tree(&handle->root_node, new_node) == INSERT_NODE_FAILURE)
+        *pinned_version = NULL;
+        result = tree_info->root_node;
+    }
+    return result;
+}
+
+// Makes the node in target_node writable for the current generation.  Nodes
+// created by an earlier write are shared with older versions so a copy
+// takes their place in the new path
+static NODE_INFO* path_copy(NODE_INFO** target_node, size_t generation)
+{
+    NODE_INFO* result = *target_node;
+    if (result != NULL && result->generation != generation)
+    {
+        NODE_INFO* original = result;
+        if ((result = (NODE_INFO*)tree_alloc(TREE_MEMORY_NODES, get_node_size(original->key_length, original->shared_length))) == NULL)
         {
-            LogError("FAILURE: Inserting new node");
-            free(new_node);
-            result = __LINE__;
+            LogError("Failure allocating path copy");
         }
         else
         {
-            handle->height = current_height;
-            handle->items++;
-            result = 0;
+            NODE_INFO* copy_node = result;
+            STATS_ADD(TREE_STAT_NODE_ALLOCATIONS, 1);
+            copy_node->key = original->key;
+            copy_node->key_length = original->key_length;
+            copy_node->shared_length = original->shared_length;
+            copy_node->shared_prefix = original->shared_prefix;
+            if (copy_node->shared_prefix != NULL)
+            {
+                (void)atomic_fetch_add(&copy_node->shared_prefix->ref_count, 1);
+            }
+            memcpy(copy_node->key_tail, original->key_tail, get_node_size(original->key_length, original->shared_length) - sizeof(NODE_INFO));
+            copy_node->data = original->data;
+            copy_node->parent = NULL;
+            copy_node->left = original->left;
+            copy_node->right = original->right;
+            copy_node->balance_factor = original->balance_factor;
+            copy_node->height = original->height;
+            copy_node->entry_hash = original->entry_hash;
+            copy_node->subtree_hash = original->subtree_hash;
+            copy_node->timer = original->timer;
+            copy_node->generation = generation;
+            copy_node->versions = NULL;
+            copy_node->tombstone = 0;
+            atomic_init(&copy_node->ref_count, 1);
+            acquire_persistent_node(copy_node->left);
+            acquire_persistent_node(copy_node->right);
+            release_persistent_node(original);
+            *target_node = copy_node;
         }
     }
     return result;
 }
 
-int binary_tree_remove(BINARY_TREE_HANDLE handle, NODE_KEY value, tree_remove_callback remove_callback)
+static int persistent_rotate_right(NODE_INFO** target_node, size_t generation)
 {
-    (void)value;
     int result;
-    if (handle == NULL)
+    NODE_INFO* node_info = *target_node;
+    NODE_INFO* pivot = path_copy(&node_info->left, generation);
+    if (pivot == NULL)
     {
-        LogError("FAILURE: Invalid handle specified on remove");
         result = __LINE__;
     }
     else
     {
-        result = remove_node(&handle->root_node, &value, remove_callback);
-        if (result == 0)
-        {
-            handle->items-- ;
-        }
+        node_info->left = pivot->right;
+        pivot->right = node_info;
+        update_node_height(node_info);
+        update_node_height(pivot);
+        *target_node = pivot;
+        result = 0;
     }
     return result;
 }
 
-void* binary_tree_find(BINARY_TREE_HANDLE handle, NODE_KEY find_value)
+static int persistent_rotate_left(NODE_INFO** target_node, size_t generation)
 {
-    void* result;
-    if (handle == NULL)
+    int result;
+    NODE_INFO* node_info = *target_node;
+    NODE_INFO* pivot = path_copy(&node_info->right, generation);
+    if (pivot == NULL)
     {
-        LogError("FAILURE: Invalid handle specified on find");
-        result = NULL;
+        result = __LINE__;
     }
     else
     {
-        const NODE_INFO* node_info = find_node(handle->root_node, &find_value);
-        if (node_info == NULL)
+        node_info->right = pivot->left;
+        pivot->left = node_info;
+        update_node_height(node_info);
+        update_node_height(pivot);
+        *target_node = pivot;
+        result = 0;
+    }
+    return result;
+}
+
+// target_node must already belong to the current generation
+static int persistent_rebalance(NODE_INFO** target_node, size_t generation)
+{
+    int result = 0;
+    NODE_INFO* node_info = *target_node;
+    update_node_height(node_info);
+    if (node_info->balance_factor > 1)
+    {
+        if (node_info->left->balance_factor < 0)
         {
-            LogDebug("Item Not found");
-            result = NULL;
+            if (path_copy(&node_info->left, generation) == NULL)
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                result = persistent_rotate_left(&node_info->left, generation);
+                STATS_ADD(TREE_STAT_DOUBLE_ROTATIONS, 1);
+            }
         }
         else
         {
-            result = node_info->data;
+            STATS_ADD(TREE_STAT_SINGLE_ROTATIONS, 1);
+        }
+        result = result == 0 ? persistent_rotate_right(target_node, generation) : result;
+    }
+    else if (node_info->balance_factor < -1)
+    {
+        if (node_info->right->balance_factor > 0)
+        {
+            if (path_copy(&node_info->right, generation) == NULL)
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                result = persistent_rotate_right(&node_info->right, generation);
+                STATS_ADD(TREE_STAT_DOUBLE_ROTATIONS, 1);
+            }
+        }
+        else
+        {
+            STATS_ADD(TREE_STAT_SINGLE_ROTATIONS, 1);
         }
+        result = result == 0 ? persistent_rotate_left(target_node, generation) : result;
     }
     return result;
 }
 
-size_t binary_tree_item_count(BINARY_TREE_HANDLE handle)
+// Once new_node is linked into the copied path the new version owns it, so
+// it is cleared even if rebalancing further up then fails
+static int persistent_insert(NODE_INFO** target_node, NODE_INFO** new_node, KEY_SEARCH* search, size_t generation)
 {
-    size_t result;
-    if (handle == NULL)
+    int result;
+    int compare_value;
+    NODE_INFO* node_info = *target_node;
+    if (node_info == NULL)
+    {
+        *target_node = *new_node;
+        *new_node = NULL;
+        result = 0;
+    }
+    else if ((compare_value = compare_search_key(search, node_info)) == 0)
+    {
+        result = __LINE__;
+    }
+    else if ((node_info = path_copy(target_node, generation)) == NULL)
     {
-        LogError("FAILURE: Invalid handle specified on remove");
         result = __LINE__;
     }
     else
     {
-        result = handle->items;
+        result = persistent_insert(compare_value < 0 ? &node_info->left : &node_info->right, new_node, search, generation);
+        if (result == 0)
+        {
+            result = persistent_rebalance(target_node, generation);
+        }
     }
     return result;
 }
 
-size_t binary_tree_height(BINARY_TREE_HANDLE handle)
+// Unlinks the smallest node under target_node and hands it back in
+// min_node, a copy of the current generation owned by the caller
+static int persistent_extract_min(NODE_INFO** target_node, NODE_INFO** min_node, size_t generation)
 {
-    size_t result;
-    if (handle == NULL)
+    int result;
+    NODE_INFO* node_info = path_copy(target_node, generation);
+    if (node_info == NULL)
     {
-        LogError("FAILURE: Invalid handle specified on remove");
         result = __LINE__;
     }
+    else if (node_info->left != NULL)
+    {
+        if ((result = persistent_extract_min(&node_info->left, min_node, generation)) == 0)
+        {
+            result = persistent_rebalance(target_node, generation);
+        }
+    }
     else
     {
-        result = handle->root_node->height;
+        // The reference to the right child moves to the parent
+        *target_node = node_info->right;
+        node_info->right = NULL;
+        *min_node = node_info;
+        result = 0;
     }
     return result;
 }
 
-void binary_tree_print(BINARY_TREE_HANDLE handle)
+static int persistent_remove(NODE_INFO** target_node, KEY_SEARCH* search, void** removed_data, size_t generation)
 {
-    if (handle == NULL)
+    int result;
+    int compare_value;
+    NODE_INFO* node_info = *target_node;
+    if (node_info == NULL)
     {
-        LogError("FAILURE: Invalid handle specified on print");
+        result = __LINE__;
     }
-    else
+    else if ((node_info = path_copy(target_node, generation)) == NULL)
     {
-        print_tree(handle->root_node, 0);
+        result = __LINE__;
     }
-}
-
-char* binary_tree_construct_visual(BINARY_TREE_HANDLE handle)
-{
-    char* result;
-    if (handle == NULL)
+    else if ((compare_value = compare_search_key(search, node_info)) != 0)
     {
-        LogError("FAILURE: Invalid handle specified on construct visual");
-        result = NULL;
+        result = persistent_remove(compare_value < 0 ? &node_info->left : &node_info->right, search, removed_data, generation);
+        if (result == 0)
+        {
+            result = persistent_rebalance(target_node, generation);
+        }
     }
     else
     {
-        // Allocate the result
-        if (handle->items > 0)
+        NODE_INFO* min_node = NULL;
+        *removed_data = node_info->data;
+        if (node_info->left == NULL || node_info->right == NULL)
         {
-            size_t len = (handle->items*NUM_OF_CHARS) + (handle->items * 2);
-            result = (char*)malloc(len + 1);
-            memset(result, 0, len + 1);
-            construct_visual_representation(handle->root_node, result, 0);
+            NODE_INFO* child_node = node_info->left != NULL ? node_info->left : node_info->right;
+            acquire_persistent_node(child_node);
+            *target_node = child_node;
+            release_persistent_node(node_info);
+            result = 0;
+        }
+        else if ((result = persistent_extract_min(&node_info->right, &min_node, generation)) != 0)
+        {
+            // A rebalance may have failed after the node came out
+            release_persistent_node(min_node);
         }
         else
         {
-            result = (char*)malloc(1);
-            result[0] = '\0';
+            // The successor takes the node's place, keys are never moved
+            // between nodes since they differ in size
+            min_node->left = node_info->left;
+            min_node->right = node_info->right;
+            node_info->left = NULL;
+            node_info->right = NULL;
+            release_persistent_node(node_info);
+            *target_node = min_node;
+            result = persistent_rebalance(target_node, generation);
         }
     }
     return result;
-}
\ No newline at end of file
+}
+
+static uint64_t mix_hash(uint64_t value)
+{
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+// Entry hashes are added up rather than chained, which makes the hash of a
+// subtree independent of its shape and lets binary_tree_diff compare any
+// key range of one tree against the other
+static uint64_t get_entry_hash(const BINARY_TREE_INFO* tree_info, const TREE_KEY* key, void* data)
+{
+    uint64_t key_hash = ((key->prefix ^ MERKLE_HASH_SEED) * MERKLE_HASH_PRIME ^ key->length) * MERKLE_HASH_PRIME;
+    for (size_t index = KEY_INLINE_BYTES; index < key->length; index++)
+    {
+        key_hash = (key_hash ^ key->bytes[index]) * MERKLE_HASH_PRIME;
+    }
+    key_hash = mix_hash(key_hash);
+    return tree_info->data_hash == NULL ? key_hash : mix_hash(key_hash ^ mix_hash(tree_info->data_hash(data, tree_info->data_hash_context) + MERKLE_HASH_SEED));
+}
+
+static size_t get_timer_size(const TREE_KEY* key)
+{
+    return sizeof(TREE_TIMER) + (key->bytes == NULL ? 0 : key->length);
+}
+
+static TREE_TIMER* create_tree_timer(const TREE_KEY* key, uint64_t expire_tick)
+{
+    TREE_TIMER* result;
+    if ((result = (TREE_TIMER*)tree_alloc(TREE_MEMORY_NODES, get_timer_size(key))) == NULL)
+    {
+        LogError("Failure allocating entry timer");
+    }
+    else
+    {
+        memset(result, 0, sizeof(TREE_TIMER));
+        result->entry.expire_tick = expire_tick;
+        result->key = *key;
+        if (key->bytes != NULL)
+        {
+            memcpy(result->key_bytes, key->bytes, key->length);
+            result->key.bytes = result->key_bytes;
+        }
+    }
+    return result;
+}
+
+static void free_tree_timer(TREE_TIMER* timer)
+{
+    tree_free(TREE_MEMORY_NODES, timer, get_timer_size(&timer->key));
+}
+
+static TREE_TIMER* get_tree_timer(TIMER_WHEEL_ENTRY* entry)
+{
+    return (TREE_TIMER*)((char*)entry - offsetof(TREE_TIMER, entry));
+}
+
+// Notes the timer of the entry a remove is about to take out.  Fails the
+// removes of binary_tree_expire whose entry was replaced meanwhile
+static int claim_entry_timer(NODE_INFO* root_node, TXN_OPERATION* operation)
+{
+    int result;
+    const NODE_INFO* node_info = find_node(root_node, &operation->key);
+    if (operation->timer != NULL && (node_info == NULL || node_info->timer != operation->timer))
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        operation->timer = node_info == NULL ? NULL : node_info->timer;
+        result = 0;
+    }
+    return result;
+}
+
+static int is_expiry_stale(NODE_INFO* root_node, const TXN_OPERATION* operation_list, size_t operation_count)
+{
+    int result = 0;
+    for (size_t index = 0; index < operation_count && result == 0; index++)
+    {
+        if (operation_list[index].type == TXN_OPERATION_REMOVE && operation_list[index].timer != NULL)
+        {
+            const NODE_INFO* node_info = find_node(root_node, &operation_list[index].key);
+            result = node_info == NULL || node_info->timer != operation_list[index].timer;
+        }
+    }
+    return result;
+}
+
+// The entry the timer belongs to left the tree, ttl_lock is held
+static void drop_entry_timer(TIMER_WHEEL* wheel, TREE_TIMER* timer)
+{
+    if (timer->due)
+    {
+        // binary_tree_expire has it and frees it
+        timer->orphaned = 1;
+    }
+    else
+    {
+        timer_wheel_remove(wheel, &timer->entry);
+        free_tree_timer(timer);
+    }
+}
+
+// Once the operations are in: starts the timers of new entries and
+// cancels those of removed ones.  The caller still holds the writer's lock
+static void settle_entry_timers(BINARY_TREE_INFO* tree_info, TXN_OPERATION* operation_list, size_t operation_count)
+{
+    TIMER_WHEEL* wheel = atomic_load_explicit(&tree_info->ttl_wheel, memory_order_acquire);
+    if (wheel != NULL)
+    {
+        (void)pthread_mutex_lock(&tree_info->ttl_lock);
+        for (size_t index = 0; index < operation_count; index++)
+        {
+            TREE_TIMER* timer = operation_list[index].timer;
+            if (timer == NULL)
+            {
+                // No expiry
+            }
+            else if (operation_list[index].type == TXN_OPERATION_INSERT)
+            {
+                timer_wheel_add(wheel, &timer->entry, timer->entry.expire_tick);
+            }
+            else
+            {
+                drop_entry_timer(wheel, timer);
+            }
+            operation_list[index].timer = NULL;
+        }
+        (void)pthread_mutex_unlock(&tree_info->ttl_lock);
+    }
+}
+
+static size_t align_log_offset(size_t offset)
+{
+    return (offset + TREE_LOG_ALIGNMENT - 1) & ~(size_t)(TREE_LOG_ALIGNMENT - 1);
+}
+
+static size_t get_log_payload_length(const TREE_LOG* log, const TXN_OPERATION* operation)
+{
+    return operation->type == TXN_OPERATION_INSERT && log->serializer != NULL ? log->serializer(operation->data, NULL, 0, log->context) : 0;
+}
+
+// Serializes outside the tree lock, the record is only appended under it
+static int encode_log_batch(const BINARY_TREE_INFO* tree_info, LOG_BATCH* batch, const TXN_OPERATION* operation_list, size_t operation_count)
+{
+    int result = 0;
+    size_t size = sizeof(TREE_LOG_BATCH);
+    for (size_t index = 0; index < operation_count && result == 0; index++)
+    {
+        size_t payload_length = get_log_payload_length(batch->log, &operation_list[index]);
+        if (payload_length > UINT32_MAX || operation_list[index].key.length > UINT32_MAX)
+        {
+            LogError("FAILURE: entry is too large to log");
+            result = __LINE__;
+        }
+        else
+        {
+            size += align_log_offset(sizeof(TREE_LOG_OPERATION) + operation_list[index].key.length + payload_length);
+        }
+    }
+
+    if (result != 0)
+    {
+        // Already logged
+    }
+    else if ((batch->bytes = (unsigned char*)tree_alloc(TREE_MEMORY_SCRATCH, size)) == NULL)
+    {
+        LogError("FAILURE: unable to allocate %zu byte log record", size);
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_LOG_BATCH* header = (TREE_LOG_BATCH*)batch->bytes;
+        size_t offset = sizeof(TREE_LOG_BATCH);
+        batch->size = size;
+        header->key_mode = (uint32_t)tree_info->key_mode;
+        header->operation_count = (uint32_t)operation_count;
+        for (size_t index = 0; index < operation_count && result == 0; index++)
+        {
+            const TXN_OPERATION* operation = &operation_list[index];
+            TREE_LOG_OPERATION* logged = (TREE_LOG_OPERATION*)(batch->bytes + offset);
+            unsigned char* payload = (unsigned char*)(logged + 1) + operation->key.length;
+            size_t payload_length = 0;
+            logged->key = operation->key.prefix;
+            logged->type = (uint32_t)operation->type;
+            logged->key_length = (uint32_t)operation->key.length;
+            logged->reserved = 0;
+            if (operation->key.length > 0)
+            {
+                (void)memcpy(logged + 1, operation->key.bytes, operation->key.length);
+            }
+            if (operation->type == TXN_OPERATION_INSERT && batch->log->serializer != NULL &&
+                (payload_length = batch->log->serializer(operation->data, payload, size - (size_t)(payload - batch->bytes), batch->log->context)) > size - (size_t)(payload - batch->bytes))
+            {
+                LogError("FAILURE: the serializer asked for more room the second time");
+                result = __LINE__;
+            }
+            else
+            {
+                size_t next_offset = offset + align_log_offset(sizeof(TREE_LOG_OPERATION) + operation->key.length + payload_length);
+                logged->payload_length = (uint32_t)payload_length;
+                (void)memset(payload + payload_length, 0, next_offset - (size_t)(payload + payload_length - batch->bytes));
+                offset = next_offset;
+            }
+        }
+    }
+    return result;
+}
+
+// Called with the tree locked once the batch is known to apply, so the log
+// holds the changes in the order they were made
+static int append_log_batch(LOG_BATCH* batch)
+{
+    int result;
+    if (batch->log == NULL)
+    {
+        result = 0;
+    }
+    else if ((batch->position = wal_writer_append(batch->log->writer, batch->bytes, batch->size)) == 0)
+    {
+        LogError("FAILURE: unable to log the change, nothing was applied");
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+// Applies a list of inserts and removes to a private copy of the current
+// version and publishes it in one step, or not at all if any of them fails.
+// Readers holding the old version keep seeing it unchanged
+static int persistent_update(BINARY_TREE_INFO* tree_info, TXN_OPERATION* operation_list, size_t operation_count, LOG_BATCH* batch)
+{
+    int result;
+    TREE_VERSION* next_version;
+
+    (void)pthread_mutex_lock(&tree_info->write_lock);
+    if ((next_version = (TREE_VERSION*)tree_alloc(TREE_MEMORY_VERSIONS, sizeof(TREE_VERSION))) == NULL)
+    {
+        LogError("FAILURE: allocating tree version");
+        result = __LINE__;
+    }
+    else
+    {
+        // Only this writer replaces the version so it can be read unlocked
+        TREE_VERSION* current_version = tree_info->version;
+        size_t generation = ++tree_info->write_generation;
+
+        next_version->root_node = current_version->root_node;
+        next_version->items = current_version->items;
+        atomic_init(&next_version->ref_count, 1);
+        acquire_persistent_node(next_version->root_node);
+
+        result = 0;
+        for (size_t index = 0; index < operation_count && result == 0; index++)
+        {
+            TXN_OPERATION* operation = &operation_list[index];
+            if (operation->type == TXN_OPERATION_INSERT)
+            {
+                NODE_INFO* new_node = operation->new_node;
+                new_node->generation = generation;
+                atomic_init(&new_node->ref_count, 1);
+                new_node->height = 1;
+                new_node->subtree_hash = new_node->entry_hash;
+                KEY_SEARCH search = { &operation->key, NULL, 0 };
+                if ((result = persistent_insert(&next_version->root_node, &operation->new_node, &search, generation)) == 0)
+                {
+                    next_version->items++;
+                }
+            }
+            else if (atomic_load_explicit(&tree_info->ttl_wheel, memory_order_acquire) != NULL && (result = claim_entry_timer(next_version->root_node, operation)) != 0)
+            {
+                // binary_tree_expire lost the entry to another writer
+            }
+            else
+            {
+                KEY_SEARCH search = { &operation->key, NULL, 0 };
+                if ((result = persistent_remove(&next_version->root_node, &search, &operation->data, generation)) == 0)
+                {
+                    next_version->items--;
+                }
+            }
+        }
+
+        if (result == 0)
+        {
+            result = append_log_batch(batch);
+        }
+
+        if (result != 0)
+        {
+            // Drops every node copied or added for this write, the shared ones stay
+            release_version(next_version);
+        }
+        else
+        {
+            (void)pthread_mutex_lock(&tree_info->version_lock);
+            tree_info->version = next_version;
+            (void)pthread_mutex_unlock(&tree_info->version_lock);
+            release_version(current_version);
+            settle_entry_timers(tree_info, operation_list, operation_count);
+
+            for (size_t index = 0; index < operation_count; index++)
+            {
+                if (operation_list[index].type == TXN_OPERATION_REMOVE && operation_list[index].remove_callback != NULL)
+                {
+                    operation_list[index].remove_callback(operation_list[index].data);
+                }
+            }
+        }
+    }
+    (void)pthread_mutex_unlock(&tree_info->write_lock);
+    return result;
+}
+
+static NODE_VERSION* create_node_version(void* data, uint64_t commit_ts, int removed, NODE_VERSION* older)
+{
+    NODE_VERSION* result;
+    if ((result = (NODE_VERSION*)tree_alloc(TREE_MEMORY_VERSIONS, sizeof(NODE_VERSION))) == NULL)
+    {
+        LogError("Failure allocating node version");
+    }
+    else
+    {
+        result->data = data;
+        result->commit_ts = commit_ts;
+        result->removed = removed;
+        result->remove_callback = NULL;
+        result->older = older;
+    }
+    return result;
+}
+
+static void release_node_versions(NODE_VERSION* version)
+{
+    while (version != NULL)
+    {
+        NODE_VERSION* older = version->older;
+        if (version->remove_callback != NULL)
+        {
+            version->remove_callback(version->data);
+        }
+        tree_free(TREE_MEMORY_VERSIONS, version, sizeof(NODE_VERSION));
+        version = older;
+    }
+}
+
+static void release_tree_versions(NODE_INFO* node_info)
+{
+    while (node_info != NULL)
+    {
+        release_tree_versions(node_info->left);
+        release_node_versions(node_info->versions);
+        node_info->versions = NULL;
+        node_info = node_info->right;
+    }
+}
+
+// Persistent trees are read through pinned versions and never lock
+static void lock_tree_for_read(BINARY_TREE_INFO* tree_info)
+{
+    if (!tree_info->persistent)
+    {
+        (void)pthread_rwlock_rdlock(&tree_info->tree_lock);
+    }
+}
+
+static void unlock_tree(BINARY_TREE_INFO* tree_info)
+{
+    if (!tree_info->persistent)
+    {
+        (void)pthread_rwlock_unlock(&tree_info->tree_lock);
+    }
+}
+
+// Callers hold the tree lock and have checked that the key isn't live.  The
+// new node is only used when the key has no node yet
+static void mvcc_link_insert(BINARY_TREE_INFO* tree_info, NODE_INFO* node_info, TXN_OPERATION* operation)
+{
+    if (node_info != NULL)
+    {
+        // Revive the removed key with a new version on top of its history
+        operation->version->older = node_info->versions;
+        node_info->versions = operation->version;
+        node_info->data = operation->data;
+        node_info->tombstone = 0;
+    }
+    else
+    {
+        operation->new_node->versions = operation->version;
+        (void)insert_into_tree(&tree_info->root_node, operation->new_node, &operation->key, tree_info->prefix_compression);
+        operation->new_node = NULL;
+    }
+    operation->version = NULL;
+}
+
+static void mvcc_link_remove(NODE_INFO* node_info, TXN_OPERATION* operation)
+{
+    // Older readers may still see the data, the callback waits for the gc
+    operation->version->older = node_info->versions;
+    node_info->versions->remove_callback = operation->remove_callback;
+    node_info->versions = operation->version;
+    node_info->data = NULL;
+    node_info->tombstone = 1;
+    operation->version = NULL;
+}
+
+// Applies a validated list of operations under one commit timestamp, so a
+// reader sees either all of them or none.  Caller holds the write lock
+static int mvcc_apply(BINARY_TREE_INFO* tree_info, TXN_OPERATION* operation_list, size_t operation_count)
+{
+    int result = 0;
+    uint64_t commit_ts = atomic_load(&tree_info->commit_clock) + 1;
+    for (size_t index = 0; index < operation_count && result == 0; index++)
+    {
+        int removed = operation_list[index].type == TXN_OPERATION_REMOVE;
+        if ((operation_list[index].version = create_node_version(removed ? NULL : operation_list[index].data, commit_ts, removed, NULL)) == NULL)
+        {
+            result = __LINE__;
+        }
+    }
+
+    if (result == 0)
+    {
+        for (size_t index = 0; index < operation_count; index++)
+        {
+            NODE_INFO* node_info = find_node(tree_info->root_node, &operation_list[index].key);
+            if (operation_list[index].type == TXN_OPERATION_INSERT)
+            {
+                mvcc_link_insert(tree_info, node_info, &operation_list[index]);
+                tree_info->items++;
+            }
+            else
+            {
+                mvcc_link_remove(node_info, &operation_list[index]);
+                tree_info->items--;
+            }
+        }
+        rebalance_dirty_paths(&tree_info->root_node);
+        // Publish only once every version is linked so a reader that picks
+        // up this timestamp is guaranteed to find them
+        atomic_store(&tree_info->commit_clock, commit_ts);
+    }
+    return result;
+}
+
+static void collect_tombstones(NODE_INFO* node_info, NODE_INFO** node_list, size_t* index)
+{
+    while (node_info != NULL)
+    {
+        collect_tombstones(node_info->left, node_list, index);
+        if (node_info->tombstone)
+        {
+            node_list[(*index)++] = node_info;
+        }
+        node_info = node_info->right;
+    }
+}
+
+// Drops every tombstoned node in one go.  When most of the tree is dead it
+// is cheaper to rebuild it from the live nodes, otherwise the tombstones are
+// spliced out and the tree gets a single rebalance pass.  Caller holds the write lock
+static void compact_tree(BINARY_TREE_INFO* tree_info)
+{
+    if (tree_info->tombstones > 0)
+    {
+        size_t index = 0;
+        size_t node_count = tree_info->items + tree_info->tombstones;
+        NODE_INFO** node_list;
+        if (tree_info->tombstones >= tree_info->items && (node_list = (NODE_INFO**)tree_alloc(TREE_MEMORY_SCRATCH, node_count * sizeof(NODE_INFO*))) != NULL)
+        {
+            size_t live_count = 0;
+            flatten_subtree(tree_info->root_node, node_list, &index);
+            for (index = 0; index < node_count; index++)
+            {
+                if (node_list[index]->tombstone)
+                {
+                    free_node(node_list[index]);
+                }
+                else
+                {
+                    node_list[live_count++] = node_list[index];
+                }
+            }
+            tree_info->root_node = build_subtree(node_list, live_count, NULL);
+            tree_free(TREE_MEMORY_SCRATCH, node_list, node_count * sizeof(NODE_INFO*));
+        }
+        else if ((node_list = (NODE_INFO**)tree_alloc(TREE_MEMORY_SCRATCH, tree_info->tombstones * sizeof(NODE_INFO*))) == NULL)
+        {
+            LogError("Failure allocating compaction list");
+        }
+        else
+        {
+            collect_tombstones(tree_info->root_node, node_list, &index);
+            for (index = 0; index < tree_info->tombstones; index++)
+            {
+                unlink_node(&tree_info->root_node, node_list[index]);
+                free_node(node_list[index]);
+            }
+            rebalance_dirty_paths(&tree_info->root_node);
+            tree_free(TREE_MEMORY_SCRATCH, node_list, tree_info->tombstones * sizeof(NODE_INFO*));
+        }
+
+        if (node_list != NULL)
+        {
+            tree_info->tombstones = 0;
+            tree_info->height = get_node_height(tree_info->root_node);
+        }
+    }
+}
+
+// Lazy remove, hands the data back right away but leaves the node in place
+static int tombstone_node(BINARY_TREE_INFO* tree_info, const TREE_KEY* node_key, tree_remove_callback remove_callback)
+{
+    int result;
+    NODE_INFO* node_info = find_node(tree_info->root_node, node_key);
+    if (node_info == NULL || node_info->tombstone)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        if (remove_callback != NULL)
+        {
+            remove_callback(node_info->data);
+        }
+        node_info->data = NULL;
+        node_info->tombstone = 1;
+        tree_info->tombstones++;
+        tree_info->items--;
+        result = 0;
+    }
+    return result;
+}
+
+// An insert over a tombstone reuses the node without touching the shape
+static int revive_node(BINARY_TREE_INFO* tree_info, TXN_OPERATION* operation)
+{
+    int result;
+    NODE_INFO* node_info = find_node(tree_info->root_node, &operation->key);
+    if (node_info == NULL || !node_info->tombstone)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        node_info->data = operation->data;
+        node_info->tombstone = 0;
+        tree_info->tombstones--;
+        tree_info->items++;
+        result = 0;
+    }
+    return result;
+}
+
+static int needs_compaction(const BINARY_TREE_INFO* tree_info)
+{
+    return tree_info->lazy_delete && tree_info->compaction_ratio > 0 &&
+        tree_info->tombstones * 100 >= (tree_info->items + tree_info->tombstones) * tree_info->compaction_ratio;
+}
+
+static void request_compaction(BINARY_TREE_INFO* tree_info)
+{
+    (void)pthread_mutex_lock(&tree_info->gc_lock);
+    tree_info->compact_requested = 1;
+    (void)pthread_cond_signal(&tree_info->gc_cond);
+    (void)pthread_mutex_unlock(&tree_info->gc_lock);
+}
+
+typedef struct TXN_KEY_ORDER_TAG
+{
+    const TREE_KEY* key;
+    size_t index;
+} TXN_KEY_ORDER;
+
+static int compare_key_order(const void* value_1, const void* value_2)
+{
+    const TXN_KEY_ORDER* order_1 = (const TXN_KEY_ORDER*)value_1;
+    const TXN_KEY_ORDER* order_2 = (const TXN_KEY_ORDER*)value_2;
+    int result = compare_keys(order_1->key, order_2->key);
+    if (result == 0)
+    {
+        result = order_1->index > order_2->index ? 1 : (order_1->index < order_2->index ? -1 : 0);
+    }
+    return result;
+}
+
+static int is_key_live(const BINARY_TREE_INFO* tree_info, const TREE_KEY* key)
+{
+    const NODE_INFO* node_info = find_node(tree_info->root_node, key);
+    return node_info != NULL && !node_info->tombstone;
+}
+
+// Checks that every insert targets a missing key and every remove a live
+// one, counting the effect of the operations before it in the list
+static int validate_operations(const BINARY_TREE_INFO* tree_info, const TXN_OPERATION* operation_list, size_t operation_count)
+{
+    int result;
+    TXN_KEY_ORDER* key_order = (TXN_KEY_ORDER*)tree_alloc(TREE_MEMORY_SCRATCH, operation_count * sizeof(TXN_KEY_ORDER));
+    if (key_order == NULL)
+    {
+        LogError("FAILURE: allocating transaction key order");
+        result = __LINE__;
+    }
+    else
+    {
+        for (size_t index = 0; index < operation_count; index++)
+        {
+            key_order[index].key = &operation_list[index].key;
+            key_order[index].index = index;
+        }
+        qsort(key_order, operation_count, sizeof(TXN_KEY_ORDER), compare_key_order);
+
+        result = 0;
+        int key_live = 0;
+        for (size_t index = 0; index < operation_count && result == 0; index++)
+        {
+            const TXN_OPERATION* operation = &operation_list[key_order[index].index];
+            if (index == 0 || compare_keys(key_order[index].key, key_order[index - 1].key) != 0)
+            {
+                key_live = is_key_live(tree_info, &operation->key);
+            }
+
+            if ((operation->type == TXN_OPERATION_INSERT) == (key_live != 0))
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                key_live = !key_live;
+            }
+        }
+        tree_free(TREE_MEMORY_SCRATCH, key_order, operation_count * sizeof(TXN_KEY_ORDER));
+    }
+    return result;
+}
+
+// What an entry counts against max_bytes
+static size_t get_entry_size(const BINARY_TREE_INFO* tree_info, const TREE_KEY* key, void* data)
+{
+    size_t result = get_node_size(key->length, 0);
+    if (tree_info->bounds.data_size != NULL)
+    {
+        result += tree_info->bounds.data_size(data, tree_info->bounds.data_size_context);
+    }
+    return result;
+}
+
+static int is_over_bounds(const BINARY_TREE_INFO* tree_info)
+{
+    return (tree_info->bounds.max_items != 0 && tree_info->items > tree_info->bounds.max_items) ||
+        (tree_info->bounds.max_bytes != 0 && tree_info->entry_bytes > tree_info->bounds.max_bytes);
+}
+
+// The first node whose key isn't below key
+static NODE_INFO* find_lower_bound(NODE_INFO* node_info, const TREE_KEY* key)
+{
+    NODE_INFO* result = NULL;
+    KEY_SEARCH search = { key, NULL, 0 };
+    while (node_info != NULL)
+    {
+        if (compare_search_key(&search, node_info) <= 0)
+        {
+            result = node_info;
+            node_info = node_info->left;
+        }
+        else
+        {
+            node_info = node_info->right;
+        }
+    }
+    return result;
+}
+
+static NODE_INFO* get_first_node(NODE_INFO* node_info)
+{
+    while (node_info != NULL && node_info->left != NULL)
+    {
+        node_info = node_info->left;
+    }
+    return node_info;
+}
+
+static NODE_INFO* get_next_node(NODE_INFO* node_info)
+{
+    NODE_INFO* result;
+    if (node_info->right != NULL)
+    {
+        result = get_first_node(node_info->right);
+    }
+    else
+    {
+        result = node_info->parent;
+        while (result != NULL && node_info == result->right)
+        {
+            node_info = result;
+            result = result->parent;
+        }
+    }
+    return result;
+}
+
+// Remembers where the next sweep starts.  Without room for the key it
+// starts over from the smallest one, which is only less fair
+static void set_clock_hand(BINARY_TREE_INFO* tree_info, const NODE_INFO* node_info)
+{
+    tree_info->clock_hand_set = 0;
+    if (node_info == NULL)
+    {
+        // Wrapped around
+    }
+    else if (tree_info->key_mode != BINARY_TREE_KEY_STRING)
+    {
+        tree_info->clock_hand = make_integer_key(node_info->key);
+        tree_info->clock_hand_set = 1;
+    }
+    else
+    {
+        if (node_info->key_length > tree_info->clock_hand_size)
+        {
+            unsigned char* key_bytes = (unsigned char*)memory_tracker_realloc(tree_info->memory, TREE_MEMORY_BOOKKEEPING, tree_info->clock_hand_bytes, tree_info->clock_hand_size, node_info->key_length);
+            if (key_bytes != NULL)
+            {
+                tree_info->clock_hand_bytes = key_bytes;
+                tree_info->clock_hand_size = node_info->key_length;
+            }
+        }
+        if (node_info->key_length <= tree_info->clock_hand_size)
+        {
+            copy_node_key(node_info, tree_info->clock_hand_bytes);
+            tree_info->clock_hand = make_string_key(tree_info->clock_hand_bytes, node_info->key_length);
+            tree_info->clock_hand_set = 1;
+        }
+    }
+}
+
+// CLOCK eviction under the writer's lock.  Finds only set referenced, so
+// they never need more than the read lock
+static void evict_cold_entries(BINARY_TREE_INFO* tree_info)
+{
+    NODE_INFO* node_info = tree_info->clock_hand_set ? find_lower_bound(tree_info->root_node, &tree_info->clock_hand) : NULL;
+    TIMER_WHEEL* wheel = atomic_load_explicit(&tree_info->ttl_wheel, memory_order_acquire);
+    while (tree_info->root_node != NULL && is_over_bounds(tree_info))
+    {
+        if (node_info == NULL)
+        {
+            node_info = get_first_node(tree_info->root_node);
+        }
+
+        if (atomic_exchange_explicit(&node_info->referenced, 0, memory_order_relaxed))
+        {
+            node_info = get_next_node(node_info);
+        }
+        else
+        {
+            // The tree stays ordered until the rebalance below, so the
+            // next node is still found by walking up and right
+            NODE_INFO* evicted_node = node_info;
+            node_info = get_next_node(evicted_node);
+            TREE_KEY key = { evicted_node->key, NULL, evicted_node->key_length };
+            tree_info->entry_bytes -= get_entry_size(tree_info, &key, evicted_node->data);
+            if (evicted_node->timer != NULL)
+            {
+                (void)pthread_mutex_lock(&tree_info->ttl_lock);
+                drop_entry_timer(wheel, evicted_node->timer);
+                (void)pthread_mutex_unlock(&tree_info->ttl_lock);
+            }
+            unlink_node(&tree_info->root_node, evicted_node);
+            tree_info->items--;
+            if (tree_info->bounds.evict_callback != NULL)
+            {
+                tree_info->bounds.evict_callback(evicted_node->data);
+            }
+            free_node(evicted_node);
+        }
+    }
+    rebalance_dirty_paths(&tree_info->root_node);
+    set_clock_hand(tree_info, node_info);
+}
+
+// The single synchronization point every change goes through.  Structural
+// changes are linked in first and the tree is rebalanced once at the end
+static int apply_operations(BINARY_TREE_INFO* tree_info, TXN_OPERATION* operation_list, size_t operation_count)
+{
+    int result;
+    LOG_BATCH batch = { atomic_load_explicit(&tree_info->log, memory_order_acquire), NULL, 0, 0 };
+    for (size_t index = 0; index < operation_count; index++)
+    {
+        if (operation_list[index].type == TXN_OPERATION_INSERT)
+        {
+            NODE_INFO* new_node = operation_list[index].new_node;
+            new_node->entry_hash = tree_info->merkle_hash ? get_entry_hash(tree_info, &operation_list[index].key, operation_list[index].data) : 0;
+            new_node->timer = operation_list[index].timer;
+            // A new entry gets one sweep before it can be evicted
+            atomic_init(&new_node->referenced, 1);
+        }
+    }
+
+    if (batch.log != NULL && encode_log_batch(tree_info, &batch, operation_list, operation_count) != 0)
+    {
+        result = __LINE__;
+    }
+    else if (tree_info->persistent)
+    {
+        result = persistent_update(tree_info, operation_list, operation_count, &batch);
+    }
+    else
+    {
+        (void)pthread_rwlock_wrlock(&tree_info->tree_lock);
+        // A lone insert or remove can't leave a partial result behind so it
+        // can skip straight to the change, unless it has to be logged first
+        if ((operation_count > 1 || tree_info->mvcc || batch.log != NULL) && validate_operations(tree_info, operation_list, operation_count) != 0)
+        {
+            result = __LINE__;
+        }
+        else if (is_expiry_stale(tree_info->root_node, operation_list, operation_count))
+        {
+            // binary_tree_expire lost the entry to another writer
+            result = __LINE__;
+        }
+        else if (append_log_batch(&batch) != 0)
+        {
+            result = __LINE__;
+        }
+        else if (tree_info->mvcc)
+        {
+            result = mvcc_apply(tree_info, operation_list, operation_count);
+        }
+        else
+        {
+            result = 0;
+            for (size_t index = 0; index < operation_count && result == 0; index++)
+            {
+                TXN_OPERATION* operation = &operation_list[index];
+                if (operation->type == TXN_OPERATION_REMOVE)
+                {
+                    if (tree_info->lazy_delete)
+                    {
+                        result = tombstone_node(tree_info, &operation->key, operation->remove_callback);
+                    }
+                    else if (atomic_load_explicit(&tree_info->ttl_wheel, memory_order_acquire) != NULL && (result = claim_entry_timer(tree_info->root_node, operation)) != 0)
+                    {
+                        // Already checked above
+                    }
+                    else if ((result = remove_node(&tree_info->root_node, &operation->key, &operation->data)) == 0)
+                    {
+                        tree_info->items--;
+                        if (tree_info->bounded)
+                        {
+                            tree_info->entry_bytes -= get_entry_size(tree_info, &operation->key, operation->data);
+                        }
+                        if (operation->remove_callback != NULL)
+                        {
+                            operation->remove_callback(operation->data);
+                        }
+                    }
+                }
+                else if (tree_info->lazy_delete && revive_node(tree_info, operation) == 0)
+                {
+                    // The node stays with the caller and is freed with the operation
+                }
+                else if (insert_into_tree(&tree_info->root_node, operation->new_node, &operation->key, tree_info->prefix_compression) == INSERT_NODE_FAILED)
+                {
+                    result = __LINE__;
+                }
+                else
+                {
+                    operation->new_node = NULL;
+                    tree_info->items++;
+                    if (tree_info->bounded)
+                    {
+                        tree_info->entry_bytes += get_entry_size(tree_info, &operation->key, operation->data);
+                    }
+                }
+            }
+            rebalance_dirty_paths(&tree_info->root_node);
+            if (result == 0)
+            {
+                settle_entry_timers(tree_info, operation_list, operation_count);
+            }
+            if (result == 0 && tree_info->bounded)
+            {
+                evict_cold_entries(tree_info);
+            }
+
+            if (!needs_compaction(tree_info))
+            {
+                // Nothing to do
+            }
+            else if (tree_info->background_compaction)
+            {
+                request_compaction(tree_info);
+            }
+            else
+            {
+                compact_tree(tree_info);
+            }
+        }
+        tree_info->height = get_node_height(tree_info->root_node);
+        (void)pthread_rwlock_unlock(&tree_info->tree_lock);
+    }
+
+    // Waited for unlocked so writers that come meanwhile join the same sync
+    if (batch.position != 0 && wal_writer_commit(batch.log->writer, batch.position) != 0)
+    {
+        LogError("FAILURE: the change was applied but the log couldn't make it durable");
+        result = __LINE__;
+    }
+    tree_free(TREE_MEMORY_SCRATCH, batch.bytes, batch.size);
+    return result;
+}
+
+// Frees whatever the tree didn't take ownership of
+static void release_operations(TXN_OPERATION* operation_list, size_t operation_count)
+{
+    for (size_t index = 0; index < operation_count; index++)
+    {
+        if (operation_list[index].new_node != NULL)
+        {
+            free_node(operation_list[index].new_node);
+        }
+        if (operation_list[index].type == TXN_OPERATION_INSERT && operation_list[index].timer != NULL)
+        {
+            free_tree_timer(operation_list[index].timer);
+        }
+        tree_free(TREE_MEMORY_VERSIONS, operation_list[index].version, sizeof(NODE_VERSION));
+    }
+}
+
+static uint64_t get_oldest_reader(BINARY_TREE_INFO* tree_info)
+{
+    uint64_t result;
+    (void)pthread_mutex_lock(&tree_info->reader_lock);
+    result = atomic_load(&tree_info->commit_clock);
+    for (size_t index = 0; index < tree_info->active_reader_count; index++)
+    {
+        if (tree_info->active_readers[index] < result)
+        {
+            result = tree_info->active_readers[index];
+        }
+    }
+    (void)pthread_mutex_unlock(&tree_info->reader_lock);
+    return result;
+}
+
+typedef struct MVCC_GC_CONTEXT_TAG
+{
+    uint64_t oldest_reader;
+    NODE_INFO** dead_nodes;
+    size_t dead_count;
+    size_t dead_capacity;
+} MVCC_GC_CONTEXT;
+
+static int trim_node_versions(NODE_INFO* node_info, MVCC_GC_CONTEXT* gc_context)
+{
+    int result = 0;
+    NODE_VERSION* visible = node_info->versions;
+    while (visible != NULL && visible->commit_ts > gc_context->oldest_reader)
+    {
+        visible = visible->older;
+    }
+    if (visible != NULL)
+    {
+        // Everything older than what the oldest reader sees is unreachable
+        release_node_versions(visible->older);
+        visible->older = NULL;
+
+        if (visible == node_info->versions && visible->removed)
+        {
+            // The key is gone for every reader, the node itself can go
+            if (gc_context->dead_count == gc_context->dead_capacity)
+            {
+                size_t new_capacity = gc_context->dead_capacity == 0 ? 16 : gc_context->dead_capacity * 2;
+                NODE_INFO** dead_nodes = (NODE_INFO**)tree_realloc(TREE_MEMORY_SCRATCH, gc_context->dead_nodes, gc_context->dead_capacity * sizeof(NODE_INFO*), new_capacity * sizeof(NODE_INFO*));
+                if (dead_nodes == NULL)
+                {
+                    LogError("Failure allocating gc key list");
+                    result = __LINE__;
+                }
+                else
+                {
+                    gc_context->dead_nodes = dead_nodes;
+                    gc_context->dead_capacity = new_capacity;
+                }
+            }
+            if (result == 0)
+            {
+                gc_context->dead_nodes[gc_context->dead_count++] = node_info;
+            }
+        }
+    }
+    return result;
+}
+
+static void trim_tree_versions(NODE_INFO* node_info, MVCC_GC_CONTEXT* gc_context)
+{
+    while (node_info != NULL)
+    {
+        trim_tree_versions(node_info->left, gc_context);
+        (void)trim_node_versions(node_info, gc_context);
+        node_info = node_info->right;
+    }
+}
+
+static void mvcc_collect_garbage(BINARY_TREE_INFO* tree_info)
+{
+    MVCC_GC_CONTEXT gc_context;
+    memset(&gc_context, 0, sizeof(MVCC_GC_CONTEXT));
+    gc_context.oldest_reader = get_oldest_reader(tree_info);
+
+    (void)pthread_rwlock_wrlock(&tree_info->tree_lock);
+    trim_tree_versions(tree_info->root_node, &gc_context);
+    for (size_t index = 0; index < gc_context.dead_count; index++)
+    {
+        NODE_INFO* node_info = gc_context.dead_nodes[index];
+        release_node_versions(node_info->versions);
+        node_info->versions = NULL;
+        unlink_node(&tree_info->root_node, node_info);
+        free_node(node_info);
+    }
+    rebalance_dirty_paths(&tree_info->root_node);
+    (void)pthread_rwlock_unlock(&tree_info->tree_lock);
+    tree_free(TREE_MEMORY_SCRATCH, gc_context.dead_nodes, gc_context.dead_capacity * sizeof(NODE_INFO*));
+}
+
+static size_t get_export_bucket(uint64_t value)
+{
+    size_t result;
+    if (value < EXPORT_LATENCY_SUB_COUNT)
+    {
+        result = (size_t)value;
+    }
+    else
+    {
+        unsigned int exponent = 63u - (unsigned int)__builtin_clzll(value);
+        result = EXPORT_LATENCY_SUB_COUNT * (exponent - EXPORT_LATENCY_SUB_BITS + 1) + (size_t)((value >> (exponent - EXPORT_LATENCY_SUB_BITS)) & (EXPORT_LATENCY_SUB_COUNT - 1));
+    }
+    return result;
+}
+
+// Highest value that lands in the bucket
+static uint64_t get_export_bucket_value(size_t index)
+{
+    uint64_t result;
+    if (index < EXPORT_LATENCY_SUB_COUNT)
+    {
+        result = index;
+    }
+    else
+    {
+        unsigned int shift = (unsigned int)(index / EXPORT_LATENCY_SUB_COUNT) - 1;
+        uint64_t lower = (uint64_t)(EXPORT_LATENCY_SUB_COUNT + index % EXPORT_LATENCY_SUB_COUNT) << shift;
+        result = lower + (((uint64_t)1 << shift) - 1);
+    }
+    return result;
+}
+
+static STATS_EXPORT* create_stats_export(BINARY_TREE_INFO* tree_info)
+{
+    STATS_EXPORT* result = (STATS_EXPORT*)memory_tracker_malloc(tree_info->memory, TREE_MEMORY_BOOKKEEPING, sizeof(STATS_EXPORT));
+    if (result == NULL)
+    {
+        LogError("FAILURE: unable to allocate stats export");
+    }
+    else
+    {
+        memset(result, 0, sizeof(STATS_EXPORT));
+    }
+    return result;
+}
+
+// Returns the start time of an operation that has to be counted or traced,
+// 0 when the tree is doing neither
+static uint64_t operation_begin(BINARY_TREE_INFO* tree_info)
+{
+    return atomic_load_explicit(&tree_info->exporting, memory_order_acquire) || atomic_load_explicit(&tree_info->trace_writer, memory_order_relaxed) != NULL ? stopwatch_now_ns() : 0;
+}
+
+static void operation_end(BINARY_TREE_INFO* tree_info, EXPORT_COUNTER counter, const TREE_KEY* key, int result, uint64_t start_ns)
+{
+    if (start_ns != 0)
+    {
+        uint64_t end_ns = stopwatch_now_ns();
+        OP_TRACE_WRITER_HANDLE trace_writer = atomic_load_explicit(&tree_info->trace_writer, memory_order_acquire);
+        if (atomic_load_explicit(&tree_info->exporting, memory_order_acquire))
+        {
+            STATS_EXPORT* stats_export = tree_info->stats_export;
+            (void)atomic_fetch_add_explicit(&stats_export->counters[counter], 1, memory_order_relaxed);
+            (void)atomic_fetch_add_explicit(&stats_export->latency_buckets[get_export_bucket(end_ns - start_ns)], 1, memory_order_relaxed);
+        }
+        if (trace_writer != NULL)
+        {
+            OP_TRACE_OPERATION operation = counter == EXPORT_COUNTER_INSERTS ? OP_TRACE_INSERT : counter == EXPORT_COUNTER_REMOVES ? OP_TRACE_REMOVE : OP_TRACE_FIND;
+            op_trace_writer_record(trace_writer, operation, key->prefix, result, start_ns, end_ns);
+        }
+    }
+}
+
+// Counts the operations of a committed transaction, the commit as a whole
+// isn't a latency sample
+static void export_operations(BINARY_TREE_INFO* tree_info, const TXN_OPERATION* operation_list, size_t operation_count)
+{
+    if (atomic_load_explicit(&tree_info->exporting, memory_order_acquire))
+    {
+        STATS_EXPORT* stats_export = tree_info->stats_export;
+        for (size_t index = 0; index < operation_count; index++)
+        {
+            (void)atomic_fetch_add_explicit(&stats_export->counters[operation_list[index].type == TXN_OPERATION_INSERT ? EXPORT_COUNTER_INSERTS : EXPORT_COUNTER_REMOVES], 1, memory_order_relaxed);
+        }
+    }
+}
+
+static uint64_t get_export_percentile(const uint64_t* bucket_list, uint64_t samples, double percentile)
+{
+    uint64_t result = 0;
+    uint64_t target = (uint64_t)((double)samples * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+    target = target == 0 ? 1 : target;
+    for (size_t index = 0; index < EXPORT_LATENCY_BUCKETS; index++)
+    {
+        seen += bucket_list[index];
+        if (seen >= target)
+        {
+            result = get_export_bucket_value(index);
+            break;
+        }
+    }
+    return result;
+}
+
+// Called on the gc thread only
+static void publish_stats(BINARY_TREE_INFO* tree_info)
+{
+    STATS_EXPORT* stats_export = tree_info->stats_export;
+    STAT_PAGE_VALUES values;
+    BINARY_TREE_MEMORY_USAGE usage;
+    uint64_t bucket_list[EXPORT_LATENCY_BUCKETS];
+    memset(&values, 0, sizeof(STAT_PAGE_VALUES));
+
+    values.pid = (uint64_t)getpid();
+    values.items = binary_tree_item_count(tree_info);
+    values.height = binary_tree_height(tree_info);
+    if (binary_tree_memory_usage(tree_info, &usage) == 0)
+    {
+        values.memory_bytes = usage.total_bytes;
+    }
+    values.inserts = atomic_load_explicit(&stats_export->counters[EXPORT_COUNTER_INSERTS], memory_order_relaxed);
+    values.removes = atomic_load_explicit(&stats_export->counters[EXPORT_COUNTER_REMOVES], memory_order_relaxed);
+    values.finds = atomic_load_explicit(&stats_export->counters[EXPORT_COUNTER_FINDS], memory_order_relaxed);
+#ifdef ENABLE_TREE_STATS
+    BINARY_TREE_STATS stats;
+    if (binary_tree_get_stats(tree_info, &stats) == 0)
+    {
+        values.rotation_stats = 1;
+        values.single_rotations = stats.single_rotations;
+        values.double_rotations = stats.double_rotations;
+        values.subtree_rebuilds = stats.subtree_rebuilds;
+    }
+#endif
+
+    for (size_t index = 0; index < EXPORT_LATENCY_BUCKETS; index++)
+    {
+        uint64_t total = atomic_load_explicit(&stats_export->latency_buckets[index], memory_order_relaxed);
+        bucket_list[index] = total - stats_export->published_buckets[index];
+        stats_export->published_buckets[index] = total;
+        values.latency_samples += bucket_list[index];
+        if (bucket_list[index] != 0)
+        {
+            values.latency_max_ns = get_export_bucket_value(index);
+        }
+    }
+    if (values.latency_samples > 0)
+    {
+        values.latency_p50_ns = get_export_percentile(bucket_list, values.latency_samples, 50.0);
+        values.latency_p90_ns = get_export_percentile(bucket_list, values.latency_samples, 90.0);
+        values.latency_p99_ns = get_export_percentile(bucket_list, values.latency_samples, 99.0);
+        values.latency_p999_ns = get_export_percentile(bucket_list, values.latency_samples, 99.9);
+    }
+
+    values.publish_ns = stopwatch_now_ns();
+    (void)stat_page_publish(stats_export->stat_page, &values);
+}
+
+// 0 waits until signalled
+static size_t get_gc_wait_ms(BINARY_TREE_INFO* tree_info)
+{
+    size_t result = tree_info->gc_interval_ms;
+    if (atomic_load(&tree_info->exporting) && (result == 0 || result > STATS_EXPORT_INTERVAL_MS))
+    {
+        result = STATS_EXPORT_INTERVAL_MS;
+    }
+    return result;
+}
+
+static int is_gc_thread_needed(BINARY_TREE_INFO* tree_info)
+{
+    return tree_info->gc_interval_ms != 0 || tree_info->background_compaction || atomic_load(&tree_info->exporting);
+}
+
+// Runs the periodic mvcc gc, any compaction a writer handed off and the
+// stats export
+static void* gc_worker(void* parameter)
+{
+    BINARY_TREE_INFO* tree_info = (BINARY_TREE_INFO*)parameter;
+    TREE_ENTER(tree_info);
+    (void)pthread_mutex_lock(&tree_info->gc_lock);
+    tree_info->last_gc_ns = stopwatch_now_ns();
+    while (tree_info->gc_running)
+    {
+        int timed_out = 0;
+        size_t wait_ms = get_gc_wait_ms(tree_info);
+        if (tree_info->compact_requested)
+        {
+            // Handle it without waiting
+        }
+        else if (wait_ms == 0)
+        {
+            (void)pthread_cond_wait(&tree_info->gc_cond, &tree_info->gc_lock);
+        }
+        else
+        {
+            struct timespec wake_time;
+            (void)clock_gettime(CLOCK_REALTIME, &wake_time);
+            wake_time.tv_sec += (time_t)(wait_ms / 1000);
+            wake_time.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+            if (wake_time.tv_nsec >= 1000000000L)
+            {
+                wake_time.tv_sec++;
+                wake_time.tv_nsec -= 1000000000L;
+            }
+            timed_out = pthread_cond_timedwait(&tree_info->gc_cond, &tree_info->gc_lock, &wake_time) == ETIMEDOUT;
+        }
+
+        if (!tree_info->gc_running)
+        {
+            // Shutting down
+        }
+        else if (tree_info->compact_requested)
+        {
+            tree_info->compact_requested = 0;
+            (void)pthread_mutex_unlock(&tree_info->gc_lock);
+            (void)pthread_rwlock_wrlock(&tree_info->tree_lock);
+            if (needs_compaction(tree_info))
+            {
+                compact_tree(tree_info);
+            }
+            (void)pthread_rwlock_unlock(&tree_info->tree_lock);
+            (void)pthread_mutex_lock(&tree_info->gc_lock);
+        }
+        else if (timed_out)
+        {
+            uint64_t now_ns = stopwatch_now_ns();
+            int collect = tree_info->mvcc && tree_info->gc_interval_ms != 0 && now_ns - tree_info->last_gc_ns >= (uint64_t)tree_info->gc_interval_ms * 1000000;
+            (void)pthread_mutex_unlock(&tree_info->gc_lock);
+            if (collect)
+            {
+                tree_info->last_gc_ns = now_ns;
+                mvcc_collect_garbage(tree_info);
+            }
+            if (atomic_load(&tree_info->exporting))
+            {
+                publish_stats(tree_info);
+            }
+            (void)pthread_mutex_lock(&tree_info->gc_lock);
+        }
+    }
+    (void)pthread_mutex_unlock(&tree_info->gc_lock);
+    TREE_LEAVE();
+    return NULL;
+}
+
+static int start_gc_thread(BINARY_TREE_INFO* tree_info)
+{
+    int result;
+    if (tree_info->gc_running)
+    {
+        // Picks up the new settings on its next wake up
+        (void)pthread_mutex_lock(&tree_info->gc_lock);
+        (void)pthread_cond_signal(&tree_info->gc_cond);
+        (void)pthread_mutex_unlock(&tree_info->gc_lock);
+        result = 0;
+    }
+    else
+    {
+        tree_info->gc_running = 1;
+        if (pthread_create(&tree_info->gc_thread, NULL, gc_worker, tree_info) != 0)
+        {
+            LogError("FAILURE: starting gc thread");
+            tree_info->gc_running = 0;
+            result = __LINE__;
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static void stop_gc_thread(BINARY_TREE_INFO* tree_info)
+{
+    if (tree_info->gc_running)
+    {
+        (void)pthread_mutex_lock(&tree_info->gc_lock);
+        tree_info->gc_running = 0;
+        (void)pthread_cond_signal(&tree_info->gc_cond);
+        (void)pthread_mutex_unlock(&tree_info->gc_lock);
+        (void)pthread_join(tree_info->gc_thread, NULL);
+    }
+}
+
+// Takes over the reference to memory, it is released if the allocation fails
+static BINARY_TREE_INFO* allocate_tree_info(MEMORY_TRACKER_HANDLE memory)
+{
+    BINARY_TREE_INFO* result;
+    if (memory == NULL)
+    {
+        LogError("FAILURE: unable to allocate tree memory tracker");
+        result = NULL;
+    }
+    else if ((result = (BINARY_TREE_INFO*)memory_tracker_malloc(memory, TREE_MEMORY_BOOKKEEPING, sizeof(BINARY_TREE_INFO))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate Binary tree info");
+        memory_tracker_destroy(memory);
+    }
+    else
+    {
+        memset(result, 0, sizeof(BINARY_TREE_INFO));
+        result->memory = memory;
+        (void)pthread_mutex_init(&result->write_lock, NULL);
+        (void)pthread_mutex_init(&result->version_lock, NULL);
+        (void)pthread_rwlock_init(&result->tree_lock, NULL);
+        (void)pthread_mutex_init(&result->reader_lock, NULL);
+        (void)pthread_mutex_init(&result->gc_lock, NULL);
+        (void)pthread_mutex_init(&result->ttl_lock, NULL);
+        (void)pthread_cond_init(&result->gc_cond, NULL);
+        atomic_init(&result->commit_clock, 0);
+        atomic_init(&result->trace_writer, NULL);
+        atomic_init(&result->log, NULL);
+        atomic_init(&result->ttl_wheel, NULL);
+        result->compaction_ratio = DEFAULT_COMPACTION_RATIO;
+#ifdef ENABLE_TREE_STATS
+        if ((result->stats_slots = (TREE_STATS_SLOT*)memory_tracker_aligned_alloc(memory, TREE_MEMORY_BOOKKEEPING, _Alignof(TREE_STATS_SLOT), TREE_STATS_SLOTS * sizeof(TREE_STATS_SLOT))) == NULL)
+        {
+            // The tree still works, it just isn't counted
+            LogError("FAILURE: unable to allocate tree stats");
+        }
+        else
+        {
+            memset(result->stats_slots, 0, TREE_STATS_SLOTS * sizeof(TREE_STATS_SLOT));
+        }
+#endif
+    }
+    return result;
+}
+
+// Walks a tree in key order for binary_tree_for_each, string keys are put
+// back together in key_buffer.  Every parallel worker has its own
+typedef struct ENTRY_VISIT_TAG
+{
+    tree_entry_visitor_callback visitor;
+    void* context;
+    BINARY_TREE_KEY_MODE key_mode;
+    unsigned char* key_buffer;
+    size_t key_buffer_size;
+    int result;
+} ENTRY_VISIT;
+
+static int reserve_key_buffer(ENTRY_VISIT* visit, size_t size)
+{
+    int result = 0;
+    if (size > visit->key_buffer_size)
+    {
+        unsigned char* key_buffer = (unsigned char*)tree_realloc(TREE_MEMORY_SCRATCH, visit->key_buffer, visit->key_buffer_size, size);
+        if (key_buffer == NULL)
+        {
+            LogError("Failure allocating %zu byte key buffer", size);
+            result = __LINE__;
+        }
+        else
+        {
+            visit->key_buffer = key_buffer;
+            visit->key_buffer_size = size;
+        }
+    }
+    return result;
+}
+
+static void visit_entry(const NODE_INFO* node_info, ENTRY_VISIT* visit)
+{
+    if (node_info->tombstone || visit->result != 0)
+    {
+        // Removed
+    }
+    else if (visit->key_mode != BINARY_TREE_KEY_STRING)
+    {
+        visit->visitor(&node_info->key, sizeof(node_info->key), node_info->data, visit->context);
+    }
+    else if ((visit->result = reserve_key_buffer(visit, node_info->key_length)) == 0)
+    {
+        copy_node_key(node_info, visit->key_buffer);
+        visit->visitor(visit->key_buffer, node_info->key_length, node_info->data, visit->context);
+    }
+}
+
+static void visit_entries(const NODE_INFO* node_info, ENTRY_VISIT* visit)
+{
+    while (node_info != NULL && visit->result == 0)
+    {
+        visit_entries(node_info->left, visit);
+        visit_entry(node_info, visit);
+        node_info = node_info->right;
+    }
+}
+
+static void visit_paged_entry(uint64_t key, uint64_t value, void* context)
+{
+    ENTRY_VISIT* visit = (ENTRY_VISIT*)context;
+    visit->visitor(&key, sizeof(key), (void*)(uintptr_t)value, visit->context);
+}
+
+// Chase-Lev work stealing deque.  The owning worker pushes and pops at
+// the bottom, any other worker steals from the top.
+typedef struct WORK_DEQUE_TAG
+{
+    atomic_size_t top;
+    atomic_size_t bottom;
+    _Atomic(const NODE_INFO*) tasks[PARALLEL_DEQUE_SIZE];
+} WORK_DEQUE;
+
+typedef struct PARALLEL_POOL_TAG
+{
+    BINARY_TREE_INFO* tree_info;
+    tree_entry_visitor_callback visitor;
+    void* context;
+    // The first failure any worker ran into
+    atomic_int result;
+    size_t worker_count;
+    // Number of subtrees pushed but not yet fully visited
+    atomic_size_t pending_tasks;
+    WORK_DEQUE* deque_list;
+} PARALLEL_POOL;
+
+typedef struct PARALLEL_WORKER_TAG
+{
+    PARALLEL_POOL* pool;
+    size_t index;
+} PARALLEL_WORKER;
+
+static int deque_push(WORK_DEQUE* deque, const NODE_INFO* node_info)
+{
+    int result;
+    size_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    size_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= PARALLEL_DEQUE_SIZE)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        atomic_store_explicit(&deque->tasks[bottom % PARALLEL_DEQUE_SIZE], node_info, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        result = 0;
+    }
+    return result;
+}
+
+static const NODE_INFO* deque_pop(WORK_DEQUE* deque)
+{
+    const NODE_INFO* result;
+    size_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    size_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (bottom == top)
+    {
+        result = NULL;
+    }
+    else
+    {
+        bottom--;
+        atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+        if (top <= bottom)
+        {
+            result = atomic_load_explicit(&deque->tasks[bottom % PARALLEL_DEQUE_SIZE], memory_order_relaxed);
+            if (top == bottom)
+            {
+                // Last item, race any thief for it
+                if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+                {
+                    result = NULL;
+                }
+                atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+            }
+        }
+        else
+        {
+            result = NULL;
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    }
+    return result;
+}
+
+static const NODE_INFO* deque_steal(WORK_DEQUE* deque)
+{
+    const NODE_INFO* result = NULL;
+    size_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top < bottom)
+    {
+        result = atomic_load_explicit(&deque->tasks[top % PARALLEL_DEQUE_SIZE], memory_order_relaxed);
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        {
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+static void process_subtree(PARALLEL_POOL* pool, WORK_DEQUE* deque, ENTRY_VISIT* visit, const NODE_INFO* node_info)
+{
+    while (node_info != NULL)
+    {
+        if (node_info->height <= PARALLEL_SERIAL_CUTOFF_HEIGHT)
+        {
+            visit_entries(node_info, visit);
+            break;
+        }
+        visit_entry(node_info, visit);
+        if (node_info->right != NULL)
+        {
+            // Count the task before it becomes visible so pending never reaches
+            // zero while there is still work sitting in a deque
+            atomic_fetch_add(&pool->pending_tasks, 1);
+            if (deque_push(deque, node_info->right) != 0)
+            {
+                atomic_fetch_sub(&pool->pending_tasks, 1);
+                visit_entries(node_info->right, visit);
+            }
+        }
+        node_info = node_info->left;
+    }
+}
+
+static void* parallel_worker(void* parameter)
+{
+    PARALLEL_WORKER* worker = (PARALLEL_WORKER*)parameter;
+    PARALLEL_POOL* pool = worker->pool;
+    WORK_DEQUE* own_deque = &pool->deque_list[worker->index];
+    size_t victim = worker->index;
+    ENTRY_VISIT visit = { pool->visitor, pool->context, pool->tree_info->key_mode, NULL, 0, 0 };
+    TREE_ENTER(pool->tree_info);
+
+    while (atomic_load(&pool->pending_tasks) != 0)
+    {
+        const NODE_INFO* task = deque_pop(own_deque);
+        if (task == NULL)
+        {
+            for (size_t attempt = 1; attempt < pool->worker_count && task == NULL; attempt++)
+            {
+                victim = (victim + 1) % pool->worker_count;
+                if (victim != worker->index)
+                {
+                    task = deque_steal(&pool->deque_list[victim]);
+                }
+            }
+        }
+
+        if (task == NULL)
+        {
+            (void)sched_yield();
+        }
+        else
+        {
+            process_subtree(pool, own_deque, &visit, task);
+            atomic_fetch_sub(&pool->pending_tasks, 1);
+        }
+    }
+
+    if (visit.result != 0)
+    {
+        int no_result = 0;
+        (void)atomic_compare_exchange_strong(&pool->result, &no_result, visit.result);
+    }
+    tree_free(TREE_MEMORY_SCRATCH, visit.key_buffer, visit.key_buffer_size);
+    TREE_LEAVE();
+    return NULL;
+}
+
+static int run_parallel_pool(BINARY_TREE_INFO* tree_info, const NODE_INFO* root_node, tree_entry_visitor_callback visitor, void* context, size_t threads)
+{
+    int result;
+    PARALLEL_POOL pool;
+    pthread_t thread_list[PARALLEL_MAX_THREADS];
+    PARALLEL_WORKER worker_list[PARALLEL_MAX_THREADS];
+
+    pool.tree_info = tree_info;
+    pool.visitor = visitor;
+    pool.context = context;
+    atomic_init(&pool.result, 0);
+    pool.worker_count = threads;
+    if ((pool.deque_list = (WORK_DEQUE*)tree_alloc(TREE_MEMORY_SCRATCH, threads * sizeof(WORK_DEQUE))) == NULL)
+    {
+        LogError("FAILURE: allocating work deques");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t started;
+        for (size_t index = 0; index < threads; index++)
+        {
+            atomic_init(&pool.deque_list[index].top, 0);
+            atomic_init(&pool.deque_list[index].bottom, 0);
+            worker_list[index].pool = &pool;
+            worker_list[index].index = index;
+        }
+        // The calling thread is worker 0 and starts with the whole tree
+        atomic_init(&pool.pending_tasks, 1);
+        (void)deque_push(&pool.deque_list[0], root_node);
+
+        for (started = 1; started < threads; started++)
+        {
+            if (pthread_create(&thread_list[started], NULL, parallel_worker, &worker_list[started]) != 0)
+            {
+                // Carry on with the threads we have, the work still gets done
+                LogError("FAILURE: starting traversal thread %d", (int)started);
+                break;
+            }
+        }
+        (void)parallel_worker(&worker_list[0]);
+        for (size_t index = 1; index < started; index++)
+        {
+            (void)pthread_join(thread_list[index], NULL);
+        }
+        tree_free(TREE_MEMORY_SCRATCH, pool.deque_list, threads * sizeof(WORK_DEQUE));
+        result = atomic_load(&pool.result);
+    }
+    return result;
+}
+
+// binary_tree_diff walks tree a and looks its key ranges up in tree b
+typedef struct TREE_DIFF_TAG
+{
+    NODE_INFO* other_root;
+    BINARY_TREE_KEY_MODE key_mode;
+    tree_diff_callback callback;
+    void* context;
+    int result;
+} TREE_DIFF;
+
+// The key of a node as a TREE_KEY, string keys are put back together in bytes
+typedef struct DIFF_KEY_TAG
+{
+    TREE_KEY key;
+    unsigned char* bytes;
+    size_t size;
+} DIFF_KEY;
+
+static int load_diff_key(const TREE_DIFF* diff, const NODE_INFO* node_info, DIFF_KEY* diff_key)
+{
+    int result;
+    diff_key->bytes = NULL;
+    diff_key->size = 0;
+    if (diff->key_mode != BINARY_TREE_KEY_STRING)
+    {
+        diff_key->key = make_integer_key(node_info->key);
+        result = 0;
+    }
+    else if ((diff_key->bytes = (unsigned char*)tree_alloc(TREE_MEMORY_SCRATCH, node_info->key_length + 1)) == NULL)
+    {
+        LogError("Failure allocating %zu byte diff key", node_info->key_length + 1);
+        result = __LINE__;
+    }
+    else
+    {
+        diff_key->size = node_info->key_length + 1;
+        copy_node_key(node_info, diff_key->bytes);
+        diff_key->key = make_string_key(diff_key->bytes, node_info->key_length);
+        result = 0;
+    }
+    return result;
+}
+
+static void report_diff(TREE_DIFF* diff, BINARY_TREE_DIFF type, const NODE_INFO* node_info, void* data_a, void* data_b)
+{
+    DIFF_KEY diff_key;
+    if ((diff->result = load_diff_key(diff, node_info, &diff_key)) == 0)
+    {
+        if (diff->key_mode == BINARY_TREE_KEY_STRING)
+        {
+            diff->callback(type, diff_key.bytes, diff_key.key.length, data_a, data_b, diff->context);
+        }
+        else
+        {
+            diff->callback(type, &diff_key.key.prefix, sizeof(uint64_t), data_a, data_b, diff->context);
+        }
+        tree_free(TREE_MEMORY_SCRATCH, diff_key.bytes, diff_key.size);
+    }
+}
+
+static int compare_bound(const TREE_KEY* bound, const NODE_INFO* node_info)
+{
+    KEY_SEARCH search = { bound, NULL, 0 };
+    return compare_search_key(&search, node_info);
+}
+
+// Sum of the entry hashes below bound, or up to it when inclusive
+static uint64_t get_hash_below(const NODE_INFO* node_info, const TREE_KEY* bound, int inclusive)
+{
+    uint64_t result = 0;
+    KEY_SEARCH search = { bound, NULL, 0 };
+    while (node_info != NULL)
+    {
+        int compare_value = compare_search_key(&search, node_info);
+        if (compare_value > 0 || (compare_value == 0 && inclusive))
+        {
+            result += get_subtree_hash(node_info->left) + node_info->entry_hash;
+            node_info = node_info->right;
+        }
+        else
+        {
+            node_info = node_info->left;
+        }
+    }
+    return result;
+}
+
+// Of the keys strictly between low and high, NULL leaves that side open
+static uint64_t get_range_hash(const NODE_INFO* root_node, const TREE_KEY* low, const TREE_KEY* high)
+{
+    uint64_t below_high = high == NULL ? get_subtree_hash(root_node) : get_hash_below(root_node, high, 0);
+    return below_high - (low == NULL ? 0 : get_hash_below(root_node, low, 1));
+}
+
+static void diff_other_range(TREE_DIFF* diff, const NODE_INFO* node_info, const TREE_KEY* low, const TREE_KEY* high)
+{
+    if (node_info != NULL && diff->result == 0)
+    {
+        int above_low = low == NULL || compare_bound(low, node_info) < 0;
+        int below_high = high == NULL || compare_bound(high, node_info) > 0;
+        if (above_low)
+        {
+            diff_other_range(diff, node_info->left, low, high);
+        }
+        if (above_low && below_high && diff->result == 0)
+        {
+            report_diff(diff, BINARY_TREE_DIFF_ONLY_IN_B, node_info, NULL, node_info->data);
+        }
+        if (below_high)
+        {
+            diff_other_range(diff, node_info->right, low, high);
+        }
+    }
+}
+
+// node_info holds every key of a between low and high.  Only descends while
+// the subtree hashes differently from the same range of b
+static void diff_subtree(TREE_DIFF* diff, const NODE_INFO* node_info, const TREE_KEY* low, const TREE_KEY* high)
+{
+    DIFF_KEY diff_key;
+    if (diff->result != 0 || get_subtree_hash(node_info) == get_range_hash(diff->other_root, low, high))
+    {
+        // Nothing to report
+    }
+    else if (node_info == NULL)
+    {
+        diff_other_range(diff, diff->other_root, low, high);
+    }
+    else if ((diff->result = load_diff_key(diff, node_info, &diff_key)) == 0)
+    {
+        const NODE_INFO* other_node = find_node(diff->other_root, &diff_key.key);
+        diff_subtree(diff, node_info->left, low, &diff_key.key);
+        if (diff->result != 0)
+        {
+            // Stop here
+        }
+        else if (other_node == NULL)
+        {
+            report_diff(diff, BINARY_TREE_DIFF_ONLY_IN_A, node_info, node_info->data, NULL);
+        }
+        else if (other_node->entry_hash != node_info->entry_hash)
+        {
+            report_diff(diff, BINARY_TREE_DIFF_CHANGED, node_info, node_info->data, other_node->data);
+        }
+        diff_subtree(diff, node_info->right, &diff_key.key, high);
+        tree_free(TREE_MEMORY_SCRATCH, diff_key.bytes, diff_key.size);
+    }
+}
+
+typedef struct IMAGE_WRITER_TAG
+{
+    int fd;
+    int failed;
+    // Of everything after the header
+    uint32_t checksum;
+    size_t used;
+    unsigned char buffer[TREE_IMAGE_WRITE_BUFFER];
+} IMAGE_WRITER;
+
+static void flush_image(IMAGE_WRITER* writer)
+{
+    size_t written = 0;
+    while (!writer->failed && written < writer->used)
+    {
+        ssize_t count = write(writer->fd, writer->buffer + written, writer->used - written);
+        if (count > 0)
+        {
+            written += (size_t)count;
+        }
+        else if (count == 0 || errno != EINTR)
+        {
+            LogError("FAILURE: writing tree image, errno %d", errno);
+            writer->failed = 1;
+        }
+    }
+    writer->used = 0;
+}
+
+static void write_image(IMAGE_WRITER* writer, const void* bytes, size_t size, int checksummed)
+{
+    const unsigned char* position = (const unsigned char*)bytes;
+    if (checksummed)
+    {
+        writer->checksum = checksum_update(writer->checksum, bytes, size);
+    }
+    while (size > 0 && !writer->failed)
+    {
+        size_t count = sizeof(writer->buffer) - writer->used < size ? sizeof(writer->buffer) - writer->used : size;
+        memcpy(writer->buffer + writer->used, position, count);
+        writer->used += count;
+        position += count;
+        size -= count;
+        if (writer->used == sizeof(writer->buffer))
+        {
+            flush_image(writer);
+        }
+    }
+}
+
+static size_t align_image_offset(size_t offset)
+{
+    return (offset + TREE_IMAGE_ALIGNMENT - 1) & ~(size_t)(TREE_IMAGE_ALIGNMENT - 1);
+}
+
+static void write_image_padding(IMAGE_WRITER* writer, size_t size)
+{
+    static const unsigned char padding[TREE_IMAGE_ALIGNMENT] = { 0 };
+    write_image(writer, padding, align_image_offset(size) - size, 1);
+}
+
+static void collect_live_nodes(const NODE_INFO* node_info, const NODE_INFO** node_list, size_t* count)
+{
+    while (node_info != NULL)
+    {
+        collect_live_nodes(node_info->left, node_list, count);
+        if (!node_info->tombstone)
+        {
+            node_list[(*count)++] = node_info;
+        }
+        node_info = node_info->right;
+    }
+}
+
+// Gives count nodes in key order from first on the shape of a perfectly
+// balanced tree and returns the index of its root
+static uint32_t link_image_nodes(TREE_IMAGE_NODE* node_list, size_t first, size_t count)
+{
+    uint32_t result;
+    if (count == 0)
+    {
+        result = TREE_IMAGE_NO_NODE;
+    }
+    else
+    {
+        size_t middle = first + count / 2;
+        node_list[middle].left = link_image_nodes(node_list, first, count / 2);
+        node_list[middle].right = link_image_nodes(node_list, middle + 1, count - count / 2 - 1);
+        result = (uint32_t)middle;
+    }
+    return result;
+}
+
+// Fills in where every key and payload goes and returns the size of the
+// bytes, or SIZE_MAX when an entry is too big for the format
+static size_t layout_image_nodes(const NODE_INFO** node_list, TREE_IMAGE_NODE* image_nodes, size_t count, tree_serialize_callback serializer, void* context, size_t* largest)
+{
+    size_t result = 0;
+    *largest = 0;
+    for (size_t index = 0; index < count && result != SIZE_MAX; index++)
+    {
+        const NODE_INFO* node_info = node_list[index];
+        size_t payload_length = serializer == NULL ? 0 : serializer(node_info->data, NULL, 0, context);
+        if (payload_length > UINT32_MAX || node_info->key_length > UINT32_MAX)
+        {
+            LogError("FAILURE: entry %zu is too big for a tree image", index);
+            result = SIZE_MAX;
+        }
+        else
+        {
+            TREE_IMAGE_NODE* image_node = &image_nodes[index];
+            image_node->key = node_info->key;
+            image_node->key_length = (uint32_t)node_info->key_length;
+            image_node->key_offset = result;
+            image_node->payload_offset = align_image_offset(result + node_info->key_length);
+            image_node->payload_length = (uint32_t)payload_length;
+            result = align_image_offset(image_node->payload_offset + payload_length);
+            *largest = payload_length > *largest ? payload_length : *largest;
+            *largest = node_info->key_length > *largest ? node_info->key_length : *largest;
+        }
+    }
+    return result;
+}
+
+static int write_image_bytes(IMAGE_WRITER* writer, const NODE_INFO** node_list, const TREE_IMAGE_NODE* image_nodes, size_t count, unsigned char* buffer, tree_serialize_callback serializer, void* context)
+{
+    int result = 0;
+    for (size_t index = 0; index < count && result == 0 && !writer->failed; index++)
+    {
+        const NODE_INFO* node_info = node_list[index];
+        const TREE_IMAGE_NODE* image_node = &image_nodes[index];
+        if (image_node->key_length > 0)
+        {
+            copy_node_key(node_info, buffer);
+            write_image(writer, buffer, image_node->key_length, 1);
+            write_image_padding(writer, image_node->key_length);
+        }
+        if (image_node->payload_length > 0)
+        {
+            if (serializer(node_info->data, buffer, image_node->payload_length, context) != image_node->payload_length)
+            {
+                LogError("FAILURE: the serializer changed its mind about the size of entry %zu", index);
+                result = __LINE__;
+            }
+            else
+            {
+                write_image(writer, buffer, image_node->payload_length, 1);
+                write_image_padding(writer, image_node->payload_length);
+            }
+        }
+    }
+    return result;
+}
+
+static int write_tree_image(BINARY_TREE_KEY_MODE key_mode, const NODE_INFO* root_node, int fd, tree_serialize_callback serializer, void* context)
+{
+    int result;
+    size_t capacity = count_nodes(root_node);
+    size_t count = 0;
+    const NODE_INFO** node_list = (const NODE_INFO**)tree_alloc(TREE_MEMORY_SCRATCH, capacity * sizeof(NODE_INFO*));
+    TREE_IMAGE_NODE* image_nodes = (TREE_IMAGE_NODE*)tree_alloc(TREE_MEMORY_SCRATCH, capacity * sizeof(TREE_IMAGE_NODE));
+    IMAGE_WRITER* writer = (IMAGE_WRITER*)tree_alloc(TREE_MEMORY_SCRATCH, sizeof(IMAGE_WRITER));
+    if (writer == NULL || (capacity > 0 && (node_list == NULL || image_nodes == NULL)))
+    {
+        LogError("FAILURE: unable to allocate tree image for %zu nodes", capacity);
+        result = __LINE__;
+    }
+    else if (capacity >= TREE_IMAGE_NO_NODE)
+    {
+        LogError("FAILURE: %zu entries are too many for a tree image", capacity);
+        result = __LINE__;
+    }
+    else
+    {
+        size_t largest;
+        size_t bytes_size;
+        unsigned char* buffer = NULL;
+        collect_live_nodes(root_node, node_list, &count);
+        memset(image_nodes, 0, count * sizeof(TREE_IMAGE_NODE));
+        if ((bytes_size = layout_image_nodes(node_list, image_nodes, count, serializer, context, &largest)) == SIZE_MAX)
+        {
+            result = __LINE__;
+        }
+        else if (largest > 0 && (buffer = (unsigned char*)tree_alloc(TREE_MEMORY_SCRATCH, largest)) == NULL)
+        {
+            LogError("FAILURE: unable to allocate %zu byte entry buffer", largest);
+            result = __LINE__;
+        }
+        else
+        {
+            TREE_IMAGE_HEADER header;
+            TREE_IMAGE_TRAILER trailer;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, TREE_IMAGE_MAGIC, sizeof(TREE_IMAGE_MAGIC));
+            header.version = TREE_IMAGE_VERSION;
+            header.byte_order = TREE_IMAGE_BYTE_ORDER;
+            header.key_mode = (uint32_t)key_mode;
+            header.node_size = sizeof(TREE_IMAGE_NODE);
+            header.node_count = count;
+            header.root_index = link_image_nodes(image_nodes, 0, count);
+            while (((uint64_t)1 << header.height) - 1 < count)
+            {
+                header.height++;
+            }
+            header.bytes_size = bytes_size;
+            header.header_checksum = checksum_update(0, &header, offsetof(TREE_IMAGE_HEADER, header_checksum));
+
+            writer->fd = fd;
+            writer->failed = 0;
+            writer->checksum = 0;
+            writer->used = 0;
+            write_image(writer, &header, sizeof(header), 0);
+            write_image(writer, image_nodes, count * sizeof(TREE_IMAGE_NODE), 1);
+            result = write_image_bytes(writer, node_list, image_nodes, count, buffer, serializer, context);
+            memset(&trailer, 0, sizeof(trailer));
+            trailer.checksum = writer->checksum;
+            write_image(writer, &trailer, sizeof(trailer), 0);
+            flush_image(writer);
+            if (result == 0 && writer->failed)
+            {
+                result = __LINE__;
+            }
+            tree_free(TREE_MEMORY_SCRATCH, buffer, largest);
+        }
+    }
+    tree_free(TREE_MEMORY_SCRATCH, writer, sizeof(IMAGE_WRITER));
+    tree_free(TREE_MEMORY_SCRATCH, image_nodes, capacity * sizeof(TREE_IMAGE_NODE));
+    tree_free(TREE_MEMORY_SCRATCH, node_list, capacity * sizeof(NODE_INFO*));
+    return result;
+}
+
+static const TREE_IMAGE_NODE* get_image_nodes(const TREE_IMAGE_HEADER* image)
+{
+    return (const TREE_IMAGE_NODE*)(image + 1);
+}
+
+static const unsigned char* get_image_bytes(const TREE_IMAGE_HEADER* image)
+{
+    return (const unsigned char*)(get_image_nodes(image) + image->node_count);
+}
+
+static int validate_image_nodes(const TREE_IMAGE_HEADER* image)
+{
+    int result = 0;
+    const TREE_IMAGE_NODE* node_list = get_image_nodes(image);
+    for (uint64_t index = 0; index < image->node_count && result == 0; index++)
+    {
+        const TREE_IMAGE_NODE* image_node = &node_list[index];
+        if (image_node->key_offset > image->bytes_size || image_node->key_length > image->bytes_size - image_node->key_offset ||
+            image_node->payload_offset > image->bytes_size || image_node->payload_length > image->bytes_size - image_node->payload_offset ||
+            (image_node->left != TREE_IMAGE_NO_NODE && image_node->left >= image->node_count) ||
+            (image_node->right != TREE_IMAGE_NO_NODE && image_node->right >= image->node_count) ||
+            (image->key_mode != BINARY_TREE_KEY_STRING && image_node->key_length != 0))
+        {
+            LogError("FAILURE: tree image node %llu is out of bounds", (unsigned long long)index);
+            result = __LINE__;
+        }
+    }
+    return result;
+}
+
+static int validate_tree_image(const unsigned char* mapping, size_t size)
+{
+    int result;
+    const TREE_IMAGE_HEADER* header = (const TREE_IMAGE_HEADER*)mapping;
+    uint64_t body_size = size - sizeof(TREE_IMAGE_HEADER) - sizeof(TREE_IMAGE_TRAILER);
+    if (memcmp(header->magic, TREE_IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->version != TREE_IMAGE_VERSION ||
+        header->byte_order != TREE_IMAGE_BYTE_ORDER || header->node_size != sizeof(TREE_IMAGE_NODE))
+    {
+        LogError("FAILURE: unknown tree image format");
+        result = __LINE__;
+    }
+    else if (header->header_checksum != checksum_update(0, header, offsetof(TREE_IMAGE_HEADER, header_checksum)))
+    {
+        LogError("FAILURE: tree image header checksum mismatch");
+        result = __LINE__;
+    }
+    else if (header->key_mode > BINARY_TREE_KEY_STRING || header->height > TREE_IMAGE_MAX_HEIGHT || header->node_count >= TREE_IMAGE_NO_NODE ||
+        header->node_count * sizeof(TREE_IMAGE_NODE) > body_size || header->bytes_size != body_size - header->node_count * sizeof(TREE_IMAGE_NODE) ||
+        (header->node_count == 0 ? header->root_index != TREE_IMAGE_NO_NODE : header->root_index >= header->node_count))
+    {
+        LogError("FAILURE: tree image is truncated or inconsistent");
+        result = __LINE__;
+    }
+    else if (((const TREE_IMAGE_TRAILER*)(mapping + size - sizeof(TREE_IMAGE_TRAILER)))->checksum != checksum_update(0, header + 1, body_size))
+    {
+        LogError("FAILURE: tree image checksum mismatch");
+        result = __LINE__;
+    }
+    else
+    {
+        result = validate_image_nodes(header);
+    }
+    return result;
+}
+
+static void* find_image_node(const TREE_IMAGE_HEADER* image, const TREE_KEY* key)
+{
+    void* result = NULL;
+    const TREE_IMAGE_NODE* node_list = get_image_nodes(image);
+    const unsigned char* bytes = get_image_bytes(image);
+    uint64_t index = image->root_index;
+    // Bounded by the height so a bad child link can't send it round in circles
+    for (uint64_t depth = 0; index != TREE_IMAGE_NO_NODE && depth < image->height; depth++)
+    {
+        const TREE_IMAGE_NODE* image_node = &node_list[index];
+        TREE_KEY node_key = { image_node->key, bytes + image_node->key_offset, image_node->key_length };
+        int compare_value = compare_keys(key, &node_key);
+        if (compare_value == 0)
+        {
+            result = (void*)(bytes + image_node->payload_offset);
+            break;
+        }
+        index = compare_value < 0 ? image_node->left : image_node->right;
+    }
+    return result;
+}
+
+// Saved nodes are already in key order
+static void visit_image(const TREE_IMAGE_HEADER* image, tree_entry_visitor_callback visitor, void* context)
+{
+    const TREE_IMAGE_NODE* node_list = get_image_nodes(image);
+    const unsigned char* bytes = get_image_bytes(image);
+    for (uint64_t index = 0; index < image->node_count; index++)
+    {
+        const TREE_IMAGE_NODE* image_node = &node_list[index];
+        if (image->key_mode == BINARY_TREE_KEY_STRING)
+        {
+            visitor(bytes + image_node->key_offset, image_node->key_length, (void*)(bytes + image_node->payload_offset), context);
+        }
+        else
+        {
+            visitor(&image_node->key, sizeof(image_node->key), (void*)(bytes + image_node->payload_offset), context);
+        }
+    }
+}
+
+static TREE_LOG* create_tree_log(MEMORY_TRACKER_HANDLE memory, const BINARY_TREE_WAL_CONFIG* config)
+{
+    TREE_LOG* result;
+    if (config->durability < BINARY_TREE_DURABILITY_ASYNC || config->durability > BINARY_TREE_DURABILITY_SYNC)
+    {
+        LogError("FAILURE: unknown durability %d", (int)config->durability);
+        result = NULL;
+    }
+    else if ((result = (TREE_LOG*)memory_tracker_malloc(memory, TREE_MEMORY_BOOKKEEPING, sizeof(TREE_LOG))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate tree log");
+    }
+    else if ((result->writer = wal_writer_create(config->path, (WAL_DURABILITY)config->durability, config->flush_interval_ms)) == NULL)
+    {
+        memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, result, sizeof(TREE_LOG));
+        result = NULL;
+    }
+    else
+    {
+        result->serializer = config->serializer;
+        result->context = config->context;
+    }
+    return result;
+}
+
+static void destroy_tree_log(MEMORY_TRACKER_HANDLE memory, TREE_LOG* log)
+{
+    if (log != NULL)
+    {
+        wal_writer_destroy(log->writer);
+        memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, log, sizeof(TREE_LOG));
+    }
+}
+
+BINARY_TREE_HANDLE binary_tree_create()
+{
+    return allocate_tree_info(memory_tracker_create());
+}
+
+BINARY_TREE_HANDLE binary_tree_create_bounded(const BINARY_TREE_BOUNDS* bounds)
+{
+    BINARY_TREE_INFO* result;
+    if (bounds == NULL || (bounds->max_items == 0 && bounds->max_bytes == 0))
+    {
+        LogError("FAILURE: a bounded tree needs max_items or max_bytes");
+        result = NULL;
+    }
+    else if ((result = allocate_tree_info(memory_tracker_create())) != NULL)
+    {
+        result->bounded = 1;
+        result->bounds = *bounds;
+    }
+    return result;
+}
+
+void binary_tree_destroy(BINARY_TREE_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        MEMORY_TRACKER_HANDLE memory = handle->memory;
+        stop_gc_thread(handle);
+        TREE_ENTER(handle);
+        if (handle->persistent)
+        {
+            // Snapshots hold their own reference
+            release_version(handle->version);
+        }
+        else if (handle->root_node != NULL)
+        {
+            release_tree_versions(handle->root_node);
+            clear_tree(handle->root_node);
+            free_node(handle->root_node);
+        }
+        if (handle->image != NULL)
+        {
+            (void)munmap((void*)handle->image, handle->image_size);
+        }
+        paged_tree_destroy(handle->paged);
+        TIMER_WHEEL* wheel = atomic_load(&handle->ttl_wheel);
+        if (wheel != NULL)
+        {
+            TIMER_WHEEL_ENTRY* entry = timer_wheel_remove_all(wheel);
+            while (entry != NULL)
+            {
+                TIMER_WHEEL_ENTRY* next_entry = entry->next;
+                free_tree_timer(get_tree_timer(entry));
+                entry = next_entry;
+            }
+            memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, wheel, sizeof(TIMER_WHEEL));
+        }
+        TREE_LEAVE();
+        (void)pthread_mutex_destroy(&handle->write_lock);
+        (void)pthread_mutex_destroy(&handle->version_lock);
+        (void)pthread_rwlock_destroy(&handle->tree_lock);
+        (void)pthread_mutex_destroy(&handle->reader_lock);
+        (void)pthread_mutex_destroy(&handle->gc_lock);
+        (void)pthread_mutex_destroy(&handle->ttl_lock);
+        (void)pthread_cond_destroy(&handle->gc_cond);
+        if (handle->stats_export != NULL)
+        {
+            stat_page_destroy(handle->stats_export->stat_page);
+            memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, handle->stats_export, sizeof(STATS_EXPORT));
+        }
+        op_trace_writer_destroy(atomic_load(&handle->trace_writer));
+        for (size_t index = 0; index < handle->retired_trace_count; index++)
+        {
+            op_trace_writer_destroy(handle->retired_traces[index]);
+        }
+        memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, handle->retired_traces, handle->retired_trace_count * sizeof(OP_TRACE_WRITER_HANDLE));
+        destroy_tree_log(memory, atomic_load(&handle->log));
+        for (size_t index = 0; index < handle->retired_log_count; index++)
+        {
+            destroy_tree_log(memory, handle->retired_logs[index]);
+        }
+        memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, handle->retired_logs, handle->retired_log_count * sizeof(TREE_LOG*));
+        memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, handle->active_readers, handle->active_reader_capacity * sizeof(uint64_t));
+        memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, handle->clock_hand_bytes, handle->clock_hand_size);
+#ifdef ENABLE_TREE_STATS
+        memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, handle->stats_slots, TREE_STATS_SLOTS * sizeof(TREE_STATS_SLOT));
+#endif
+        memory_tracker_free(memory, TREE_MEMORY_BOOKKEEPING, handle, sizeof(BINARY_TREE_INFO));
+        memory_tracker_destroy(memory);
+    }
+}
+
+// Nodes of removed mvcc keys and lazy delete tombstones count, they still hold keys
+static int is_tree_empty(const BINARY_TREE_INFO* tree_info)
+{
+    return tree_info->root_node == NULL && (!tree_info->persistent || tree_info->version->root_node == NULL);
+}
+
+int binary_tree_set_option(BINARY_TREE_HANDLE handle, const char* option_name, const void* value)
+{
+    int result;
+    if (handle == NULL || option_name == NULL || value == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on set option");
+        result = __LINE__;
+    }
+    else if (handle->paged != NULL)
+    {
+        LogError("FAILURE: options can't be changed on a paged tree");
+        result = __LINE__;
+    }
+    else if (handle->bounded && (strcmp(option_name, OPTION_PERSISTENT_MODE) == 0 || strcmp(option_name, OPTION_MVCC_MODE) == 0 || strcmp(option_name, OPTION_LAZY_DELETE) == 0 || strcmp(option_name, OPTION_WAL) == 0))
+    {
+        // Evictions happen inside the tree, none of these would see them
+        LogError("FAILURE: %s is not available on a bounded tree", option_name);
+        result = __LINE__;
+    }
+    else if (strcmp(option_name, OPTION_PERSISTENT_MODE) == 0)
+    {
+        int enable = *(const int*)value != 0;
+        if (handle->read_only || handle->items > 0 || handle->persistent || handle->mvcc || handle->lazy_delete || handle->prefix_compression)
+        {
+            LogError("FAILURE: persistent mode can only be changed on an empty tree");
+            result = enable == handle->persistent ? 0 : __LINE__;
+        }
+        else if (!enable)
+        {
+            result = 0;
+        }
+        else if ((handle->version = (TREE_VERSION*)memory_tracker_malloc(handle->memory, TREE_MEMORY_VERSIONS, sizeof(TREE_VERSION))) == NULL)
+        {
+            LogError("FAILURE: allocating tree version");
+            result = __LINE__;
+        }
+        else
+        {
+            handle->version->root_node = NULL;
+            handle->version->items = 0;
+            atomic_init(&handle->version->ref_count, 1);
+            handle->persistent = 1;
+            result = 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_MVCC_MODE) == 0)
+    {
+        int enable = *(const int*)value != 0;
+        if (handle->read_only || handle->items > 0 || handle->persistent || handle->mvcc || handle->lazy_delete || handle->merkle_hash || atomic_load(&handle->ttl_wheel) != NULL)
+        {
+            LogError("FAILURE: mvcc mode can only be changed on an empty tree");
+            result = enable == handle->mvcc ? 0 : __LINE__;
+        }
+        else
+        {
+            handle->mvcc = enable;
+            result = 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_MVCC_GC_INTERVAL_MS) == 0)
+    {
+        size_t interval_ms = *(const size_t*)value;
+        if (!handle->mvcc)
+        {
+            LogError("FAILURE: gc interval requires mvcc mode");
+            result = __LINE__;
+        }
+        else
+        {
+            (void)pthread_mutex_lock(&handle->gc_lock);
+            handle->gc_interval_ms = interval_ms;
+            (void)pthread_mutex_unlock(&handle->gc_lock);
+            if (!is_gc_thread_needed(handle))
+            {
+                stop_gc_thread(handle);
+                result = 0;
+            }
+            else
+            {
+                result = start_gc_thread(handle);
+            }
+        }
+    }
+    else if (strcmp(option_name, OPTION_LAZY_DELETE) == 0)
+    {
+        int enable = *(const int*)value != 0;
+        if (handle->read_only || handle->persistent || handle->mvcc || handle->merkle_hash || atomic_load(&handle->ttl_wheel) != NULL)
+        {
+            LogError("FAILURE: lazy delete is not supported with persistent or mvcc mode, merkle hashes or expiring entries");
+            result = __LINE__;
+        }
+        else
+        {
+            (void)pthread_rwlock_wrlock(&handle->tree_lock);
+            if (!enable)
+            {
+                // Nothing may stay tombstoned once removes are immediate again
+                TREE_ENTER(handle);
+                compact_tree(handle);
+                TREE_LEAVE();
+            }
+            handle->lazy_delete = enable;
+            (void)pthread_rwlock_unlock(&handle->tree_lock);
+            result = 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_COMPACTION_RATIO) == 0)
+    {
+        size_t compaction_ratio = *(const size_t*)value;
+        if (compaction_ratio > 100)
+        {
+            LogError("FAILURE: compaction ratio is a percentage");
+            result = __LINE__;
+        }
+        else
+        {
+            (void)pthread_rwlock_wrlock(&handle->tree_lock);
+            handle->compaction_ratio = compaction_ratio;
+            (void)pthread_rwlock_unlock(&handle->tree_lock);
+            result = 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_BACKGROUND_COMPACTION) == 0)
+    {
+        int enable = *(const int*)value != 0;
+        (void)pthread_rwlock_wrlock(&handle->tree_lock);
+        handle->background_compaction = enable;
+        (void)pthread_rwlock_unlock(&handle->tree_lock);
+        if (enable)
+        {
+            result = start_gc_thread(handle);
+        }
+        else
+        {
+            if (!is_gc_thread_needed(handle))
+            {
+                stop_gc_thread(handle);
+            }
+            result = 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_STATS_EXPORT) == 0)
+    {
+        const char* page_name = (const char*)value;
+        STAT_PAGE_HANDLE stat_page = NULL;
+        if (handle->read_only)
+        {
+            LogError("FAILURE: snapshots can't export stats");
+            result = __LINE__;
+        }
+        else if (handle->stats_export == NULL && (handle->stats_export = create_stats_export(handle)) == NULL)
+        {
+            result = __LINE__;
+        }
+        else if (page_name[0] != '\0' && (stat_page = stat_page_create(page_name)) == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            // The page only changes hands while the gc thread is stopped
+            stop_gc_thread(handle);
+            stat_page_destroy(handle->stats_export->stat_page);
+            handle->stats_export->stat_page = stat_page;
+            atomic_store_explicit(&handle->exporting, stat_page != NULL, memory_order_release);
+            result = is_gc_thread_needed(handle) ? start_gc_thread(handle) : 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_KEY_MODE) == 0)
+    {
+        int key_mode = *(const int*)value;
+        if (key_mode < BINARY_TREE_KEY_BYTE || key_mode > BINARY_TREE_KEY_STRING)
+        {
+            LogError("FAILURE: unknown key mode %d", key_mode);
+            result = __LINE__;
+        }
+        else if (handle->read_only || !is_tree_empty(handle))
+        {
+            LogError("FAILURE: key mode can only be changed on an empty tree");
+            result = key_mode == (int)handle->key_mode ? 0 : __LINE__;
+        }
+        else if (atomic_load(&handle->trace_writer) != NULL && key_mode != (int)handle->key_mode)
+        {
+            // The trace header already names the mode its keys are in
+            LogError("FAILURE: key mode can't be changed while the tree is traced");
+            result = __LINE__;
+        }
+        else
+        {
+            handle->key_mode = (BINARY_TREE_KEY_MODE)key_mode;
+            handle->prefix_compression = handle->prefix_compression && key_mode == BINARY_TREE_KEY_STRING;
+            result = 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_PREFIX_COMPRESSION) == 0)
+    {
+        int enable = *(const int*)value != 0;
+        if (handle->read_only || handle->persistent || handle->key_mode != BINARY_TREE_KEY_STRING || !is_tree_empty(handle))
+        {
+            LogError("FAILURE: prefix compression needs an empty string tree that isn't persistent");
+            result = enable == handle->prefix_compression ? 0 : __LINE__;
+        }
+        else
+        {
+            handle->prefix_compression = enable;
+            result = 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_TRACE_FILE) == 0)
+    {
+        const char* trace_path = (const char*)value;
+        OP_TRACE_WRITER_HANDLE trace_writer = NULL;
+        OP_TRACE_WRITER_HANDLE* retired_traces = NULL;
+        if (handle->read_only)
+        {
+            LogError("FAILURE: snapshots can't be traced");
+            result = __LINE__;
+        }
+        else if (trace_path[0] != '\0' && (trace_writer = op_trace_writer_create(trace_path, (uint32_t)handle->key_mode)) == NULL)
+        {
+            result = __LINE__;
+        }
+        // Room for the recorder being replaced is made up front so that
+        // swapping it can't fail
+        else if (atomic_load(&handle->trace_writer) != NULL &&
+            (retired_traces = (OP_TRACE_WRITER_HANDLE*)memory_tracker_realloc(handle->memory, TREE_MEMORY_BOOKKEEPING, handle->retired_traces,
+                handle->retired_trace_count * sizeof(OP_TRACE_WRITER_HANDLE), (handle->retired_trace_count + 1) * sizeof(OP_TRACE_WRITER_HANDLE))) == NULL)
+        {
+            LogError("FAILURE: unable to retire the current trace");
+            op_trace_writer_destroy(trace_writer);
+            result = __LINE__;
+        }
+        else
+        {
+            OP_TRACE_WRITER_HANDLE old_writer = atomic_exchange(&handle->trace_writer, trace_writer);
+            handle->retired_traces = retired_traces != NULL ? retired_traces : handle->retired_traces;
+            result = 0;
+            if (old_writer != NULL)
+            {
+                handle->retired_traces[handle->retired_trace_count++] = old_writer;
+                result = op_trace_writer_close(old_writer);
+            }
+        }
+    }
+    else if (strcmp(option_name, OPTION_MERKLE_HASH) == 0)
+    {
+        const BINARY_TREE_HASH_CONFIG* config = (const BINARY_TREE_HASH_CONFIG*)value;
+        if (handle->read_only || handle->mvcc || handle->lazy_delete || !is_tree_empty(handle))
+        {
+            LogError("FAILURE: merkle hashes need an empty tree without mvcc mode or lazy delete");
+            result = __LINE__;
+        }
+        else
+        {
+            handle->merkle_hash = 1;
+            handle->data_hash = config->data_hash;
+            handle->data_hash_context = config->context;
+            result = 0;
+        }
+    }
+    else if (strcmp(option_name, OPTION_WAL) == 0)
+    {
+        const BINARY_TREE_WAL_CONFIG* config = (const BINARY_TREE_WAL_CONFIG*)value;
+        TREE_LOG* log = NULL;
+        TREE_LOG** retired_logs = NULL;
+        if (handle->read_only)
+        {
+            LogError("FAILURE: snapshots and mapped trees can't be logged");
+            result = __LINE__;
+        }
+        else if (config->path != NULL && config->path[0] != '\0' && (log = create_tree_log(handle->memory, config)) == NULL)
+        {
+            result = __LINE__;
+        }
+        // Same as the trace, the log being replaced may still be in use
+        else if (atomic_load(&handle->log) != NULL &&
+            (retired_logs = (TREE_LOG**)memory_tracker_realloc(handle->memory, TREE_MEMORY_BOOKKEEPING, handle->retired_logs,
+                handle->retired_log_count * sizeof(TREE_LOG*), (handle->retired_log_count + 1) * sizeof(TREE_LOG*))) == NULL)
+        {
+            LogError("FAILURE: unable to retire the current log");
+            destroy_tree_log(handle->memory, log);
+            result = __LINE__;
+        }
+        else
+        {
+            TREE_LOG* old_log = atomic_exchange(&handle->log, log);
+            handle->retired_logs = retired_logs != NULL ? retired_logs : handle->retired_logs;
+            result = 0;
+            if (old_log != NULL)
+            {
+                handle->retired_logs[handle->retired_log_count++] = old_log;
+                result = wal_writer_close(old_log->writer);
+            }
+        }
+    }
+    else
+    {
+        LogError("FAILURE: unknown option %s", option_name);
+        result = __LINE__;
+    }
+    return result;
+}
+
+BINARY_TREE_HANDLE binary_tree_snapshot(BINARY_TREE_HANDLE handle)
+{
+    BINARY_TREE_INFO* result;
+    if (handle == NULL || !handle->persistent)
+    {
+        LogError("FAILURE: snapshots require a persistent tree");
+        result = NULL;
+    }
+    else if ((result = allocate_tree_info(memory_tracker_add_ref(handle->memory))) != NULL)
+    {
+        // A snapshot of a snapshot just shares the same version
+        result->version = handle->read_only ? handle->version : pin_version(handle);
+        if (handle->read_only)
+        {
+            atomic_fetch_add(&result->version->ref_count, 1);
+        }
+        result->persistent = 1;
+        result->read_only = 1;
+        result->key_mode = handle->key_mode;
+        result->merkle_hash = handle->merkle_hash;
+        result->data_hash = handle->data_hash;
+        result->data_hash_context = handle->data_hash_context;
+        result->root_node = result->version->root_node;
+        result->items = result->version->items;
+    }
+    return result;
+}
+
+// Byte keys are small integers, so integer trees take them too
+static int accepts_key_mode(const BINARY_TREE_INFO* tree_info, BINARY_TREE_KEY_MODE key_mode)
+{
+    return tree_info->key_mode == key_mode || (key_mode == BINARY_TREE_KEY_BYTE && tree_info->key_mode == BINARY_TREE_KEY_UINT64);
+}
+
+static TIMER_WHEEL* get_ttl_wheel(BINARY_TREE_INFO* tree_info)
+{
+    TIMER_WHEEL* result = atomic_load_explicit(&tree_info->ttl_wheel, memory_order_acquire);
+    if (result != NULL)
+    {
+        // Already there
+    }
+    else if ((result = (TIMER_WHEEL*)memory_tracker_malloc(tree_info->memory, TREE_MEMORY_BOOKKEEPING, sizeof(TIMER_WHEEL))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate the expiry wheel");
+    }
+    else
+    {
+        TIMER_WHEEL* expected = NULL;
+        timer_wheel_init(result, stopwatch_now_ns() / TTL_TICK_NS);
+        if (!atomic_compare_exchange_strong_explicit(&tree_info->ttl_wheel, &expected, result, memory_order_acq_rel, memory_order_acquire))
+        {
+            // Another insert got there first
+            memory_tracker_free(tree_info->memory, TREE_MEMORY_BOOKKEEPING, result, sizeof(TIMER_WHEEL));
+            result = expected;
+        }
+    }
+    return result;
+}
+
+// ttl_ms is NULL for entries that never expire
+static int insert_key(BINARY_TREE_INFO* handle, BINARY_TREE_KEY_MODE key_mode, const TREE_KEY* key, void* data, const uint64_t* ttl_ms)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on insert");
+        result = __LINE__;
+    }
+    else if (handle->read_only)
+    {
+        LogError("FAILURE: Cannot insert into a snapshot");
+        result = __LINE__;
+    }
+    else if (!accepts_key_mode(handle, key_mode))
+    {
+        LogError("FAILURE: The tree holds another kind of key");
+        result = __LINE__;
+    }
+    else if (ttl_ms != NULL && (handle->paged != NULL || handle->mvcc || handle->lazy_delete))
+    {
+        LogError("FAILURE: entries can't expire in a paged tree or in mvcc or lazy delete mode");
+        result = __LINE__;
+    }
+    else if (handle->paged != NULL)
+    {
+        result = paged_tree_insert(handle->paged, key->prefix, (uint64_t)(uintptr_t)data);
+    }
+    else
+    {
+        TXN_OPERATION operation = { TXN_OPERATION_INSERT, *key, data, NULL, NULL, NULL, NULL };
+        uint64_t start_ns = operation_begin(handle);
+        TREE_ENTER(handle);
+        if ((operation.new_node = create_new_node(key, data)) == NULL)
+        {
+            LogError("FAILURE: Creating new node on insert");
+            result = __LINE__;
+        }
+        else if (ttl_ms != NULL && get_ttl_wheel(handle) == NULL)
+        {
+            result = __LINE__;
+        }
+        else if (ttl_ms != NULL && (operation.timer = create_tree_timer(key, (stopwatch_now_ns() + TTL_TICK_NS - 1) / TTL_TICK_NS + *ttl_ms)) == NULL)
+        {
+            LogError("FAILURE: Creating entry timer on insert");
+            result = __LINE__;
+        }
+        else if ((result = apply_operations(handle, &operation, 1)) != 0)
+        {
+            LogError("FAILURE: Inserting new node");
+        }
+        release_operations(&operation, 1);
+        TREE_LEAVE();
+        operation_end(handle, EXPORT_COUNTER_INSERTS, key, result, start_ns);
+    }
+    return result;
+}
+
+static int remove_key(BINARY_TREE_INFO* handle, BINARY_TREE_KEY_MODE key_mode, const TREE_KEY* key, tree_remove_callback remove_callback)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on remove");
+        result = __LINE__;
+    }
+    else if (handle->read_only)
+    {
+        LogError("FAILURE: Cannot remove from a snapshot");
+        result = __LINE__;
+    }
+    else if (!accepts_key_mode(handle, key_mode))
+    {
+        LogError("FAILURE: The tree holds another kind of key");
+        result = __LINE__;
+    }
+    else if (handle->paged != NULL)
+    {
+        uint64_t value;
+        if ((result = paged_tree_remove(handle->paged, key->prefix, &value)) == 0 && remove_callback != NULL)
+        {
+            remove_callback((void*)(uintptr_t)value);
+        }
+    }
+    else
+    {
+        TXN_OPERATION operation = { TXN_OPERATION_REMOVE, *key, NULL, remove_callback, NULL, NULL, NULL };
+        uint64_t start_ns = operation_begin(handle);
+        TREE_ENTER(handle);
+        result = apply_operations(handle, &operation, 1);
+        release_operations(&operation, 1);
+        TREE_LEAVE();
+        operation_end(handle, EXPORT_COUNTER_REMOVES, key, result, start_ns);
+    }
+    return result;
+}
+
+static void* find_key(BINARY_TREE_INFO* handle, BINARY_TREE_KEY_MODE key_mode, const TREE_KEY* key)
+{
+    void* result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on find");
+        result = NULL;
+    }
+    else if (!accepts_key_mode(handle, key_mode))
+    {
+        LogError("FAILURE: The tree holds another kind of key");
+        result = NULL;
+    }
+    else if (handle->image != NULL)
+    {
+        uint64_t start_ns = operation_begin(handle);
+        result = find_image_node(handle->image, key);
+        operation_end(handle, EXPORT_COUNTER_FINDS, key, result == NULL, start_ns);
+    }
+    else if (handle->paged != NULL)
+    {
+        uint64_t value;
+        result = paged_tree_find(handle->paged, key->prefix, &value) == 0 ? (void*)(uintptr_t)value : NULL;
+    }
+    else
+    {
+        TREE_VERSION* pinned_version;
+        uint64_t start_ns = operation_begin(handle);
+        TREE_ENTER(handle);
+        lock_tree_for_read(handle);
+        const NODE_INFO* node_info = find_node((NODE_INFO*)pin_root(handle, &pinned_version), key);
+        STATS_ADD(TREE_STAT_FINDS, 1);
+        if (node_info == NULL || node_info->tombstone)
+        {
+            LogDebug("Item Not found");
+            STATS_ADD(TREE_STAT_FIND_MISSES, 1);
+            result = NULL;
+        }
+        else
+        {
+            STATS_ADD(TREE_STAT_FIND_HITS, 1);
+            result = node_info->data;
+            // Only written when it changes, finds of a hot entry on other
+            // threads then keep sharing its cache line
+            if (handle->bounded && !atomic_load_explicit(&node_info->referenced, memory_order_relaxed))
+            {
+                atomic_store_explicit(&((NODE_INFO*)node_info)->referenced, 1, memory_order_relaxed);
+            }
+        }
+        release_version(pinned_version);
+        unlock_tree(handle);
+        TREE_LEAVE();
+        operation_end(handle, EXPORT_COUNTER_FINDS, key, result == NULL, start_ns);
+    }
+    return result;
+}
+
+int binary_tree_insert(BINARY_TREE_HANDLE handle, NODE_KEY value, void* data)
+{
+    TREE_KEY key = make_integer_key(value);
+    return insert_key(handle, BINARY_TREE_KEY_BYTE, &key, data, NULL);
+}
+
+int binary_tree_remove(BINARY_TREE_HANDLE handle, NODE_KEY value, tree_remove_callback remove_callback)
+{
+    TREE_KEY key = make_integer_key(value);
+    return remove_key(handle, BINARY_TREE_KEY_BYTE, &key, remove_callback);
+}
+
+void* binary_tree_find(BINARY_TREE_HANDLE handle, NODE_KEY find_value)
+{
+    TREE_KEY key = make_integer_key(find_value);
+    return find_key(handle, BINARY_TREE_KEY_BYTE, &key);
+}
+
+int binary_tree_insert_u64(BINARY_TREE_HANDLE handle, uint64_t value, void* data)
+{
+    TREE_KEY key = make_integer_key(value);
+    return insert_key(handle, BINARY_TREE_KEY_UINT64, &key, data, NULL);
+}
+
+int binary_tree_remove_u64(BINARY_TREE_HANDLE handle, uint64_t value, tree_remove_callback remove_callback)
+{
+    TREE_KEY key = make_integer_key(value);
+    return remove_key(handle, BINARY_TREE_KEY_UINT64, &key, remove_callback);
+}
+
+void* binary_tree_find_u64(BINARY_TREE_HANDLE handle, uint64_t find_value)
+{
+    TREE_KEY key = make_integer_key(find_value);
+    return find_key(handle, BINARY_TREE_KEY_UINT64, &key);
+}
+
+int binary_tree_insert_string(BINARY_TREE_HANDLE handle, const void* value, size_t length, void* data)
+{
+    int result;
+    if (value == NULL && length > 0)
+    {
+        LogError("FAILURE: Invalid key specified on insert");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_KEY key = make_string_key(value, length);
+        result = insert_key(handle, BINARY_TREE_KEY_STRING, &key, data, NULL);
+    }
+    return result;
+}
+
+int binary_tree_remove_string(BINARY_TREE_HANDLE handle, const void* value, size_t length, tree_remove_callback remove_callback)
+{
+    int result;
+    if (value == NULL && length > 0)
+    {
+        LogError("FAILURE: Invalid key specified on remove");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_KEY key = make_string_key(value, length);
+        result = remove_key(handle, BINARY_TREE_KEY_STRING, &key, remove_callback);
+    }
+    return result;
+}
+
+void* binary_tree_find_string(BINARY_TREE_HANDLE handle, const void* find_value, size_t length)
+{
+    void* result;
+    if (find_value == NULL && length > 0)
+    {
+        LogError("FAILURE: Invalid key specified on find");
+        result = NULL;
+    }
+    else
+    {
+        TREE_KEY key = make_string_key(find_value, length);
+        result = find_key(handle, BINARY_TREE_KEY_STRING, &key);
+    }
+    return result;
+}
+
+int binary_tree_insert_ttl(BINARY_TREE_HANDLE handle, NODE_KEY value, void* data, uint64_t ttl_ms)
+{
+    TREE_KEY key = make_integer_key(value);
+    return insert_key(handle, BINARY_TREE_KEY_BYTE, &key, data, &ttl_ms);
+}
+
+int binary_tree_insert_u64_ttl(BINARY_TREE_HANDLE handle, uint64_t value, void* data, uint64_t ttl_ms)
+{
+    TREE_KEY key = make_integer_key(value);
+    return insert_key(handle, BINARY_TREE_KEY_UINT64, &key, data, &ttl_ms);
+}
+
+int binary_tree_insert_string_ttl(BINARY_TREE_HANDLE handle, const void* value, size_t length, void* data, uint64_t ttl_ms)
+{
+    int result;
+    if (value == NULL && length > 0)
+    {
+        LogError("FAILURE: Invalid key specified on insert");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_KEY key = make_string_key(value, length);
+        result = insert_key(handle, BINARY_TREE_KEY_STRING, &key, data, &ttl_ms);
+    }
+    return result;
+}
+
+int binary_tree_expire(BINARY_TREE_HANDLE handle, uint64_t now, tree_remove_callback remove_callback)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on expire");
+        result = __LINE__;
+    }
+    else if (handle->read_only)
+    {
+        LogError("FAILURE: Cannot expire entries of a snapshot");
+        result = __LINE__;
+    }
+    else
+    {
+        TIMER_WHEEL* wheel = atomic_load_explicit(&handle->ttl_wheel, memory_order_acquire);
+        TIMER_WHEEL_ENTRY* due_entry = NULL;
+        result = 0;
+        TREE_ENTER(handle);
+        if (wheel != NULL)
+        {
+            (void)pthread_mutex_lock(&handle->ttl_lock);
+            due_entry = timer_wheel_advance(wheel, now / TTL_TICK_NS);
+            for (TIMER_WHEEL_ENTRY* entry = due_entry; entry != NULL; entry = entry->next)
+            {
+                get_tree_timer(entry)->due = 1;
+            }
+            (void)pthread_mutex_unlock(&handle->ttl_lock);
+        }
+
+        // Removed one at a time like any other remove.  The timer tells
+        // whether the entry is still the one it was started for
+        while (due_entry != NULL)
+        {
+            TREE_TIMER* timer = get_tree_timer(due_entry);
+            TXN_OPERATION operation = { TXN_OPERATION_REMOVE, timer->key, NULL, remove_callback, NULL, NULL, timer };
+            due_entry = due_entry->next;
+            int remove_result = apply_operations(handle, &operation, 1);
+            (void)pthread_mutex_lock(&handle->ttl_lock);
+            if (timer->orphaned)
+            {
+                free_tree_timer(timer);
+            }
+            else
+            {
+                // Still in the tree, so the remove itself failed.  The
+                // next expire tries again
+                LogError("FAILURE: unable to remove an expired entry (%d)", remove_result);
+                timer->due = 0;
+                timer_wheel_add(wheel, &timer->entry, timer->entry.expire_tick);
+                result = __LINE__;
+            }
+            (void)pthread_mutex_unlock(&handle->ttl_lock);
+        }
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+size_t binary_tree_item_count(BINARY_TREE_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on remove");
+        result = __LINE__;
+    }
+    else if (handle->paged != NULL)
+    {
+        result = paged_tree_item_count(handle->paged);
+    }
+    else if (handle->persistent && !handle->read_only)
+    {
+        TREE_ENTER(handle);
+        TREE_VERSION* pinned_version = pin_version(handle);
+        result = pinned_version->items;
+        release_version(pinned_version);
+        TREE_LEAVE();
+    }
+    else
+    {
+        lock_tree_for_read(handle);
+        result = handle->items;
+        unlock_tree(handle);
+    }
+    return result;
+}
+
+size_t binary_tree_height(BINARY_TREE_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on remove");
+        result = __LINE__;
+    }
+    else if (handle->image != NULL)
+    {
+        result = (size_t)handle->image->height;
+    }
+    else if (handle->paged != NULL)
+    {
+        result = paged_tree_height(handle->paged);
+    }
+    else
+    {
+        TREE_VERSION* pinned_version;
+        TREE_ENTER(handle);
+        lock_tree_for_read(handle);
+        result = get_node_height(pin_root(handle, &pinned_version));
+        release_version(pinned_version);
+        unlock_tree(handle);
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+void binary_tree_print(BINARY_TREE_HANDLE handle)
+{
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on print");
+    }
+    else
+    {
+        TREE_VERSION* pinned_version;
+        TREE_ENTER(handle);
+        lock_tree_for_read(handle);
+        print_tree(pin_root(handle, &pinned_version), 0);
+        release_version(pinned_version);
+        unlock_tree(handle);
+        TREE_LEAVE();
+    }
+}
+
+char* binary_tree_construct_visual(BINARY_TREE_HANDLE handle)
+{
+    char* result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on construct visual");
+        result = NULL;
+    }
+    else
+    {
+        TREE_VERSION* pinned_version;
+        TREE_ENTER(handle);
+        lock_tree_for_read(handle);
+        const NODE_INFO* root_node = pin_root(handle, &pinned_version);
+        // Removed mvcc keys keep their node until the gc runs
+        size_t items = count_nodes(root_node);
+
+        // Allocate the result
+        if (items > 0)
+        {
+            size_t len = (items*NUM_OF_CHARS) + (items * 2);
+            result = (char*)malloc(len + 1);
+            memset(result, 0, len + 1);
+            construct_visual_representation(root_node, result, 0);
+        }
+        else
+        {
+            result = (char*)malloc(1);
+            result[0] = '\0';
+        }
+        release_version(pinned_version);
+        unlock_tree(handle);
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+int binary_tree_for_each_parallel_entries(BINARY_TREE_HANDLE handle, tree_entry_visitor_callback visitor, void* context, size_t threads)
+{
+    int result;
+    if (handle == NULL || visitor == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on for each");
+        result = __LINE__;
+    }
+    else if (handle->image != NULL)
+    {
+        // Already a flat array in key order, walked serially
+        visit_image(handle->image, visitor, context);
+        result = 0;
+    }
+    else if (handle->paged != NULL)
+    {
+        // Every page goes through the one buffer pool lock, threads wouldn't help
+        ENTRY_VISIT visit = { visitor, context, handle->key_mode, NULL, 0, 0 };
+        result = paged_tree_scan(handle->paged, 0, UINT64_MAX, visit_paged_entry, &visit);
+    }
+    else
+    {
+        TREE_VERSION* pinned_version;
+        TREE_ENTER(handle);
+        lock_tree_for_read(handle);
+        const NODE_INFO* root_node = pin_root(handle, &pinned_version);
+        if (threads <= 1 || root_node == NULL || root_node->height <= PARALLEL_SERIAL_CUTOFF_HEIGHT)
+        {
+            ENTRY_VISIT visit = { visitor, context, handle->key_mode, NULL, 0, 0 };
+            visit_entries(root_node, &visit);
+            tree_free(TREE_MEMORY_SCRATCH, visit.key_buffer, visit.key_buffer_size);
+            result = visit.result;
+        }
+        else
+        {
+            if (threads > PARALLEL_MAX_THREADS)
+            {
+                threads = PARALLEL_MAX_THREADS;
+            }
+            result = run_parallel_pool(handle, root_node, visitor, context, threads);
+        }
+        release_version(pinned_version);
+        unlock_tree(handle);
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+// binary_tree_for_each_parallel hands the byte keys on to a tree_visitor_callback
+typedef struct BYTE_KEY_VISIT_TAG
+{
+    tree_visitor_callback visitor;
+    void* context;
+} BYTE_KEY_VISIT;
+
+static void visit_byte_key_entry(const void* key, size_t key_length, void* data, void* context)
+{
+    BYTE_KEY_VISIT* visit = (BYTE_KEY_VISIT*)context;
+    (void)key_length;
+    visit->visitor((NODE_KEY)*(const uint64_t*)key, data, visit->context);
+}
+
+int binary_tree_for_each_parallel(BINARY_TREE_HANDLE handle, tree_visitor_callback visitor, void* context, size_t threads)
+{
+    int result;
+    if (handle == NULL || visitor == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on for each");
+        result = __LINE__;
+    }
+    else if (handle->key_mode != BINARY_TREE_KEY_BYTE)
+    {
+        LogError("FAILURE: Only byte keys can be visited, use binary_tree_for_each_parallel_entries");
+        result = __LINE__;
+    }
+    else
+    {
+        BYTE_KEY_VISIT visit = { visitor, context };
+        result = binary_tree_for_each_parallel_entries(handle, visit_byte_key_entry, &visit, threads);
+    }
+    return result;
+}
+
+int binary_tree_for_each(BINARY_TREE_HANDLE handle, tree_entry_visitor_callback visitor, void* context)
+{
+    int result;
+    if (handle == NULL || visitor == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on for each");
+        result = __LINE__;
+    }
+    else if (handle->image != NULL)
+    {
+        visit_image(handle->image, visitor, context);
+        result = 0;
+    }
+    else if (handle->paged != NULL)
+    {
+        ENTRY_VISIT visit = { visitor, context, handle->key_mode, NULL, 0, 0 };
+        result = paged_tree_scan(handle->paged, 0, UINT64_MAX, visit_paged_entry, &visit);
+    }
+    else
+    {
+        TREE_VERSION* pinned_version;
+        ENTRY_VISIT visit = { visitor, context, handle->key_mode, NULL, 0, 0 };
+        TREE_ENTER(handle);
+        lock_tree_for_read(handle);
+        visit_entries(pin_root(handle, &pinned_version), &visit);
+        release_version(pinned_version);
+        unlock_tree(handle);
+        tree_free(TREE_MEMORY_SCRATCH, visit.key_buffer, visit.key_buffer_size);
+        TREE_LEAVE();
+        result = visit.result;
+    }
+    return result;
+}
+
+int binary_tree_root_hash(BINARY_TREE_HANDLE handle, uint64_t* hash)
+{
+    int result;
+    if (handle == NULL || hash == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on root hash");
+        result = __LINE__;
+    }
+    else if (!handle->merkle_hash)
+    {
+        LogError("FAILURE: the tree isn't hashed, set OPTION_MERKLE_HASH");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_VERSION* pinned_version;
+        TREE_ENTER(handle);
+        lock_tree_for_read(handle);
+        *hash = get_subtree_hash(pin_root(handle, &pinned_version));
+        release_version(pinned_version);
+        unlock_tree(handle);
+        TREE_LEAVE();
+        result = 0;
+    }
+    return result;
+}
+
+// Drops a pin on a tree other than the one entered, what that frees is
+// charged to the tree it belongs to
+static void release_other_version(BINARY_TREE_INFO* tree_info, TREE_VERSION* version)
+{
+    TREE_ENTER(tree_info);
+    release_version(version);
+    TREE_LEAVE();
+}
+
+int binary_tree_diff(BINARY_TREE_HANDLE a, BINARY_TREE_HANDLE b, tree_diff_callback callback, void* context)
+{
+    int result;
+    if (a == NULL || b == NULL || callback == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on diff");
+        result = __LINE__;
+    }
+    else if (!a->merkle_hash || !b->merkle_hash || a->key_mode != b->key_mode)
+    {
+        LogError("FAILURE: diff needs two OPTION_MERKLE_HASH trees with the same key mode");
+        result = __LINE__;
+    }
+    else if (a == b)
+    {
+        result = 0;
+    }
+    else
+    {
+        TREE_VERSION* pinned_a;
+        TREE_VERSION* pinned_b;
+        TREE_DIFF diff = { NULL, a->key_mode, callback, context, 0 };
+        TREE_ENTER(a);
+        // Only read locks, which can't deadlock against another diff
+        // taking them the other way round
+        lock_tree_for_read(a);
+        lock_tree_for_read(b);
+        const NODE_INFO* root_a = pin_root(a, &pinned_a);
+        diff.other_root = (NODE_INFO*)pin_root(b, &pinned_b);
+        diff_subtree(&diff, root_a, NULL, NULL);
+        release_other_version(b, pinned_b);
+        release_version(pinned_a);
+        unlock_tree(b);
+        unlock_tree(a);
+        TREE_LEAVE();
+        result = diff.result;
+    }
+    return result;
+}
+
+int binary_tree_save(BINARY_TREE_HANDLE handle, int fd, tree_serialize_callback serializer, void* context)
+{
+    int result;
+    if (handle == NULL || fd < 0)
+    {
+        LogError("FAILURE: Invalid parameter specified on save");
+        result = __LINE__;
+    }
+    else if (handle->image != NULL)
+    {
+        LogError("FAILURE: The tree is already a saved image, copy the file instead");
+        result = __LINE__;
+    }
+    else if (handle->paged != NULL)
+    {
+        LogError("FAILURE: A paged tree already lives in its file, flush and copy that instead");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_VERSION* pinned_version;
+        TREE_ENTER(handle);
+        lock_tree_for_read(handle);
+        result = write_tree_image(handle->key_mode, pin_root(handle, &pinned_version), fd, serializer, context);
+        release_version(pinned_version);
+        unlock_tree(handle);
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+BINARY_TREE_HANDLE binary_tree_open_mapped(const char* path)
+{
+    BINARY_TREE_INFO* result = NULL;
+    if (path == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on open mapped");
+    }
+    else
+    {
+        int fd = open(path, O_RDONLY);
+        struct stat file_stat;
+        void* mapping = MAP_FAILED;
+        size_t mapping_size = 0;
+        if (fd < 0)
+        {
+            LogError("FAILURE: unable to open tree image %s", path);
+        }
+        else if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(TREE_IMAGE_HEADER) + sizeof(TREE_IMAGE_TRAILER))
+        {
+            LogError("FAILURE: %s is not a tree image", path);
+        }
+        else
+        {
+            mapping_size = (size_t)file_stat.st_size;
+            if ((mapping = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+            {
+                LogError("FAILURE: unable to map tree image %s", path);
+            }
+        }
+
+        if (fd >= 0)
+        {
+            (void)close(fd);
+        }
+
+        if (mapping == MAP_FAILED)
+        {
+            // Already logged
+        }
+        else if (validate_tree_image((const unsigned char*)mapping, mapping_size) != 0 ||
+            (result = allocate_tree_info(memory_tracker_create())) == NULL)
+        {
+            LogError("FAILURE: unable to open tree image %s", path);
+            (void)munmap(mapping, mapping_size);
+        }
+        else
+        {
+            result->image = (const TREE_IMAGE_HEADER*)mapping;
+            result->image_size = mapping_size;
+            result->read_only = 1;
+            result->key_mode = (BINARY_TREE_KEY_MODE)result->image->key_mode;
+            result->items = (size_t)result->image->node_count;
+        }
+    }
+    return result;
+}
+
+BINARY_TREE_HANDLE binary_tree_open_paged(const char* path, size_t cache_pages)
+{
+    BINARY_TREE_INFO* result;
+    PAGED_TREE_HANDLE paged = paged_tree_open(path, cache_pages);
+    if (paged == NULL)
+    {
+        LogError("FAILURE: unable to open paged tree %s", path == NULL ? "" : path);
+        result = NULL;
+    }
+    else if ((result = allocate_tree_info(memory_tracker_create())) == NULL)
+    {
+        paged_tree_destroy(paged);
+    }
+    else
+    {
+        result->paged = paged;
+        result->key_mode = BINARY_TREE_KEY_UINT64;
+    }
+    return result;
+}
+
+// Makes a rename in the directory of path durable
+static int sync_parent_directory(const char* path)
+{
+    int result;
+    const char* separator = strrchr(path, '/');
+    size_t length = separator == NULL || separator == path ? 1 : (size_t)(separator - path);
+    char* directory = (char*)tree_alloc(TREE_MEMORY_SCRATCH, length + 1);
+    if (directory == NULL)
+    {
+        LogError("FAILURE: unable to allocate directory name");
+        result = __LINE__;
+    }
+    else
+    {
+        int fd;
+        (void)memcpy(directory, separator == NULL ? "." : path, length);
+        directory[length] = '\0';
+        if ((fd = open(directory, O_RDONLY)) < 0)
+        {
+            LogError("FAILURE: unable to open directory %s", directory);
+            result = __LINE__;
+        }
+        else
+        {
+            if (fsync(fd) != 0)
+            {
+                LogError("FAILURE: unable to sync directory %s", directory);
+                result = __LINE__;
+            }
+            else
+            {
+                result = 0;
+            }
+            (void)close(fd);
+        }
+        tree_free(TREE_MEMORY_SCRATCH, directory, length + 1);
+    }
+    return result;
+}
+
+// A crash part way leaves the previous image in place
+static int write_checkpoint_image(BINARY_TREE_INFO* tree_info, const TREE_LOG* log, const char* image_path)
+{
+    int result;
+    size_t path_size = strlen(image_path) + sizeof(".tmp");
+    char* temp_path = (char*)tree_alloc(TREE_MEMORY_SCRATCH, path_size);
+    if (temp_path == NULL)
+    {
+        LogError("FAILURE: unable to allocate checkpoint path");
+        result = __LINE__;
+    }
+    else
+    {
+        int fd;
+        (void)snprintf(temp_path, path_size, "%s.tmp", image_path);
+        if ((fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        {
+            LogError("FAILURE: unable to create %s", temp_path);
+            result = __LINE__;
+        }
+        else
+        {
+            TREE_VERSION* pinned_version;
+            result = write_tree_image(tree_info->key_mode, pin_root(tree_info, &pinned_version), fd, log->serializer, log->context);
+            release_version(pinned_version);
+            if (result == 0 && fdatasync(fd) != 0)
+            {
+                LogError("FAILURE: unable to sync %s", temp_path);
+                result = __LINE__;
+            }
+            (void)close(fd);
+
+            if (result != 0)
+            {
+                (void)unlink(temp_path);
+            }
+            else if (rename(temp_path, image_path) != 0)
+            {
+                LogError("FAILURE: unable to replace %s", image_path);
+                (void)unlink(temp_path);
+                result = __LINE__;
+            }
+            else
+            {
+                result = sync_parent_directory(image_path);
+            }
+        }
+        tree_free(TREE_MEMORY_SCRATCH, temp_path, path_size);
+    }
+    return result;
+}
+
+int binary_tree_checkpoint(BINARY_TREE_HANDLE handle, const char* image_path)
+{
+    int result;
+    TREE_LOG* log;
+    if (handle == NULL || image_path == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on checkpoint");
+        result = __LINE__;
+    }
+    else if ((log = atomic_load_explicit(&handle->log, memory_order_acquire)) == NULL)
+    {
+        LogError("FAILURE: checkpoints need OPTION_WAL");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_ENTER(handle);
+        // Writers log under the same lock, so none fall between the image
+        // and emptying the log
+        if (handle->persistent)
+        {
+            (void)pthread_mutex_lock(&handle->write_lock);
+        }
+        else
+        {
+            lock_tree_for_read(handle);
+        }
+
+        if ((result = write_checkpoint_image(handle, log, image_path)) == 0)
+        {
+            result = wal_writer_reset(log->writer);
+        }
+
+        if (handle->persistent)
+        {
+            (void)pthread_mutex_unlock(&handle->write_lock);
+        }
+        else
+        {
+            unlock_tree(handle);
+        }
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+static int is_file_missing(const char* path)
+{
+    struct stat file_stat;
+    return stat(path, &file_stat) != 0 && errno == ENOENT;
+}
+
+static int is_key_present(BINARY_TREE_INFO* tree_info, const TREE_KEY* key)
+{
+    int result;
+    TREE_VERSION* pinned_version;
+    lock_tree_for_read(tree_info);
+    const NODE_INFO* node_info = find_node((NODE_INFO*)pin_root(tree_info, &pinned_version), key);
+    result = node_info != NULL && !node_info->tombstone;
+    release_version(pinned_version);
+    unlock_tree(tree_info);
+    return result;
+}
+
+// A change the tree already has is skipped, it was in the image before
+// the log was emptied.  Anything else that fails stops the recovery
+static int recover_operation(BINARY_TREE_INFO* tree_info, TXN_OPERATION_TYPE type, const TREE_KEY* key, void* data, tree_remove_callback remove_callback)
+{
+    int result;
+    if ((type == TXN_OPERATION_INSERT) == (is_key_present(tree_info, key) != 0))
+    {
+        if (type == TXN_OPERATION_INSERT && remove_callback != NULL)
+        {
+            remove_callback(data);
+        }
+        result = 0;
+    }
+    else if (type == TXN_OPERATION_REMOVE)
+    {
+        result = remove_key(tree_info, tree_info->key_mode, key, remove_callback);
+    }
+    else if ((result = insert_key(tree_info, tree_info->key_mode, key, data, NULL)) != 0 && remove_callback != NULL)
+    {
+        remove_callback(data);
+    }
+    return result;
+}
+
+static int recover_image(BINARY_TREE_INFO* tree_info, const char* image_path, tree_deserialize_callback deserializer, tree_remove_callback remove_callback, void* context)
+{
+    int result;
+    BINARY_TREE_INFO* image_tree;
+    if (image_path == NULL || is_file_missing(image_path))
+    {
+        result = 0;
+    }
+    else if ((image_tree = binary_tree_open_mapped(image_path)) == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        const TREE_IMAGE_HEADER* image = image_tree->image;
+        if (image->key_mode != (uint32_t)tree_info->key_mode)
+        {
+            LogError("FAILURE: %s holds another kind of key", image_path);
+            result = __LINE__;
+        }
+        else
+        {
+            const TREE_IMAGE_NODE* node_list = get_image_nodes(image);
+            const unsigned char* bytes = get_image_bytes(image);
+            result = 0;
+            for (uint64_t index = 0; index < image->node_count && result == 0; index++)
+            {
+                const TREE_IMAGE_NODE* image_node = &node_list[index];
+                TREE_KEY key = image->key_mode == BINARY_TREE_KEY_STRING ? make_string_key(bytes + image_node->key_offset, image_node->key_length) : make_integer_key(image_node->key);
+                void* data = deserializer != NULL ? deserializer(bytes + image_node->payload_offset, image_node->payload_length, context) : NULL;
+                result = recover_operation(tree_info, TXN_OPERATION_INSERT, &key, data, remove_callback);
+            }
+        }
+        binary_tree_destroy(image_tree);
+    }
+    return result;
+}
+
+// The operations of a batch are replayed one by one, so a batch that is
+// partly in the image still catches up
+static int replay_log_record(BINARY_TREE_INFO* tree_info, const unsigned char* record, size_t size, tree_deserialize_callback deserializer, tree_remove_callback remove_callback, void* context)
+{
+    int result;
+    const TREE_LOG_BATCH* header = (const TREE_LOG_BATCH*)record;
+    if (size < sizeof(TREE_LOG_BATCH) || header->key_mode != (uint32_t)tree_info->key_mode)
+    {
+        LogError("FAILURE: the log holds another kind of key");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t offset = sizeof(TREE_LOG_BATCH);
+        result = 0;
+        for (uint32_t index = 0; index < header->operation_count && result == 0; index++)
+        {
+            const TREE_LOG_OPERATION* logged = (const TREE_LOG_OPERATION*)(record + offset);
+            size_t operation_size = 0;
+            if (size - offset < sizeof(TREE_LOG_OPERATION) || logged->type > TXN_OPERATION_REMOVE ||
+                (operation_size = align_log_offset(sizeof(TREE_LOG_OPERATION) + (size_t)logged->key_length + logged->payload_length)) > size - offset)
+            {
+                LogError("FAILURE: log record is inconsistent");
+                result = __LINE__;
+            }
+            else
+            {
+                const unsigned char* key_bytes = (const unsigned char*)(logged + 1);
+                TREE_KEY key = tree_info->key_mode == BINARY_TREE_KEY_STRING ? make_string_key(key_bytes, logged->key_length) : make_integer_key(logged->key);
+                void* data = logged->type == TXN_OPERATION_INSERT && deserializer != NULL ? deserializer(key_bytes + logged->key_length, logged->payload_length, context) : NULL;
+                result = recover_operation(tree_info, (TXN_OPERATION_TYPE)logged->type, &key, data, remove_callback);
+                offset += operation_size;
+            }
+        }
+    }
+    return result;
+}
+
+static int recover_log(BINARY_TREE_INFO* tree_info, const char* wal_path, tree_deserialize_callback deserializer, tree_remove_callback remove_callback, void* context)
+{
+    int result;
+    WAL_READER_HANDLE reader;
+    if (is_file_missing(wal_path))
+    {
+        result = 0;
+    }
+    else if ((reader = wal_reader_open(wal_path)) == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        const void* record;
+        size_t record_size;
+        result = 0;
+        while (result == 0 && wal_reader_next(reader, &record, &record_size) == 0)
+        {
+            result = replay_log_record(tree_info, (const unsigned char*)record, record_size, deserializer, remove_callback, context);
+        }
+        wal_reader_close(reader);
+    }
+    return result;
+}
+
+int binary_tree_recover(BINARY_TREE_HANDLE handle, const char* image_path, const char* wal_path, tree_deserialize_callback deserializer, tree_remove_callback remove_callback, void* context)
+{
+    int result;
+    if (handle == NULL || wal_path == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on recover");
+        result = __LINE__;
+    }
+    else if (handle->read_only || handle->paged != NULL)
+    {
+        LogError("FAILURE: only a live in memory tree can be recovered into");
+        result = __LINE__;
+    }
+    else if (!is_tree_empty(handle) || atomic_load(&handle->log) != NULL)
+    {
+        LogError("FAILURE: recover into an empty tree before turning on OPTION_WAL");
+        result = __LINE__;
+    }
+    else if ((result = recover_image(handle, image_path, deserializer, remove_callback, context)) != 0)
+    {
+        LogError("FAILURE: unable to recover the checkpoint %s", image_path);
+    }
+    else if ((result = recover_log(handle, wal_path, deserializer, remove_callback, context)) != 0)
+    {
+        LogError("FAILURE: unable to replay the log %s", wal_path);
+    }
+    return result;
+}
+
+int binary_tree_read_begin(BINARY_TREE_HANDLE handle, uint64_t* read_ts)
+{
+    int result;
+    if (handle == NULL || read_ts == NULL || !handle->mvcc)
+    {
+        LogError("FAILURE: Invalid parameter specified on read begin");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->reader_lock);
+        if (handle->active_reader_count == handle->active_reader_capacity)
+        {
+            size_t new_capacity = handle->active_reader_capacity == 0 ? 8 : handle->active_reader_capacity * 2;
+            uint64_t* active_readers = (uint64_t*)memory_tracker_realloc(handle->memory, TREE_MEMORY_BOOKKEEPING, handle->active_readers, handle->active_reader_capacity * sizeof(uint64_t), new_capacity * sizeof(uint64_t));
+            if (active_readers != NULL)
+            {
+                handle->active_readers = active_readers;
+                handle->active_reader_capacity = new_capacity;
+            }
+        }
+        if (handle->active_reader_count == handle->active_reader_capacity)
+        {
+            LogError("FAILURE: allocating active reader list");
+            result = __LINE__;
+        }
+        else
+        {
+            // Registered under the reader lock so the gc never misses it
+            *read_ts = atomic_load(&handle->commit_clock);
+            handle->active_readers[handle->active_reader_count++] = *read_ts;
+            result = 0;
+        }
+        (void)pthread_mutex_unlock(&handle->reader_lock);
+    }
+    return result;
+}
+
+void binary_tree_read_end(BINARY_TREE_HANDLE handle, uint64_t read_ts)
+{
+    if (handle != NULL && handle->mvcc)
+    {
+        (void)pthread_mutex_lock(&handle->reader_lock);
+        for (size_t index = 0; index < handle->active_reader_count; index++)
+        {
+            if (handle->active_readers[index] == read_ts)
+            {
+                handle->active_readers[index] = handle->active_readers[--handle->active_reader_count];
+                break;
+            }
+        }
+        (void)pthread_mutex_unlock(&handle->reader_lock);
+    }
+}
+
+static void* find_key_at(BINARY_TREE_INFO* handle, BINARY_TREE_KEY_MODE key_mode, const TREE_KEY* key, uint64_t read_ts)
+{
+    void* result;
+    if (handle == NULL || !handle->mvcc || !accepts_key_mode(handle, key_mode))
+    {
+        LogError("FAILURE: Invalid handle specified on find at");
+        result = NULL;
+    }
+    else
+    {
+        TREE_ENTER(handle);
+        (void)pthread_rwlock_rdlock(&handle->tree_lock);
+        const NODE_INFO* node_info = find_node(handle->root_node, key);
+        const NODE_VERSION* version = node_info == NULL ? NULL : node_info->versions;
+        while (version != NULL && version->commit_ts > read_ts)
+        {
+            version = version->older;
+        }
+        result = (version == NULL || version->removed) ? NULL : version->data;
+        (void)pthread_rwlock_unlock(&handle->tree_lock);
+        STATS_ADD(TREE_STAT_FINDS, 1);
+        STATS_ADD(result == NULL ? TREE_STAT_FIND_MISSES : TREE_STAT_FIND_HITS, 1);
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+void* binary_tree_find_at(BINARY_TREE_HANDLE handle, NODE_KEY find_value, uint64_t read_ts)
+{
+    TREE_KEY key = make_integer_key(find_value);
+    return find_key_at(handle, BINARY_TREE_KEY_BYTE, &key, read_ts);
+}
+
+void* binary_tree_find_at_u64(BINARY_TREE_HANDLE handle, uint64_t find_value, uint64_t read_ts)
+{
+    TREE_KEY key = make_integer_key(find_value);
+    return find_key_at(handle, BINARY_TREE_KEY_UINT64, &key, read_ts);
+}
+
+void* binary_tree_find_at_string(BINARY_TREE_HANDLE handle, const void* find_value, size_t length, uint64_t read_ts)
+{
+    void* result;
+    if (find_value == NULL && length > 0)
+    {
+        LogError("FAILURE: Invalid key specified on find at");
+        result = NULL;
+    }
+    else
+    {
+        TREE_KEY key = make_string_key(find_value, length);
+        result = find_key_at(handle, BINARY_TREE_KEY_STRING, &key, read_ts);
+    }
+    return result;
+}
+
+int binary_tree_mvcc_gc(BINARY_TREE_HANDLE handle)
+{
+    int result;
+    if (handle == NULL || !handle->mvcc)
+    {
+        LogError("FAILURE: Invalid handle specified on gc");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_ENTER(handle);
+        mvcc_collect_garbage(handle);
+        TREE_LEAVE();
+        result = 0;
+    }
+    return result;
+}
+
+BINARY_TREE_TXN_HANDLE binary_tree_txn_begin(BINARY_TREE_HANDLE handle)
+{
+    BINARY_TREE_TXN* result;
+    if (handle == NULL || handle->read_only || handle->paged != NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on transaction begin");
+        result = NULL;
+    }
+    else if ((result = (BINARY_TREE_TXN*)memory_tracker_malloc(handle->memory, TREE_MEMORY_BOOKKEEPING, sizeof(BINARY_TREE_TXN))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate transaction");
+    }
+    else
+    {
+        memset(result, 0, sizeof(BINARY_TREE_TXN));
+        result->tree_info = handle;
+    }
+    return result;
+}
+
+static TXN_OPERATION* add_txn_operation(BINARY_TREE_TXN* txn_info)
+{
+    TXN_OPERATION* result;
+    if (txn_info->operation_count == txn_info->operation_capacity)
+    {
+        size_t new_capacity = txn_info->operation_capacity == 0 ? 8 : txn_info->operation_capacity * 2;
+        TXN_OPERATION* operation_list = (TXN_OPERATION*)memory_tracker_realloc(txn_info->tree_info->memory, TREE_MEMORY_BOOKKEEPING, txn_info->operation_list, txn_info->operation_capacity * sizeof(TXN_OPERATION), new_capacity * sizeof(TXN_OPERATION));
+        if (operation_list != NULL)
+        {
+            txn_info->operation_list = operation_list;
+            txn_info->operation_capacity = new_capacity;
+        }
+    }
+    if (txn_info->operation_count == txn_info->operation_capacity)
+    {
+        LogError("FAILURE: unable to allocate transaction operation");
+        result = NULL;
+    }
+    else
+    {
+        result = &txn_info->operation_list[txn_info->operation_count];
+        memset(result, 0, sizeof(TXN_OPERATION));
+    }
+    return result;
+}
+
+// The caller's string bytes may be gone by the commit, so the operation
+// gets its own copy
+static int copy_txn_key(TXN_OPERATION* operation, const TREE_KEY* key)
+{
+    int result;
+    unsigned char* key_bytes;
+    operation->key = *key;
+    if (key->bytes == NULL || key->length == 0)
+    {
+        operation->key.bytes = NULL;
+        result = 0;
+    }
+    else if ((key_bytes = (unsigned char*)tree_alloc(TREE_MEMORY_BOOKKEEPING, key->length)) == NULL)
+    {
+        LogError("FAILURE: unable to allocate transaction key");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)memcpy(key_bytes, key->bytes, key->length);
+        operation->key.bytes = key_bytes;
+        result = 0;
+    }
+    return result;
+}
+
+static void free_txn_key(TXN_OPERATION* operation)
+{
+    tree_free(TREE_MEMORY_BOOKKEEPING, (void*)operation->key.bytes, operation->key.length);
+}
+
+static int txn_insert_key(BINARY_TREE_TXN* txn_info, BINARY_TREE_KEY_MODE key_mode, const TREE_KEY* key, void* data)
+{
+    int result;
+    TXN_OPERATION* operation;
+    if (txn_info == NULL || !accepts_key_mode(txn_info->tree_info, key_mode))
+    {
+        LogError("FAILURE: Invalid handle specified on transaction insert");
+        result = __LINE__;
+    }
+    else if ((operation = add_txn_operation(txn_info)) == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_ENTER(txn_info->tree_info);
+        if (copy_txn_key(operation, key) != 0)
+        {
+            result = __LINE__;
+        }
+        else if ((operation->new_node = create_new_node(&operation->key, data)) == NULL)
+        {
+            LogError("FAILURE: Creating new node on transaction insert");
+            free_txn_key(operation);
+            result = __LINE__;
+        }
+        else
+        {
+            operation->type = TXN_OPERATION_INSERT;
+            operation->data = data;
+            txn_info->operation_count++;
+            result = 0;
+        }
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+static int txn_remove_key(BINARY_TREE_TXN* txn_info, BINARY_TREE_KEY_MODE key_mode, const TREE_KEY* key, tree_remove_callback remove_callback)
+{
+    int result;
+    TXN_OPERATION* operation;
+    if (txn_info == NULL || !accepts_key_mode(txn_info->tree_info, key_mode))
+    {
+        LogError("FAILURE: Invalid handle specified on transaction remove");
+        result = __LINE__;
+    }
+    else if ((operation = add_txn_operation(txn_info)) == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_ENTER(txn_info->tree_info);
+        if (copy_txn_key(operation, key) != 0)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            operation->type = TXN_OPERATION_REMOVE;
+            operation->remove_callback = remove_callback;
+            txn_info->operation_count++;
+            result = 0;
+        }
+        TREE_LEAVE();
+    }
+    return result;
+}
+
+int binary_tree_txn_insert(BINARY_TREE_TXN_HANDLE txn_handle, NODE_KEY value, void* data)
+{
+    TREE_KEY key = make_integer_key(value);
+    return txn_insert_key(txn_handle, BINARY_TREE_KEY_BYTE, &key, data);
+}
+
+int binary_tree_txn_remove(BINARY_TREE_TXN_HANDLE txn_handle, NODE_KEY value, tree_remove_callback remove_callback)
+{
+    TREE_KEY key = make_integer_key(value);
+    return txn_remove_key(txn_handle, BINARY_TREE_KEY_BYTE, &key, remove_callback);
+}
+
+int binary_tree_txn_insert_u64(BINARY_TREE_TXN_HANDLE txn_handle, uint64_t value, void* data)
+{
+    TREE_KEY key = make_integer_key(value);
+    return txn_insert_key(txn_handle, BINARY_TREE_KEY_UINT64, &key, data);
+}
+
+int binary_tree_txn_remove_u64(BINARY_TREE_TXN_HANDLE txn_handle, uint64_t value, tree_remove_callback remove_callback)
+{
+    TREE_KEY key = make_integer_key(value);
+    return txn_remove_key(txn_handle, BINARY_TREE_KEY_UINT64, &key, remove_callback);
+}
+
+int binary_tree_txn_insert_string(BINARY_TREE_TXN_HANDLE txn_handle, const void* value, size_t length, void* data)
+{
+    int result;
+    if (value == NULL && length > 0)
+    {
+        LogError("FAILURE: Invalid key specified on transaction insert");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_KEY key = make_string_key(value, length);
+        result = txn_insert_key(txn_handle, BINARY_TREE_KEY_STRING, &key, data);
+    }
+    return result;
+}
+
+int binary_tree_txn_remove_string(BINARY_TREE_TXN_HANDLE txn_handle, const void* value, size_t length, tree_remove_callback remove_callback)
+{
+    int result;
+    if (value == NULL && length > 0)
+    {
+        LogError("FAILURE: Invalid key specified on transaction remove");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_KEY key = make_string_key(value, length);
+        result = txn_remove_key(txn_handle, BINARY_TREE_KEY_STRING, &key, remove_callback);
+    }
+    return result;
+}
+
+int binary_tree_txn_commit(BINARY_TREE_TXN_HANDLE txn_handle)
+{
+    int result;
+    if (txn_handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on transaction commit");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_ENTER(txn_handle->tree_info);
+        if (txn_handle->operation_count == 0)
+        {
+            result = 0;
+        }
+        else if ((result = apply_operations(txn_handle->tree_info, txn_handle->operation_list, txn_handle->operation_count)) != 0)
+        {
+            LogError("FAILURE: transaction conflicts with the tree, nothing was applied");
+        }
+        else
+        {
+            export_operations(txn_handle->tree_info, txn_handle->operation_list, txn_handle->operation_count);
+        }
+        TREE_LEAVE();
+        binary_tree_txn_abort(txn_handle);
+    }
+    return result;
+}
+
+void binary_tree_txn_abort(BINARY_TREE_TXN_HANDLE txn_handle)
+{
+    if (txn_handle != NULL)
+    {
+        TREE_ENTER(txn_handle->tree_info);
+        release_operations(txn_handle->operation_list, txn_handle->operation_count);
+        for (size_t index = 0; index < txn_handle->operation_count; index++)
+        {
+            free_txn_key(&txn_handle->operation_list[index]);
+        }
+        TREE_LEAVE();
+        memory_tracker_free(txn_handle->tree_info->memory, TREE_MEMORY_BOOKKEEPING, txn_handle->operation_list, txn_handle->operation_capacity * sizeof(TXN_OPERATION));
+        memory_tracker_free(txn_handle->tree_info->memory, TREE_MEMORY_BOOKKEEPING, txn_handle, sizeof(BINARY_TREE_TXN));
+    }
+}
+
+int binary_tree_compact(BINARY_TREE_HANDLE handle)
+{
+    int result;
+    if (handle == NULL || handle->persistent)
+    {
+        LogError("FAILURE: Invalid handle specified on compact");
+        result = __LINE__;
+    }
+    else
+    {
+        TREE_ENTER(handle);
+        (void)pthread_rwlock_wrlock(&handle->tree_lock);
+        compact_tree(handle);
+        (void)pthread_rwlock_unlock(&handle->tree_lock);
+        TREE_LEAVE();
+        result = 0;
+    }
+    return result;
+}
+
+int binary_tree_get_stats(BINARY_TREE_HANDLE handle, BINARY_TREE_STATS* stats)
+{
+    int result;
+    if (handle == NULL || stats == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on get stats");
+        result = __LINE__;
+    }
+    else
+    {
+#ifdef ENABLE_TREE_STATS
+        if (handle->stats_slots == NULL)
+        {
+            LogError("FAILURE: stats are not being collected on this tree");
+            result = __LINE__;
+        }
+        else
+        {
+            uint64_t counters[TREE_STAT_COUNT] = { 0 };
+            memset(stats, 0, sizeof(BINARY_TREE_STATS));
+            for (size_t slot = 0; slot < TREE_STATS_SLOTS; slot++)
+            {
+                TREE_STATS_SLOT* stats_slot = &handle->stats_slots[slot];
+                for (size_t index = 0; index < TREE_STAT_COUNT; index++)
+                {
+                    counters[index] += atomic_load_explicit(&stats_slot->counters[index], memory_order_relaxed);
+                }
+                for (size_t index = 0; index < BINARY_TREE_STATS_MAX_DEPTH; index++)
+                {
+                    stats->depth_histogram[index] += atomic_load_explicit(&stats_slot->depth_histogram[index], memory_order_relaxed);
+                }
+            }
+            stats->finds = counters[TREE_STAT_FINDS];
+            stats->find_hits = counters[TREE_STAT_FIND_HITS];
+            stats->find_misses = counters[TREE_STAT_FIND_MISSES];
+            stats->comparisons = counters[TREE_STAT_COMPARISONS];
+            stats->nodes_visited = counters[TREE_STAT_NODES_VISITED];
+            stats->single_rotations = counters[TREE_STAT_SINGLE_ROTATIONS];
+            stats->double_rotations = counters[TREE_STAT_DOUBLE_ROTATIONS];
+            stats->subtree_rebuilds = counters[TREE_STAT_SUBTREE_REBUILDS];
+            stats->node_allocations = counters[TREE_STAT_NODE_ALLOCATIONS];
+            stats->node_frees = counters[TREE_STAT_NODE_FREES];
+            result = 0;
+        }
+#else
+        LogError("FAILURE: built without ENABLE_TREE_STATS");
+        result = __LINE__;
+#endif
+    }
+    return result;
+}
+
+void binary_tree_reset_stats(BINARY_TREE_HANDLE handle)
+{
+#ifdef ENABLE_TREE_STATS
+    if (handle != NULL && handle->stats_slots != NULL)
+    {
+        for (size_t slot = 0; slot < TREE_STATS_SLOTS; slot++)
+        {
+            TREE_STATS_SLOT* stats_slot = &handle->stats_slots[slot];
+            for (size_t index = 0; index < TREE_STAT_COUNT; index++)
+            {
+                atomic_store_explicit(&stats_slot->counters[index], 0, memory_order_relaxed);
+            }
+            for (size_t index = 0; index < BINARY_TREE_STATS_MAX_DEPTH; index++)
+            {
+                atomic_store_explicit(&stats_slot->depth_histogram[index], 0, memory_order_relaxed);
+            }
+        }
+    }
+#else
+    (void)handle;
+#endif
+}
+
+int binary_tree_memory_usage(BINARY_TREE_HANDLE handle, BINARY_TREE_MEMORY_USAGE* usage)
+{
+    int result;
+    MEMORY_TRACKER_USAGE tracker_usage;
+    if (handle == NULL || usage == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on memory usage");
+        result = __LINE__;
+    }
+    else if ((result = memory_tracker_get_usage(handle->memory, &tracker_usage)) == 0)
+    {
+        memset(usage, 0, sizeof(BINARY_TREE_MEMORY_USAGE));
+        usage->items = binary_tree_item_count(handle);
+        usage->node_bytes = tracker_usage.requested_bytes[TREE_MEMORY_NODES];
+        usage->version_bytes = tracker_usage.requested_bytes[TREE_MEMORY_VERSIONS];
+        usage->bookkeeping_bytes = tracker_usage.requested_bytes[TREE_MEMORY_BOOKKEEPING];
+        usage->scratch_bytes = tracker_usage.requested_bytes[TREE_MEMORY_SCRATCH];
+        usage->overhead_bytes = tracker_usage.overhead_bytes;
+        usage->total_bytes = tracker_usage.live_bytes + tracker_usage.overhead_bytes;
+        usage->peak_bytes = tracker_usage.peak_bytes;
+        usage->allocations = tracker_usage.allocations;
+        usage->live_allocations = tracker_usage.live_allocations;
+        usage->fragmentation = tracker_usage.fragmentation;
+        if (usage->items > 0)
+        {
+            usage->metadata_bytes_per_entry = (double)(usage->node_bytes + usage->version_bytes) / (double)usage->items;
+            usage->overhead_bytes_per_entry = (double)usage->overhead_bytes / (double)usage->items;
+            usage->bytes_per_entry = (double)usage->total_bytes / (double)usage->items;
+        }
+    }
+    return result;
+}
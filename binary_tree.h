@@ -6,26 +6,348 @@
 
 #ifdef __cplusplus
 #include <cstdio>
+#include <cstdint>
 extern "C" {
 #else // __cplusplus
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #endif // __cplusplus
 
 typedef struct BINARY_TREE_INFO_TAG* BINARY_TREE_HANDLE;
+typedef struct BINARY_TREE_TXN_TAG* BINARY_TREE_TXN_HANDLE;
+
+// Options for binary_tree_set_option, the value is an int* unless stated
+// Writes path copy the nodes they touch and publish a new root, so
+// binary_tree_snapshot can hand out consistent read-only versions.
+// Only allowed on an empty tree
+#define OPTION_PERSISTENT_MODE          "persistent_mode"
+// Every insert and remove adds a version stamped with a commit timestamp
+// that binary_tree_find_at can read back.  Only allowed on an empty tree
+#define OPTION_MVCC_MODE                "mvcc_mode"
+// size_t* milliseconds between background binary_tree_mvcc_gc passes, 0 stops it
+#define OPTION_MVCC_GC_INTERVAL_MS      "mvcc_gc_interval_ms"
+// Removes only tombstone the node, the data still goes to the remove callback
+// right away.  Tombstones are dropped in bulk by binary_tree_compact or once
+// they pass OPTION_COMPACTION_RATIO.  Not supported with persistent or mvcc mode
+#define OPTION_LAZY_DELETE              "lazy_delete"
+// size_t* percentage of tombstoned nodes that triggers a compaction, 0 turns
+// automatic compaction off.  Defaults to 50
+#define OPTION_COMPACTION_RATIO         "compaction_ratio"
+// Automatic compactions run on a background thread instead of the remove
+// that crossed the ratio
+#define OPTION_BACKGROUND_COMPACTION    "background_compaction"
+// The value is a const char* naming a POSIX shared memory page (see
+// stat_page.h) that the tree publishes its counters to for whiskey-stat.
+// Operations are counted and timed while it is on.  An empty name stops it
+#define OPTION_STATS_EXPORT             "stats_export"
+// The value is a const char* path that every binary_tree_insert, remove and
+// find is recorded to (see op_trace.h) for whiskey_replay.  Transactions
+// aren't recorded and string keys only by their first eight bytes.  An
+// empty path stops the recording and completes the file
+#define OPTION_TRACE_FILE               "trace_file"
+// int* BINARY_TREE_KEY_MODE.  Only allowed on an empty tree that isn't
+// being traced
+#define OPTION_KEY_MODE                 "key_mode"
+// String keys that share at least 16 leading bytes with a key already in the
+// tree keep one shared copy of those bytes, and lookups skip over the part
+// they already matched.  Only allowed on an empty string tree that isn't
+// in persistent mode
+#define OPTION_PREFIX_COMPRESSION       "prefix_compression"
+// The value is a const BINARY_TREE_WAL_CONFIG*.  Every insert, remove and
+// transaction commit appends a record to a write-ahead log (see wal.h)
+// before the change becomes visible and returns once the record is as
+// durable as asked, concurrent writers share the writes and syncs.  Keep
+// the log short with binary_tree_checkpoint and rebuild the tree with
+// binary_tree_recover.  A write whose record couldn't be made durable
+// fails although the tree keeps the change, and the log refuses every
+// write after it.  An empty path stops logging.  Not supported on
+// snapshots, mapped or paged trees
+#define OPTION_WAL                      "wal"
+// The value is a const BINARY_TREE_HASH_CONFIG*.  Every node keeps a hash of
+// its subtree, over the keys and the hash of their data, that inserts,
+// removes and rotations keep up to date.  Needed by binary_tree_root_hash
+// and binary_tree_diff.  Only allowed on an empty tree and not with mvcc
+// mode or lazy delete
+#define OPTION_MERKLE_HASH              "merkle_hash"
 
 typedef void (*tree_remove_callback)(void* data);
 
 // Used as the type value
 typedef unsigned char NODE_KEY;
 
+typedef enum BINARY_TREE_KEY_MODE_TAG
+{
+    // NODE_KEY keys, the default
+    BINARY_TREE_KEY_BYTE,
+    // uint64_t keys through the _u64 functions.  The NODE_KEY functions
+    // still work, the traversal functions don't
+    BINARY_TREE_KEY_UINT64,
+    // Byte strings through the _string functions, the only ones that take
+    // a key in this mode.  Ordered like memcmp with a shorter key before a
+    // longer one it is a prefix of, the bytes are copied into the tree
+    BINARY_TREE_KEY_STRING
+} BINARY_TREE_KEY_MODE;
+
+// Called in key order by binary_tree_for_each.  key points at the uint64_t
+// key in the byte and uint64 modes and at the key bytes in string mode
+typedef void (*tree_entry_visitor_callback)(const void* key, size_t key_length, void* data, void* context);
+
+// Turns data into the bytes binary_tree_save stores for it.  Returns how
+// many that takes and only writes them when buffer_size is enough
+typedef size_t (*tree_serialize_callback)(void* data, void* buffer, size_t buffer_size, void* context);
+// Turns the bytes a serializer wrote back into data
+typedef void* (*tree_deserialize_callback)(const void* bytes, size_t size, void* context);
+
+// In the same order as WAL_DURABILITY
+typedef enum BINARY_TREE_DURABILITY_TAG
+{
+    // Writes return right away and the log is synced every flush interval
+    BINARY_TREE_DURABILITY_ASYNC,
+    // Writes return once logged to the file, they survive the process but
+    // not the machine
+    BINARY_TREE_DURABILITY_WRITE,
+    // Writes return once the log is synced to the disk
+    BINARY_TREE_DURABILITY_SYNC
+} BINARY_TREE_DURABILITY;
+
+typedef struct BINARY_TREE_WAL_CONFIG_TAG
+{
+    const char* path;
+    BINARY_TREE_DURABILITY durability;
+    // Async only, 0 picks a default
+    size_t flush_interval_ms;
+    // Turns inserted data into the bytes logged for it, without one only
+    // keys are logged.  Also used by binary_tree_checkpoint
+    tree_serialize_callback serializer;
+    void* context;
+} BINARY_TREE_WAL_CONFIG;
+
+// Hash of the data of an entry for OPTION_MERKLE_HASH, equal data has to
+// hash the same in every tree that is compared
+typedef uint64_t (*tree_hash_callback)(void* data, void* context);
+
+typedef struct BINARY_TREE_HASH_CONFIG_TAG
+{
+    // NULL hashes only the keys
+    tree_hash_callback data_hash;
+    void* context;
+} BINARY_TREE_HASH_CONFIG;
+
+typedef enum BINARY_TREE_DIFF_TAG
+{
+    BINARY_TREE_DIFF_ONLY_IN_A,
+    BINARY_TREE_DIFF_ONLY_IN_B,
+    // The key is in both trees but its data hashes differently
+    BINARY_TREE_DIFF_CHANGED
+} BINARY_TREE_DIFF;
+
+// Called in key order by binary_tree_diff, key is passed as for
+// tree_entry_visitor_callback.  The data of a tree that doesn't have the key is NULL
+typedef void (*tree_diff_callback)(BINARY_TREE_DIFF diff, const void* key, size_t key_length, void* data_a, void* data_b, void* context);
+
+// Bytes of an entry's data that count against max_bytes
+typedef size_t (*tree_data_size_callback)(void* data, void* context);
+
+// binary_tree_create_bounded limits, at least one of them set
+typedef struct BINARY_TREE_BOUNDS_TAG
+{
+    // 0 for no limit on the entry count
+    size_t max_items;
+    // 0 for no limit on the bytes of the entries.  An entry counts its node
+    // and key plus what data_size reports for the data
+    size_t max_bytes;
+    tree_data_size_callback data_size;
+    void* data_size_context;
+    // Gets the data of every entry evicted to stay within the bounds
+    tree_remove_callback evict_callback;
+} BINARY_TREE_BOUNDS;
+
+// Called once for every entry by the traversal functions.  When
+// called from binary_tree_for_each_parallel the visitor runs on
+// several threads at once and in no particular key order
+typedef void (*tree_visitor_callback)(NODE_KEY key, void* data, void* context);
+
+#define BINARY_TREE_STATS_MAX_DEPTH     64
+
+// Only collected when the library is built with ENABLE_TREE_STATS
+typedef struct BINARY_TREE_STATS_TAG
+{
+    uint64_t finds;
+    uint64_t find_hits;
+    uint64_t find_misses;
+    // Key comparisons and nodes walked by every lookup, finds and the
+    // lookups inside removes and commits
+    uint64_t comparisons;
+    uint64_t nodes_visited;
+    uint64_t single_rotations;
+    uint64_t double_rotations;
+    uint64_t subtree_rebuilds;
+    uint64_t node_allocations;
+    uint64_t node_frees;
+    // Depth of every node a lookup landed on, the root is depth 0 and
+    // anything deeper than the last bucket is counted there
+    uint64_t depth_histogram[BINARY_TREE_STATS_MAX_DEPTH];
+} BINARY_TREE_STATS;
+
+typedef struct BINARY_TREE_MEMORY_USAGE_TAG
+{
+    size_t items;
+    // Bytes requested from the allocator and still held, by what they are for
+    uint64_t node_bytes;
+    uint64_t version_bytes;
+    uint64_t bookkeeping_bytes;
+    uint64_t scratch_bytes;
+    // Allocator headers and size class rounding on top of the requested bytes
+    uint64_t overhead_bytes;
+    uint64_t total_bytes;
+    uint64_t peak_bytes;
+    uint64_t allocations;
+    uint64_t live_allocations;
+    // Share of total_bytes lost to overhead_bytes
+    double fragmentation;
+    // Node and version bytes per item, overhead per item and everything per item
+    double metadata_bytes_per_entry;
+    double overhead_bytes_per_entry;
+    double bytes_per_entry;
+} BINARY_TREE_MEMORY_USAGE;
+
 extern BINARY_TREE_HANDLE binary_tree_create();
+// A tree for use as a cache.  Finds mark the entries they return and an
+// insert that goes over a bound evicts the entries no find marked since
+// the hand of a CLOCK sweep last passed them.  Persistent, mvcc and lazy
+// delete mode and OPTION_WAL are not available
+extern BINARY_TREE_HANDLE binary_tree_create_bounded(const BINARY_TREE_BOUNDS* bounds);
 extern void binary_tree_destroy(BINARY_TREE_HANDLE handle);
+extern int binary_tree_set_option(BINARY_TREE_HANDLE handle, const char* option_name, const void* value);
+
+// Returns a read-only handle over the current version of a persistent
+// tree.  It is O(1), unaffected by later writes and works with the find,
+// count and traversal functions.  Release it with binary_tree_destroy.
+// Data removed from the live tree is still handed to the remove callback
+// right away, so don't free data that an open snapshot may return
+extern BINARY_TREE_HANDLE binary_tree_snapshot(BINARY_TREE_HANDLE handle);
+
+// MVCC reads.  A reader registers the timestamp it reads at so the gc keeps
+// every version it can see, then reads any number of keys at that timestamp
+// while writers carry on.  Data handed to a remove callback is held back
+// until no registered reader can see it
+extern int binary_tree_read_begin(BINARY_TREE_HANDLE handle, uint64_t* read_ts);
+extern void binary_tree_read_end(BINARY_TREE_HANDLE handle, uint64_t read_ts);
+extern void* binary_tree_find_at(BINARY_TREE_HANDLE handle, NODE_KEY find_value, uint64_t read_ts);
+extern void* binary_tree_find_at_u64(BINARY_TREE_HANDLE handle, uint64_t find_value, uint64_t read_ts);
+extern void* binary_tree_find_at_string(BINARY_TREE_HANDLE handle, const void* find_value, size_t length, uint64_t read_ts);
+// Trims versions older than the oldest active reader and unlinks keys whose removal everyone can see
+extern int binary_tree_mvcc_gc(BINARY_TREE_HANDLE handle);
+
+// Splices out or rebuilds around every tombstone left by lazy delete mode
+extern int binary_tree_compact(BINARY_TREE_HANDLE handle);
+
+// Sums the per thread counters, fails unless built with ENABLE_TREE_STATS
+extern int binary_tree_get_stats(BINARY_TREE_HANDLE handle, BINARY_TREE_STATS* stats);
+extern void binary_tree_reset_stats(BINARY_TREE_HANDLE handle);
+
+// Every allocation the tree makes is accounted against it.  A tree and its
+// snapshots share nodes and so report the same memory, items is the count
+// of the handle asked
+extern int binary_tree_memory_usage(BINARY_TREE_HANDLE handle, BINARY_TREE_MEMORY_USAGE* usage);
 
 extern int binary_tree_insert(BINARY_TREE_HANDLE handle, NODE_KEY value, void* data);
 extern int binary_tree_remove(BINARY_TREE_HANDLE handle, NODE_KEY value, tree_remove_callback remove_callback);
 extern void* binary_tree_find(BINARY_TREE_HANDLE handle, NODE_KEY find_value);
 
+extern int binary_tree_insert_u64(BINARY_TREE_HANDLE handle, uint64_t value, void* data);
+extern int binary_tree_remove_u64(BINARY_TREE_HANDLE handle, uint64_t value, tree_remove_callback remove_callback);
+extern void* binary_tree_find_u64(BINARY_TREE_HANDLE handle, uint64_t find_value);
+
+extern int binary_tree_insert_string(BINARY_TREE_HANDLE handle, const void* value, size_t length, void* data);
+extern int binary_tree_remove_string(BINARY_TREE_HANDLE handle, const void* value, size_t length, tree_remove_callback remove_callback);
+extern void* binary_tree_find_string(BINARY_TREE_HANDLE handle, const void* find_value, size_t length);
+
+// Inserts an entry that binary_tree_expire removes once ttl_ms milliseconds
+// of the stopwatch_now_ns() clock have passed.  Removing the entry before
+// then cancels that.  Not available in a paged tree or in mvcc or lazy
+// delete mode, and the expiry isn't kept by OPTION_WAL or a saved image
+extern int binary_tree_insert_ttl(BINARY_TREE_HANDLE handle, NODE_KEY value, void* data, uint64_t ttl_ms);
+extern int binary_tree_insert_u64_ttl(BINARY_TREE_HANDLE handle, uint64_t value, void* data, uint64_t ttl_ms);
+extern int binary_tree_insert_string_ttl(BINARY_TREE_HANDLE handle, const void* value, size_t length, void* data, uint64_t ttl_ms);
+// Removes every entry that is due by now, a stopwatch_now_ns() time, and
+// hands its data to remove_callback.  The expiry times sit in a timing
+// wheel, so the cost follows the number of entries that expire rather
+// than the size of the tree
+extern int binary_tree_expire(BINARY_TREE_HANDLE handle, uint64_t now, tree_remove_callback remove_callback);
+
+// Serial scan of every entry in key order, for every key mode
+extern int binary_tree_for_each(BINARY_TREE_HANDLE handle, tree_entry_visitor_callback visitor, void* context);
+
+// Hash over every entry of an OPTION_MERKLE_HASH tree.  Entry hashes are
+// added up, so trees holding the same entries have the same hash whatever
+// order they were built in
+extern int binary_tree_root_hash(BINARY_TREE_HANDLE handle, uint64_t* hash);
+// Reports every key whose entry differs between two OPTION_MERKLE_HASH trees
+// of the same key mode, such as a persistent tree and an older snapshot of
+// it.  Subtrees of a that hash the same as the same key range of b are
+// skipped, so the cost grows with the number of differences rather than
+// with the size of the trees.  Writers of both trees wait until it returns,
+// the callback must not use them
+extern int binary_tree_diff(BINARY_TREE_HANDLE a, BINARY_TREE_HANDLE b, tree_diff_callback callback, void* context);
+
+// Writes every entry to fd from its current position: the keys, the bytes
+// serializer turns each data into and a balanced tree shape, with a
+// checksum over all of it.  Without a serializer only keys are written.
+// Writers wait until it returns, the serializer must not use the tree
+extern int binary_tree_save(BINARY_TREE_HANDLE handle, int fd, tree_serialize_callback serializer, void* context);
+// Returns a read-only handle served straight from a file binary_tree_save
+// wrote, mapped rather than read, so nothing is allocated per entry.  The
+// find functions return a pointer to the stored bytes, 8 byte aligned and
+// valid until the handle is destroyed, and it works with the count and
+// traversal functions.  The whole file is checksummed on open
+extern BINARY_TREE_HANDLE binary_tree_open_mapped(const char* path);
+// Returns a uint64 key tree kept in the B+-tree pages of path (see
+// paged_tree.h) rather than in memory, so it can outgrow the memory and
+// only cache_pages pages are held at a time.  The file is created if it is
+// missing and reopened as it was otherwise.  The data pointer itself is
+// what gets stored, so use ids or offsets that still mean something once
+// the process is gone.  It works with the insert, remove, find, count and
+// binary_tree_for_each functions, options and transactions are refused.
+// binary_tree_destroy flushes the file
+extern BINARY_TREE_HANDLE binary_tree_open_paged(const char* path, size_t cache_pages);
+
+// Saves the tree to image_path and empties the OPTION_WAL log, with writers
+// held off in between so every change is in exactly one of them.  The
+// image goes to a temporary file that is synced and renamed over image_path
+extern int binary_tree_checkpoint(BINARY_TREE_HANDLE handle, const char* image_path);
+// Fills an empty tree, set up with the key mode and options it had, from
+// the last checkpoint in image_path and then the log at wal_path.  Either
+// file may be missing and image_path may be NULL.  The data comes from
+// deserializer, or is NULL without one.  Logged changes that don't apply,
+// like those already in an image whose log wasn't emptied yet, are
+// skipped and the data of a skipped insert goes to remove_callback.  Set
+// OPTION_WAL afterwards to carry on with the same log
+extern int binary_tree_recover(BINARY_TREE_HANDLE handle, const char* image_path, const char* wal_path, tree_deserialize_callback deserializer, tree_remove_callback remove_callback, void* context);
+
+// Read-only scan of every entry.  Subtrees are split into tasks that the
+// worker threads steal from each other, small subtrees are walked serially.
+// Writers wait until the scan returns.  Entries come in no particular order,
+// for every key mode.  Mapped and paged trees are walked serially
+extern int binary_tree_for_each_parallel_entries(BINARY_TREE_HANDLE handle, tree_entry_visitor_callback visitor, void* context, size_t threads);
+// The same for byte keys, handed over as a NODE_KEY
+extern int binary_tree_for_each_parallel(BINARY_TREE_HANDLE handle, tree_visitor_callback visitor, void* context, size_t threads);
+
+
+// Buffers inserts and removes and applies them as one atomic unit on commit,
+// rebalancing the tree once for the whole group.  If any operation conflicts
+// with the tree nothing is applied.  Commit and abort both free the transaction
+extern BINARY_TREE_TXN_HANDLE binary_tree_txn_begin(BINARY_TREE_HANDLE handle);
+extern int binary_tree_txn_insert(BINARY_TREE_TXN_HANDLE txn_handle, NODE_KEY value, void* data);
+extern int binary_tree_txn_remove(BINARY_TREE_TXN_HANDLE txn_handle, NODE_KEY value, tree_remove_callback remove_callback);
+extern int binary_tree_txn_insert_u64(BINARY_TREE_TXN_HANDLE txn_handle, uint64_t value, void* data);
+extern int binary_tree_txn_remove_u64(BINARY_TREE_TXN_HANDLE txn_handle, uint64_t value, tree_remove_callback remove_callback);
+// String keys are copied, the caller's bytes can go before the commit
+extern int binary_tree_txn_insert_string(BINARY_TREE_TXN_HANDLE txn_handle, const void* value, size_t length, void* data);
+extern int binary_tree_txn_remove_string(BINARY_TREE_TXN_HANDLE txn_handle, const void* value, size_t length, tree_remove_callback remove_callback);
+extern int binary_tree_txn_commit(BINARY_TREE_TXN_HANDLE txn_handle);
+extern void binary_tree_txn_abort(BINARY_TREE_TXN_HANDLE txn_handle);
 
 // Diagnostic function
 extern size_t binary_tree_item_count(BINARY_TREE_HANDLE handle);
@@ -0,0 +1,36 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "checksum.h"
+
+static uint32_t g_checksum_table[256];
+static pthread_once_t g_checksum_once = PTHREAD_ONCE_INIT;
+
+static void init_checksum_table(void)
+{
+    for (uint32_t index = 0; index < 256; index++)
+    {
+        uint32_t value = index;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            value = (value & 1) ? (value >> 1) ^ 0xEDB88320u : value >> 1;
+        }
+        g_checksum_table[index] = value;
+    }
+}
+
+uint32_t checksum_update(uint32_t checksum, const void* bytes, size_t size)
+{
+    const unsigned char* position = (const unsigned char*)bytes;
+    (void)pthread_once(&g_checksum_once, init_checksum_table);
+    checksum = ~checksum;
+    for (size_t index = 0; index < size; index++)
+    {
+        checksum = g_checksum_table[(checksum ^ position[index]) & 0xFF] ^ (checksum >> 8);
+    }
+    return ~checksum;
+}
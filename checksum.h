@@ -0,0 +1,23 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+// CRC-32, start from 0 and feed it the previous result to continue
+extern uint32_t checksum_update(uint32_t checksum, const void* bytes, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* CHECKSUM_H */
@@ -0,0 +1,267 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "latency_histogram.h"
+#include "logging.h"
+
+// Values below SUB_BUCKET_COUNT get a bucket each, above that every power
+// of two gets SUB_BUCKET_HALF buckets
+#define SUB_BUCKET_BITS         7
+#define SUB_BUCKET_COUNT        (1u << SUB_BUCKET_BITS)
+#define SUB_BUCKET_HALF         (SUB_BUCKET_COUNT / 2)
+#define EXPONENT_COUNT          (64 - SUB_BUCKET_BITS)
+#define BUCKET_COUNT            (SUB_BUCKET_COUNT + EXPONENT_COUNT * SUB_BUCKET_HALF)
+
+typedef struct LATENCY_HISTOGRAM_INFO_TAG
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint64_t buckets[BUCKET_COUNT];
+} LATENCY_HISTOGRAM_INFO;
+
+static unsigned int get_highest_bit(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63u - (unsigned int)__builtin_clzll(value);
+#else
+    unsigned int result = 0;
+    while (value >>= 1)
+    {
+        result++;
+    }
+    return result;
+#endif
+}
+
+static size_t get_bucket_index(uint64_t value)
+{
+    size_t result;
+    if (value < SUB_BUCKET_COUNT)
+    {
+        result = (size_t)value;
+    }
+    else
+    {
+        // Shifting by exponent leaves the value in [SUB_BUCKET_HALF, SUB_BUCKET_COUNT)
+        unsigned int exponent = get_highest_bit(value) - (SUB_BUCKET_BITS - 1);
+        result = SUB_BUCKET_COUNT + (size_t)(exponent - 1) * SUB_BUCKET_HALF + (size_t)((value >> exponent) - SUB_BUCKET_HALF);
+    }
+    return result;
+}
+
+// Highest value that lands in the bucket
+static uint64_t get_bucket_value(size_t index)
+{
+    uint64_t result;
+    if (index < SUB_BUCKET_COUNT)
+    {
+        result = index;
+    }
+    else
+    {
+        unsigned int exponent = (unsigned int)((index - SUB_BUCKET_COUNT) / SUB_BUCKET_HALF) + 1;
+        uint64_t sub_bucket = (uint64_t)((index - SUB_BUCKET_COUNT) % SUB_BUCKET_HALF) + SUB_BUCKET_HALF;
+        result = ((sub_bucket + 1) << exponent) - 1;
+    }
+    return result;
+}
+
+LATENCY_HISTOGRAM_HANDLE latency_histogram_create()
+{
+    LATENCY_HISTOGRAM_INFO* result = (LATENCY_HISTOGRAM_INFO*)malloc(sizeof(LATENCY_HISTOGRAM_INFO));
+    if (result == NULL)
+    {
+        LogError("FAILURE: unable to allocate latency histogram");
+    }
+    else
+    {
+        latency_histogram_reset(result);
+    }
+    return result;
+}
+
+void latency_histogram_destroy(LATENCY_HISTOGRAM_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        free(handle);
+    }
+}
+
+void latency_histogram_reset(LATENCY_HISTOGRAM_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        memset(handle, 0, sizeof(LATENCY_HISTOGRAM_INFO));
+        handle->min = UINT64_MAX;
+    }
+}
+
+void latency_histogram_record(LATENCY_HISTOGRAM_HANDLE handle, uint64_t value_ns)
+{
+    if (handle != NULL)
+    {
+        handle->buckets[get_bucket_index(value_ns)]++;
+        handle->count++;
+        handle->sum += value_ns;
+        if (value_ns < handle->min)
+        {
+            handle->min = value_ns;
+        }
+        if (value_ns > handle->max)
+        {
+            handle->max = value_ns;
+        }
+    }
+}
+
+void latency_histogram_record_elapsed(LATENCY_HISTOGRAM_HANDLE handle, STOPWATCH_HANDLE stopwatch)
+{
+    latency_histogram_record(handle, stopwatch_get_elapsed_ns(stopwatch));
+}
+
+int latency_histogram_merge(LATENCY_HISTOGRAM_HANDLE handle, LATENCY_HISTOGRAM_HANDLE source)
+{
+    int result;
+    if (handle == NULL || source == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on merge");
+        result = __LINE__;
+    }
+    else
+    {
+        for (size_t index = 0; index < BUCKET_COUNT; index++)
+        {
+            handle->buckets[index] += source->buckets[index];
+        }
+        handle->count += source->count;
+        handle->sum += source->sum;
+        if (source->min < handle->min)
+        {
+            handle->min = source->min;
+        }
+        if (source->max > handle->max)
+        {
+            handle->max = source->max;
+        }
+        result = 0;
+    }
+    return result;
+}
+
+uint64_t latency_histogram_count(LATENCY_HISTOGRAM_HANDLE handle)
+{
+    return handle == NULL ? 0 : handle->count;
+}
+
+uint64_t latency_histogram_min(LATENCY_HISTOGRAM_HANDLE handle)
+{
+    return handle == NULL || handle->count == 0 ? 0 : handle->min;
+}
+
+uint64_t latency_histogram_max(LATENCY_HISTOGRAM_HANDLE handle)
+{
+    return handle == NULL ? 0 : handle->max;
+}
+
+double latency_histogram_mean(LATENCY_HISTOGRAM_HANDLE handle)
+{
+    return handle == NULL || handle->count == 0 ? 0.0 : (double)handle->sum / (double)handle->count;
+}
+
+uint64_t latency_histogram_percentile(LATENCY_HISTOGRAM_HANDLE handle, double percentile)
+{
+    uint64_t result = 0;
+    if (handle == NULL || handle->count == 0)
+    {
+        // Nothing recorded
+    }
+    else
+    {
+        uint64_t target;
+        uint64_t seen = 0;
+        if (percentile >= 100.0)
+        {
+            target = handle->count;
+        }
+        else
+        {
+            target = (uint64_t)(percentile / 100.0 * (double)handle->count + 0.5);
+            if (target == 0)
+            {
+                target = 1;
+            }
+        }
+
+        for (size_t index = 0; index < BUCKET_COUNT; index++)
+        {
+            seen += handle->buckets[index];
+            if (seen >= target)
+            {
+                result = get_bucket_value(index);
+                break;
+            }
+        }
+
+        // The bucket bounds can overshoot what was really recorded
+        if (result > handle->max)
+        {
+            result = handle->max;
+        }
+        if (result < handle->min)
+        {
+            result = handle->min;
+        }
+    }
+    return result;
+}
+
+int latency_histogram_export(LATENCY_HISTOGRAM_HANDLE handle, FILE* output, const char* name, LATENCY_HISTOGRAM_FORMAT format)
+{
+    int result;
+    if (handle == NULL || output == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on export");
+        result = __LINE__;
+    }
+    else if (format == LATENCY_HISTOGRAM_FORMAT_TEXT)
+    {
+        (void)fprintf(output, "%-12s count %llu min %llu mean %.1f p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu (ns)\r\n",
+            name == NULL ? "latency" : name,
+            (unsigned long long)handle->count,
+            (unsigned long long)latency_histogram_min(handle),
+            latency_histogram_mean(handle),
+            (unsigned long long)latency_histogram_percentile(handle, 50.0),
+            (unsigned long long)latency_histogram_percentile(handle, 90.0),
+            (unsigned long long)latency_histogram_percentile(handle, 99.0),
+            (unsigned long long)latency_histogram_percentile(handle, 99.9),
+            (unsigned long long)handle->max);
+        result = 0;
+    }
+    else
+    {
+        uint64_t seen = 0;
+        (void)fprintf(output, "name,value_ns,count,percentile\n");
+        for (size_t index = 0; index < BUCKET_COUNT; index++)
+        {
+            if (handle->buckets[index] != 0)
+            {
+                seen += handle->buckets[index];
+                (void)fprintf(output, "%s,%llu,%llu,%.4f\n",
+                    name == NULL ? "latency" : name,
+                    (unsigned long long)get_bucket_value(index),
+                    (unsigned long long)handle->buckets[index],
+                    100.0 * (double)seen / (double)handle->count);
+            }
+        }
+        result = 0;
+    }
+    return result;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+#include "stopwatch.h"
+
+// Log-linear histogram of nanosecond latencies.  Every power of two range is
+// split into the same number of linear sub buckets, so any value is kept to
+// within 1/64 of itself and the footprint is fixed no matter what is recorded.
+// A histogram is not thread safe, give each thread its own and merge them.
+typedef struct LATENCY_HISTOGRAM_INFO_TAG* LATENCY_HISTOGRAM_HANDLE;
+
+typedef enum LATENCY_HISTOGRAM_FORMAT_TAG
+{
+    LATENCY_HISTOGRAM_FORMAT_TEXT,
+    LATENCY_HISTOGRAM_FORMAT_CSV
+} LATENCY_HISTOGRAM_FORMAT;
+
+extern LATENCY_HISTOGRAM_HANDLE latency_histogram_create();
+extern void latency_histogram_destroy(LATENCY_HISTOGRAM_HANDLE handle);
+extern void latency_histogram_reset(LATENCY_HISTOGRAM_HANDLE handle);
+
+extern void latency_histogram_record(LATENCY_HISTOGRAM_HANDLE handle, uint64_t value_ns);
+// Records stopwatch_get_elapsed_ns of the stopwatch
+extern void latency_histogram_record_elapsed(LATENCY_HISTOGRAM_HANDLE handle, STOPWATCH_HANDLE stopwatch);
+// Adds the source counts into handle, source is left as is
+extern int latency_histogram_merge(LATENCY_HISTOGRAM_HANDLE handle, LATENCY_HISTOGRAM_HANDLE source);
+
+extern uint64_t latency_histogram_count(LATENCY_HISTOGRAM_HANDLE handle);
+extern uint64_t latency_histogram_min(LATENCY_HISTOGRAM_HANDLE handle);
+extern uint64_t latency_histogram_max(LATENCY_HISTOGRAM_HANDLE handle);
+extern double latency_histogram_mean(LATENCY_HISTOGRAM_HANDLE handle);
+// percentile is 0 to 100, e.g. 99.9
+extern uint64_t latency_histogram_percentile(LATENCY_HISTOGRAM_HANDLE handle, double percentile);
+
+// Text is a one line summary with p50/p90/p99/p99.9/max, csv is one row per
+// non empty bucket with its cumulative percentile
+extern int latency_histogram_export(LATENCY_HISTOGRAM_HANDLE handle, FILE* output, const char* name, LATENCY_HISTOGRAM_FORMAT format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* LATENCY_HISTOGRAM_H */
@@ -0,0 +1,562 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "logging.h"
+
+// Records per thread, a power of two
+#define LOG_RING_SIZE           256
+#define LOG_RECORD_ARGUMENTS    8
+// Room for the bytes of every %s argument of one message
+#define LOG_RECORD_TEXT         96
+#define LOG_SPEC_LENGTH         32
+#define LOG_OUTPUT_BUFFER       16384
+#define LOG_IDLE_SLEEP_NS       1000000L
+
+typedef enum LOG_ARGUMENT_TYPE_TAG
+{
+    LOG_ARGUMENT_NONE,
+    LOG_ARGUMENT_SIGNED,
+    LOG_ARGUMENT_UNSIGNED,
+    LOG_ARGUMENT_DOUBLE,
+    LOG_ARGUMENT_STRING,
+    LOG_ARGUMENT_POINTER,
+    LOG_ARGUMENT_LITERAL
+} LOG_ARGUMENT_TYPE;
+
+typedef enum LOG_LENGTH_TAG
+{
+    LOG_LENGTH_INT,
+    LOG_LENGTH_CHAR,
+    LOG_LENGTH_SHORT,
+    LOG_LENGTH_LONG,
+    LOG_LENGTH_LONG_LONG,
+    LOG_LENGTH_SIZE,
+    LOG_LENGTH_INTMAX,
+    LOG_LENGTH_PTRDIFF,
+    LOG_LENGTH_LONG_DOUBLE
+} LOG_LENGTH;
+
+// One printf conversion, start points at the '%'
+typedef struct LOG_CONVERSION_TAG
+{
+    const char* start;
+    const char* end;
+    LOG_ARGUMENT_TYPE type;
+    LOG_LENGTH length;
+    size_t star_count;
+} LOG_CONVERSION;
+
+typedef union LOG_ARGUMENT_TAG
+{
+    int64_t signed_value;
+    uint64_t unsigned_value;
+    double double_value;
+    const void* pointer_value;
+    size_t text_offset;
+} LOG_ARGUMENT;
+
+typedef struct LOG_RECORD_TAG
+{
+    // The format string is the message id, it is only read when formatting
+    const char* format;
+    uint8_t log_category;
+    uint8_t log_options;
+    uint8_t argument_count;
+    uint8_t text_used;
+    LOG_ARGUMENT arguments[LOG_RECORD_ARGUMENTS];
+    char text[LOG_RECORD_TEXT];
+} LOG_RECORD;
+
+// Single producer (the owning thread), single consumer (whoever holds drain_lock)
+typedef struct LOG_RING_TAG
+{
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_uint_least64_t dropped;
+    // Set when the owning thread exits, the ring is freed once drained
+    atomic_int closed;
+    struct LOG_RING_TAG* next;
+    LOG_RECORD records[LOG_RING_SIZE];
+} LOG_RING;
+
+static atomic_int g_log_level = AZ_LOG_TRACE;
+static atomic_uint_least64_t g_lost_records;
+static uint64_t g_reported_drops;
+
+static pthread_once_t g_logger_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_ring_key;
+static _Thread_local LOG_RING* g_thread_ring;
+static pthread_mutex_t g_ring_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static LOG_RING* g_ring_list;
+static pthread_mutex_t g_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t g_logger_thread;
+static atomic_int g_logger_running;
+
+static const char* parse_conversion(const char* format, LOG_CONVERSION* conversion)
+{
+    const char* position = format + 1;
+    conversion->start = format;
+    conversion->type = LOG_ARGUMENT_NONE;
+    conversion->length = LOG_LENGTH_INT;
+    conversion->star_count = 0;
+
+    // Flags, width and precision
+    while (*position != '\0' && strchr("-+ #0123456789.*'", *position) != NULL)
+    {
+        if (*position == '*')
+        {
+            conversion->star_count++;
+        }
+        position++;
+    }
+
+    switch (*position)
+    {
+        case 'h':
+            position++;
+            conversion->length = *position == 'h' ? LOG_LENGTH_CHAR : LOG_LENGTH_SHORT;
+            position += *position == 'h' ? 1 : 0;
+            break;
+        case 'l':
+            position++;
+            conversion->length = *position == 'l' ? LOG_LENGTH_LONG_LONG : LOG_LENGTH_LONG;
+            position += *position == 'l' ? 1 : 0;
+            break;
+        case 'z': conversion->length = LOG_LENGTH_SIZE; position++; break;
+        case 'j': conversion->length = LOG_LENGTH_INTMAX; position++; break;
+        case 't': conversion->length = LOG_LENGTH_PTRDIFF; position++; break;
+        case 'L': conversion->length = LOG_LENGTH_LONG_DOUBLE; position++; break;
+        default: break;
+    }
+
+    switch (*position)
+    {
+        case 'd': case 'i':
+            conversion->type = LOG_ARGUMENT_SIGNED;
+            break;
+        case 'u': case 'x': case 'X': case 'o': case 'c':
+            conversion->type = LOG_ARGUMENT_UNSIGNED;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            conversion->type = LOG_ARGUMENT_DOUBLE;
+            break;
+        case 's':
+            conversion->type = LOG_ARGUMENT_STRING;
+            break;
+        case 'p':
+            conversion->type = LOG_ARGUMENT_POINTER;
+            break;
+        default:
+            // %%, %n and anything unknown print as they are
+            conversion->type = LOG_ARGUMENT_LITERAL;
+            break;
+    }
+    conversion->end = *position == '\0' ? position : position + 1;
+    return conversion->end;
+}
+
+static void capture_argument(LOG_RECORD* record, const LOG_CONVERSION* conversion, va_list* arguments)
+{
+    LOG_ARGUMENT argument;
+    memset(&argument, 0, sizeof(argument));
+    switch (conversion->type)
+    {
+        case LOG_ARGUMENT_SIGNED:
+            switch (conversion->length)
+            {
+                case LOG_LENGTH_LONG: argument.signed_value = va_arg(*arguments, long); break;
+                case LOG_LENGTH_LONG_LONG: argument.signed_value = va_arg(*arguments, long long); break;
+                case LOG_LENGTH_SIZE: argument.signed_value = (int64_t)va_arg(*arguments, size_t); break;
+                case LOG_LENGTH_INTMAX: argument.signed_value = va_arg(*arguments, intmax_t); break;
+                case LOG_LENGTH_PTRDIFF: argument.signed_value = va_arg(*arguments, ptrdiff_t); break;
+                default: argument.signed_value = va_arg(*arguments, int); break;
+            }
+            break;
+        case LOG_ARGUMENT_UNSIGNED:
+            switch (conversion->length)
+            {
+                case LOG_LENGTH_LONG: argument.unsigned_value = va_arg(*arguments, unsigned long); break;
+                case LOG_LENGTH_LONG_LONG: argument.unsigned_value = va_arg(*arguments, unsigned long long); break;
+                case LOG_LENGTH_SIZE: argument.unsigned_value = va_arg(*arguments, size_t); break;
+                case LOG_LENGTH_INTMAX: argument.unsigned_value = va_arg(*arguments, uintmax_t); break;
+                case LOG_LENGTH_PTRDIFF: argument.unsigned_value = (uint64_t)va_arg(*arguments, ptrdiff_t); break;
+                default: argument.unsigned_value = va_arg(*arguments, unsigned int); break;
+            }
+            break;
+        case LOG_ARGUMENT_DOUBLE:
+            argument.double_value = conversion->length == LOG_LENGTH_LONG_DOUBLE ? (double)va_arg(*arguments, long double) : va_arg(*arguments, double);
+            break;
+        case LOG_ARGUMENT_STRING:
+        {
+            // The caller's string may be gone by the time it is formatted
+            const char* value = va_arg(*arguments, const char*);
+            size_t length = value == NULL ? 6 : strlen(value);
+            size_t space = record->text_used >= LOG_RECORD_TEXT ? 0 : LOG_RECORD_TEXT - record->text_used - 1;
+            if (record->text_used >= LOG_RECORD_TEXT)
+            {
+                // Nothing fits, the last byte ends the string that filled the text
+                argument.text_offset = LOG_RECORD_TEXT - 1;
+            }
+            else
+            {
+                length = length < space ? length : space;
+                argument.text_offset = record->text_used;
+                memcpy(&record->text[record->text_used], value == NULL ? "(null)" : value, length);
+                record->text[record->text_used + length] = '\0';
+                record->text_used = (uint8_t)(record->text_used + length + (space > 0 ? 1 : 0));
+            }
+            break;
+        }
+        case LOG_ARGUMENT_POINTER:
+            argument.pointer_value = va_arg(*arguments, const void*);
+            break;
+        default:
+            break;
+    }
+
+    if (record->argument_count < LOG_RECORD_ARGUMENTS)
+    {
+        record->arguments[record->argument_count] = argument;
+    }
+    record->argument_count++;
+}
+
+// Copies the conversion with its length modifier swapped for the one the
+// captured argument is stored as
+static void build_spec(const LOG_CONVERSION* conversion, char spec[LOG_SPEC_LENGTH])
+{
+    size_t used = 0;
+    const char* position = conversion->start;
+    const char* conversion_char = conversion->end - 1;
+    while (position < conversion_char && used < LOG_SPEC_LENGTH - 4)
+    {
+        if (strchr("hlzjtL", *position) == NULL)
+        {
+            spec[used++] = *position;
+        }
+        position++;
+    }
+    if (conversion->type == LOG_ARGUMENT_SIGNED || (conversion->type == LOG_ARGUMENT_UNSIGNED && *conversion_char != 'c'))
+    {
+        spec[used++] = 'l';
+        spec[used++] = 'l';
+    }
+    spec[used++] = *conversion_char;
+    spec[used] = '\0';
+}
+
+static int format_argument(char* output, size_t size, const LOG_RECORD* record, const LOG_CONVERSION* conversion, size_t* argument_index)
+{
+    int result;
+    char spec[LOG_SPEC_LENGTH];
+    int stars[2] = { 0, 0 };
+    LOG_ARGUMENT argument;
+    size_t star_count = conversion->star_count < 2 ? conversion->star_count : 2;
+
+    for (size_t index = 0; index < star_count; index++)
+    {
+        stars[index] = *argument_index < LOG_RECORD_ARGUMENTS ? (int)record->arguments[*argument_index].signed_value : 0;
+        (*argument_index)++;
+    }
+
+    if (*argument_index >= LOG_RECORD_ARGUMENTS || *argument_index >= record->argument_count)
+    {
+        // More arguments than a record holds
+        result = snprintf(output, size, "?");
+    }
+    else
+    {
+        argument = record->arguments[*argument_index];
+        build_spec(conversion, spec);
+
+#define FORMAT_WITH_STARS(value) \
+        (star_count == 0 ? snprintf(output, size, spec, value) : \
+         star_count == 1 ? snprintf(output, size, spec, stars[0], value) : \
+         snprintf(output, size, spec, stars[0], stars[1], value))
+
+        switch (conversion->type)
+        {
+            case LOG_ARGUMENT_SIGNED:
+                result = FORMAT_WITH_STARS((long long)argument.signed_value);
+                break;
+            case LOG_ARGUMENT_UNSIGNED:
+                result = *(conversion->end - 1) == 'c' ? FORMAT_WITH_STARS((int)argument.unsigned_value) : FORMAT_WITH_STARS((unsigned long long)argument.unsigned_value);
+                break;
+            case LOG_ARGUMENT_DOUBLE:
+                result = FORMAT_WITH_STARS(argument.double_value);
+                break;
+            case LOG_ARGUMENT_STRING:
+                result = FORMAT_WITH_STARS(&record->text[argument.text_offset]);
+                break;
+            case LOG_ARGUMENT_POINTER:
+                result = FORMAT_WITH_STARS(argument.pointer_value);
+                break;
+            default:
+                result = 0;
+                break;
+        }
+#undef FORMAT_WITH_STARS
+    }
+    (*argument_index)++;
+    return result < 0 ? 0 : result;
+}
+
+// Formats one record, returns the bytes used (always less than size)
+static size_t format_record(char* output, size_t size, const LOG_RECORD* record)
+{
+    size_t used = 0;
+    size_t argument_index = 0;
+    const char* position = record->format;
+    while (*position != '\0' && used + 1 < size)
+    {
+        if (*position != '%')
+        {
+            output[used++] = *position++;
+        }
+        else
+        {
+            LOG_CONVERSION conversion;
+            position = parse_conversion(position, &conversion);
+            if (conversion.type == LOG_ARGUMENT_LITERAL)
+            {
+                output[used++] = *(conversion.end - 1) == '%' ? '%' : '?';
+            }
+            else
+            {
+                int written = format_argument(&output[used], size - used, record, &conversion, &argument_index);
+                used += (size_t)written < size - used ? (size_t)written : size - used - 1;
+            }
+        }
+    }
+    if ((record->log_options & LOG_LINE) != 0 && used + 2 < size)
+    {
+        output[used++] = '\r';
+        output[used++] = '\n';
+    }
+    output[used] = '\0';
+    return used;
+}
+
+static void write_output(const char* output, size_t length)
+{
+    if (length > 0)
+    {
+        (void)fwrite(output, 1, length, stdout);
+        (void)fflush(stdout);
+    }
+}
+
+// Formats and writes everything currently in the rings, caller holds
+// g_drain_lock.  Returns the number of records written
+static size_t drain_rings(void)
+{
+    static char output[LOG_OUTPUT_BUFFER];
+    size_t result = 0;
+    size_t used = 0;
+    uint64_t dropped = atomic_load(&g_lost_records);
+    LOG_RING** ring_link;
+
+    (void)pthread_mutex_lock(&g_ring_list_lock);
+    ring_link = &g_ring_list;
+    while (*ring_link != NULL)
+    {
+        LOG_RING* ring = *ring_link;
+        int closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++)
+        {
+            if (LOG_OUTPUT_BUFFER - used < 512)
+            {
+                write_output(output, used);
+                used = 0;
+            }
+            used += format_record(&output[used], LOG_OUTPUT_BUFFER - used, &ring->records[tail & (LOG_RING_SIZE - 1)]);
+            result++;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+
+        if (closed)
+        {
+            // Nothing can be added once the owner is gone
+            *ring_link = ring->next;
+            (void)atomic_fetch_add(&g_lost_records, atomic_load(&ring->dropped));
+            free(ring);
+        }
+        else
+        {
+            ring_link = &ring->next;
+        }
+    }
+    (void)pthread_mutex_unlock(&g_ring_list_lock);
+
+    if (dropped > g_reported_drops)
+    {
+        used += (size_t)snprintf(&output[used], LOG_OUTPUT_BUFFER - used, "logger: %llu messages dropped\r\n", (unsigned long long)(dropped - g_reported_drops));
+        g_reported_drops = dropped;
+    }
+    write_output(output, used);
+    return result;
+}
+
+static void* logger_worker(void* parameter)
+{
+    (void)parameter;
+    while (atomic_load(&g_logger_running))
+    {
+        size_t drained;
+        (void)pthread_mutex_lock(&g_drain_lock);
+        drained = drain_rings();
+        (void)pthread_mutex_unlock(&g_drain_lock);
+        if (drained == 0)
+        {
+            struct timespec idle_time = { 0, LOG_IDLE_SLEEP_NS };
+            (void)nanosleep(&idle_time, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void close_thread_ring(void* parameter)
+{
+    LOG_RING* ring = (LOG_RING*)parameter;
+    atomic_store_explicit(&ring->closed, 1, memory_order_release);
+}
+
+static void stop_logger(void)
+{
+    if (atomic_exchange(&g_logger_running, 0))
+    {
+        (void)pthread_join(g_logger_thread, NULL);
+    }
+    logger_flush();
+}
+
+static void start_logger(void)
+{
+    (void)pthread_key_create(&g_ring_key, close_thread_ring);
+    atomic_store(&g_logger_running, 1);
+    if (pthread_create(&g_logger_thread, NULL, logger_worker, NULL) != 0)
+    {
+        // Every write drains inline instead
+        atomic_store(&g_logger_running, 0);
+    }
+    (void)atexit(stop_logger);
+}
+
+static LOG_RING* get_thread_ring(void)
+{
+    if (g_thread_ring == NULL)
+    {
+        LOG_RING* ring = (LOG_RING*)aligned_alloc(_Alignof(LOG_RING), sizeof(LOG_RING));
+        if (ring != NULL)
+        {
+            atomic_init(&ring->head, 0);
+            atomic_init(&ring->tail, 0);
+            atomic_init(&ring->dropped, 0);
+            atomic_init(&ring->closed, 0);
+            (void)pthread_mutex_lock(&g_ring_list_lock);
+            ring->next = g_ring_list;
+            g_ring_list = ring;
+            (void)pthread_mutex_unlock(&g_ring_list_lock);
+            (void)pthread_setspecific(g_ring_key, ring);
+            g_thread_ring = ring;
+        }
+    }
+    return g_thread_ring;
+}
+
+int logger_is_enabled(LOG_CATEGORY log_category)
+{
+    return (int)log_category <= atomic_load_explicit(&g_log_level, memory_order_relaxed);
+}
+
+void logger_write(LOG_CATEGORY log_category, int log_options, const char* format, ...)
+{
+    LOG_RING* ring;
+    (void)pthread_once(&g_logger_once, start_logger);
+    if (format == NULL)
+    {
+        // Nothing to record
+    }
+    else if ((ring = get_thread_ring()) == NULL)
+    {
+        (void)atomic_fetch_add(&g_lost_records, 1);
+    }
+    else
+    {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE)
+        {
+            (void)atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        }
+        else
+        {
+            va_list arguments;
+            LOG_RECORD* record = &ring->records[head & (LOG_RING_SIZE - 1)];
+            const char* position = format;
+            record->format = format;
+            record->log_category = (uint8_t)log_category;
+            record->log_options = (uint8_t)log_options;
+            record->argument_count = 0;
+            record->text_used = 0;
+
+            va_start(arguments, format);
+            while ((position = strchr(position, '%')) != NULL)
+            {
+                LOG_CONVERSION conversion;
+                position = parse_conversion(position, &conversion);
+                for (size_t index = 0; index < conversion.star_count; index++)
+                {
+                    LOG_CONVERSION star = { NULL, NULL, LOG_ARGUMENT_SIGNED, LOG_LENGTH_INT, 0 };
+                    capture_argument(record, &star, &arguments);
+                }
+                if (conversion.type != LOG_ARGUMENT_LITERAL)
+                {
+                    capture_argument(record, &conversion, &arguments);
+                }
+            }
+            va_end(arguments);
+            atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+        }
+
+        if (!atomic_load(&g_logger_running))
+        {
+            logger_flush();
+        }
+    }
+}
+
+void logger_set_level(LOG_CATEGORY log_level)
+{
+    atomic_store(&g_log_level, (int)log_level);
+}
+
+void logger_flush(void)
+{
+    (void)pthread_mutex_lock(&g_drain_lock);
+    (void)drain_rings();
+    (void)pthread_mutex_unlock(&g_drain_lock);
+}
+
+uint64_t logger_get_dropped(void)
+{
+    uint64_t result = atomic_load(&g_lost_records);
+    (void)pthread_mutex_lock(&g_ring_list_lock);
+    for (LOG_RING* ring = g_ring_list; ring != NULL; ring = ring->next)
+    {
+        result += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    (void)pthread_mutex_unlock(&g_ring_list_lock);
+    return result;
+}
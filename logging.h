@@ -6,10 +6,12 @@
 
 #ifdef __cplusplus
 #include <cstdio>
+#include <cstdint>
 extern "C" {
 #else // __cplusplus
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #endif // __cplusplus
 
 typedef enum LOG_CATEGORY_TAG
@@ -27,14 +29,29 @@ typedef enum LOG_CATEGORY_TAG
 #define LOG_NONE 0x00
 #define LOG_LINE 0x01
 
-#define LOG(log_category, log_options, format, ...) {(void)log_category;(void)log_options; (void)printf(format, __VA_ARGS__);(void)printf("\r\n"); }
+// Messages are not formatted by the caller.  The format string and the raw
+// arguments go into a per thread ring buffer and a background thread formats
+// and writes them in batches.  A full ring drops the message and counts it.
+// Only printf conversions are understood, %s arguments are copied up to a
+// short limit and %n is not supported
+extern int logger_is_enabled(LOG_CATEGORY log_category);
+extern void logger_write(LOG_CATEGORY log_category, int log_options, const char* format, ...);
+
+// Messages above log_level are dropped before they are recorded, AZ_LOG_TRACE keeps everything
+extern void logger_set_level(LOG_CATEGORY log_level);
+// Formats and writes everything recorded so far before returning
+extern void logger_flush(void);
+// Messages lost to full ring buffers since the process started
+extern uint64_t logger_get_dropped(void);
+
+#define LOG(log_category, log_options, format, ...) do { if (logger_is_enabled(log_category)) { logger_write(log_category, log_options, format, ##__VA_ARGS__); } } while((void)0,0)
 
 #ifdef DEBUG_LOG
-#define LogDebug(FORMAT, ...) do { LOG(AZ_LOG_TRACE, LOG_LINE, FORMAT, __VA_ARGS__); } while((void)0,0)
+#define LogDebug(FORMAT, ...) do { LOG(AZ_LOG_TRACE, LOG_LINE, FORMAT, ##__VA_ARGS__); } while((void)0,0)
 #else
 #define LogDebug(FORMAT, ...) do {} while((void)0,0)
 #endif // DEBUG_LOG
-#define LogError(FORMAT, ...) do { LOG(AZ_LOG_ERROR, LOG_LINE, FORMAT, __VA_ARGS__); } while((void)0,0)
+#define LogError(FORMAT, ...) do { LOG(AZ_LOG_ERROR, LOG_LINE, FORMAT, ##__VA_ARGS__); } while((void)0,0)
 
 #define INSERT_NODE_FAILURE     11
 
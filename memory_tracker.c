@@ -0,0 +1,206 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "memory_tracker.h"
+#include "logging.h"
+
+// Used when the allocator can't tell the real block size: a size_t header
+// in front of every block and sizes rounded up to the alignment
+#define ESTIMATED_ALIGNMENT     16
+#define ESTIMATED_MINIMUM       32
+
+typedef struct MEMORY_TRACKER_INFO_TAG
+{
+    atomic_size_t ref_count;
+    atomic_uint_least64_t requested_bytes[MEMORY_TRACKER_CATEGORIES];
+    // Everything the allocator handed out including its overhead
+    atomic_uint_least64_t footprint_bytes;
+    atomic_uint_least64_t peak_bytes;
+    atomic_uint_least64_t allocations;
+    atomic_uint_least64_t frees;
+} MEMORY_TRACKER_INFO;
+
+// Bytes the allocator really uses for a block of size bytes
+static uint64_t get_block_footprint(void* block, size_t size)
+{
+    uint64_t result;
+#ifdef __GLIBC__
+    (void)size;
+    // The chunk header sits in front of the usable area
+    result = (uint64_t)malloc_usable_size(block) + sizeof(size_t);
+#else
+    (void)block;
+    result = ((uint64_t)size + sizeof(size_t) + ESTIMATED_ALIGNMENT - 1) & ~(uint64_t)(ESTIMATED_ALIGNMENT - 1);
+    result = result < ESTIMATED_MINIMUM ? ESTIMATED_MINIMUM : result;
+#endif
+    return result;
+}
+
+static void add_block(MEMORY_TRACKER_INFO* tracker_info, size_t category, void* block, size_t size)
+{
+    uint64_t block_footprint = get_block_footprint(block, size);
+    uint64_t footprint = atomic_fetch_add_explicit(&tracker_info->footprint_bytes, block_footprint, memory_order_relaxed) + block_footprint;
+    uint64_t peak = atomic_load_explicit(&tracker_info->peak_bytes, memory_order_relaxed);
+    while (footprint > peak && !atomic_compare_exchange_weak_explicit(&tracker_info->peak_bytes, &peak, footprint, memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+    (void)atomic_fetch_add_explicit(&tracker_info->requested_bytes[category], size, memory_order_relaxed);
+    (void)atomic_fetch_add_explicit(&tracker_info->allocations, 1, memory_order_relaxed);
+}
+
+static void remove_block(MEMORY_TRACKER_INFO* tracker_info, size_t category, void* block, size_t size)
+{
+    (void)atomic_fetch_sub_explicit(&tracker_info->footprint_bytes, get_block_footprint(block, size), memory_order_relaxed);
+    (void)atomic_fetch_sub_explicit(&tracker_info->requested_bytes[category], size, memory_order_relaxed);
+    (void)atomic_fetch_add_explicit(&tracker_info->frees, 1, memory_order_relaxed);
+}
+
+MEMORY_TRACKER_HANDLE memory_tracker_create(void)
+{
+    MEMORY_TRACKER_INFO* result = (MEMORY_TRACKER_INFO*)malloc(sizeof(MEMORY_TRACKER_INFO));
+    if (result == NULL)
+    {
+        LogError("FAILURE: unable to allocate memory tracker");
+    }
+    else
+    {
+        atomic_init(&result->ref_count, 1);
+        for (size_t index = 0; index < MEMORY_TRACKER_CATEGORIES; index++)
+        {
+            atomic_init(&result->requested_bytes[index], 0);
+        }
+        atomic_init(&result->footprint_bytes, 0);
+        atomic_init(&result->peak_bytes, 0);
+        atomic_init(&result->allocations, 0);
+        atomic_init(&result->frees, 0);
+    }
+    return result;
+}
+
+MEMORY_TRACKER_HANDLE memory_tracker_add_ref(MEMORY_TRACKER_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        (void)atomic_fetch_add(&handle->ref_count, 1);
+    }
+    return handle;
+}
+
+void memory_tracker_destroy(MEMORY_TRACKER_HANDLE handle)
+{
+    if (handle != NULL && atomic_fetch_sub(&handle->ref_count, 1) == 1)
+    {
+        free(handle);
+    }
+}
+
+void* memory_tracker_malloc(MEMORY_TRACKER_HANDLE handle, size_t category, size_t size)
+{
+    void* result;
+    if (category >= MEMORY_TRACKER_CATEGORIES)
+    {
+        LogError("FAILURE: Invalid memory category %zu", category);
+        result = NULL;
+    }
+    else if ((result = malloc(size)) != NULL && handle != NULL)
+    {
+        add_block(handle, category, result, size);
+    }
+    return result;
+}
+
+void* memory_tracker_aligned_alloc(MEMORY_TRACKER_HANDLE handle, size_t category, size_t alignment, size_t size)
+{
+    void* result;
+    if (category >= MEMORY_TRACKER_CATEGORIES)
+    {
+        LogError("FAILURE: Invalid memory category %zu", category);
+        result = NULL;
+    }
+    else if ((result = aligned_alloc(alignment, size)) != NULL && handle != NULL)
+    {
+        add_block(handle, category, result, size);
+    }
+    return result;
+}
+
+void* memory_tracker_realloc(MEMORY_TRACKER_HANDLE handle, size_t category, void* block, size_t old_size, size_t new_size)
+{
+    void* result;
+    if (category >= MEMORY_TRACKER_CATEGORIES)
+    {
+        LogError("FAILURE: Invalid memory category %zu", category);
+        result = NULL;
+    }
+    else if (handle == NULL)
+    {
+        result = realloc(block, new_size);
+    }
+    else
+    {
+        // The old block may be gone after realloc, so measure it first
+        uint64_t old_footprint = block == NULL ? 0 : get_block_footprint(block, old_size);
+        if ((result = realloc(block, new_size)) != NULL)
+        {
+            if (block != NULL)
+            {
+                (void)atomic_fetch_sub_explicit(&handle->footprint_bytes, old_footprint, memory_order_relaxed);
+                (void)atomic_fetch_sub_explicit(&handle->requested_bytes[category], old_size, memory_order_relaxed);
+                (void)atomic_fetch_add_explicit(&handle->frees, 1, memory_order_relaxed);
+            }
+            add_block(handle, category, result, new_size);
+        }
+    }
+    return result;
+}
+
+void memory_tracker_free(MEMORY_TRACKER_HANDLE handle, size_t category, void* block, size_t size)
+{
+    if (block != NULL)
+    {
+        if (handle != NULL && category < MEMORY_TRACKER_CATEGORIES)
+        {
+            remove_block(handle, category, block, size);
+        }
+        free(block);
+    }
+}
+
+int memory_tracker_get_usage(MEMORY_TRACKER_HANDLE handle, MEMORY_TRACKER_USAGE* usage)
+{
+    int result;
+    if (handle == NULL || usage == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on get usage");
+        result = __LINE__;
+    }
+    else
+    {
+        uint64_t footprint = atomic_load_explicit(&handle->footprint_bytes, memory_order_relaxed);
+        memset(usage, 0, sizeof(MEMORY_TRACKER_USAGE));
+        for (size_t index = 0; index < MEMORY_TRACKER_CATEGORIES; index++)
+        {
+            usage->requested_bytes[index] = atomic_load_explicit(&handle->requested_bytes[index], memory_order_relaxed);
+            usage->live_bytes += usage->requested_bytes[index];
+        }
+        // Counters are read one by one, a concurrent allocation can make
+        // the footprint lag the requested bytes for a moment
+        usage->overhead_bytes = footprint > usage->live_bytes ? footprint - usage->live_bytes : 0;
+        usage->peak_bytes = atomic_load_explicit(&handle->peak_bytes, memory_order_relaxed);
+        usage->allocations = atomic_load_explicit(&handle->allocations, memory_order_relaxed);
+        usage->frees = atomic_load_explicit(&handle->frees, memory_order_relaxed);
+        usage->live_allocations = usage->allocations > usage->frees ? usage->allocations - usage->frees : 0;
+        usage->fragmentation = footprint == 0 ? 0.0 : (double)usage->overhead_bytes / (double)footprint;
+        result = 0;
+    }
+    return result;
+}
@@ -0,0 +1,59 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct MEMORY_TRACKER_INFO_TAG* MEMORY_TRACKER_HANDLE;
+
+// Callers tag every allocation with a category of their own below this
+#define MEMORY_TRACKER_CATEGORIES       8
+
+typedef struct MEMORY_TRACKER_USAGE_TAG
+{
+    // Bytes asked for and still allocated, per category and in total
+    uint64_t requested_bytes[MEMORY_TRACKER_CATEGORIES];
+    uint64_t live_bytes;
+    // Allocator headers and size class rounding on top of live_bytes
+    uint64_t overhead_bytes;
+    // Highest live_bytes + overhead_bytes seen
+    uint64_t peak_bytes;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t live_allocations;
+    // overhead_bytes as a share of everything the allocator handed out
+    double fragmentation;
+} MEMORY_TRACKER_USAGE;
+
+// A tracker is reference counted so structures that share allocations
+// (snapshots of a tree) can share the accounting.  destroy drops one
+// reference and frees the tracker with the last one
+extern MEMORY_TRACKER_HANDLE memory_tracker_create(void);
+extern MEMORY_TRACKER_HANDLE memory_tracker_add_ref(MEMORY_TRACKER_HANDLE handle);
+extern void memory_tracker_destroy(MEMORY_TRACKER_HANDLE handle);
+
+// malloc, realloc and free that account the block against handle.  The
+// caller passes back the size it asked for, nothing is stored in the block.
+// A NULL handle allocates without accounting
+extern void* memory_tracker_malloc(MEMORY_TRACKER_HANDLE handle, size_t category, size_t size);
+extern void* memory_tracker_aligned_alloc(MEMORY_TRACKER_HANDLE handle, size_t category, size_t alignment, size_t size);
+extern void* memory_tracker_realloc(MEMORY_TRACKER_HANDLE handle, size_t category, void* block, size_t old_size, size_t new_size);
+extern void memory_tracker_free(MEMORY_TRACKER_HANDLE handle, size_t category, void* block, size_t size);
+
+extern int memory_tracker_get_usage(MEMORY_TRACKER_HANDLE handle, MEMORY_TRACKER_USAGE* usage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* MEMORY_TRACKER_H */
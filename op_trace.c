@@ -0,0 +1,415 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "op_trace.h"
+#include "stopwatch.h"
+#include "logging.h"
+
+// Records the queue holds, a power of two
+#define OP_TRACE_QUEUE_SIZE     65536
+// Records handed to fwrite at once
+#define OP_TRACE_BATCH_SIZE     4096
+#define OP_TRACE_IDLE_SLEEP_NS  1000000L
+
+// Bounded multi producer multi consumer queue: every cell carries a sequence
+// number that says whether it is free for the producer at that position or
+// holds a record for the consumer at that position
+typedef struct OP_TRACE_CELL_TAG
+{
+    atomic_size_t sequence;
+    OP_TRACE_RECORD record;
+} OP_TRACE_CELL;
+
+typedef struct OP_TRACE_WRITER_INFO_TAG
+{
+    _Alignas(64) atomic_size_t enqueue_position;
+    _Alignas(64) atomic_size_t dequeue_position;
+    _Alignas(64) atomic_int closed;
+    atomic_uint_least64_t dropped;
+    // record calls between counting themselves in and leaving, close waits
+    // for none to be left before it frees the queue
+    _Alignas(64) atomic_size_t active_producers;
+    uint64_t base_ns;
+    FILE* file;
+    int write_failed;
+    pthread_t thread;
+    // Allocated apart from the handle so close can free them while a
+    // replaced handle is kept around for late callers
+    OP_TRACE_RECORD* batch;
+    OP_TRACE_CELL* cells;
+} OP_TRACE_WRITER_INFO;
+
+typedef struct OP_TRACE_READER_INFO_TAG
+{
+    void* mapping;
+    size_t mapping_size;
+    size_t count;
+    uint32_t key_mode;
+    const OP_TRACE_RECORD* records;
+} OP_TRACE_READER_INFO;
+
+static int try_enqueue(OP_TRACE_WRITER_INFO* writer, const OP_TRACE_RECORD* record)
+{
+    int result = __LINE__;
+    size_t position = atomic_load_explicit(&writer->enqueue_position, memory_order_relaxed);
+    for (;;)
+    {
+        OP_TRACE_CELL* cell = &writer->cells[position & (OP_TRACE_QUEUE_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&writer->enqueue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                cell->record = *record;
+                atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+                result = 0;
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Full, the consumer hasn't freed this cell yet
+            break;
+        }
+        else
+        {
+            position = atomic_load_explicit(&writer->enqueue_position, memory_order_relaxed);
+        }
+    }
+    return result;
+}
+
+static int try_dequeue(OP_TRACE_WRITER_INFO* writer, OP_TRACE_RECORD* record)
+{
+    int result = __LINE__;
+    size_t position = atomic_load_explicit(&writer->dequeue_position, memory_order_relaxed);
+    for (;;)
+    {
+        OP_TRACE_CELL* cell = &writer->cells[position & (OP_TRACE_QUEUE_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&writer->dequeue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *record = cell->record;
+                atomic_store_explicit(&cell->sequence, position + OP_TRACE_QUEUE_SIZE, memory_order_release);
+                result = 0;
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Empty
+            break;
+        }
+        else
+        {
+            position = atomic_load_explicit(&writer->dequeue_position, memory_order_relaxed);
+        }
+    }
+    return result;
+}
+
+static size_t write_batch(OP_TRACE_WRITER_INFO* writer)
+{
+    size_t count = 0;
+    while (count < OP_TRACE_BATCH_SIZE && try_dequeue(writer, &writer->batch[count]) == 0)
+    {
+        count++;
+    }
+
+    if (count > 0 && !writer->write_failed && fwrite(writer->batch, sizeof(OP_TRACE_RECORD), count, writer->file) != count)
+    {
+        LogError("FAILURE: writing trace records, the rest of the trace is dropped");
+        writer->write_failed = 1;
+    }
+    return count;
+}
+
+static void free_queue(OP_TRACE_WRITER_INFO* writer)
+{
+    free(writer->batch);
+    free(writer->cells);
+    writer->batch = NULL;
+    writer->cells = NULL;
+}
+
+static void* trace_writer_worker(void* parameter)
+{
+    OP_TRACE_WRITER_INFO* writer = (OP_TRACE_WRITER_INFO*)parameter;
+    struct timespec idle_time = { 0, OP_TRACE_IDLE_SLEEP_NS };
+    while (!atomic_load(&writer->closed))
+    {
+        if (write_batch(writer) < OP_TRACE_BATCH_SIZE)
+        {
+            (void)nanosleep(&idle_time, NULL);
+        }
+    }
+    // Whatever producers managed to queue before close
+    while (write_batch(writer) > 0)
+    {
+    }
+    return NULL;
+}
+
+OP_TRACE_WRITER_HANDLE op_trace_writer_create(const char* path, uint32_t key_mode)
+{
+    OP_TRACE_WRITER_INFO* result;
+    if (path == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on trace writer create");
+        result = NULL;
+    }
+    else if ((result = (OP_TRACE_WRITER_INFO*)malloc(sizeof(OP_TRACE_WRITER_INFO))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate trace writer");
+    }
+    else if ((result->batch = (OP_TRACE_RECORD*)malloc(OP_TRACE_BATCH_SIZE * sizeof(OP_TRACE_RECORD))) == NULL ||
+        (result->cells = (OP_TRACE_CELL*)malloc(OP_TRACE_QUEUE_SIZE * sizeof(OP_TRACE_CELL))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate trace queue");
+        free(result->batch);
+        free(result);
+        result = NULL;
+    }
+    else if ((result->file = fopen(path, "wb")) == NULL)
+    {
+        LogError("FAILURE: unable to open trace file %s", path);
+        free_queue(result);
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        OP_TRACE_HEADER header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, OP_TRACE_MAGIC, sizeof(header.magic));
+        header.version = OP_TRACE_VERSION;
+        header.record_size = sizeof(OP_TRACE_RECORD);
+        header.key_mode = key_mode;
+
+        for (size_t index = 0; index < OP_TRACE_QUEUE_SIZE; index++)
+        {
+            atomic_init(&result->cells[index].sequence, index);
+        }
+        atomic_init(&result->enqueue_position, 0);
+        atomic_init(&result->dequeue_position, 0);
+        atomic_init(&result->closed, 0);
+        atomic_init(&result->dropped, 0);
+        atomic_init(&result->active_producers, 0);
+        result->write_failed = 0;
+        result->base_ns = stopwatch_now_ns();
+
+        if (fwrite(&header, sizeof(header), 1, result->file) != 1)
+        {
+            LogError("FAILURE: writing trace header to %s", path);
+            (void)fclose(result->file);
+            free_queue(result);
+            free(result);
+            result = NULL;
+        }
+        else if (pthread_create(&result->thread, NULL, trace_writer_worker, result) != 0)
+        {
+            LogError("FAILURE: unable to start trace writer thread");
+            (void)fclose(result->file);
+            free_queue(result);
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void op_trace_writer_record(OP_TRACE_WRITER_HANDLE handle, OP_TRACE_OPERATION operation, uint64_t key, int result, uint64_t start_ns, uint64_t end_ns)
+{
+    if (handle != NULL)
+    {
+        OP_TRACE_RECORD record;
+        uint64_t duration = end_ns - start_ns;
+        record.timestamp_ns = start_ns > handle->base_ns ? start_ns - handle->base_ns : 0;
+        record.key = key;
+        record.operation = (uint8_t)operation;
+        record.result = result == 0 ? 0 : 1;
+        record.reserved = 0;
+        record.duration_ns = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration;
+
+        // Counted in before closed is read, so either close sees this call
+        // and waits for it or the call sees close and leaves the queue alone
+        (void)atomic_fetch_add(&handle->active_producers, 1);
+        if (atomic_load(&handle->closed))
+        {
+            (void)atomic_fetch_add_explicit(&handle->dropped, 1, memory_order_relaxed);
+        }
+        else
+        {
+            // A full queue means the writer thread is behind, waiting for it
+            // keeps the trace complete
+            while (try_enqueue(handle, &record) != 0)
+            {
+                if (atomic_load_explicit(&handle->closed, memory_order_relaxed))
+                {
+                    (void)atomic_fetch_add_explicit(&handle->dropped, 1, memory_order_relaxed);
+                    break;
+                }
+                (void)sched_yield();
+            }
+        }
+        (void)atomic_fetch_sub_explicit(&handle->active_producers, 1, memory_order_release);
+    }
+}
+
+int op_trace_writer_close(OP_TRACE_WRITER_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on trace writer close");
+        result = __LINE__;
+    }
+    else if (atomic_exchange(&handle->closed, 1))
+    {
+        // Already closed
+        result = handle->write_failed ? __LINE__ : 0;
+    }
+    else
+    {
+        (void)pthread_join(handle->thread, NULL);
+        if (fclose(handle->file) != 0 || handle->write_failed)
+        {
+            LogError("FAILURE: the trace file is incomplete");
+            result = __LINE__;
+        }
+        else
+        {
+            result = 0;
+        }
+        handle->file = NULL;
+
+        while (atomic_load(&handle->active_producers) != 0)
+        {
+            (void)sched_yield();
+        }
+        free_queue(handle);
+
+        if (atomic_load(&handle->dropped) > 0)
+        {
+            LogError("FAILURE: %llu trace records arrived after close", (unsigned long long)atomic_load(&handle->dropped));
+        }
+    }
+    return result;
+}
+
+void op_trace_writer_destroy(OP_TRACE_WRITER_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        (void)op_trace_writer_close(handle);
+        free(handle);
+    }
+}
+
+OP_TRACE_READER_HANDLE op_trace_reader_open(const char* path)
+{
+    OP_TRACE_READER_INFO* result;
+    if (path == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on trace reader open");
+        result = NULL;
+    }
+    else if ((result = (OP_TRACE_READER_INFO*)malloc(sizeof(OP_TRACE_READER_INFO))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate trace reader");
+    }
+    else
+    {
+        int fd = open(path, O_RDONLY);
+        struct stat file_stat;
+        void* mapping = MAP_FAILED;
+        if (fd < 0)
+        {
+            LogError("FAILURE: unable to open trace file %s", path);
+        }
+        else if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(OP_TRACE_HEADER))
+        {
+            LogError("FAILURE: %s is not a trace file", path);
+        }
+        else
+        {
+            mapping = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                LogError("FAILURE: unable to map trace file %s", path);
+            }
+        }
+
+        if (fd >= 0)
+        {
+            (void)close(fd);
+        }
+
+        if (mapping == MAP_FAILED)
+        {
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            const OP_TRACE_HEADER* header = (const OP_TRACE_HEADER*)mapping;
+            result->mapping = mapping;
+            result->mapping_size = (size_t)file_stat.st_size;
+            if (memcmp(header->magic, OP_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+                header->version != OP_TRACE_VERSION || header->record_size != sizeof(OP_TRACE_RECORD))
+            {
+                LogError("FAILURE: %s has an unknown trace format", path);
+                op_trace_reader_close(result);
+                result = NULL;
+            }
+            else
+            {
+                result->key_mode = header->key_mode;
+                result->records = (const OP_TRACE_RECORD*)(header + 1);
+                result->count = (result->mapping_size - sizeof(OP_TRACE_HEADER)) / sizeof(OP_TRACE_RECORD);
+            }
+        }
+    }
+    return result;
+}
+
+void op_trace_reader_close(OP_TRACE_READER_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        (void)munmap(handle->mapping, handle->mapping_size);
+        free(handle);
+    }
+}
+
+size_t op_trace_reader_count(OP_TRACE_READER_HANDLE handle)
+{
+    return handle == NULL ? 0 : handle->count;
+}
+
+uint32_t op_trace_reader_key_mode(OP_TRACE_READER_HANDLE handle)
+{
+    return handle == NULL ? 0 : handle->key_mode;
+}
+
+const OP_TRACE_RECORD* op_trace_reader_records(OP_TRACE_READER_HANDLE handle)
+{
+    return handle == NULL ? NULL : handle->records;
+}
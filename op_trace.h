@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef OP_TRACE_H
+#define OP_TRACE_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct OP_TRACE_WRITER_INFO_TAG* OP_TRACE_WRITER_HANDLE;
+typedef struct OP_TRACE_READER_INFO_TAG* OP_TRACE_READER_HANDLE;
+
+typedef enum OP_TRACE_OPERATION_TAG
+{
+    OP_TRACE_INSERT,
+    OP_TRACE_REMOVE,
+    OP_TRACE_FIND
+} OP_TRACE_OPERATION;
+
+// A trace file is an OP_TRACE_HEADER followed by records in the order the
+// calls were made, all in the byte order of the machine that recorded them
+#define OP_TRACE_MAGIC          "WSKTRACE"
+#define OP_TRACE_VERSION        2
+
+typedef struct OP_TRACE_HEADER_TAG
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    // BINARY_TREE_KEY_MODE of the recorded tree.  A string key is recorded
+    // as its first 8 bytes
+    uint32_t key_mode;
+    uint32_t reserved;
+} OP_TRACE_HEADER;
+
+typedef struct OP_TRACE_RECORD_TAG
+{
+    // When the call started, relative to the start of the recording
+    uint64_t timestamp_ns;
+    uint64_t key;
+    uint8_t operation;
+    // 0 when the call succeeded or the find hit
+    uint8_t result;
+    uint16_t reserved;
+    // Call duration as the recording process saw it
+    uint32_t duration_ns;
+} OP_TRACE_RECORD;
+
+// Records go into a bounded lock-free queue and a background thread writes
+// them out in large batches.  Callers only wait when that thread falls a
+// whole queue behind.  close flushes and stops the thread and frees the
+// queue once no record call is inside it, records that arrive afterwards
+// are dropped.  A closed handle is small and still safe to record to,
+// destroy frees it and must not race with record
+extern OP_TRACE_WRITER_HANDLE op_trace_writer_create(const char* path, uint32_t key_mode);
+extern void op_trace_writer_record(OP_TRACE_WRITER_HANDLE handle, OP_TRACE_OPERATION operation, uint64_t key, int result, uint64_t start_ns, uint64_t end_ns);
+extern int op_trace_writer_close(OP_TRACE_WRITER_HANDLE handle);
+extern void op_trace_writer_destroy(OP_TRACE_WRITER_HANDLE handle);
+
+// Maps a trace read-only.  A trace cut short by a crash is read up to the
+// last whole record
+extern OP_TRACE_READER_HANDLE op_trace_reader_open(const char* path);
+extern void op_trace_reader_close(OP_TRACE_READER_HANDLE handle);
+extern size_t op_trace_reader_count(OP_TRACE_READER_HANDLE handle);
+extern uint32_t op_trace_reader_key_mode(OP_TRACE_READER_HANDLE handle);
+extern const OP_TRACE_RECORD* op_trace_reader_records(OP_TRACE_READER_HANDLE handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* OP_TRACE_H */
@@ -0,0 +1,1154 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "paged_tree.h"
+#include "logging.h"
+
+#define PAGED_TREE_MAGIC            0x454741504b535755ull
+#define PAGED_TREE_LAYOUT_VERSION   1
+// A tree of 4K pages this high holds far more than any disk
+#define PAGED_TREE_MAX_HEIGHT       12
+#define PAGED_TREE_NO_FRAME         -1
+
+typedef enum PAGE_TYPE_TAG
+{
+    PAGE_TYPE_FREE,
+    PAGE_TYPE_LEAF,
+    PAGE_TYPE_INNER
+} PAGE_TYPE;
+
+typedef struct PAGE_HEADER_TAG
+{
+    uint16_t type;
+    uint16_t count;
+    // The next leaf in key order, or the next free page
+    uint32_t next;
+    uint64_t reserved;
+} PAGE_HEADER;
+
+// Keys and values in separate arrays so a search only touches keys
+#define LEAF_CAPACITY   ((PAGED_TREE_PAGE_SIZE - sizeof(PAGE_HEADER)) / (2 * sizeof(uint64_t)))
+#define INNER_CAPACITY  ((PAGED_TREE_PAGE_SIZE - sizeof(PAGE_HEADER) - sizeof(uint32_t)) / (sizeof(uint64_t) + sizeof(uint32_t)))
+// Pages other than the root are kept at least half full
+#define LEAF_MINIMUM    (LEAF_CAPACITY / 2)
+#define INNER_MINIMUM   (INNER_CAPACITY / 2)
+
+typedef struct LEAF_PAGE_TAG
+{
+    PAGE_HEADER header;
+    uint64_t keys[LEAF_CAPACITY];
+    uint64_t values[LEAF_CAPACITY];
+} LEAF_PAGE;
+
+// children[i] holds the keys from keys[i - 1] up to but not including keys[i]
+typedef struct INNER_PAGE_TAG
+{
+    PAGE_HEADER header;
+    uint64_t keys[INNER_CAPACITY];
+    uint32_t children[INNER_CAPACITY + 1];
+} INNER_PAGE;
+
+// Page 0 of the file, the tree pages are numbered from 1
+typedef struct PAGED_TREE_META_TAG
+{
+    uint64_t magic;
+    uint32_t layout_version;
+    uint32_t page_size;
+    uint64_t items;
+    uint32_t root;
+    uint32_t height;
+    uint32_t page_count;
+    uint32_t free_list;
+} PAGED_TREE_META;
+
+typedef struct PAGE_FRAME_TAG
+{
+    // 0 while the frame holds no page
+    uint32_t page_number;
+    uint32_t pin_count;
+    int dirty;
+    // CLOCK bit, set on every hit and cleared as the hand passes
+    int referenced;
+    int hash_next;
+    unsigned char* bytes;
+} PAGE_FRAME;
+
+typedef struct PAGED_TREE_INFO_TAG
+{
+    int fd;
+    pthread_mutex_t lock;
+    PAGED_TREE_META meta;
+    PAGE_FRAME* frame_list;
+    size_t frame_count;
+    size_t clock_hand;
+    unsigned char* page_bytes;
+    // Page number to frame, chained through hash_next
+    int* bucket_list;
+    size_t bucket_mask;
+    PAGED_TREE_STATS stats;
+} PAGED_TREE_INFO;
+
+static LEAF_PAGE* get_leaf(const PAGE_FRAME* frame)
+{
+    return (LEAF_PAGE*)frame->bytes;
+}
+
+static INNER_PAGE* get_inner(const PAGE_FRAME* frame)
+{
+    return (INNER_PAGE*)frame->bytes;
+}
+
+static PAGE_HEADER* get_header(const PAGE_FRAME* frame)
+{
+    return (PAGE_HEADER*)frame->bytes;
+}
+
+// Buffer pool
+
+static size_t get_bucket(const PAGED_TREE_INFO* tree_info, uint32_t page_number)
+{
+    return (size_t)(page_number * 2654435761u) & tree_info->bucket_mask;
+}
+
+static PAGE_FRAME* find_frame(const PAGED_TREE_INFO* tree_info, uint32_t page_number)
+{
+    PAGE_FRAME* result = NULL;
+    for (int index = tree_info->bucket_list[get_bucket(tree_info, page_number)]; index != PAGED_TREE_NO_FRAME; index = tree_info->frame_list[index].hash_next)
+    {
+        if (tree_info->frame_list[index].page_number == page_number)
+        {
+            result = &tree_info->frame_list[index];
+            break;
+        }
+    }
+    return result;
+}
+
+static void link_frame(PAGED_TREE_INFO* tree_info, PAGE_FRAME* frame)
+{
+    size_t bucket = get_bucket(tree_info, frame->page_number);
+    frame->hash_next = tree_info->bucket_list[bucket];
+    tree_info->bucket_list[bucket] = (int)(frame - tree_info->frame_list);
+}
+
+static void unlink_frame(PAGED_TREE_INFO* tree_info, PAGE_FRAME* frame)
+{
+    int index = (int)(frame - tree_info->frame_list);
+    int* link = &tree_info->bucket_list[get_bucket(tree_info, frame->page_number)];
+    while (*link != index)
+    {
+        link = &tree_info->frame_list[*link].hash_next;
+    }
+    *link = frame->hash_next;
+    frame->page_number = 0;
+}
+
+static int write_page(PAGED_TREE_INFO* tree_info, uint32_t page_number, const void* bytes)
+{
+    int result;
+    if (pwrite(tree_info->fd, bytes, PAGED_TREE_PAGE_SIZE, (off_t)page_number * PAGED_TREE_PAGE_SIZE) != PAGED_TREE_PAGE_SIZE)
+    {
+        LogError("FAILURE: writing page %u", page_number);
+        result = __LINE__;
+    }
+    else
+    {
+        tree_info->stats.page_writes++;
+        result = 0;
+    }
+    return result;
+}
+
+static int write_frame(PAGED_TREE_INFO* tree_info, PAGE_FRAME* frame)
+{
+    int result = 0;
+    if (frame->page_number != 0 && frame->dirty)
+    {
+        if ((result = write_page(tree_info, frame->page_number, frame->bytes)) == 0)
+        {
+            frame->dirty = 0;
+        }
+    }
+    return result;
+}
+
+// Sweeps the CLOCK hand to an unpinned frame whose page wasn't used since
+// the last sweep, writes that page back if it changed and hands the frame out
+static PAGE_FRAME* claim_frame(PAGED_TREE_INFO* tree_info)
+{
+    PAGE_FRAME* result = NULL;
+    for (size_t step = 0; step < 2 * tree_info->frame_count && result == NULL; step++)
+    {
+        PAGE_FRAME* frame = &tree_info->frame_list[tree_info->clock_hand];
+        tree_info->clock_hand = (tree_info->clock_hand + 1) % tree_info->frame_count;
+        if (frame->pin_count > 0)
+        {
+            // In use
+        }
+        else if (frame->referenced)
+        {
+            frame->referenced = 0;
+        }
+        else
+        {
+            result = frame;
+        }
+    }
+
+    if (result == NULL)
+    {
+        LogError("FAILURE: all %zu cached pages are pinned", tree_info->frame_count);
+    }
+    else if (write_frame(tree_info, result) != 0)
+    {
+        result = NULL;
+    }
+    else if (result->page_number != 0)
+    {
+        unlink_frame(tree_info, result);
+        tree_info->stats.evictions++;
+    }
+    return result;
+}
+
+// Returns the page pinned, release_page unpins it.  Pages a scan pulls in
+// don't get their CLOCK bit, so one long scan can't push the hot pages out
+static PAGE_FRAME* fetch_page(PAGED_TREE_INFO* tree_info, uint32_t page_number, int scan)
+{
+    PAGE_FRAME* result;
+    if (page_number == 0 || page_number >= tree_info->meta.page_count)
+    {
+        LogError("FAILURE: page %u is out of range", page_number);
+        result = NULL;
+    }
+    else if ((result = find_frame(tree_info, page_number)) != NULL)
+    {
+        tree_info->stats.cache_hits++;
+        result->referenced = 1;
+        result->pin_count++;
+    }
+    else if ((result = claim_frame(tree_info)) != NULL)
+    {
+        tree_info->stats.cache_misses++;
+        if (pread(tree_info->fd, result->bytes, PAGED_TREE_PAGE_SIZE, (off_t)page_number * PAGED_TREE_PAGE_SIZE) != PAGED_TREE_PAGE_SIZE)
+        {
+            LogError("FAILURE: reading page %u", page_number);
+            result = NULL;
+        }
+        else
+        {
+            tree_info->stats.page_reads++;
+            result->page_number = page_number;
+            result->dirty = 0;
+            result->referenced = !scan;
+            result->pin_count = 1;
+            link_frame(tree_info, result);
+        }
+    }
+    return result;
+}
+
+static void release_page(PAGE_FRAME* frame)
+{
+    if (frame != NULL)
+    {
+        frame->pin_count--;
+    }
+}
+
+// Returns an empty page of type, pinned and dirty
+static PAGE_FRAME* allocate_page(PAGED_TREE_INFO* tree_info, PAGE_TYPE type)
+{
+    PAGE_FRAME* result;
+    if (tree_info->meta.free_list != 0)
+    {
+        if ((result = fetch_page(tree_info, tree_info->meta.free_list, 0)) != NULL)
+        {
+            tree_info->meta.free_list = get_header(result)->next;
+        }
+    }
+    else if (tree_info->meta.page_count == UINT32_MAX)
+    {
+        LogError("FAILURE: paged tree file is full");
+        result = NULL;
+    }
+    else if ((result = claim_frame(tree_info)) != NULL)
+    {
+        result->page_number = tree_info->meta.page_count++;
+        result->pin_count = 1;
+        result->referenced = 1;
+        link_frame(tree_info, result);
+    }
+
+    if (result != NULL)
+    {
+        memset(result->bytes, 0, PAGED_TREE_PAGE_SIZE);
+        get_header(result)->type = (uint16_t)type;
+        result->dirty = 1;
+    }
+    return result;
+}
+
+static void free_page(PAGED_TREE_INFO* tree_info, PAGE_FRAME* frame)
+{
+    get_header(frame)->type = PAGE_TYPE_FREE;
+    get_header(frame)->count = 0;
+    get_header(frame)->next = tree_info->meta.free_list;
+    tree_info->meta.free_list = frame->page_number;
+    frame->dirty = 1;
+}
+
+static int write_meta(PAGED_TREE_INFO* tree_info)
+{
+    unsigned char page[PAGED_TREE_PAGE_SIZE] = { 0 };
+    (void)memcpy(page, &tree_info->meta, sizeof(PAGED_TREE_META));
+    return write_page(tree_info, 0, page);
+}
+
+static int flush_pages(PAGED_TREE_INFO* tree_info)
+{
+    int result = 0;
+    for (size_t index = 0; index < tree_info->frame_count && result == 0; index++)
+    {
+        result = write_frame(tree_info, &tree_info->frame_list[index]);
+    }
+
+    if (result != 0)
+    {
+        // Already logged
+    }
+    else if ((result = write_meta(tree_info)) != 0)
+    {
+        // Already logged
+    }
+    else if (fdatasync(tree_info->fd) != 0)
+    {
+        LogError("FAILURE: syncing paged tree");
+        result = __LINE__;
+    }
+    return result;
+}
+
+// Searching a page
+
+// Position of the first key not below key
+static size_t lower_bound(const uint64_t* keys, size_t count, uint64_t key)
+{
+    size_t low = 0;
+    size_t high = count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (keys[middle] < key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Position of the first key above key, the child of an inner page to follow
+static size_t upper_bound(const uint64_t* keys, size_t count, uint64_t key)
+{
+    size_t low = 0;
+    size_t high = count;
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (keys[middle] <= key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Walks from the root to the leaf that holds key, only ever one page pinned
+static PAGE_FRAME* fetch_leaf(PAGED_TREE_INFO* tree_info, uint64_t key)
+{
+    PAGE_FRAME* result = tree_info->meta.root == 0 ? NULL : fetch_page(tree_info, tree_info->meta.root, 0);
+    while (result != NULL && get_header(result)->type == PAGE_TYPE_INNER)
+    {
+        const INNER_PAGE* inner = get_inner(result);
+        uint32_t child = inner->children[upper_bound(inner->keys, inner->header.count, key)];
+        release_page(result);
+        result = fetch_page(tree_info, child, 0);
+    }
+    return result;
+}
+
+// Insert
+
+static int is_page_full(const PAGE_FRAME* frame)
+{
+    return get_header(frame)->count == (get_header(frame)->type == PAGE_TYPE_LEAF ? LEAF_CAPACITY : INNER_CAPACITY);
+}
+
+// The leaf has room, splits were settled on the way down
+static int insert_into_leaf(PAGE_FRAME* frame, uint64_t key, uint64_t value)
+{
+    int result;
+    LEAF_PAGE* leaf = get_leaf(frame);
+    size_t count = leaf->header.count;
+    size_t position = lower_bound(leaf->keys, count, key);
+    if (position < count && leaf->keys[position] == key)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        (void)memmove(&leaf->keys[position + 1], &leaf->keys[position], (count - position) * sizeof(uint64_t));
+        (void)memmove(&leaf->values[position + 1], &leaf->values[position], (count - position) * sizeof(uint64_t));
+        leaf->keys[position] = key;
+        leaf->values[position] = value;
+        leaf->header.count++;
+        frame->dirty = 1;
+        result = 0;
+    }
+    return result;
+}
+
+// Moves the upper half of the full child at position into a new page
+// right after it.  The parent has room for the separator and the new page
+// is taken before anything moves, so a failure leaves the tree as it was.
+// The new page comes back pinned
+static int split_child(PAGED_TREE_INFO* tree_info, PAGE_FRAME* parent_frame, size_t position, PAGE_FRAME* child_frame, PAGE_FRAME** right_frame)
+{
+    int result;
+    if ((*right_frame = allocate_page(tree_info, (PAGE_TYPE)get_header(child_frame)->type)) == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        INNER_PAGE* parent = get_inner(parent_frame);
+        size_t count = parent->header.count;
+        uint64_t separator;
+        if (get_header(child_frame)->type == PAGE_TYPE_LEAF)
+        {
+            LEAF_PAGE* left = get_leaf(child_frame);
+            LEAF_PAGE* right = get_leaf(*right_frame);
+            size_t left_count = LEAF_CAPACITY / 2;
+            size_t right_count = LEAF_CAPACITY - left_count;
+            (void)memcpy(right->keys, &left->keys[left_count], right_count * sizeof(uint64_t));
+            (void)memcpy(right->values, &left->values[left_count], right_count * sizeof(uint64_t));
+            left->header.count = (uint16_t)left_count;
+            right->header.count = (uint16_t)right_count;
+            right->header.next = left->header.next;
+            left->header.next = (*right_frame)->page_number;
+            separator = right->keys[0];
+        }
+        else
+        {
+            // The middle key moves up to the parent rather than into either half
+            INNER_PAGE* left = get_inner(child_frame);
+            INNER_PAGE* right = get_inner(*right_frame);
+            size_t left_count = INNER_CAPACITY / 2;
+            size_t right_count = INNER_CAPACITY - left_count - 1;
+            (void)memcpy(right->keys, &left->keys[left_count + 1], right_count * sizeof(uint64_t));
+            (void)memcpy(right->children, &left->children[left_count + 1], (right_count + 1) * sizeof(uint32_t));
+            left->header.count = (uint16_t)left_count;
+            right->header.count = (uint16_t)right_count;
+            separator = left->keys[left_count];
+        }
+
+        (void)memmove(&parent->keys[position + 1], &parent->keys[position], (count - position) * sizeof(uint64_t));
+        (void)memmove(&parent->children[position + 2], &parent->children[position + 1], (count - position) * sizeof(uint32_t));
+        parent->keys[position] = separator;
+        parent->children[position + 1] = (*right_frame)->page_number;
+        parent->header.count++;
+        parent_frame->dirty = 1;
+        child_frame->dirty = 1;
+        result = 0;
+    }
+    return result;
+}
+
+// A full root gets a new one on top before an insert goes down.  Both new
+// pages are taken before the old root changes
+static int grow_root(PAGED_TREE_INFO* tree_info)
+{
+    int result;
+    PAGE_FRAME* frame = fetch_page(tree_info, tree_info->meta.root, 0);
+    if (frame == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        PAGE_FRAME* root_frame;
+        PAGE_FRAME* right_frame;
+        if (!is_page_full(frame))
+        {
+            result = 0;
+        }
+        else if (tree_info->meta.height == PAGED_TREE_MAX_HEIGHT)
+        {
+            LogError("FAILURE: unable to grow the paged tree");
+            result = __LINE__;
+        }
+        else if ((root_frame = allocate_page(tree_info, PAGE_TYPE_INNER)) == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            get_inner(root_frame)->children[0] = tree_info->meta.root;
+            if (split_child(tree_info, root_frame, 0, frame, &right_frame) != 0)
+            {
+                free_page(tree_info, root_frame);
+                result = __LINE__;
+            }
+            else
+            {
+                tree_info->meta.root = root_frame->page_number;
+                tree_info->meta.height++;
+                release_page(right_frame);
+                result = 0;
+            }
+            release_page(root_frame);
+        }
+        release_page(frame);
+    }
+    return result;
+}
+
+// Goes down from the root splitting every full page before stepping into
+// it, so no split ever has to travel back up to a parent that can't take
+// it.  A page, its child and the page split off it are all that is pinned
+static int insert_into(PAGED_TREE_INFO* tree_info, uint64_t key, uint64_t value)
+{
+    int result;
+    PAGE_FRAME* frame = fetch_page(tree_info, tree_info->meta.root, 0);
+    while (frame != NULL && get_header(frame)->type == PAGE_TYPE_INNER)
+    {
+        INNER_PAGE* inner = get_inner(frame);
+        size_t position = upper_bound(inner->keys, inner->header.count, key);
+        PAGE_FRAME* child_frame = fetch_page(tree_info, inner->children[position], 0);
+        PAGE_FRAME* right_frame;
+        if (child_frame == NULL || !is_page_full(child_frame))
+        {
+            // Nothing to split, or a failed read that was logged
+        }
+        else if (split_child(tree_info, frame, position, child_frame, &right_frame) != 0)
+        {
+            release_page(child_frame);
+            child_frame = NULL;
+        }
+        else if (key < inner->keys[position])
+        {
+            release_page(right_frame);
+        }
+        else
+        {
+            release_page(child_frame);
+            child_frame = right_frame;
+        }
+        release_page(frame);
+        frame = child_frame;
+    }
+
+    if (frame == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        result = insert_into_leaf(frame, key, value);
+        release_page(frame);
+    }
+    return result;
+}
+
+// Remove
+
+static size_t get_minimum(const PAGE_FRAME* frame)
+{
+    return get_header(frame)->type == PAGE_TYPE_LEAF ? LEAF_MINIMUM : INNER_MINIMUM;
+}
+
+// Moves one entry from the fuller sibling into the page that ran low,
+// through the separator in the parent for inner pages
+static void borrow_entry(INNER_PAGE* parent, size_t separator, PAGE_FRAME* left_frame, PAGE_FRAME* right_frame, int from_left)
+{
+    if (get_header(left_frame)->type == PAGE_TYPE_LEAF)
+    {
+        LEAF_PAGE* left = get_leaf(left_frame);
+        LEAF_PAGE* right = get_leaf(right_frame);
+        if (from_left)
+        {
+            size_t last = left->header.count - 1;
+            (void)memmove(&right->keys[1], right->keys, right->header.count * sizeof(uint64_t));
+            (void)memmove(&right->values[1], right->values, right->header.count * sizeof(uint64_t));
+            right->keys[0] = left->keys[last];
+            right->values[0] = left->values[last];
+        }
+        else
+        {
+            left->keys[left->header.count] = right->keys[0];
+            left->values[left->header.count] = right->values[0];
+            (void)memmove(right->keys, &right->keys[1], (right->header.count - 1) * sizeof(uint64_t));
+            (void)memmove(right->values, &right->values[1], (right->header.count - 1) * sizeof(uint64_t));
+        }
+        left->header.count = (uint16_t)(from_left ? left->header.count - 1 : left->header.count + 1);
+        right->header.count = (uint16_t)(from_left ? right->header.count + 1 : right->header.count - 1);
+        parent->keys[separator] = right->keys[0];
+    }
+    else
+    {
+        INNER_PAGE* left = get_inner(left_frame);
+        INNER_PAGE* right = get_inner(right_frame);
+        if (from_left)
+        {
+            size_t last = left->header.count;
+            (void)memmove(&right->keys[1], right->keys, right->header.count * sizeof(uint64_t));
+            (void)memmove(&right->children[1], right->children, (right->header.count + 1) * sizeof(uint32_t));
+            right->keys[0] = parent->keys[separator];
+            right->children[0] = left->children[last];
+            parent->keys[separator] = left->keys[last - 1];
+            left->header.count--;
+            right->header.count++;
+        }
+        else
+        {
+            left->keys[left->header.count] = parent->keys[separator];
+            left->children[left->header.count + 1] = right->children[0];
+            parent->keys[separator] = right->keys[0];
+            (void)memmove(right->keys, &right->keys[1], (right->header.count - 1) * sizeof(uint64_t));
+            (void)memmove(right->children, &right->children[1], right->header.count * sizeof(uint32_t));
+            left->header.count++;
+            right->header.count--;
+        }
+    }
+}
+
+// Appends right to left, frees right and drops its separator from the parent
+static void merge_pages(PAGED_TREE_INFO* tree_info, INNER_PAGE* parent, size_t separator, PAGE_FRAME* left_frame, PAGE_FRAME* right_frame)
+{
+    if (get_header(left_frame)->type == PAGE_TYPE_LEAF)
+    {
+        LEAF_PAGE* left = get_leaf(left_frame);
+        LEAF_PAGE* right = get_leaf(right_frame);
+        (void)memcpy(&left->keys[left->header.count], right->keys, right->header.count * sizeof(uint64_t));
+        (void)memcpy(&left->values[left->header.count], right->values, right->header.count * sizeof(uint64_t));
+        left->header.count = (uint16_t)(left->header.count + right->header.count);
+        left->header.next = right->header.next;
+    }
+    else
+    {
+        INNER_PAGE* left = get_inner(left_frame);
+        INNER_PAGE* right = get_inner(right_frame);
+        left->keys[left->header.count] = parent->keys[separator];
+        (void)memcpy(&left->keys[left->header.count + 1], right->keys, right->header.count * sizeof(uint64_t));
+        (void)memcpy(&left->children[left->header.count + 1], right->children, (right->header.count + 1) * sizeof(uint32_t));
+        left->header.count = (uint16_t)(left->header.count + 1 + right->header.count);
+    }
+
+    (void)memmove(&parent->keys[separator], &parent->keys[separator + 1], (parent->header.count - separator - 1) * sizeof(uint64_t));
+    (void)memmove(&parent->children[separator + 1], &parent->children[separator + 2], (parent->header.count - separator - 1) * sizeof(uint32_t));
+    parent->header.count--;
+    free_page(tree_info, right_frame);
+}
+
+// The child at position fell below half full, borrow from or merge with a sibling
+static int fix_underflow(PAGED_TREE_INFO* tree_info, PAGE_FRAME* parent_frame, size_t position, PAGE_FRAME* child_frame)
+{
+    int result;
+    INNER_PAGE* parent = get_inner(parent_frame);
+    int from_left = position > 0;
+    PAGE_FRAME* sibling_frame = fetch_page(tree_info, parent->children[from_left ? position - 1 : position + 1], 0);
+    if (sibling_frame == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        PAGE_FRAME* left_frame = from_left ? sibling_frame : child_frame;
+        PAGE_FRAME* right_frame = from_left ? child_frame : sibling_frame;
+        size_t separator = from_left ? position - 1 : position;
+        if (get_header(sibling_frame)->count > get_minimum(sibling_frame))
+        {
+            borrow_entry(parent, separator, left_frame, right_frame, from_left);
+        }
+        else
+        {
+            merge_pages(tree_info, parent, separator, left_frame, right_frame);
+        }
+        parent_frame->dirty = 1;
+        left_frame->dirty = 1;
+        right_frame->dirty = 1;
+        release_page(sibling_frame);
+        result = 0;
+    }
+    return result;
+}
+
+static int remove_from(PAGED_TREE_INFO* tree_info, PAGE_FRAME* frame, uint64_t key, uint64_t* removed_value)
+{
+    int result;
+    if (get_header(frame)->type == PAGE_TYPE_LEAF)
+    {
+        LEAF_PAGE* leaf = get_leaf(frame);
+        size_t count = leaf->header.count;
+        size_t position = lower_bound(leaf->keys, count, key);
+        if (position == count || leaf->keys[position] != key)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            *removed_value = leaf->values[position];
+            (void)memmove(&leaf->keys[position], &leaf->keys[position + 1], (count - position - 1) * sizeof(uint64_t));
+            (void)memmove(&leaf->values[position], &leaf->values[position + 1], (count - position - 1) * sizeof(uint64_t));
+            leaf->header.count--;
+            frame->dirty = 1;
+            result = 0;
+        }
+    }
+    else
+    {
+        INNER_PAGE* inner = get_inner(frame);
+        size_t position = upper_bound(inner->keys, inner->header.count, key);
+        PAGE_FRAME* child_frame = fetch_page(tree_info, inner->children[position], 0);
+        if (child_frame == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            if ((result = remove_from(tree_info, child_frame, key, removed_value)) == 0 && get_header(child_frame)->count < get_minimum(child_frame))
+            {
+                result = fix_underflow(tree_info, frame, position, child_frame);
+            }
+            release_page(child_frame);
+        }
+    }
+    return result;
+}
+
+static int validate_meta(const PAGED_TREE_META* meta, off_t file_size)
+{
+    int result;
+    if (meta->magic != PAGED_TREE_MAGIC || meta->layout_version != PAGED_TREE_LAYOUT_VERSION || meta->page_size != PAGED_TREE_PAGE_SIZE)
+    {
+        LogError("FAILURE: unknown paged tree format");
+        result = __LINE__;
+    }
+    else if (meta->page_count == 0 || (uint64_t)file_size < (uint64_t)meta->page_count * PAGED_TREE_PAGE_SIZE ||
+        meta->root >= meta->page_count || meta->free_list >= meta->page_count || meta->height > PAGED_TREE_MAX_HEIGHT ||
+        (meta->root == 0) != (meta->height == 0))
+    {
+        LogError("FAILURE: paged tree header is inconsistent");
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static int load_meta(PAGED_TREE_INFO* tree_info, const char* path)
+{
+    int result;
+    struct stat file_stat;
+    if (fstat(tree_info->fd, &file_stat) != 0)
+    {
+        LogError("FAILURE: unable to stat %s", path);
+        result = __LINE__;
+    }
+    else if (file_stat.st_size == 0)
+    {
+        memset(&tree_info->meta, 0, sizeof(PAGED_TREE_META));
+        tree_info->meta.magic = PAGED_TREE_MAGIC;
+        tree_info->meta.layout_version = PAGED_TREE_LAYOUT_VERSION;
+        tree_info->meta.page_size = PAGED_TREE_PAGE_SIZE;
+        tree_info->meta.page_count = 1;
+        result = write_meta(tree_info);
+    }
+    else if (pread(tree_info->fd, &tree_info->meta, sizeof(PAGED_TREE_META), 0) != (ssize_t)sizeof(PAGED_TREE_META))
+    {
+        LogError("FAILURE: %s is not a paged tree", path);
+        result = __LINE__;
+    }
+    else
+    {
+        result = validate_meta(&tree_info->meta, file_stat.st_size);
+    }
+    return result;
+}
+
+static int allocate_pool(PAGED_TREE_INFO* tree_info, size_t cache_pages)
+{
+    int result;
+    size_t bucket_count = 1;
+    while (bucket_count < 2 * cache_pages)
+    {
+        bucket_count *= 2;
+    }
+
+    tree_info->frame_count = cache_pages;
+    tree_info->bucket_mask = bucket_count - 1;
+    tree_info->frame_list = (PAGE_FRAME*)calloc(cache_pages, sizeof(PAGE_FRAME));
+    tree_info->bucket_list = (int*)malloc(bucket_count * sizeof(int));
+    if (posix_memalign((void**)&tree_info->page_bytes, PAGED_TREE_PAGE_SIZE, cache_pages * PAGED_TREE_PAGE_SIZE) != 0)
+    {
+        tree_info->page_bytes = NULL;
+    }
+
+    if (tree_info->frame_list == NULL || tree_info->bucket_list == NULL || tree_info->page_bytes == NULL)
+    {
+        LogError("FAILURE: unable to allocate %zu cached pages", cache_pages);
+        result = __LINE__;
+    }
+    else
+    {
+        for (size_t index = 0; index < bucket_count; index++)
+        {
+            tree_info->bucket_list[index] = PAGED_TREE_NO_FRAME;
+        }
+        for (size_t index = 0; index < cache_pages; index++)
+        {
+            tree_info->frame_list[index].hash_next = PAGED_TREE_NO_FRAME;
+            tree_info->frame_list[index].bytes = tree_info->page_bytes + index * PAGED_TREE_PAGE_SIZE;
+        }
+        result = 0;
+    }
+    return result;
+}
+
+static void free_tree_info(PAGED_TREE_INFO* tree_info)
+{
+    if (tree_info->fd >= 0)
+    {
+        (void)close(tree_info->fd);
+    }
+    (void)pthread_mutex_destroy(&tree_info->lock);
+    free(tree_info->frame_list);
+    free(tree_info->bucket_list);
+    free(tree_info->page_bytes);
+    free(tree_info);
+}
+
+PAGED_TREE_HANDLE paged_tree_open(const char* path, size_t cache_pages)
+{
+    PAGED_TREE_INFO* result;
+    if (path == NULL || cache_pages < PAGED_TREE_MIN_CACHE_PAGES || cache_pages > INT32_MAX)
+    {
+        LogError("FAILURE: Invalid parameter specified on paged tree open");
+        result = NULL;
+    }
+    else if ((result = (PAGED_TREE_INFO*)calloc(1, sizeof(PAGED_TREE_INFO))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate paged tree");
+    }
+    else
+    {
+        (void)pthread_mutex_init(&result->lock, NULL);
+        if ((result->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+        {
+            LogError("FAILURE: unable to open %s", path);
+            free_tree_info(result);
+            result = NULL;
+        }
+        else if (load_meta(result, path) != 0 || allocate_pool(result, cache_pages) != 0)
+        {
+            free_tree_info(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void paged_tree_destroy(PAGED_TREE_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        if (flush_pages(handle) != 0)
+        {
+            LogError("FAILURE: paged tree was not fully written on close");
+        }
+        free_tree_info(handle);
+    }
+}
+
+int paged_tree_flush(PAGED_TREE_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on paged tree flush");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->lock);
+        result = flush_pages(handle);
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+int paged_tree_insert(PAGED_TREE_HANDLE handle, uint64_t key, uint64_t value)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on paged tree insert");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->lock);
+        if (handle->meta.root == 0)
+        {
+            PAGE_FRAME* frame = allocate_page(handle, PAGE_TYPE_LEAF);
+            if (frame == NULL)
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                handle->meta.root = frame->page_number;
+                handle->meta.height = 1;
+                release_page(frame);
+                result = 0;
+            }
+        }
+        else
+        {
+            result = grow_root(handle);
+        }
+
+        if (result != 0)
+        {
+            // Already logged
+        }
+        else if ((result = insert_into(handle, key, value)) != 0)
+        {
+            // Duplicate key or an I/O failure that was logged
+        }
+
+        if (result == 0)
+        {
+            handle->meta.items++;
+        }
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+int paged_tree_remove(PAGED_TREE_HANDLE handle, uint64_t key, uint64_t* removed_value)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on paged tree remove");
+        result = __LINE__;
+    }
+    else
+    {
+        uint64_t value;
+        PAGE_FRAME* frame;
+        (void)pthread_mutex_lock(&handle->lock);
+        if (handle->meta.root == 0)
+        {
+            result = __LINE__;
+        }
+        else if ((frame = fetch_page(handle, handle->meta.root, 0)) == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            if ((result = remove_from(handle, frame, key, &value)) == 0)
+            {
+                PAGE_HEADER* header = get_header(frame);
+                handle->meta.items--;
+                if (removed_value != NULL)
+                {
+                    *removed_value = value;
+                }
+
+                // The root may be left with a single child, or nothing at all
+                if (header->count == 0)
+                {
+                    handle->meta.root = header->type == PAGE_TYPE_INNER ? get_inner(frame)->children[0] : 0;
+                    handle->meta.height--;
+                    free_page(handle, frame);
+                }
+            }
+            release_page(frame);
+        }
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+int paged_tree_find(PAGED_TREE_HANDLE handle, uint64_t key, uint64_t* value)
+{
+    int result;
+    if (handle == NULL || value == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on paged tree find");
+        result = __LINE__;
+    }
+    else
+    {
+        PAGE_FRAME* frame;
+        (void)pthread_mutex_lock(&handle->lock);
+        if ((frame = fetch_leaf(handle, key)) == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            const LEAF_PAGE* leaf = get_leaf(frame);
+            size_t position = lower_bound(leaf->keys, leaf->header.count, key);
+            if (position == leaf->header.count || leaf->keys[position] != key)
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                *value = leaf->values[position];
+                result = 0;
+            }
+            release_page(frame);
+        }
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+int paged_tree_scan(PAGED_TREE_HANDLE handle, uint64_t low, uint64_t high, paged_tree_visitor_callback visitor, void* context)
+{
+    int result;
+    if (handle == NULL || visitor == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on paged tree scan");
+        result = __LINE__;
+    }
+    else
+    {
+        PAGE_FRAME* frame;
+        (void)pthread_mutex_lock(&handle->lock);
+        if (low > high || handle->meta.root == 0)
+        {
+            result = 0;
+        }
+        else if ((frame = fetch_leaf(handle, low)) == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            const LEAF_PAGE* leaf = get_leaf(frame);
+            size_t position = lower_bound(leaf->keys, leaf->header.count, low);
+            int done = 0;
+            result = 0;
+            while (!done)
+            {
+                for (; position < leaf->header.count && leaf->keys[position] <= high; position++)
+                {
+                    visitor(leaf->keys[position], leaf->values[position], context);
+                }
+
+                if (position < leaf->header.count || leaf->header.next == 0)
+                {
+                    done = 1;
+                }
+                else
+                {
+                    // Straight on to the next leaf, the inner pages aren't needed again
+                    PAGE_FRAME* next_frame = fetch_page(handle, leaf->header.next, 1);
+                    release_page(frame);
+                    frame = next_frame;
+                    if (frame == NULL)
+                    {
+                        result = __LINE__;
+                        done = 1;
+                    }
+                    else
+                    {
+                        leaf = get_leaf(frame);
+                        position = 0;
+                    }
+                }
+            }
+            release_page(frame);
+        }
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+size_t paged_tree_item_count(PAGED_TREE_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on paged tree item count");
+        result = 0;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->lock);
+        result = (size_t)handle->meta.items;
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+size_t paged_tree_height(PAGED_TREE_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on paged tree height");
+        result = 0;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->lock);
+        result = handle->meta.height;
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+int paged_tree_get_stats(PAGED_TREE_HANDLE handle, PAGED_TREE_STATS* stats)
+{
+    int result;
+    if (handle == NULL || stats == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on paged tree stats");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->lock);
+        *stats = handle->stats;
+        stats->file_pages = handle->meta.page_count;
+        (void)pthread_mutex_unlock(&handle->lock);
+        result = 0;
+    }
+    return result;
+}
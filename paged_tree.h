@@ -0,0 +1,69 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef PAGED_TREE_H
+#define PAGED_TREE_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct PAGED_TREE_INFO_TAG* PAGED_TREE_HANDLE;
+
+// A B+-tree of uint64_t keys and values kept in fixed size pages of a local
+// file, for data that doesn't fit in memory.  Only cache_pages pages are
+// held in memory at a time, in a buffer pool that evicts with CLOCK and
+// writes dirty pages back with pwrite.  Entries live in the leaves, which
+// are chained in key order so scans read them one after the other without
+// going back through the inner pages.
+//
+// The file is only consistent once paged_tree_flush or paged_tree_destroy
+// has returned.  Every call takes one lock, so threads take turns
+#define PAGED_TREE_PAGE_SIZE        4096
+// Enough for every page an insert or remove can hold pinned at once
+#define PAGED_TREE_MIN_CACHE_PAGES  16
+
+typedef void (*paged_tree_visitor_callback)(uint64_t key, uint64_t value, void* context);
+
+typedef struct PAGED_TREE_STATS_TAG
+{
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t page_reads;
+    uint64_t page_writes;
+    uint64_t evictions;
+    // Pages in the file, the header page and free pages included
+    uint64_t file_pages;
+} PAGED_TREE_STATS;
+
+// Opens the tree in path, creating the file when it is missing or empty
+extern PAGED_TREE_HANDLE paged_tree_open(const char* path, size_t cache_pages);
+// Flushes and closes the file
+extern void paged_tree_destroy(PAGED_TREE_HANDLE handle);
+// Writes every dirty page and the header and syncs the file
+extern int paged_tree_flush(PAGED_TREE_HANDLE handle);
+
+// Insert fails when the key is already in the tree.  removed_value may be NULL
+extern int paged_tree_insert(PAGED_TREE_HANDLE handle, uint64_t key, uint64_t value);
+extern int paged_tree_remove(PAGED_TREE_HANDLE handle, uint64_t key, uint64_t* removed_value);
+extern int paged_tree_find(PAGED_TREE_HANDLE handle, uint64_t key, uint64_t* value);
+// Visits the entries from low to high, both included, in key order.  The
+// tree stays locked meanwhile, the visitor must not use it
+extern int paged_tree_scan(PAGED_TREE_HANDLE handle, uint64_t low, uint64_t high, paged_tree_visitor_callback visitor, void* context);
+
+extern size_t paged_tree_item_count(PAGED_TREE_HANDLE handle);
+// Levels of pages, 1 for a lone leaf and 0 for an empty tree
+extern size_t paged_tree_height(PAGED_TREE_HANDLE handle);
+extern int paged_tree_get_stats(PAGED_TREE_HANDLE handle, PAGED_TREE_STATS* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* PAGED_TREE_H */
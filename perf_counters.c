@@ -0,0 +1,223 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perf_counters.h"
+#include "logging.h"
+
+typedef struct PERF_COUNTERS_INFO_TAG
+{
+    int fds[PERF_COUNTER_COUNT];
+    uint64_t values[PERF_COUNTER_COUNT];
+} PERF_COUNTERS_INFO;
+
+static const char* PERF_COUNTER_NAMES[PERF_COUNTER_COUNT] =
+{
+    "cycles", "instructions", "l1d-misses", "llc-misses", "branch-misses", "dtlb-misses", "task-clock-ns", "page-faults"
+};
+
+#ifdef __linux__
+typedef struct PERF_COUNTER_EVENT_TAG
+{
+    uint32_t type;
+    uint64_t config;
+} PERF_COUNTER_EVENT;
+
+#define CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const PERF_COUNTER_EVENT PERF_COUNTER_EVENTS[PERF_COUNTER_COUNT] =
+{
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+};
+
+static int open_counter(const PERF_COUNTER_EVENT* event)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event->type;
+    attr.config = event->config;
+    attr.disabled = 1;
+    // Kernel and hypervisor time would need perf_event_paranoid below 2
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+PERF_COUNTERS_HANDLE perf_counters_create()
+{
+    PERF_COUNTERS_INFO* result = (PERF_COUNTERS_INFO*)malloc(sizeof(PERF_COUNTERS_INFO));
+    if (result == NULL)
+    {
+        LogError("FAILURE: unable to allocate perf counters");
+    }
+    else
+    {
+        size_t open_count = 0;
+        memset(result->values, 0, sizeof(result->values));
+        for (size_t index = 0; index < PERF_COUNTER_COUNT; index++)
+        {
+#ifdef __linux__
+            result->fds[index] = open_counter(&PERF_COUNTER_EVENTS[index]);
+#else
+            result->fds[index] = -1;
+#endif
+            if (result->fds[index] >= 0)
+            {
+                open_count++;
+            }
+        }
+
+        if (open_count == 0)
+        {
+            LogError("FAILURE: no perf counters could be opened");
+        }
+        else if (result->fds[PERF_COUNTER_CYCLES] < 0)
+        {
+            LogDebug("Hardware counters are not available, using software counters only");
+        }
+    }
+    return result;
+}
+
+void perf_counters_destroy(PERF_COUNTERS_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        for (size_t index = 0; index < PERF_COUNTER_COUNT; index++)
+        {
+#ifdef __linux__
+            if (handle->fds[index] >= 0)
+            {
+                (void)close(handle->fds[index]);
+            }
+#endif
+        }
+        free(handle);
+    }
+}
+
+int perf_counters_start(PERF_COUNTERS_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on start");
+        result = __LINE__;
+    }
+    else
+    {
+        for (size_t index = 0; index < PERF_COUNTER_COUNT; index++)
+        {
+#ifdef __linux__
+            if (handle->fds[index] >= 0)
+            {
+                (void)ioctl(handle->fds[index], PERF_EVENT_IOC_RESET, 0);
+                (void)ioctl(handle->fds[index], PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+        result = 0;
+    }
+    return result;
+}
+
+int perf_counters_stop(PERF_COUNTERS_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on stop");
+        result = __LINE__;
+    }
+    else
+    {
+        for (size_t index = 0; index < PERF_COUNTER_COUNT; index++)
+        {
+#ifdef __linux__
+            if (handle->fds[index] >= 0)
+            {
+                (void)ioctl(handle->fds[index], PERF_EVENT_IOC_DISABLE, 0);
+            }
+#endif
+        }
+
+        for (size_t index = 0; index < PERF_COUNTER_COUNT; index++)
+        {
+            handle->values[index] = 0;
+#ifdef __linux__
+            // value, time enabled, time running
+            uint64_t reading[3];
+            if (handle->fds[index] >= 0 && read(handle->fds[index], reading, sizeof(reading)) == (ssize_t)sizeof(reading) && reading[2] != 0)
+            {
+                handle->values[index] = reading[2] == reading[1] ? reading[0] : (uint64_t)((double)reading[0] * (double)reading[1] / (double)reading[2]);
+            }
+#endif
+        }
+        result = 0;
+    }
+    return result;
+}
+
+int perf_counters_is_available(PERF_COUNTERS_HANDLE handle, PERF_COUNTER counter)
+{
+    return handle != NULL && counter < PERF_COUNTER_COUNT && handle->fds[counter] >= 0;
+}
+
+uint64_t perf_counters_get(PERF_COUNTERS_HANDLE handle, PERF_COUNTER counter)
+{
+    return perf_counters_is_available(handle, counter) ? handle->values[counter] : 0;
+}
+
+const char* perf_counters_get_name(PERF_COUNTER counter)
+{
+    return counter < PERF_COUNTER_COUNT ? PERF_COUNTER_NAMES[counter] : "unknown";
+}
+
+int perf_counters_print(PERF_COUNTERS_HANDLE handle, FILE* output, const char* name, size_t operations)
+{
+    int result;
+    if (handle == NULL || output == NULL || operations == 0)
+    {
+        LogError("FAILURE: Invalid parameter specified on print");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)fprintf(output, "%-12s per op:", name == NULL ? "counters" : name);
+        for (size_t index = 0; index < PERF_COUNTER_COUNT; index++)
+        {
+            if (handle->fds[index] >= 0)
+            {
+                (void)fprintf(output, " %s %.2f", PERF_COUNTER_NAMES[index], (double)handle->values[index] / (double)operations);
+            }
+        }
+        if (handle->fds[PERF_COUNTER_CYCLES] >= 0 && handle->fds[PERF_COUNTER_INSTRUCTIONS] >= 0 && handle->values[PERF_COUNTER_CYCLES] != 0)
+        {
+            (void)fprintf(output, " ipc %.2f", (double)handle->values[PERF_COUNTER_INSTRUCTIONS] / (double)handle->values[PERF_COUNTER_CYCLES]);
+        }
+        (void)fprintf(output, "\r\n");
+        result = 0;
+    }
+    return result;
+}
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+// Linux perf_event_open counters for the calling thread, user space only.
+// Counters the kernel does not permit or the cpu does not have are left
+// closed, the software ones (task clock, page faults) open nearly everywhere.
+typedef struct PERF_COUNTERS_INFO_TAG* PERF_COUNTERS_HANDLE;
+
+typedef enum PERF_COUNTER_TAG
+{
+    PERF_COUNTER_CYCLES,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_L1D_MISSES,
+    PERF_COUNTER_LLC_MISSES,
+    PERF_COUNTER_BRANCH_MISSES,
+    PERF_COUNTER_DTLB_MISSES,
+    PERF_COUNTER_TASK_CLOCK,
+    PERF_COUNTER_PAGE_FAULTS,
+    PERF_COUNTER_COUNT
+} PERF_COUNTER;
+
+extern PERF_COUNTERS_HANDLE perf_counters_create();
+extern void perf_counters_destroy(PERF_COUNTERS_HANDLE handle);
+
+// Resets and enables every open counter
+extern int perf_counters_start(PERF_COUNTERS_HANDLE handle);
+// Disables the counters and latches their values
+extern int perf_counters_stop(PERF_COUNTERS_HANDLE handle);
+
+extern int perf_counters_is_available(PERF_COUNTERS_HANDLE handle, PERF_COUNTER counter);
+// Value latched by the last stop, scaled up if the kernel multiplexed the counter
+extern uint64_t perf_counters_get(PERF_COUNTERS_HANDLE handle, PERF_COUNTER counter);
+extern const char* perf_counters_get_name(PERF_COUNTER counter);
+
+// One line with every available counter divided by operations
+extern int perf_counters_print(PERF_COUNTERS_HANDLE handle, FILE* output, const char* name, size_t operations);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* PERF_COUNTERS_H */
@@ -0,0 +1,707 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shared_tree.h"
+#include "logging.h"
+
+#define SHARED_TREE_MAGIC           0x57534b54u
+#define SHARED_TREE_NAME_LENGTH     256
+// A reader that keeps losing to the writer gives up after this many tries
+#define SHARED_TREE_READ_RETRIES    10000
+// Deeper than any AVL tree that fits in memory, walks that get this far
+// are following links torn by a write
+#define SHARED_TREE_MAX_DEPTH       128
+// Entries a range query copies out per consistent read
+#define SHARED_TREE_RANGE_BATCH     256
+
+// The fields readers follow are relaxed atomics so a read that overlaps a
+// write is a retry and not a data race.  Links are offsets from the start
+// of the segment, 0 for none
+typedef struct SHARED_TREE_NODE_TAG
+{
+    atomic_uint_least64_t key;
+    atomic_uint_least64_t value;
+    // left also links the free nodes
+    atomic_uint_least64_t left;
+    atomic_uint_least64_t right;
+    // Only used by the writer
+    uint64_t height;
+} SHARED_TREE_NODE;
+
+typedef struct SHARED_TREE_LAYOUT_TAG
+{
+    uint32_t magic;
+    uint32_t layout_version;
+    uint64_t capacity;
+    // Odd while a write is in progress
+    atomic_uint_least64_t sequence;
+    atomic_uint_least64_t root;
+    atomic_uint_least64_t items;
+    // Only used by the writer: the free list and the first node never handed out
+    uint64_t free_list;
+    uint64_t next_unused;
+    SHARED_TREE_NODE nodes[];
+} SHARED_TREE_LAYOUT;
+
+typedef struct SHARED_TREE_ENTRY_TAG
+{
+    uint64_t key;
+    uint64_t value;
+} SHARED_TREE_ENTRY;
+
+typedef struct SHARED_TREE_INFO_TAG
+{
+    SHARED_TREE_LAYOUT* layout;
+    size_t layout_size;
+    // Taken from the segment size rather than trusted from the segment
+    uint64_t capacity;
+    int owner;
+    pthread_mutex_t write_lock;
+    char name[SHARED_TREE_NAME_LENGTH];
+} SHARED_TREE_INFO;
+
+static int build_name(const char* name, char full_name[SHARED_TREE_NAME_LENGTH])
+{
+    int result;
+    int length = snprintf(full_name, SHARED_TREE_NAME_LENGTH, "%s%s", name[0] == '/' ? "" : "/", name);
+    if (name[0] == '\0' || length < 0 || length >= SHARED_TREE_NAME_LENGTH || strchr(full_name + 1, '/') != NULL)
+    {
+        LogError("FAILURE: Invalid shared tree name %s", name);
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static size_t get_layout_size(uint64_t capacity)
+{
+    return sizeof(SHARED_TREE_LAYOUT) + (size_t)capacity * sizeof(SHARED_TREE_NODE);
+}
+
+static SHARED_TREE_NODE* get_node(const SHARED_TREE_INFO* tree_info, uint64_t offset)
+{
+    return (SHARED_TREE_NODE*)((unsigned char*)tree_info->layout + offset);
+}
+
+// Readers check every offset they load, one read during a write can be anything
+static int is_valid_offset(const SHARED_TREE_INFO* tree_info, uint64_t offset)
+{
+    uint64_t first = offsetof(SHARED_TREE_LAYOUT, nodes);
+    return offset >= first && (offset - first) % sizeof(SHARED_TREE_NODE) == 0 && (offset - first) / sizeof(SHARED_TREE_NODE) < tree_info->capacity;
+}
+
+static uint64_t load_field(atomic_uint_least64_t* field)
+{
+    return atomic_load_explicit(field, memory_order_relaxed);
+}
+
+static void store_field(atomic_uint_least64_t* field, uint64_t value)
+{
+    atomic_store_explicit(field, value, memory_order_relaxed);
+}
+
+static SHARED_TREE_INFO* map_tree(const char* name, int owner, uint64_t capacity)
+{
+    SHARED_TREE_INFO* result;
+    if (name == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on shared tree");
+        result = NULL;
+    }
+    else if ((result = (SHARED_TREE_INFO*)malloc(sizeof(SHARED_TREE_INFO))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate shared tree");
+    }
+    else if (build_name(name, result->name) != 0)
+    {
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        int fd = shm_open(result->name, owner ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        struct stat segment_stat;
+        void* mapping = MAP_FAILED;
+        if (fd < 0)
+        {
+            LogError("FAILURE: opening shared memory %s", result->name);
+        }
+        else if (owner && ftruncate(fd, (off_t)get_layout_size(capacity)) != 0)
+        {
+            LogError("FAILURE: sizing shared memory %s for %llu entries", result->name, (unsigned long long)capacity);
+        }
+        else if (!owner && (fstat(fd, &segment_stat) != 0 || (size_t)segment_stat.st_size < sizeof(SHARED_TREE_LAYOUT)))
+        {
+            LogError("FAILURE: %s is not a shared tree", result->name);
+        }
+        else
+        {
+            if (!owner)
+            {
+                capacity = ((size_t)segment_stat.st_size - sizeof(SHARED_TREE_LAYOUT)) / sizeof(SHARED_TREE_NODE);
+            }
+            result->layout_size = get_layout_size(capacity);
+            mapping = mmap(NULL, result->layout_size, owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        }
+
+        if (fd >= 0)
+        {
+            (void)close(fd);
+        }
+
+        if (mapping == MAP_FAILED)
+        {
+            if (owner && fd >= 0)
+            {
+                (void)shm_unlink(result->name);
+            }
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            result->layout = (SHARED_TREE_LAYOUT*)mapping;
+            result->capacity = capacity;
+            result->owner = owner;
+            (void)pthread_mutex_init(&result->write_lock, NULL);
+        }
+    }
+    return result;
+}
+
+SHARED_TREE_HANDLE shared_tree_create(const char* name, size_t capacity)
+{
+    SHARED_TREE_INFO* result;
+    if (capacity == 0 || capacity > (SIZE_MAX - sizeof(SHARED_TREE_LAYOUT)) / sizeof(SHARED_TREE_NODE))
+    {
+        LogError("FAILURE: Invalid capacity %zu specified on shared tree create", capacity);
+        result = NULL;
+    }
+    else if ((result = map_tree(name, 1, capacity)) != NULL)
+    {
+        // Whatever a previous owner left behind is dropped, the magic goes
+        // last so readers never attach to a half initialized tree
+        SHARED_TREE_LAYOUT* layout = result->layout;
+        layout->magic = 0;
+        atomic_store(&layout->sequence, 0);
+        atomic_store(&layout->root, 0);
+        atomic_store(&layout->items, 0);
+        layout->capacity = capacity;
+        layout->free_list = 0;
+        layout->next_unused = 0;
+        layout->layout_version = SHARED_TREE_LAYOUT_VERSION;
+        atomic_thread_fence(memory_order_release);
+        layout->magic = SHARED_TREE_MAGIC;
+    }
+    return result;
+}
+
+SHARED_TREE_HANDLE shared_tree_open(const char* name)
+{
+    SHARED_TREE_INFO* result = map_tree(name, 0, 0);
+    if (result != NULL && (result->layout->magic != SHARED_TREE_MAGIC || result->layout->layout_version != SHARED_TREE_LAYOUT_VERSION))
+    {
+        LogError("FAILURE: %s has an unknown layout", result->name);
+        shared_tree_destroy(result);
+        result = NULL;
+    }
+    return result;
+}
+
+void shared_tree_destroy(SHARED_TREE_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        (void)munmap(handle->layout, handle->layout_size);
+        if (handle->owner)
+        {
+            (void)shm_unlink(handle->name);
+        }
+        (void)pthread_mutex_destroy(&handle->write_lock);
+        free(handle);
+    }
+}
+
+// Writer side.  Everything between begin_write and end_write runs with an
+// odd sequence, so the offsets and heights it follows can be trusted
+
+static void begin_write(SHARED_TREE_LAYOUT* layout)
+{
+    uint64_t sequence = atomic_load_explicit(&layout->sequence, memory_order_relaxed);
+    atomic_store_explicit(&layout->sequence, sequence + 1, memory_order_relaxed);
+    // Keeps the tree stores from moving above the odd sequence
+    atomic_thread_fence(memory_order_release);
+}
+
+static void end_write(SHARED_TREE_LAYOUT* layout)
+{
+    uint64_t sequence = atomic_load_explicit(&layout->sequence, memory_order_relaxed);
+    atomic_store_explicit(&layout->sequence, sequence + 1, memory_order_release);
+}
+
+static uint64_t allocate_node(SHARED_TREE_INFO* tree_info)
+{
+    SHARED_TREE_LAYOUT* layout = tree_info->layout;
+    uint64_t result;
+    if (layout->free_list != 0)
+    {
+        result = layout->free_list;
+        layout->free_list = load_field(&get_node(tree_info, result)->left);
+    }
+    else if (layout->next_unused < tree_info->capacity)
+    {
+        result = offsetof(SHARED_TREE_LAYOUT, nodes) + layout->next_unused * sizeof(SHARED_TREE_NODE);
+        layout->next_unused++;
+    }
+    else
+    {
+        LogError("FAILURE: shared tree %s is full at %llu entries", tree_info->name, (unsigned long long)tree_info->capacity);
+        result = 0;
+    }
+    return result;
+}
+
+static void free_node(SHARED_TREE_INFO* tree_info, uint64_t offset)
+{
+    store_field(&get_node(tree_info, offset)->left, tree_info->layout->free_list);
+    tree_info->layout->free_list = offset;
+}
+
+static uint64_t get_height(const SHARED_TREE_INFO* tree_info, uint64_t offset)
+{
+    return offset == 0 ? 0 : get_node(tree_info, offset)->height;
+}
+
+static int get_balance_factor(const SHARED_TREE_INFO* tree_info, SHARED_TREE_NODE* node)
+{
+    return (int)get_height(tree_info, load_field(&node->left)) - (int)get_height(tree_info, load_field(&node->right));
+}
+
+static void update_height(const SHARED_TREE_INFO* tree_info, SHARED_TREE_NODE* node)
+{
+    uint64_t left_height = get_height(tree_info, load_field(&node->left));
+    uint64_t right_height = get_height(tree_info, load_field(&node->right));
+    node->height = (left_height > right_height ? left_height : right_height) + 1;
+}
+
+static void rotate_right(const SHARED_TREE_INFO* tree_info, atomic_uint_least64_t* link)
+{
+    uint64_t offset = load_field(link);
+    SHARED_TREE_NODE* node = get_node(tree_info, offset);
+    uint64_t pivot_offset = load_field(&node->left);
+    SHARED_TREE_NODE* pivot = get_node(tree_info, pivot_offset);
+
+    store_field(&node->left, load_field(&pivot->right));
+    store_field(&pivot->right, offset);
+    update_height(tree_info, node);
+    update_height(tree_info, pivot);
+    store_field(link, pivot_offset);
+}
+
+static void rotate_left(const SHARED_TREE_INFO* tree_info, atomic_uint_least64_t* link)
+{
+    uint64_t offset = load_field(link);
+    SHARED_TREE_NODE* node = get_node(tree_info, offset);
+    uint64_t pivot_offset = load_field(&node->right);
+    SHARED_TREE_NODE* pivot = get_node(tree_info, pivot_offset);
+
+    store_field(&node->right, load_field(&pivot->left));
+    store_field(&pivot->left, offset);
+    update_height(tree_info, node);
+    update_height(tree_info, pivot);
+    store_field(link, pivot_offset);
+}
+
+// Restores the AVL property at link once both children are balanced
+static void rebalance(const SHARED_TREE_INFO* tree_info, atomic_uint_least64_t* link)
+{
+    SHARED_TREE_NODE* node = get_node(tree_info, load_field(link));
+    int balance_factor = get_balance_factor(tree_info, node);
+    if (balance_factor > 1)
+    {
+        if (get_balance_factor(tree_info, get_node(tree_info, load_field(&node->left))) < 0)
+        {
+            // Left right case
+            rotate_left(tree_info, &node->left);
+        }
+        rotate_right(tree_info, link);
+    }
+    else if (balance_factor < -1)
+    {
+        if (get_balance_factor(tree_info, get_node(tree_info, load_field(&node->right))) > 0)
+        {
+            // Right left case
+            rotate_right(tree_info, &node->right);
+        }
+        rotate_left(tree_info, link);
+    }
+    else
+    {
+        update_height(tree_info, node);
+    }
+}
+
+static int insert_at(SHARED_TREE_INFO* tree_info, atomic_uint_least64_t* link, uint64_t key, uint64_t value)
+{
+    int result;
+    uint64_t offset = load_field(link);
+    if (offset == 0)
+    {
+        if ((offset = allocate_node(tree_info)) == 0)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            SHARED_TREE_NODE* node = get_node(tree_info, offset);
+            store_field(&node->key, key);
+            store_field(&node->value, value);
+            store_field(&node->left, 0);
+            store_field(&node->right, 0);
+            node->height = 1;
+            store_field(link, offset);
+            result = 0;
+        }
+    }
+    else
+    {
+        SHARED_TREE_NODE* node = get_node(tree_info, offset);
+        uint64_t node_key = load_field(&node->key);
+        if (key == node_key)
+        {
+            result = __LINE__;
+        }
+        else if ((result = insert_at(tree_info, key < node_key ? &node->left : &node->right, key, value)) == 0)
+        {
+            rebalance(tree_info, link);
+        }
+    }
+    return result;
+}
+
+static int remove_at(SHARED_TREE_INFO* tree_info, atomic_uint_least64_t* link, uint64_t key)
+{
+    int result;
+    uint64_t offset = load_field(link);
+    if (offset == 0)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        SHARED_TREE_NODE* node = get_node(tree_info, offset);
+        uint64_t node_key = load_field(&node->key);
+        uint64_t left = load_field(&node->left);
+        uint64_t right = load_field(&node->right);
+        if (key != node_key)
+        {
+            result = remove_at(tree_info, key < node_key ? &node->left : &node->right, key);
+        }
+        else if (left == 0 || right == 0)
+        {
+            store_field(link, left != 0 ? left : right);
+            free_node(tree_info, offset);
+            result = 0;
+        }
+        else
+        {
+            // Take over the successor's entry and remove that from the right
+            SHARED_TREE_NODE* successor = get_node(tree_info, right);
+            while (load_field(&successor->left) != 0)
+            {
+                successor = get_node(tree_info, load_field(&successor->left));
+            }
+            store_field(&node->key, load_field(&successor->key));
+            store_field(&node->value, load_field(&successor->value));
+            result = remove_at(tree_info, &node->right, load_field(&node->key));
+        }
+
+        if (result == 0 && load_field(link) != 0)
+        {
+            rebalance(tree_info, link);
+        }
+    }
+    return result;
+}
+
+int shared_tree_insert(SHARED_TREE_HANDLE handle, uint64_t key, uint64_t value)
+{
+    int result;
+    if (handle == NULL || !handle->owner)
+    {
+        LogError("FAILURE: Invalid handle specified on shared tree insert");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->write_lock);
+        begin_write(handle->layout);
+        if ((result = insert_at(handle, &handle->layout->root, key, value)) == 0)
+        {
+            store_field(&handle->layout->items, load_field(&handle->layout->items) + 1);
+        }
+        end_write(handle->layout);
+        (void)pthread_mutex_unlock(&handle->write_lock);
+    }
+    return result;
+}
+
+int shared_tree_remove(SHARED_TREE_HANDLE handle, uint64_t key)
+{
+    int result;
+    if (handle == NULL || !handle->owner)
+    {
+        LogError("FAILURE: Invalid handle specified on shared tree remove");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->write_lock);
+        begin_write(handle->layout);
+        if ((result = remove_at(handle, &handle->layout->root, key)) == 0)
+        {
+            store_field(&handle->layout->items, load_field(&handle->layout->items) - 1);
+        }
+        end_write(handle->layout);
+        (void)pthread_mutex_unlock(&handle->write_lock);
+    }
+    return result;
+}
+
+// Reader side.  Nothing loaded between begin_read and a successful
+// end_read may be trusted, so every walk is bounded and every offset checked
+
+static int begin_read(SHARED_TREE_LAYOUT* layout, uint64_t* sequence)
+{
+    int result;
+    *sequence = atomic_load_explicit(&layout->sequence, memory_order_acquire);
+    if ((*sequence & 1) != 0)
+    {
+        (void)sched_yield();
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+// 0 when no write overlapped the read
+static int end_read(SHARED_TREE_LAYOUT* layout, uint64_t sequence)
+{
+    // Keeps the tree loads from moving below the second sequence load
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&layout->sequence, memory_order_relaxed) == sequence ? 0 : __LINE__;
+}
+
+// Returns 1 when found, 0 when not and -1 when the links were torn
+static int find_entry(SHARED_TREE_INFO* tree_info, uint64_t key, uint64_t* value)
+{
+    int result = 0;
+    uint64_t offset = load_field(&tree_info->layout->root);
+    for (size_t depth = 0; offset != 0; depth++)
+    {
+        if (depth == SHARED_TREE_MAX_DEPTH || !is_valid_offset(tree_info, offset))
+        {
+            result = -1;
+            break;
+        }
+        else
+        {
+            SHARED_TREE_NODE* node = get_node(tree_info, offset);
+            uint64_t node_key = load_field(&node->key);
+            if (key == node_key)
+            {
+                *value = load_field(&node->value);
+                result = 1;
+                break;
+            }
+            offset = load_field(key < node_key ? &node->left : &node->right);
+        }
+    }
+    return result;
+}
+
+// Copies up to SHARED_TREE_RANGE_BATCH entries from low to high in key
+// order and returns how many, SIZE_MAX when the links were torn
+static size_t collect_range(SHARED_TREE_INFO* tree_info, uint64_t low, uint64_t high, SHARED_TREE_ENTRY* entry_list)
+{
+    uint64_t path[SHARED_TREE_MAX_DEPTH];
+    size_t depth = 0;
+    size_t count = 0;
+    int torn = 0;
+    uint64_t offset = load_field(&tree_info->layout->root);
+    while (!torn && count < SHARED_TREE_RANGE_BATCH)
+    {
+        // Down to the smallest key not below low, keeping the nodes still to visit
+        while (offset != 0)
+        {
+            if (depth == SHARED_TREE_MAX_DEPTH || !is_valid_offset(tree_info, offset))
+            {
+                torn = 1;
+                break;
+            }
+            else
+            {
+                SHARED_TREE_NODE* node = get_node(tree_info, offset);
+                if (load_field(&node->key) >= low)
+                {
+                    path[depth++] = offset;
+                    offset = load_field(&node->left);
+                }
+                else
+                {
+                    offset = load_field(&node->right);
+                }
+            }
+        }
+
+        if (torn || depth == 0)
+        {
+            break;
+        }
+        else
+        {
+            SHARED_TREE_NODE* node = get_node(tree_info, path[--depth]);
+            uint64_t node_key = load_field(&node->key);
+            if (node_key > high)
+            {
+                break;
+            }
+            entry_list[count].key = node_key;
+            entry_list[count].value = load_field(&node->value);
+            count++;
+            offset = load_field(&node->right);
+        }
+    }
+    return torn ? SIZE_MAX : count;
+}
+
+int shared_tree_find(SHARED_TREE_HANDLE handle, uint64_t key, uint64_t* value)
+{
+    int result;
+    if (handle == NULL || value == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on shared tree find");
+        result = __LINE__;
+    }
+    else
+    {
+        int found = -1;
+        uint64_t sequence;
+        uint64_t found_value = 0;
+        for (size_t attempt = 0; attempt < SHARED_TREE_READ_RETRIES && found < 0; attempt++)
+        {
+            if (begin_read(handle->layout, &sequence) == 0)
+            {
+                found = find_entry(handle, key, &found_value);
+                if (end_read(handle->layout, sequence) != 0)
+                {
+                    found = -1;
+                }
+            }
+        }
+
+        if (found < 0)
+        {
+            LogError("FAILURE: shared tree kept changing while being read");
+            result = __LINE__;
+        }
+        else if (found == 0)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            *value = found_value;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int shared_tree_range(SHARED_TREE_HANDLE handle, uint64_t low, uint64_t high, shared_tree_visitor_callback visitor, void* context)
+{
+    int result;
+    if (handle == NULL || visitor == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on shared tree range");
+        result = __LINE__;
+    }
+    else
+    {
+        SHARED_TREE_ENTRY entry_list[SHARED_TREE_RANGE_BATCH];
+        int done = low > high;
+        result = 0;
+        while (!done && result == 0)
+        {
+            size_t count = SIZE_MAX;
+            uint64_t sequence;
+            for (size_t attempt = 0; attempt < SHARED_TREE_READ_RETRIES && count == SIZE_MAX; attempt++)
+            {
+                if (begin_read(handle->layout, &sequence) == 0)
+                {
+                    count = collect_range(handle, low, high, entry_list);
+                    if (end_read(handle->layout, sequence) != 0)
+                    {
+                        count = SIZE_MAX;
+                    }
+                }
+            }
+
+            if (count == SIZE_MAX)
+            {
+                LogError("FAILURE: shared tree kept changing while being read");
+                result = __LINE__;
+            }
+            else
+            {
+                for (size_t index = 0; index < count; index++)
+                {
+                    visitor(entry_list[index].key, entry_list[index].value, context);
+                }
+                if (count < SHARED_TREE_RANGE_BATCH || entry_list[count - 1].key >= high)
+                {
+                    done = 1;
+                }
+                else
+                {
+                    low = entry_list[count - 1].key + 1;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+size_t shared_tree_item_count(SHARED_TREE_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on shared tree item count");
+        result = 0;
+    }
+    else
+    {
+        result = (size_t)atomic_load_explicit(&handle->layout->items, memory_order_relaxed);
+    }
+    return result;
+}
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SHARED_TREE_H
+#define SHARED_TREE_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct SHARED_TREE_INFO_TAG* SHARED_TREE_HANDLE;
+
+// An AVL tree of uint64_t keys and values that lives in a POSIX shared
+// memory segment, so one process can maintain it while any number of
+// others read it without a copy of their own.  Links are offsets from the
+// start of the segment, so every process can map it at its own address.
+// Values have to mean the same in every process, so store offsets or ids
+// rather than pointers.
+//
+// The writer process may use the handle from several threads, they take
+// turns.  Readers take no lock.  A reader that overlaps a write retries, so
+// it never sees a half updated tree and never slows the writer down
+#define SHARED_TREE_LAYOUT_VERSION  1
+
+typedef void (*shared_tree_visitor_callback)(uint64_t key, uint64_t value, void* context);
+
+// Creates or takes over the named segment with room for capacity entries
+// and unlinks it on destroy.  A name without a leading '/' gets one
+extern SHARED_TREE_HANDLE shared_tree_create(const char* name, size_t capacity);
+// Attaches read-only to a tree another process created
+extern SHARED_TREE_HANDLE shared_tree_open(const char* name);
+extern void shared_tree_destroy(SHARED_TREE_HANDLE handle);
+
+// Creator only.  Insert fails once capacity entries are in the tree
+extern int shared_tree_insert(SHARED_TREE_HANDLE handle, uint64_t key, uint64_t value);
+extern int shared_tree_remove(SHARED_TREE_HANDLE handle, uint64_t key);
+
+extern int shared_tree_find(SHARED_TREE_HANDLE handle, uint64_t key, uint64_t* value);
+// Visits the entries from low to high, both included, in key order.  They
+// are read in consistent batches, a write that lands between two batches
+// shows up in the later ones only.  The visitor runs outside the read
+extern int shared_tree_range(SHARED_TREE_HANDLE handle, uint64_t low, uint64_t high, shared_tree_visitor_callback visitor, void* context);
+extern size_t shared_tree_item_count(SHARED_TREE_HANDLE handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* SHARED_TREE_H */
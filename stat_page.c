@@ -0,0 +1,228 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stat_page.h"
+#include "logging.h"
+
+#define STAT_PAGE_MAGIC         0x57534b59u
+#define STAT_PAGE_NAME_LENGTH   256
+#define STAT_PAGE_WORDS         (sizeof(STAT_PAGE_VALUES) / sizeof(uint64_t))
+// A reader that keeps losing to the publisher gives up after this many tries
+#define STAT_PAGE_READ_RETRIES  10000
+
+// The values are copied a word at a time with relaxed atomics so a torn
+// read is a retry and not a data race
+typedef struct STAT_PAGE_LAYOUT_TAG
+{
+    uint32_t magic;
+    uint32_t layout_version;
+    // Odd while a publish is in progress
+    atomic_uint_least64_t sequence;
+    atomic_uint_least64_t words[STAT_PAGE_WORDS];
+} STAT_PAGE_LAYOUT;
+
+typedef struct STAT_PAGE_INFO_TAG
+{
+    STAT_PAGE_LAYOUT* layout;
+    int owner;
+    char name[STAT_PAGE_NAME_LENGTH];
+} STAT_PAGE_INFO;
+
+static int build_name(const char* name, char full_name[STAT_PAGE_NAME_LENGTH])
+{
+    int result;
+    int length = snprintf(full_name, STAT_PAGE_NAME_LENGTH, "%s%s", name[0] == '/' ? "" : "/", name);
+    if (name[0] == '\0' || length < 0 || length >= STAT_PAGE_NAME_LENGTH || strchr(full_name + 1, '/') != NULL)
+    {
+        LogError("FAILURE: Invalid stat page name %s", name);
+        result = __LINE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static STAT_PAGE_INFO* map_page(const char* name, int owner)
+{
+    STAT_PAGE_INFO* result;
+    if (name == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on stat page");
+        result = NULL;
+    }
+    else if ((result = (STAT_PAGE_INFO*)malloc(sizeof(STAT_PAGE_INFO))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate stat page");
+    }
+    else if (build_name(name, result->name) != 0)
+    {
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        int fd = shm_open(result->name, owner ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        struct stat page_stat;
+        void* mapping = MAP_FAILED;
+        if (fd < 0)
+        {
+            LogError("FAILURE: opening shared memory %s", result->name);
+        }
+        else if (owner && ftruncate(fd, sizeof(STAT_PAGE_LAYOUT)) != 0)
+        {
+            LogError("FAILURE: sizing shared memory %s", result->name);
+        }
+        else if (!owner && (fstat(fd, &page_stat) != 0 || (size_t)page_stat.st_size < sizeof(STAT_PAGE_LAYOUT)))
+        {
+            LogError("FAILURE: %s is not a stat page", result->name);
+        }
+        else
+        {
+            mapping = mmap(NULL, sizeof(STAT_PAGE_LAYOUT), owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        }
+
+        if (fd >= 0)
+        {
+            (void)close(fd);
+        }
+
+        if (mapping == MAP_FAILED)
+        {
+            if (owner && fd >= 0)
+            {
+                (void)shm_unlink(result->name);
+            }
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            result->layout = (STAT_PAGE_LAYOUT*)mapping;
+            result->owner = owner;
+        }
+    }
+    return result;
+}
+
+STAT_PAGE_HANDLE stat_page_create(const char* name)
+{
+    STAT_PAGE_INFO* result = map_page(name, 1);
+    if (result != NULL)
+    {
+        // Whatever a previous owner left behind is reset
+        atomic_store(&result->layout->sequence, 0);
+        for (size_t index = 0; index < STAT_PAGE_WORDS; index++)
+        {
+            atomic_store_explicit(&result->layout->words[index], 0, memory_order_relaxed);
+        }
+        result->layout->layout_version = STAT_PAGE_LAYOUT_VERSION;
+        result->layout->magic = STAT_PAGE_MAGIC;
+    }
+    return result;
+}
+
+STAT_PAGE_HANDLE stat_page_open(const char* name)
+{
+    STAT_PAGE_INFO* result = map_page(name, 0);
+    if (result != NULL && (result->layout->magic != STAT_PAGE_MAGIC || result->layout->layout_version != STAT_PAGE_LAYOUT_VERSION))
+    {
+        LogError("FAILURE: %s has an unknown layout", result->name);
+        stat_page_destroy(result);
+        result = NULL;
+    }
+    return result;
+}
+
+void stat_page_destroy(STAT_PAGE_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        (void)munmap(handle->layout, sizeof(STAT_PAGE_LAYOUT));
+        if (handle->owner)
+        {
+            (void)shm_unlink(handle->name);
+        }
+        free(handle);
+    }
+}
+
+int stat_page_publish(STAT_PAGE_HANDLE handle, const STAT_PAGE_VALUES* values)
+{
+    int result;
+    if (handle == NULL || values == NULL || !handle->owner)
+    {
+        LogError("FAILURE: Invalid parameter specified on stat page publish");
+        result = __LINE__;
+    }
+    else
+    {
+        uint64_t words[STAT_PAGE_WORDS];
+        uint64_t sequence = atomic_load_explicit(&handle->layout->sequence, memory_order_relaxed);
+        memcpy(words, values, sizeof(words));
+
+        atomic_store_explicit(&handle->layout->sequence, sequence + 1, memory_order_relaxed);
+        // Keeps the word stores from moving above the odd sequence
+        atomic_thread_fence(memory_order_release);
+        for (size_t index = 0; index < STAT_PAGE_WORDS; index++)
+        {
+            atomic_store_explicit(&handle->layout->words[index], words[index], memory_order_relaxed);
+        }
+        atomic_store_explicit(&handle->layout->sequence, sequence + 2, memory_order_release);
+        result = 0;
+    }
+    return result;
+}
+
+int stat_page_read(STAT_PAGE_HANDLE handle, STAT_PAGE_VALUES* values)
+{
+    int result;
+    if (handle == NULL || values == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on stat page read");
+        result = __LINE__;
+    }
+    else
+    {
+        uint64_t words[STAT_PAGE_WORDS];
+        result = __LINE__;
+        for (size_t attempt = 0; attempt < STAT_PAGE_READ_RETRIES && result != 0; attempt++)
+        {
+            uint64_t sequence = atomic_load_explicit(&handle->layout->sequence, memory_order_acquire);
+            if ((sequence & 1) != 0)
+            {
+                (void)sched_yield();
+                continue;
+            }
+            for (size_t index = 0; index < STAT_PAGE_WORDS; index++)
+            {
+                words[index] = atomic_load_explicit(&handle->layout->words[index], memory_order_relaxed);
+            }
+            // Keeps the word loads from moving below the second sequence load
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&handle->layout->sequence, memory_order_relaxed) == sequence)
+            {
+                memcpy(values, words, sizeof(words));
+                result = 0;
+            }
+        }
+
+        if (result != 0)
+        {
+            LogError("FAILURE: stat page kept changing while being read");
+        }
+    }
+    return result;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef STAT_PAGE_H
+#define STAT_PAGE_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct STAT_PAGE_INFO_TAG* STAT_PAGE_HANDLE;
+
+// Bump STAT_PAGE_LAYOUT_VERSION whenever the fields change, readers refuse
+// pages of another version.  Counters are totals since the page was created,
+// the latency fields cover the operations since the previous publish
+#define STAT_PAGE_LAYOUT_VERSION    1
+
+typedef struct STAT_PAGE_VALUES_TAG
+{
+    // CLOCK_MONOTONIC time of the publish, 0 until the first one
+    uint64_t publish_ns;
+    uint64_t pid;
+    uint64_t items;
+    uint64_t height;
+    uint64_t memory_bytes;
+    uint64_t inserts;
+    uint64_t removes;
+    uint64_t finds;
+    // Only counted when the library is built with ENABLE_TREE_STATS,
+    // rotation_stats is 1 when they are
+    uint64_t rotation_stats;
+    uint64_t single_rotations;
+    uint64_t double_rotations;
+    uint64_t subtree_rebuilds;
+    uint64_t latency_samples;
+    uint64_t latency_p50_ns;
+    uint64_t latency_p90_ns;
+    uint64_t latency_p99_ns;
+    uint64_t latency_p999_ns;
+    uint64_t latency_max_ns;
+} STAT_PAGE_VALUES;
+
+// Creates or takes over the named POSIX shared memory page and unlinks it
+// on destroy.  A name without a leading '/' gets one
+extern STAT_PAGE_HANDLE stat_page_create(const char* name);
+// Attaches read-only to a page another process created
+extern STAT_PAGE_HANDLE stat_page_open(const char* name);
+extern void stat_page_destroy(STAT_PAGE_HANDLE handle);
+
+// Only one thread may publish to a page at a time.  Readers never block the
+// publisher, they retry until they get a copy no publish overlapped
+extern int stat_page_publish(STAT_PAGE_HANDLE handle, const STAT_PAGE_VALUES* values);
+extern int stat_page_read(STAT_PAGE_HANDLE handle, STAT_PAGE_VALUES* values);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* STAT_PAGE_H */
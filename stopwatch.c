@@ -4,30 +4,176 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define STOPWATCH_HAS_TSC
+#endif
 
 #include "stopwatch.h"
 #include "logging.h"
 
+#define NANOSECONDS_PER_SECOND          1000000000ULL
+#define TSC_CALIBRATION_NS              10000000ULL
+
 typedef struct STOPWATCH_INFO_TAG* STOPWATCH_HANDLE;
 typedef struct STOPWATCH_INFO_TAG
 {
-    clock_t start_time;
-    clock_t stop_time;
+    STOPWATCH_CLOCK clock_source;
+    // Raw readings of clock_source, only converted when read back
+    uint64_t start_time;
+    uint64_t stop_time;
+    uint64_t lap_time;
     int started;
 } STOPWATCH_INFO;
 
+static pthread_once_t g_tsc_calibration = PTHREAD_ONCE_INIT;
+static double g_tsc_ns_per_tick;
+
+uint64_t stopwatch_now_ns(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+}
+
+#ifdef STOPWATCH_HAS_TSC
+// The fences keep the read from drifting into the code being timed
+static uint64_t read_tsc_start(void)
+{
+    uint64_t result;
+    _mm_lfence();
+    result = __rdtsc();
+    _mm_lfence();
+    return result;
+}
+
+// rdtscp waits for everything before it to retire, the fence holds back what follows
+static uint64_t read_tsc_stop(void)
+{
+    unsigned int processor_id;
+    uint64_t result = __rdtscp(&processor_id);
+    _mm_lfence();
+    return result;
+}
+
+static void calibrate_tsc(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    // CPUID 0x80000007 EDX bit 8, the TSC ticks at a constant rate through
+    // frequency and power state changes
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 || (edx & (1u << 8)) == 0)
+    {
+        LogError("FAILURE: processor does not have an invariant TSC");
+    }
+    else
+    {
+        uint64_t start_ns = stopwatch_now_ns();
+        uint64_t start_ticks = read_tsc_start();
+        uint64_t end_ns;
+        uint64_t end_ticks;
+        do
+        {
+            end_ns = stopwatch_now_ns();
+            end_ticks = read_tsc_stop();
+        } while (end_ns - start_ns < TSC_CALIBRATION_NS);
+
+        if (end_ticks > start_ticks)
+        {
+            g_tsc_ns_per_tick = (double)(end_ns - start_ns) / (double)(end_ticks - start_ticks);
+        }
+    }
+}
+#endif
+
+static uint64_t read_clock(const STOPWATCH_INFO* stopwatch_info, int is_stop)
+{
+    uint64_t result;
+    switch (stopwatch_info->clock_source)
+    {
+#ifdef STOPWATCH_HAS_TSC
+        case STOPWATCH_CLOCK_TSC:
+            result = is_stop ? read_tsc_stop() : read_tsc_start();
+            break;
+#endif
+        case STOPWATCH_CLOCK_MONOTONIC:
+            result = stopwatch_now_ns();
+            break;
+        case STOPWATCH_CLOCK_PROCESS:
+        default:
+            result = (uint64_t)clock();
+            break;
+    }
+    (void)is_stop;
+    return result;
+}
+
+static uint64_t convert_to_ns(const STOPWATCH_INFO* stopwatch_info, uint64_t ticks)
+{
+    uint64_t result;
+    switch (stopwatch_info->clock_source)
+    {
+        case STOPWATCH_CLOCK_TSC:
+            result = (uint64_t)((double)ticks * g_tsc_ns_per_tick);
+            break;
+        case STOPWATCH_CLOCK_MONOTONIC:
+            result = ticks;
+            break;
+        case STOPWATCH_CLOCK_PROCESS:
+        default:
+            result = (uint64_t)((double)ticks * ((double)NANOSECONDS_PER_SECOND / CLOCKS_PER_SEC));
+            break;
+    }
+    return result;
+}
+
+static uint64_t get_elapsed_ticks(const STOPWATCH_INFO* stopwatch_info)
+{
+    uint64_t result;
+    // If still in progress
+    if (stopwatch_info->started != 0)
+    {
+        result = read_clock(stopwatch_info, 1) - stopwatch_info->start_time;
+    }
+    else
+    {
+        result = stopwatch_info->stop_time - stopwatch_info->start_time;
+    }
+    return result;
+}
+
 STOPWATCH_HANDLE stopwatch_create()
 {
-    STOPWATCH_INFO* result = (STOPWATCH_INFO*)malloc(sizeof(STOPWATCH_INFO));
-    if (result == NULL)
+    return stopwatch_create_with_clock(STOPWATCH_CLOCK_PROCESS);
+}
+
+STOPWATCH_HANDLE stopwatch_create_with_clock(STOPWATCH_CLOCK clock_source)
+{
+    STOPWATCH_INFO* result;
+    if (clock_source == STOPWATCH_CLOCK_TSC)
     {
-        LogError("FAILURE: unable to allocate stopwatch info");
+#ifdef STOPWATCH_HAS_TSC
+        (void)pthread_once(&g_tsc_calibration, calibrate_tsc);
+#endif
+    }
+
+    if (clock_source == STOPWATCH_CLOCK_TSC && g_tsc_ns_per_tick == 0.0)
+    {
+        LogError("FAILURE: TSC clock is not available");
         result = NULL;
     }
+    else if ((result = (STOPWATCH_INFO*)malloc(sizeof(STOPWATCH_INFO))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate stopwatch info");
+    }
     else
     {
         memset(result, 0, sizeof(STOPWATCH_INFO));
+        result->clock_source = clock_source;
     }
     return result;
 }
@@ -58,10 +204,11 @@ int stopwatch_start(STOPWATCH_HANDLE handle)
         else
         {
             handle->started = 1;
-            handle->start_time = clock();
-            handle->stop_time = clock();
+            handle->start_time = read_clock(handle, 0);
+            handle->stop_time = handle->start_time;
+            handle->lap_time = handle->start_time;
+            result = 0;
         }
-        result = 0;
     }
     return result;
 }
@@ -70,8 +217,8 @@ void stopwatch_stop(STOPWATCH_HANDLE handle)
 {
     if (handle != NULL)
     {
+        handle->stop_time = read_clock(handle, 1);
         handle->started = 0;
-        handle->stop_time = clock();
     }
 }
 
@@ -79,8 +226,9 @@ void stopwatch_reset(STOPWATCH_HANDLE handle)
 {
     if (handle != NULL)
     {
-        handle->start_time = clock();
-        handle->stop_time = clock();
+        handle->start_time = read_clock(handle, 0);
+        handle->stop_time = handle->start_time;
+        handle->lap_time = handle->start_time;
     }
 }
 
@@ -92,18 +240,51 @@ clock_t stopwatch_get_elapsed(STOPWATCH_HANDLE handle)
         LogError("FAILURE: Invalid handle specified on start");
         result = __LINE__;
     }
+    else if (handle->clock_source == STOPWATCH_CLOCK_PROCESS)
+    {
+        result = (clock_t)get_elapsed_ticks(handle);
+    }
     else
     {
-        // If still in progress
-        if (handle->started != 0)
-        {
-            result = clock() - handle->start_time;
-        }
-        else
-        {
-            result = handle->stop_time - handle->start_time;
-        }
+        result = (clock_t)((double)convert_to_ns(handle, get_elapsed_ticks(handle)) * CLOCKS_PER_SEC / NANOSECONDS_PER_SECOND);
     }
     return result;
 }
 
+uint64_t stopwatch_get_elapsed_ns(STOPWATCH_HANDLE handle)
+{
+    uint64_t result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on get elapsed");
+        result = 0;
+    }
+    else
+    {
+        result = convert_to_ns(handle, get_elapsed_ticks(handle));
+    }
+    return result;
+}
+
+uint64_t stopwatch_lap_ns(STOPWATCH_HANDLE handle)
+{
+    uint64_t result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid handle specified on lap");
+        result = 0;
+    }
+    else
+    {
+        uint64_t lap_end = handle->started != 0 ? read_clock(handle, 1) : handle->stop_time;
+        result = convert_to_ns(handle, lap_end - handle->lap_time);
+        handle->lap_time = lap_end;
+    }
+    return result;
+}
+
+uint64_t stopwatch_split_ns(STOPWATCH_HANDLE handle)
+{
+    return stopwatch_get_elapsed_ns(handle);
+}
+
@@ -7,22 +7,45 @@
 #ifdef __cplusplus
 #include <cstdio>
 #include <ctime>
+#include <cstdint>
 extern "C" {
 #else // __cplusplus
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 #endif // __cplusplus
 
 typedef struct STOPWATCH_INFO_TAG* STOPWATCH_HANDLE;
 
+typedef enum STOPWATCH_CLOCK_TAG
+{
+    // Process cpu time through clock(), what stopwatch_create uses
+    STOPWATCH_CLOCK_PROCESS,
+    // Wall time through clock_gettime(CLOCK_MONOTONIC)
+    STOPWATCH_CLOCK_MONOTONIC,
+    // Fenced rdtsc/rdtscp calibrated against CLOCK_MONOTONIC, needs an
+    // invariant TSC.  Creating a stopwatch on it fails when there is none
+    STOPWATCH_CLOCK_TSC
+} STOPWATCH_CLOCK;
+
 extern STOPWATCH_HANDLE stopwatch_create();
+extern STOPWATCH_HANDLE stopwatch_create_with_clock(STOPWATCH_CLOCK clock_source);
 extern void stopwatch_destroy(STOPWATCH_HANDLE handle);
 
 extern int stopwatch_start(STOPWATCH_HANDLE handle);
 extern void stopwatch_stop(STOPWATCH_HANDLE handle);
 extern void stopwatch_reset(STOPWATCH_HANDLE handle);
 extern clock_t stopwatch_get_elapsed(STOPWATCH_HANDLE handle);
+extern uint64_t stopwatch_get_elapsed_ns(STOPWATCH_HANDLE handle);
+
+// Time since the previous lap, or since start for the first one
+extern uint64_t stopwatch_lap_ns(STOPWATCH_HANDLE handle);
+// Time since start without stopping or touching the lap mark
+extern uint64_t stopwatch_split_ns(STOPWATCH_HANDLE handle);
+
+// CLOCK_MONOTONIC timestamp in nanoseconds
+extern uint64_t stopwatch_now_ns(void);
 
 #ifdef __cplusplus
 }
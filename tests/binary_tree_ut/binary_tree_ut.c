@@ -5,11 +5,18 @@
 #include <cstdlib>
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
+#include <ctime>
 #else
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <time.h>
 #endif
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "testrunnerswitcher.h"
 
@@ -34,7 +41,273 @@ static void remove_callback(void* data)
     (void)data;
 }
 
+static size_t g_remove_callback_count;
+
+static void counting_remove_callback(void* data)
+{
+    (void)data;
+    g_remove_callback_count++;
+}
+
 #include "binary_tree.h"
+#include "stat_page.h"
+#include "op_trace.h"
+#include "whiskey_tree.h"
+#include "whiskey_node.h"
+#include "shared_tree.h"
+#include "paged_tree.h"
+#include "stopwatch.h"
+#include "logging.h"
+
+WHISKEY_TREE_DEFINE(test_typed_tree, uint64_t, uint64_t, WHISKEY_TREE_COMPARE_SCALAR)
+
+static const char* TEST_STAT_PAGE_NAME = "/whiskey_binary_tree_ut";
+static const char* TEST_TRACE_FILE_NAME = "whiskey_binary_tree_ut.trace";
+static const char* TEST_IMAGE_FILE_NAME = "whiskey_binary_tree_ut.tree";
+static const char* TEST_SHARED_TREE_NAME = "/whiskey_binary_tree_ut_shared";
+static const char* TEST_PAGED_FILE_NAME = "whiskey_binary_tree_ut.pages";
+static const char* TEST_WAL_FILE_NAME = "whiskey_binary_tree_ut.wal";
+static const char* TEST_LOG_FILE_NAME = "whiskey_binary_tree_ut.log";
+
+// Waits up to two seconds for the tree's background publish to report items
+static int wait_for_published_items(STAT_PAGE_HANDLE stat_page, uint64_t items, STAT_PAGE_VALUES* values)
+{
+    int result = __LINE__;
+    for (size_t attempt = 0; attempt < 200 && result != 0; attempt++)
+    {
+        struct timespec sleep_time = { 0, 10000000L };
+        if (stat_page_read(stat_page, values) == 0 && values->publish_ns != 0 && values->items == items)
+        {
+            result = 0;
+        }
+        else
+        {
+            (void)nanosleep(&sleep_time, NULL);
+        }
+    }
+    return result;
+}
+
+static unsigned char g_visited_keys[256];
+static unsigned char g_visited_entries[20000];
+
+static void visitor_callback(NODE_KEY key, void* data, void* context)
+{
+    (void)data;
+    (void)context;
+    // Keys are unique so each slot is only ever written by one thread
+    g_visited_keys[key]++;
+}
+
+static size_t u64_serializer(void* data, void* buffer, size_t buffer_size, void* context)
+{
+    (void)context;
+    if (buffer_size >= sizeof(uint64_t))
+    {
+        memcpy(buffer, data, sizeof(uint64_t));
+    }
+    return sizeof(uint64_t);
+}
+
+static int save_test_image(BINARY_TREE_HANDLE handle, tree_serialize_callback serializer)
+{
+    int result;
+    int fd = open(TEST_IMAGE_FILE_NAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    result = binary_tree_save(handle, fd, serializer, NULL);
+    (void)close(fd);
+    return result;
+}
+
+typedef struct ENTRY_ORDER_TAG
+{
+    unsigned char previous_key[64];
+    size_t previous_length;
+    size_t count;
+    int out_of_order;
+} ENTRY_ORDER;
+
+static void entry_order_callback(const void* key, size_t key_length, void* data, void* context)
+{
+    ENTRY_ORDER* order = (ENTRY_ORDER*)context;
+    size_t common = key_length < order->previous_length ? key_length : order->previous_length;
+    int compare_result = memcmp(order->previous_key, key, common);
+    (void)data;
+    if (order->count > 0 && (compare_result > 0 || (compare_result == 0 && order->previous_length >= key_length)))
+    {
+        order->out_of_order++;
+    }
+    memcpy(order->previous_key, key, key_length);
+    order->previous_length = key_length;
+    order->count++;
+}
+
+static void u64_entry_visitor_callback(const void* key, size_t key_length, void* data, void* context)
+{
+    uint64_t index;
+    (void)context;
+    ASSERT_ARE_EQUAL(int, (int)sizeof(uint64_t), (int)key_length);
+    memcpy(&index, key, sizeof(uint64_t));
+    ASSERT_IS_TRUE(index < sizeof(g_visited_entries));
+    ASSERT_ARE_EQUAL(void_ptr, (void*)(uintptr_t)(index + 1), data);
+    // Keys are unique so each slot is only ever written by one thread
+    g_visited_entries[index]++;
+}
+
+static void string_entry_visitor_callback(const void* key, size_t key_length, void* data, void* context)
+{
+    char key_text[32] = { 0 };
+    (void)context;
+    // Keys are "whiskey/<index>" and the data is index + 1, each slot is only
+    // ever written by one thread
+    ASSERT_IS_TRUE(key_length > 8 && key_length < sizeof(key_text));
+    memcpy(key_text, key, key_length);
+    size_t index = (size_t)strtoul(key_text + 8, NULL, 10);
+    ASSERT_ARE_EQUAL(void_ptr, (void*)(uintptr_t)(index + 1), data);
+    g_visited_entries[index]++;
+}
+
+static void typed_visitor_callback(uint64_t key, uint64_t* value, void* context)
+{
+    uint64_t* previous_key = (uint64_t*)context;
+    // Visited in key order and every value is its key doubled
+    ASSERT_IS_TRUE(key > *previous_key && *value == key * 2);
+    *previous_key = key;
+}
+
+typedef struct TEST_ENTRY_TAG
+{
+    int key;
+    whiskey_node node;
+} TEST_ENTRY;
+
+static int compare_test_entries(const whiskey_node* node_1, const whiskey_node* node_2)
+{
+    int key_1 = whiskey_entry(node_1, TEST_ENTRY, node)->key;
+    int key_2 = whiskey_entry(node_2, TEST_ENTRY, node)->key;
+    return key_1 < key_2 ? -1 : key_1 > key_2 ? 1 : 0;
+}
+
+static int compare_test_entry_key(const void* key, const whiskey_node* node)
+{
+    int key_1 = *(const int*)key;
+    int key_2 = whiskey_entry(node, TEST_ENTRY, node)->key;
+    return key_1 < key_2 ? -1 : key_1 > key_2 ? 1 : 0;
+}
+
+typedef struct U64_RANGE_TAG
+{
+    size_t count;
+    uint64_t previous_key;
+    int out_of_order;
+} U64_RANGE;
+
+static void u64_range_callback(uint64_t key, uint64_t value, void* context)
+{
+    U64_RANGE* range = (U64_RANGE*)context;
+    if ((range->count > 0 && key <= range->previous_key) || value != key * 2)
+    {
+        range->out_of_order++;
+    }
+    range->previous_key = key;
+    range->count++;
+}
+
+static void u64_entry_callback(const void* key, size_t key_length, void* data, void* context)
+{
+    (void)key_length;
+    u64_range_callback(*(const uint64_t*)key, (uint64_t)(uintptr_t)data, context);
+}
+
+// Data that is the value itself rather than a pointer to it
+static size_t u64_value_serializer(void* data, void* buffer, size_t buffer_size, void* context)
+{
+    uint64_t value = (uint64_t)(uintptr_t)data;
+    (void)context;
+    if (buffer_size >= sizeof(uint64_t))
+    {
+        memcpy(buffer, &value, sizeof(uint64_t));
+    }
+    return sizeof(uint64_t);
+}
+
+static void* u64_value_deserializer(const void* bytes, size_t size, void* context)
+{
+    uint64_t value;
+    (void)context;
+    ASSERT_ARE_EQUAL(int, (int)sizeof(uint64_t), (int)size);
+    memcpy(&value, bytes, sizeof(uint64_t));
+    return (void*)(uintptr_t)value;
+}
+
+static BINARY_TREE_HANDLE create_logged_tree(BINARY_TREE_DURABILITY durability)
+{
+    int key_mode = BINARY_TREE_KEY_UINT64;
+    BINARY_TREE_WAL_CONFIG config = { TEST_WAL_FILE_NAME, durability, 0, u64_value_serializer, NULL };
+    BINARY_TREE_HANDLE result = binary_tree_create();
+    ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(result, OPTION_KEY_MODE, &key_mode));
+    ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(result, OPTION_WAL, &config));
+    return result;
+}
+
+static BINARY_TREE_HANDLE recover_test_tree(const char* image_path)
+{
+    int key_mode = BINARY_TREE_KEY_UINT64;
+    BINARY_TREE_HANDLE result = binary_tree_create();
+    ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(result, OPTION_KEY_MODE, &key_mode));
+    ASSERT_ARE_EQUAL(int, 0, binary_tree_recover(result, image_path, TEST_WAL_FILE_NAME, u64_value_deserializer, NULL, NULL));
+    return result;
+}
+
+static uint64_t u64_value_hash(void* data, void* context)
+{
+    (void)context;
+    return (uint64_t)(uintptr_t)data;
+}
+
+static BINARY_TREE_HANDLE create_hashed_tree(int persistent)
+{
+    int key_mode = BINARY_TREE_KEY_UINT64;
+    BINARY_TREE_HASH_CONFIG config = { u64_value_hash, NULL };
+    BINARY_TREE_HANDLE result = binary_tree_create();
+    ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(result, OPTION_KEY_MODE, &key_mode));
+    ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(result, OPTION_PERSISTENT_MODE, &persistent));
+    ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(result, OPTION_MERKLE_HASH, &config));
+    return result;
+}
+
+typedef struct DIFF_RECORD_TAG
+{
+    size_t count;
+    BINARY_TREE_DIFF types[8];
+    uint64_t keys[8];
+} DIFF_RECORD;
+
+static void record_diff_callback(BINARY_TREE_DIFF diff, const void* key, size_t key_length, void* data_a, void* data_b, void* context)
+{
+    DIFF_RECORD* record = (DIFF_RECORD*)context;
+    (void)data_a;
+    (void)data_b;
+    ASSERT_ARE_EQUAL(int, (int)sizeof(uint64_t), (int)key_length);
+    if (record->count < 8)
+    {
+        record->types[record->count] = diff;
+        record->keys[record->count] = *(const uint64_t*)key;
+    }
+    record->count++;
+}
+
+// Data that is its own size in bytes
+static size_t data_size_callback(void* data, void* context)
+{
+    (void)context;
+    return (size_t)(uintptr_t)data;
+}
+
+// Every key below count once, in an order that splits pages all over the tree
+static uint64_t get_scattered_key(uint64_t index, uint64_t count)
+{
+    return (index * 7919) % count;
+}
 
 #ifdef __cplusplus
 extern "C"
@@ -722,4 +995,2234 @@ BEGIN_TEST_SUITE(binary_tree_ut)
         binary_tree_destroy(handle);
     }
 
+    TEST_FUNCTION(binary_tree_for_each_parallel_handle_NULL_fail)
+    {
+        //arrange
+
+        //act
+        int result = binary_tree_for_each_parallel(NULL, visitor_callback, NULL, 4);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+    }
+
+    TEST_FUNCTION(binary_tree_for_each_parallel_visitor_NULL_fail)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+
+        //act
+        int result = binary_tree_for_each_parallel(handle, NULL, NULL, 4);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_for_each_parallel_no_items_succeed)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        memset(g_visited_keys, 0, sizeof(g_visited_keys));
+
+        //act
+        int result = binary_tree_for_each_parallel(handle, visitor_callback, NULL, 4);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        for (size_t index = 0; index < sizeof(g_visited_keys); index++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, g_visited_keys[index]);
+        }
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_for_each_parallel_visits_every_item_succeed)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        memset(g_visited_keys, 0, sizeof(g_visited_keys));
+
+        //act
+        int result = binary_tree_for_each_parallel(handle, visitor_callback, NULL, 4);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        for (size_t index = 0; index < count; index++)
+        {
+            ASSERT_ARE_EQUAL(int, 1, g_visited_keys[INSERT_FOR_NO_ROTATION[index]]);
+        }
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_for_each_parallel_entries_tall_tree_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        for (uint64_t index = 0; index < 20000; index++)
+        {
+            uint64_t key = get_scattered_key(index, 20000);
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key + 1)));
+        }
+        // Well above the height walked serially, so the work is split
+        // between the threads and stolen
+        ASSERT_IS_TRUE(binary_tree_height(handle) > 10);
+        memset(g_visited_entries, 0, sizeof(g_visited_entries));
+
+        //act
+        int result = binary_tree_for_each_parallel_entries(handle, u64_entry_visitor_callback, NULL, 8);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        for (size_t index = 0; index < 20000; index++)
+        {
+            ASSERT_ARE_EQUAL(int, 1, g_visited_entries[index]);
+        }
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_handle_NULL_fail)
+    {
+        //arrange
+        int enable = 1;
+
+        //act
+        int result = binary_tree_set_option(NULL, OPTION_PERSISTENT_MODE, &enable);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_unknown_option_fail)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+
+        //act
+        int result = binary_tree_set_option(handle, "unknown_option", &enable);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_persistent_not_empty_fail)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_persistent_insert_succeed)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        int result = binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+        ASSERT_ARE_EQUAL(int, 0, result);
+
+        //act
+        size_t count = sizeof(INSERT_FOR_RIGHT_LEFT_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            result = binary_tree_insert(handle, INSERT_FOR_RIGHT_LEFT_ROTATION[index], DATA_VALUE);
+
+            //assert
+            ASSERT_ARE_EQUAL(int, 0, result);
+        }
+        assert_visual_check(handle, VISUAL_RIGHT_LEFT_ROTATION);
+        ASSERT_ARE_EQUAL(size_t, count, binary_tree_item_count(handle));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find(handle, INSERT_FOR_RIGHT_LEFT_ROTATION[count - 1]));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_persistent_remove_root_succeed)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+
+        //act
+        int result = binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[0], remove_callback);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        assert_visual_check(handle, "b(5(3)(7))(c)");
+        ASSERT_IS_NULL(binary_tree_find(handle, INSERT_FOR_NO_ROTATION[0]));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_snapshot_handle_NULL_fail)
+    {
+        //arrange
+
+        //act
+        BINARY_TREE_HANDLE snapshot = binary_tree_snapshot(NULL);
+
+        //assert
+        ASSERT_IS_NULL(snapshot);
+
+        //cleanup
+    }
+
+    TEST_FUNCTION(binary_tree_snapshot_not_persistent_fail)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+
+        //act
+        BINARY_TREE_HANDLE snapshot = binary_tree_snapshot(handle);
+
+        //assert
+        ASSERT_IS_NULL(snapshot);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_snapshot_unchanged_by_writes_succeed)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+
+        //act
+        BINARY_TREE_HANDLE snapshot = binary_tree_snapshot(handle);
+        (void)binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[0], remove_callback);
+        (void)binary_tree_insert(handle, INVALID_ITEM, DATA_VALUE);
+
+        //assert
+        ASSERT_IS_NOT_NULL(snapshot);
+        assert_visual_check(snapshot, VISUAL_NO_ROTATION);
+        ASSERT_ARE_EQUAL(size_t, count, binary_tree_item_count(snapshot));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find(snapshot, INSERT_FOR_NO_ROTATION[0]));
+        ASSERT_IS_NULL(binary_tree_find(snapshot, INVALID_ITEM));
+        ASSERT_IS_NULL(binary_tree_find(handle, INSERT_FOR_NO_ROTATION[0]));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find(handle, INVALID_ITEM));
+
+        //cleanup
+        binary_tree_destroy(handle);
+        binary_tree_destroy(snapshot);
+    }
+
+    TEST_FUNCTION(binary_tree_snapshot_insert_fail)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+        BINARY_TREE_HANDLE snapshot = binary_tree_snapshot(handle);
+
+        //act
+        int result = binary_tree_insert(snapshot, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, 0, binary_tree_item_count(snapshot));
+
+        //cleanup
+        binary_tree_destroy(snapshot);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_read_begin_not_mvcc_fail)
+    {
+        //arrange
+        uint64_t read_ts;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+
+        //act
+        int result = binary_tree_read_begin(handle, &read_ts);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_mvcc_with_persistent_fail)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_MVCC_MODE, &enable);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_find_at_sees_removed_item_succeed)
+    {
+        //arrange
+        int enable = 1;
+        uint64_t read_ts;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_MVCC_MODE, &enable);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        int result = binary_tree_read_begin(handle, &read_ts);
+        ASSERT_ARE_EQUAL(int, 0, result);
+
+        //act
+        result = binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[count - 1], remove_callback);
+        (void)binary_tree_insert(handle, INVALID_ITEM, DATA_VALUE);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find_at(handle, INSERT_FOR_NO_ROTATION[count - 1], read_ts));
+        ASSERT_IS_NULL(binary_tree_find_at(handle, INVALID_ITEM, read_ts));
+        ASSERT_IS_NULL(binary_tree_find(handle, INSERT_FOR_NO_ROTATION[count - 1]));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find(handle, INVALID_ITEM));
+        ASSERT_ARE_EQUAL(size_t, count, binary_tree_item_count(handle));
+
+        //cleanup
+        binary_tree_read_end(handle, read_ts);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_mvcc_reinsert_removed_item_succeed)
+    {
+        //arrange
+        int enable = 1;
+        void* new_value = (void*)0x22;
+        uint64_t read_ts;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_MVCC_MODE, &enable);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        (void)binary_tree_read_begin(handle, &read_ts);
+        (void)binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[1], remove_callback);
+
+        //act
+        int result = binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[1], new_value);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(void_ptr, new_value, binary_tree_find(handle, INSERT_FOR_NO_ROTATION[1]));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find_at(handle, INSERT_FOR_NO_ROTATION[1], read_ts));
+
+        //cleanup
+        binary_tree_read_end(handle, read_ts);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_mvcc_gc_waits_for_reader_succeed)
+    {
+        //arrange
+        int enable = 1;
+        uint64_t read_ts;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_MVCC_MODE, &enable);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        (void)binary_tree_read_begin(handle, &read_ts);
+        (void)binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[count - 1], counting_remove_callback);
+        g_remove_callback_count = 0;
+
+        //act
+        int result = binary_tree_mvcc_gc(handle);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, 0, g_remove_callback_count);
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find_at(handle, INSERT_FOR_NO_ROTATION[count - 1], read_ts));
+
+        binary_tree_read_end(handle, read_ts);
+        result = binary_tree_mvcc_gc(handle);
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, 1, g_remove_callback_count);
+        assert_visual_check(handle, "a(5(7))(b(c))");
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_insert_rotate_at_root_succeed)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        const NODE_KEY INSERT_FOR_ROOT_ROTATION[] = { 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7 };
+
+        //act
+        size_t count = sizeof(INSERT_FOR_ROOT_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            int result = binary_tree_insert(handle, INSERT_FOR_ROOT_ROTATION[index], DATA_VALUE);
+
+            //assert
+            ASSERT_ARE_EQUAL(int, 0, result);
+        }
+        assert_visual_check(handle, "4(2(1)(3))(6(5)(7))");
+        ASSERT_ARE_EQUAL(size_t, 3, binary_tree_height(handle));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_insert_duplicate_fail)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+
+        //act
+        int result = binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, 1, binary_tree_item_count(handle));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_txn_begin_handle_NULL_fail)
+    {
+        //arrange
+
+        //act
+        BINARY_TREE_TXN_HANDLE txn_handle = binary_tree_txn_begin(NULL);
+
+        //assert
+        ASSERT_IS_NULL(txn_handle);
+
+        //cleanup
+    }
+
+    TEST_FUNCTION(binary_tree_txn_insert_handle_NULL_fail)
+    {
+        //arrange
+
+        //act
+        int result = binary_tree_txn_insert(NULL, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+    }
+
+    TEST_FUNCTION(binary_tree_txn_commit_handle_NULL_fail)
+    {
+        //arrange
+
+        //act
+        int result = binary_tree_txn_commit(NULL);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+    }
+
+    TEST_FUNCTION(binary_tree_txn_commit_succeed)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        BINARY_TREE_TXN_HANDLE txn_handle = binary_tree_txn_begin(handle);
+        size_t count = sizeof(INSERT_FOR_RIGHT_LEFT_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            int result = binary_tree_txn_insert(txn_handle, INSERT_FOR_RIGHT_LEFT_ROTATION[index], DATA_VALUE);
+            ASSERT_ARE_EQUAL(int, 0, result);
+        }
+
+        //act
+        ASSERT_ARE_EQUAL(size_t, 0, binary_tree_item_count(handle));
+        int result = binary_tree_txn_commit(txn_handle);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, count, binary_tree_item_count(handle));
+        assert_visual_check(handle, VISUAL_RIGHT_LEFT_ROTATION);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_txn_commit_insert_and_remove_succeed)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        BINARY_TREE_TXN_HANDLE txn_handle = binary_tree_txn_begin(handle);
+        (void)binary_tree_txn_remove(txn_handle, INSERT_FOR_NO_ROTATION[0], remove_callback);
+        (void)binary_tree_txn_insert(txn_handle, INVALID_ITEM, DATA_VALUE);
+        // Insert after remove in the same transaction is valid
+        (void)binary_tree_txn_insert(txn_handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+
+        //act
+        int result = binary_tree_txn_commit(txn_handle);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, count + 1, binary_tree_item_count(handle));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find(handle, INVALID_ITEM));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find(handle, INSERT_FOR_NO_ROTATION[0]));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_txn_commit_conflict_applies_nothing_fail)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        BINARY_TREE_TXN_HANDLE txn_handle = binary_tree_txn_begin(handle);
+        (void)binary_tree_txn_insert(txn_handle, INVALID_ITEM, DATA_VALUE);
+        (void)binary_tree_txn_remove(txn_handle, INSERT_FOR_NO_ROTATION[0], remove_callback);
+        // Already in the tree
+        (void)binary_tree_txn_insert(txn_handle, INSERT_FOR_NO_ROTATION[1], DATA_VALUE);
+
+        //act
+        int result = binary_tree_txn_commit(txn_handle);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, count, binary_tree_item_count(handle));
+        ASSERT_IS_NULL(binary_tree_find(handle, INVALID_ITEM));
+        assert_visual_check(handle, VISUAL_NO_ROTATION);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_txn_abort_applies_nothing_succeed)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        BINARY_TREE_TXN_HANDLE txn_handle = binary_tree_txn_begin(handle);
+        (void)binary_tree_txn_insert(txn_handle, INVALID_ITEM, DATA_VALUE);
+
+        //act
+        binary_tree_txn_abort(txn_handle);
+
+        //assert
+        ASSERT_ARE_EQUAL(size_t, 0, binary_tree_item_count(handle));
+        ASSERT_IS_NULL(binary_tree_find(handle, INVALID_ITEM));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_txn_commit_persistent_succeed)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+        BINARY_TREE_HANDLE snapshot = binary_tree_snapshot(handle);
+        BINARY_TREE_TXN_HANDLE txn_handle = binary_tree_txn_begin(handle);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_txn_insert(txn_handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+
+        //act
+        int result = binary_tree_txn_commit(txn_handle);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, count, binary_tree_item_count(handle));
+        ASSERT_ARE_EQUAL(size_t, 0, binary_tree_item_count(snapshot));
+
+        //cleanup
+        binary_tree_destroy(snapshot);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_remove_lazy_delete_keeps_node_succeed)
+    {
+        //arrange
+        int enable = 1;
+        size_t compaction_ratio = 0;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_LAZY_DELETE, &enable);
+        (void)binary_tree_set_option(handle, OPTION_COMPACTION_RATIO, &compaction_ratio);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        g_remove_callback_count = 0;
+
+        //act
+        int result = binary_tree_remove(handle, 0x7, counting_remove_callback);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, 1, g_remove_callback_count);
+        ASSERT_ARE_EQUAL(size_t, count - 1, binary_tree_item_count(handle));
+        ASSERT_IS_NULL(binary_tree_find(handle, 0x7));
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_remove(handle, 0x7, counting_remove_callback));
+        assert_visual_check(handle, VISUAL_NO_ROTATION);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_insert_lazy_delete_revives_tombstone_succeed)
+    {
+        //arrange
+        int enable = 1;
+        size_t compaction_ratio = 0;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_LAZY_DELETE, &enable);
+        (void)binary_tree_set_option(handle, OPTION_COMPACTION_RATIO, &compaction_ratio);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        (void)binary_tree_remove(handle, 0x7, remove_callback);
+
+        //act
+        int result = binary_tree_insert(handle, 0x7, DATA_VALUE);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, count, binary_tree_item_count(handle));
+        ASSERT_IS_NOT_NULL(binary_tree_find(handle, 0x7));
+        assert_visual_check(handle, VISUAL_NO_ROTATION);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_compact_drops_tombstones_succeed)
+    {
+        //arrange
+        int enable = 1;
+        size_t compaction_ratio = 0;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_LAZY_DELETE, &enable);
+        (void)binary_tree_set_option(handle, OPTION_COMPACTION_RATIO, &compaction_ratio);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        (void)binary_tree_remove(handle, 0x7, remove_callback);
+
+        //act
+        int result = binary_tree_compact(handle);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, count - 1, binary_tree_item_count(handle));
+        assert_visual_check(handle, "a(5(3))(b(c))");
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_remove_lazy_delete_compacts_at_ratio_succeed)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_LAZY_DELETE, &enable);
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        (void)binary_tree_remove(handle, 0xa, remove_callback);
+        (void)binary_tree_remove(handle, 0xb, remove_callback);
+
+        //act
+        int result = binary_tree_remove(handle, 0xc, remove_callback);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, count - 3, binary_tree_item_count(handle));
+        assert_visual_check(handle, "5(3)(7)");
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_lazy_delete_with_mvcc_fail)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_MVCC_MODE, &enable);
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_LAZY_DELETE, &enable);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_get_stats_find_succeed)
+    {
+        //arrange
+        BINARY_TREE_STATS stats;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        binary_tree_reset_stats(handle);
+        (void)binary_tree_find(handle, 0x7);
+        (void)binary_tree_find(handle, INVALID_ITEM);
+
+        //act
+        int result = binary_tree_get_stats(handle, &stats);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 2, (int)stats.finds);
+        ASSERT_ARE_EQUAL(int, 1, (int)stats.find_hits);
+        ASSERT_ARE_EQUAL(int, 1, (int)stats.find_misses);
+        ASSERT_ARE_EQUAL(int, 6, (int)stats.comparisons);
+        ASSERT_ARE_EQUAL(int, 6, (int)stats.nodes_visited);
+        ASSERT_ARE_EQUAL(int, 1, (int)stats.depth_histogram[2]);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_get_stats_rotations_succeed)
+    {
+        //arrange
+        BINARY_TREE_STATS stats;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_RIGHT_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_RIGHT_ROTATION[index], DATA_VALUE);
+        }
+        count = sizeof(INSERT_FOR_RIGHT_LEFT_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_RIGHT_LEFT_ROTATION[index], DATA_VALUE);
+        }
+
+        //act
+        int result = binary_tree_get_stats(handle, &stats);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_IS_TRUE(stats.single_rotations >= 1);
+        ASSERT_IS_TRUE(stats.double_rotations >= 1);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_get_stats_allocations_succeed)
+    {
+        //arrange
+        BINARY_TREE_STATS stats;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+        (void)binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[0], remove_callback);
+
+        //act
+        int result = binary_tree_get_stats(handle, &stats);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, (int)count + 1, (int)stats.node_allocations);
+        ASSERT_ARE_EQUAL(int, 2, (int)stats.node_frees);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_reset_stats_succeed)
+    {
+        //arrange
+        BINARY_TREE_STATS stats;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+        (void)binary_tree_find(handle, INSERT_FOR_NO_ROTATION[0]);
+
+        //act
+        binary_tree_reset_stats(handle);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_get_stats(handle, &stats));
+        ASSERT_ARE_EQUAL(int, 0, (int)stats.finds);
+        ASSERT_ARE_EQUAL(int, 0, (int)stats.node_allocations);
+        ASSERT_ARE_EQUAL(int, 0, (int)stats.depth_histogram[0]);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_memory_usage_handle_NULL_fail)
+    {
+        //arrange
+        BINARY_TREE_MEMORY_USAGE usage;
+
+        //act
+        int result = binary_tree_memory_usage(NULL, &usage);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    }
+
+    TEST_FUNCTION(binary_tree_memory_usage_succeed)
+    {
+        //arrange
+        BINARY_TREE_MEMORY_USAGE usage;
+        BINARY_TREE_MEMORY_USAGE empty_usage;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        (void)binary_tree_memory_usage(handle, &empty_usage);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+
+        //act
+        int result = binary_tree_memory_usage(handle, &usage);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 0, (int)empty_usage.node_bytes);
+        ASSERT_ARE_EQUAL(int, (int)count, (int)usage.items);
+        ASSERT_ARE_EQUAL(int, 0, (int)(usage.node_bytes % count));
+        ASSERT_ARE_EQUAL(int, (int)(usage.node_bytes / count), (int)usage.metadata_bytes_per_entry);
+        ASSERT_IS_TRUE(usage.total_bytes == usage.node_bytes + usage.bookkeeping_bytes + usage.overhead_bytes);
+        ASSERT_IS_TRUE(usage.overhead_bytes > 0);
+        ASSERT_ARE_EQUAL(int, (int)(empty_usage.live_allocations + count), (int)usage.live_allocations);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_memory_usage_remove_frees_nodes_succeed)
+    {
+        //arrange
+        BINARY_TREE_MEMORY_USAGE usage;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[index], NULL);
+        }
+
+        //act
+        int result = binary_tree_memory_usage(handle, &usage);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 0, (int)usage.node_bytes);
+        ASSERT_ARE_EQUAL(int, 0, (int)usage.scratch_bytes);
+        ASSERT_IS_TRUE(usage.peak_bytes > usage.total_bytes);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_memory_usage_snapshot_shares_nodes_succeed)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_MEMORY_USAGE live_usage;
+        BINARY_TREE_MEMORY_USAGE snapshot_usage;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[1], DATA_VALUE);
+        BINARY_TREE_HANDLE snapshot = binary_tree_snapshot(handle);
+        (void)binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[0], NULL);
+
+        //act
+        int result = binary_tree_memory_usage(snapshot, &snapshot_usage);
+        (void)binary_tree_memory_usage(handle, &live_usage);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 2, (int)snapshot_usage.items);
+        ASSERT_ARE_EQUAL(int, 1, (int)live_usage.items);
+        ASSERT_IS_TRUE(snapshot_usage.node_bytes == live_usage.node_bytes);
+        ASSERT_IS_TRUE(snapshot_usage.node_bytes > 0);
+
+        //cleanup
+        binary_tree_destroy(handle);
+        (void)binary_tree_memory_usage(snapshot, &snapshot_usage);
+        ASSERT_IS_TRUE(snapshot_usage.node_bytes > 0);
+        binary_tree_destroy(snapshot);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_stats_export_publishes_succeed)
+    {
+        //arrange
+        STAT_PAGE_VALUES values;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        size_t count = sizeof(INSERT_FOR_NO_ROTATION);
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_STATS_EXPORT, TEST_STAT_PAGE_NAME);
+        for (size_t index = 0; index < count; index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        (void)binary_tree_find(handle, INSERT_FOR_NO_ROTATION[0]);
+        STAT_PAGE_HANDLE stat_page = stat_page_open(TEST_STAT_PAGE_NAME);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_IS_NOT_NULL(stat_page);
+        ASSERT_ARE_EQUAL(int, 0, wait_for_published_items(stat_page, count, &values));
+        ASSERT_ARE_EQUAL(int, (int)INSERT_NO_ROTATION_HEIGHT, (int)values.height);
+        ASSERT_ARE_EQUAL(int, (int)count, (int)values.inserts);
+        ASSERT_ARE_EQUAL(int, 1, (int)values.finds);
+        ASSERT_IS_TRUE(values.memory_bytes > 0);
+
+        //cleanup
+        stat_page_destroy(stat_page);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_stats_export_stop_succeed)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_STATS_EXPORT, TEST_STAT_PAGE_NAME);
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_STATS_EXPORT, "");
+        STAT_PAGE_HANDLE stat_page = stat_page_open(TEST_STAT_PAGE_NAME);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_IS_NULL(stat_page);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_trace_file_records_calls_succeed)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE);
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_TRACE_FILE, TEST_TRACE_FILE_NAME);
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[1], DATA_VALUE);
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[1], DATA_VALUE);
+        (void)binary_tree_find(handle, INSERT_FOR_NO_ROTATION[0]);
+        (void)binary_tree_remove(handle, INSERT_FOR_NO_ROTATION[1], remove_callback);
+        (void)binary_tree_find(handle, INSERT_FOR_NO_ROTATION[1]);
+        int stop_result = binary_tree_set_option(handle, OPTION_TRACE_FILE, "");
+        (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[2], DATA_VALUE);
+        OP_TRACE_READER_HANDLE reader = op_trace_reader_open(TEST_TRACE_FILE_NAME);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 0, stop_result);
+        ASSERT_IS_NOT_NULL(reader);
+        ASSERT_ARE_EQUAL(int, 5, (int)op_trace_reader_count(reader));
+        ASSERT_ARE_EQUAL(int, BINARY_TREE_KEY_BYTE, (int)op_trace_reader_key_mode(reader));
+        const OP_TRACE_RECORD* records = op_trace_reader_records(reader);
+        ASSERT_ARE_EQUAL(int, OP_TRACE_INSERT, (int)records[0].operation);
+        ASSERT_ARE_EQUAL(int, (int)INSERT_FOR_NO_ROTATION[1], (int)records[0].key);
+        ASSERT_ARE_EQUAL(int, 0, (int)records[0].result);
+        ASSERT_ARE_EQUAL(int, OP_TRACE_INSERT, (int)records[1].operation);
+        ASSERT_ARE_EQUAL(int, 1, (int)records[1].result);
+        ASSERT_ARE_EQUAL(int, OP_TRACE_FIND, (int)records[2].operation);
+        ASSERT_ARE_EQUAL(int, 0, (int)records[2].result);
+        ASSERT_ARE_EQUAL(int, OP_TRACE_REMOVE, (int)records[3].operation);
+        ASSERT_ARE_EQUAL(int, 0, (int)records[3].result);
+        ASSERT_ARE_EQUAL(int, OP_TRACE_FIND, (int)records[4].operation);
+        ASSERT_ARE_EQUAL(int, 1, (int)records[4].result);
+        ASSERT_IS_TRUE(records[4].timestamp_ns >= records[0].timestamp_ns);
+
+        //cleanup
+        op_trace_reader_close(reader);
+        (void)remove(TEST_TRACE_FILE_NAME);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_trace_file_records_u64_key_mode_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        int byte_mode = BINARY_TREE_KEY_BYTE;
+        uint64_t wide_key = 0x123456789abcdef0ULL;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode));
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_TRACE_FILE, TEST_TRACE_FILE_NAME);
+        int mode_result = binary_tree_set_option(handle, OPTION_KEY_MODE, &byte_mode);
+        (void)binary_tree_insert_u64(handle, wide_key, DATA_VALUE);
+        int stop_result = binary_tree_set_option(handle, OPTION_TRACE_FILE, "");
+        OP_TRACE_READER_HANDLE reader = op_trace_reader_open(TEST_TRACE_FILE_NAME);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_NOT_EQUAL(int, 0, mode_result);
+        ASSERT_ARE_EQUAL(int, 0, stop_result);
+        ASSERT_IS_NOT_NULL(reader);
+        ASSERT_ARE_EQUAL(int, BINARY_TREE_KEY_UINT64, (int)op_trace_reader_key_mode(reader));
+        ASSERT_ARE_EQUAL(int, 1, (int)op_trace_reader_count(reader));
+        ASSERT_IS_TRUE(op_trace_reader_records(reader)[0].key == wide_key);
+
+        //cleanup
+        op_trace_reader_close(reader);
+        (void)remove(TEST_TRACE_FILE_NAME);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_trace_file_unwritable_fail)
+    {
+        //arrange
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_TRACE_FILE, "no_such_directory/whiskey.trace");
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[0], DATA_VALUE));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(op_trace_writer_record_after_close_is_dropped_succeed)
+    {
+        //arrange
+        OP_TRACE_WRITER_HANDLE writer = op_trace_writer_create(TEST_TRACE_FILE_NAME, BINARY_TREE_KEY_BYTE);
+        ASSERT_IS_NOT_NULL(writer);
+        op_trace_writer_record(writer, OP_TRACE_INSERT, 1, 0, 10, 20);
+
+        //act
+        int result = op_trace_writer_close(writer);
+        // A replaced tree recorder is closed while operations may still hold it
+        op_trace_writer_record(writer, OP_TRACE_FIND, 1, 0, 30, 40);
+        OP_TRACE_READER_HANDLE reader = op_trace_reader_open(TEST_TRACE_FILE_NAME);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_IS_NOT_NULL(reader);
+        ASSERT_ARE_EQUAL(int, 1, (int)op_trace_reader_count(reader));
+        ASSERT_ARE_EQUAL(int, OP_TRACE_INSERT, (int)op_trace_reader_records(reader)[0].operation);
+
+        //cleanup
+        op_trace_reader_close(reader);
+        op_trace_writer_destroy(writer);
+        (void)remove(TEST_TRACE_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_insert_u64_wide_keys_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        int string_mode = BINARY_TREE_KEY_STRING;
+        uint64_t keys[] = { 0x100, 0xFFFFFFFFFFFFFFFFULL, 7, 0x123456789ULL, 0x8000000000000000ULL };
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+
+        //act
+        for (size_t index = 0; index < sizeof(keys) / sizeof(keys[0]); index++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, keys[index], DATA_VALUE));
+        }
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 5, (int)binary_tree_item_count(handle));
+        ASSERT_IS_NOT_NULL(binary_tree_find_u64(handle, 0x123456789ULL));
+        ASSERT_IS_NOT_NULL(binary_tree_find(handle, 7));
+        ASSERT_IS_NULL(binary_tree_find_u64(handle, 0x123456788ULL));
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_insert_u64(handle, 0x100, DATA_VALUE));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_u64(handle, 0xFFFFFFFFFFFFFFFFULL, remove_callback));
+        ASSERT_IS_NULL(binary_tree_find_u64(handle, 0xFFFFFFFFFFFFFFFFULL));
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_set_option(handle, OPTION_KEY_MODE, &string_mode));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_insert_string_orders_like_memcmp_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_STRING;
+        const char* keys[] = { "whiskey", "whisk", "whiskey_sour", "a", "", "whiskez", "whiskey\x01" };
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+
+        //act
+        for (size_t index = 0; index < sizeof(keys) / sizeof(keys[0]); index++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_string(handle, keys[index], strlen(keys[index]), (void*)keys[index]));
+        }
+
+        //assert
+        for (size_t index = 0; index < sizeof(keys) / sizeof(keys[0]); index++)
+        {
+            ASSERT_ARE_EQUAL(void_ptr, (void*)keys[index], binary_tree_find_string(handle, keys[index], strlen(keys[index])));
+        }
+        ASSERT_IS_NULL(binary_tree_find_string(handle, "whiske", 6));
+        ASSERT_IS_NULL(binary_tree_find_string(handle, "whiskey\0", 8));
+        ASSERT_IS_NULL(binary_tree_find(handle, 'a'));
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_insert_string(handle, "whisk", 5, DATA_VALUE));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_string(handle, "whiskey", 7, NULL));
+        ASSERT_IS_NULL(binary_tree_find_string(handle, "whiskey", 7));
+        ASSERT_IS_NOT_NULL(binary_tree_find_string(handle, "whiskey_sour", 12));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_for_each_parallel_entries_string_keys_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_STRING;
+        int enable = 1;
+        char key[32];
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        (void)binary_tree_set_option(handle, OPTION_PREFIX_COMPRESSION, &enable);
+        for (size_t index = 0; index < 20000; index++)
+        {
+            int length = snprintf(key, sizeof(key), "whiskey/%05d", (int)get_scattered_key(index, 20000));
+            (void)binary_tree_insert_string(handle, key, (size_t)length, (void*)(uintptr_t)(get_scattered_key(index, 20000) + 1));
+        }
+        memset(g_visited_entries, 0, sizeof(g_visited_entries));
+
+        //act
+        int result = binary_tree_for_each_parallel_entries(handle, string_entry_visitor_callback, NULL, 4);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        for (size_t index = 0; index < 20000; index++)
+        {
+            ASSERT_ARE_EQUAL(int, 1, g_visited_entries[index]);
+        }
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_for_each_parallel(handle, visitor_callback, NULL, 4));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_find_at_u64_sees_removed_item_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        int enable = 1;
+        uint64_t read_ts;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        (void)binary_tree_set_option(handle, OPTION_MVCC_MODE, &enable);
+        for (uint64_t key = 1000; key < 2000; key++)
+        {
+            (void)binary_tree_insert_u64(handle, key << 32, (void*)(uintptr_t)key);
+        }
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_read_begin(handle, &read_ts));
+
+        //act
+        int result = binary_tree_remove_u64(handle, (uint64_t)1500 << 32, NULL);
+        (void)binary_tree_insert_u64(handle, (uint64_t)5000 << 32, DATA_VALUE);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)(uintptr_t)1500, binary_tree_find_at_u64(handle, (uint64_t)1500 << 32, read_ts));
+        ASSERT_ARE_EQUAL(void_ptr, (void*)(uintptr_t)1999, binary_tree_find_at_u64(handle, (uint64_t)1999 << 32, read_ts));
+        ASSERT_IS_NULL(binary_tree_find_at_u64(handle, (uint64_t)5000 << 32, read_ts));
+        ASSERT_IS_NULL(binary_tree_find_u64(handle, (uint64_t)1500 << 32));
+        ASSERT_IS_NULL(binary_tree_find_at_string(handle, "1500", 4, read_ts));
+
+        //cleanup
+        binary_tree_read_end(handle, read_ts);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_txn_commit_string_keys_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_STRING;
+        char key[32];
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        (void)binary_tree_insert_string(handle, "whiskey", 7, DATA_VALUE);
+        BINARY_TREE_TXN_HANDLE txn_handle = binary_tree_txn_begin(handle);
+        // The transaction has to keep its own copy of every key
+        (void)strcpy(key, "whiskey");
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_txn_remove_string(txn_handle, key, strlen(key), remove_callback));
+        (void)strcpy(key, "bourbon_single_barrel");
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_txn_insert_string(txn_handle, key, strlen(key), DATA_VALUE));
+        (void)strcpy(key, "rye");
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_txn_insert_string(txn_handle, key, strlen(key), DATA_VALUE));
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_txn_insert_u64(txn_handle, 1, DATA_VALUE));
+        (void)memset(key, 'x', sizeof(key));
+
+        //act
+        int result = binary_tree_txn_commit(txn_handle);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(size_t, 2, binary_tree_item_count(handle));
+        ASSERT_IS_NULL(binary_tree_find_string(handle, "whiskey", 7));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find_string(handle, "bourbon_single_barrel", 21));
+        ASSERT_ARE_EQUAL(void_ptr, DATA_VALUE, binary_tree_find_string(handle, "rye", 3));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_set_option_prefix_compression_shares_prefix_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_STRING;
+        int enable = 1;
+        char key[64];
+        BINARY_TREE_MEMORY_USAGE plain_usage;
+        BINARY_TREE_MEMORY_USAGE compressed_usage;
+        BINARY_TREE_HANDLE plain = binary_tree_create();
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(plain, OPTION_KEY_MODE, &key_mode);
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+
+        //act
+        int result = binary_tree_set_option(handle, OPTION_PREFIX_COMPRESSION, &enable);
+        for (int index = 0; index < 200; index++)
+        {
+            int length = snprintf(key, sizeof(key), "/var/lib/whiskey/tables/orders/%05d", (index * 37) % 200);
+            (void)binary_tree_insert_string(plain, key, (size_t)length, DATA_VALUE);
+            (void)binary_tree_insert_string(handle, key, (size_t)length, DATA_VALUE);
+        }
+        (void)binary_tree_memory_usage(plain, &plain_usage);
+        (void)binary_tree_memory_usage(handle, &compressed_usage);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 200, (int)binary_tree_item_count(handle));
+        ASSERT_IS_TRUE(compressed_usage.node_bytes < plain_usage.node_bytes);
+        for (int index = 0; index < 200; index += 2)
+        {
+            int length = snprintf(key, sizeof(key), "/var/lib/whiskey/tables/orders/%05d", index);
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_string(handle, key, (size_t)length, NULL));
+        }
+        for (int index = 0; index < 200; index++)
+        {
+            int length = snprintf(key, sizeof(key), "/var/lib/whiskey/tables/orders/%05d", index);
+            ASSERT_ARE_EQUAL(int, index % 2 != 0, binary_tree_find_string(handle, key, (size_t)length) != NULL);
+        }
+
+        //cleanup
+        binary_tree_destroy(plain);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(whiskey_tree_insert_find_remove_succeed)
+    {
+        //arrange
+        test_typed_tree_tree tree;
+        uint64_t removed_value = 0;
+        uint64_t previous_key = 0;
+        test_typed_tree_init(&tree);
+
+        //act
+        for (uint64_t key = 1; key <= 1000; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, test_typed_tree_insert(&tree, (key * 7919) % 1009, ((key * 7919) % 1009) * 2));
+        }
+        for (uint64_t key = 2; key <= 1008; key += 2)
+        {
+            (void)test_typed_tree_remove(&tree, key, NULL);
+        }
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, test_typed_tree_insert(&tree, 7, 0));
+        ASSERT_IS_NULL(test_typed_tree_find(&tree, 8));
+        ASSERT_ARE_EQUAL(int, 14, (int)*test_typed_tree_find(&tree, 7));
+        ASSERT_ARE_EQUAL(int, 0, test_typed_tree_remove(&tree, 7, &removed_value));
+        ASSERT_ARE_EQUAL(int, 14, (int)removed_value);
+        ASSERT_ARE_NOT_EQUAL(int, 0, test_typed_tree_remove(&tree, 7, NULL));
+        ASSERT_IS_TRUE(test_typed_tree_height(&tree) <= 11);
+        test_typed_tree_for_each(&tree, typed_visitor_callback, &previous_key);
+        ASSERT_ARE_EQUAL(int, 1007, (int)previous_key);
+
+        //cleanup
+        test_typed_tree_clear(&tree);
+        ASSERT_ARE_EQUAL(int, 0, (int)test_typed_tree_count(&tree));
+    }
+
+    TEST_FUNCTION(whiskey_tree_count_succeed)
+    {
+        //arrange
+        test_typed_tree_tree tree;
+        test_typed_tree_init(&tree);
+        for (uint64_t key = 1000; key > 0; key--)
+        {
+            (void)test_typed_tree_insert(&tree, key, key * 2);
+        }
+
+        //act
+        size_t result = test_typed_tree_count(&tree);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 1000, (int)result);
+        ASSERT_ARE_EQUAL(int, 10, (int)test_typed_tree_height(&tree));
+
+        //cleanup
+        test_typed_tree_clear(&tree);
+    }
+
+    TEST_FUNCTION(whiskey_node_insert_find_succeed)
+    {
+        //arrange
+        TEST_ENTRY entries[100];
+        TEST_ENTRY duplicate;
+        whiskey_root root = WHISKEY_ROOT_INIT;
+        int find_key = 42;
+        int previous_key = -1;
+        size_t count = 0;
+        duplicate.key = 42;
+
+        //act
+        for (int index = 0; index < 100; index++)
+        {
+            entries[index].key = (index * 37) % 100;
+            ASSERT_ARE_EQUAL(int, 0, whiskey_insert(&root, &entries[index].node, compare_test_entries));
+        }
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, whiskey_insert(&root, &duplicate.node, compare_test_entries));
+        ASSERT_ARE_EQUAL(int, 42, whiskey_entry(whiskey_find(&root, &find_key, compare_test_entry_key), TEST_ENTRY, node)->key);
+        ASSERT_IS_TRUE(root.node->height <= 9);
+        for (whiskey_node* node = whiskey_first(&root); node != NULL; node = whiskey_next(node))
+        {
+            ASSERT_ARE_EQUAL(int, previous_key + 1, whiskey_entry(node, TEST_ENTRY, node)->key);
+            previous_key++;
+            count++;
+        }
+        ASSERT_ARE_EQUAL(int, 100, (int)count);
+        ASSERT_ARE_EQUAL(int, 99, whiskey_entry(whiskey_last(&root), TEST_ENTRY, node)->key);
+    }
+
+    TEST_FUNCTION(whiskey_node_erase_succeed)
+    {
+        //arrange
+        TEST_ENTRY entries[100];
+        whiskey_root root = WHISKEY_ROOT_INIT;
+        int previous_key = 100;
+        size_t count = 0;
+        for (int index = 0; index < 100; index++)
+        {
+            entries[index].key = index;
+            (void)whiskey_insert(&root, &entries[index].node, compare_test_entries);
+        }
+
+        //act
+        for (int index = 0; index < 100; index += 3)
+        {
+            whiskey_erase(&root, &entries[index].node);
+        }
+
+        //assert
+        for (int index = 0; index < 100; index++)
+        {
+            whiskey_node* node = whiskey_find(&root, &index, compare_test_entry_key);
+            ASSERT_IS_TRUE(index % 3 == 0 ? node == NULL : node == &entries[index].node);
+        }
+        for (whiskey_node* node = whiskey_last(&root); node != NULL; node = whiskey_prev(node))
+        {
+            ASSERT_IS_TRUE(whiskey_entry(node, TEST_ENTRY, node)->key < previous_key);
+            previous_key = whiskey_entry(node, TEST_ENTRY, node)->key;
+            count++;
+        }
+        ASSERT_ARE_EQUAL(int, 66, (int)count);
+        ASSERT_IS_TRUE(root.node->height <= 9);
+    }
+
+    TEST_FUNCTION(binary_tree_open_mapped_u64_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        uint64_t values[1000];
+        size_t height;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        for (size_t index = 0; index < 1000; index++)
+        {
+            values[index] = (uint64_t)index * 3;
+            (void)binary_tree_insert_u64(handle, (uint64_t)index << 20, &values[index]);
+        }
+        ASSERT_ARE_EQUAL(int, 0, save_test_image(handle, u64_serializer));
+
+        //act
+        BINARY_TREE_HANDLE mapped = binary_tree_open_mapped(TEST_IMAGE_FILE_NAME);
+
+        //assert
+        ASSERT_IS_NOT_NULL(mapped);
+        ASSERT_ARE_EQUAL(int, 1000, (int)binary_tree_item_count(mapped));
+        height = binary_tree_height(mapped);
+        ASSERT_ARE_EQUAL(int, 10, (int)height);
+        for (size_t index = 0; index < 1000; index++)
+        {
+            const uint64_t* payload = (const uint64_t*)binary_tree_find_u64(mapped, (uint64_t)index << 20);
+            ASSERT_IS_NOT_NULL(payload);
+            ASSERT_ARE_EQUAL(int, (int)index * 3, (int)*payload);
+        }
+        ASSERT_IS_NULL(binary_tree_find_u64(mapped, 1));
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_insert_u64(mapped, 1, DATA_VALUE));
+
+        //cleanup
+        binary_tree_destroy(mapped);
+        binary_tree_destroy(handle);
+        (void)remove(TEST_IMAGE_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_open_mapped_string_keys_in_order_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_STRING;
+        int enable = 1;
+        char key[64];
+        ENTRY_ORDER live_order;
+        ENTRY_ORDER mapped_order;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        (void)binary_tree_set_option(handle, OPTION_PREFIX_COMPRESSION, &enable);
+        for (int index = 0; index < 300; index++)
+        {
+            int length = snprintf(key, sizeof(key), "%s%d", index % 2 == 0 ? "/var/lib/whiskey/tables/" : "k", (index * 7) % 300);
+            (void)binary_tree_insert_string(handle, key, (size_t)length, DATA_VALUE);
+        }
+        (void)binary_tree_remove_string(handle, "k7", 2, NULL);
+        memset(&live_order, 0, sizeof(live_order));
+        memset(&mapped_order, 0, sizeof(mapped_order));
+        ASSERT_ARE_EQUAL(int, 0, save_test_image(handle, NULL));
+
+        //act
+        BINARY_TREE_HANDLE mapped = binary_tree_open_mapped(TEST_IMAGE_FILE_NAME);
+
+        //assert
+        ASSERT_IS_NOT_NULL(mapped);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_for_each(handle, entry_order_callback, &live_order));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_for_each(mapped, entry_order_callback, &mapped_order));
+        ASSERT_ARE_EQUAL(int, 299, (int)live_order.count);
+        ASSERT_ARE_EQUAL(int, 299, (int)mapped_order.count);
+        ASSERT_ARE_EQUAL(int, 0, live_order.out_of_order + mapped_order.out_of_order);
+        ASSERT_IS_NOT_NULL(binary_tree_find_string(mapped, "/var/lib/whiskey/tables/14", 26));
+        ASSERT_IS_NULL(binary_tree_find_string(mapped, "k7", 2));
+        ASSERT_IS_NULL(binary_tree_find_string(mapped, "/var/lib/whiskey/tables/7", 25));
+
+        //cleanup
+        binary_tree_destroy(mapped);
+        binary_tree_destroy(handle);
+        (void)remove(TEST_IMAGE_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_open_mapped_corrupt_fail)
+    {
+        //arrange
+        unsigned char flipped = 0xFF;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        for (size_t index = 0; index < sizeof(INSERT_FOR_NO_ROTATION); index++)
+        {
+            (void)binary_tree_insert(handle, INSERT_FOR_NO_ROTATION[index], DATA_VALUE);
+        }
+        (void)save_test_image(handle, NULL);
+        int fd = open(TEST_IMAGE_FILE_NAME, O_WRONLY);
+        ASSERT_ARE_EQUAL(int, 1, (int)pwrite(fd, &flipped, 1, 72));
+        (void)close(fd);
+
+        //act
+        BINARY_TREE_HANDLE mapped = binary_tree_open_mapped(TEST_IMAGE_FILE_NAME);
+
+        //assert
+        ASSERT_IS_NULL(mapped);
+
+        //cleanup
+        binary_tree_destroy(handle);
+        (void)remove(TEST_IMAGE_FILE_NAME);
+    }
+
+    TEST_FUNCTION(shared_tree_open_reads_writer_tree_succeed)
+    {
+        //arrange
+        U64_RANGE range = { 0, 0, 0 };
+        uint64_t value = 0;
+        SHARED_TREE_HANDLE writer = shared_tree_create(TEST_SHARED_TREE_NAME, 1000);
+        ASSERT_IS_NOT_NULL(writer);
+        for (uint64_t key = 0; key < 1000; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, shared_tree_insert(writer, key, key * 2));
+        }
+
+        //act
+        SHARED_TREE_HANDLE reader = shared_tree_open(TEST_SHARED_TREE_NAME);
+        ASSERT_IS_NOT_NULL(reader);
+        for (uint64_t key = 0; key < 1000; key += 2)
+        {
+            ASSERT_ARE_EQUAL(int, 0, shared_tree_remove(writer, key));
+        }
+        int result = shared_tree_range(reader, 100, 899, u64_range_callback, &range);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 400, (int)range.count);
+        ASSERT_ARE_EQUAL(int, 0, range.out_of_order);
+        ASSERT_ARE_EQUAL(int, 500, (int)shared_tree_item_count(reader));
+        ASSERT_ARE_EQUAL(int, 0, shared_tree_find(reader, 777, &value));
+        ASSERT_ARE_EQUAL(int, 1554, (int)value);
+        ASSERT_ARE_NOT_EQUAL(int, 0, shared_tree_find(reader, 778, &value));
+        ASSERT_ARE_NOT_EQUAL(int, 0, shared_tree_insert(reader, 2000, 1));
+
+        //cleanup
+        shared_tree_destroy(reader);
+        shared_tree_destroy(writer);
+    }
+
+    TEST_FUNCTION(shared_tree_insert_full_fail)
+    {
+        //arrange
+        SHARED_TREE_HANDLE writer = shared_tree_create(TEST_SHARED_TREE_NAME, 3);
+        for (uint64_t key = 0; key < 3; key++)
+        {
+            (void)shared_tree_insert(writer, key, key);
+        }
+
+        //act
+        int result = shared_tree_insert(writer, 3, 3);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 0, shared_tree_remove(writer, 1));
+        ASSERT_ARE_EQUAL(int, 0, shared_tree_insert(writer, 3, 3));
+        ASSERT_ARE_EQUAL(int, 3, (int)shared_tree_item_count(writer));
+
+        //cleanup
+        shared_tree_destroy(writer);
+    }
+
+    TEST_FUNCTION(shared_tree_open_missing_fail)
+    {
+        //arrange
+        SHARED_TREE_HANDLE writer = shared_tree_create(TEST_SHARED_TREE_NAME, 10);
+        shared_tree_destroy(writer);
+
+        //act
+        SHARED_TREE_HANDLE reader = shared_tree_open(TEST_SHARED_TREE_NAME);
+
+        //assert
+        ASSERT_IS_NULL(reader);
+    }
+
+    TEST_FUNCTION(paged_tree_larger_than_cache_succeed)
+    {
+        //arrange
+        U64_RANGE range = { 0, 0, 0 };
+        PAGED_TREE_STATS stats;
+        uint64_t value = 0;
+        (void)remove(TEST_PAGED_FILE_NAME);
+        PAGED_TREE_HANDLE handle = paged_tree_open(TEST_PAGED_FILE_NAME, PAGED_TREE_MIN_CACHE_PAGES);
+        ASSERT_IS_NOT_NULL(handle);
+
+        //act
+        for (uint64_t index = 0; index < 100000; index++)
+        {
+            uint64_t key = get_scattered_key(index, 100000);
+            ASSERT_ARE_EQUAL(int, 0, paged_tree_insert(handle, key, key * 2));
+        }
+        for (uint64_t key = 0; key < 100000; key += 2)
+        {
+            ASSERT_ARE_EQUAL(int, 0, paged_tree_remove(handle, key, &value));
+            ASSERT_ARE_EQUAL(int, (int)(key * 2), (int)value);
+        }
+        int result = paged_tree_scan(handle, 1000, 59999, u64_range_callback, &range);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 29500, (int)range.count);
+        ASSERT_ARE_EQUAL(int, 0, range.out_of_order);
+        ASSERT_ARE_EQUAL(int, 50000, (int)paged_tree_item_count(handle));
+        ASSERT_ARE_EQUAL(int, 0, paged_tree_find(handle, 77777, &value));
+        ASSERT_ARE_EQUAL(int, 155554, (int)value);
+        ASSERT_ARE_NOT_EQUAL(int, 0, paged_tree_find(handle, 77778, &value));
+        ASSERT_ARE_NOT_EQUAL(int, 0, paged_tree_insert(handle, 77777, 1));
+        ASSERT_ARE_EQUAL(int, 0, paged_tree_get_stats(handle, &stats));
+        ASSERT_IS_TRUE(stats.file_pages > 10 * PAGED_TREE_MIN_CACHE_PAGES);
+        ASSERT_IS_TRUE(stats.page_reads > 0 && stats.evictions > 0);
+
+        //cleanup
+        paged_tree_destroy(handle);
+        (void)remove(TEST_PAGED_FILE_NAME);
+    }
+
+    TEST_FUNCTION(paged_tree_reopen_succeed)
+    {
+        //arrange
+        uint64_t value = 0;
+        (void)remove(TEST_PAGED_FILE_NAME);
+        PAGED_TREE_HANDLE handle = paged_tree_open(TEST_PAGED_FILE_NAME, 64);
+        for (uint64_t index = 0; index < 20000; index++)
+        {
+            (void)paged_tree_insert(handle, index << 8, index);
+        }
+        for (uint64_t index = 0; index < 20000; index += 3)
+        {
+            (void)paged_tree_remove(handle, index << 8, NULL);
+        }
+        size_t height = paged_tree_height(handle);
+        paged_tree_destroy(handle);
+
+        //act
+        handle = paged_tree_open(TEST_PAGED_FILE_NAME, 32);
+
+        //assert
+        ASSERT_IS_NOT_NULL(handle);
+        ASSERT_ARE_EQUAL(int, 13333, (int)paged_tree_item_count(handle));
+        ASSERT_ARE_EQUAL(int, (int)height, (int)paged_tree_height(handle));
+        for (uint64_t index = 0; index < 20000; index++)
+        {
+            int found = paged_tree_find(handle, index << 8, &value) == 0 && value == index;
+            ASSERT_ARE_EQUAL(int, index % 3 != 0, found);
+        }
+
+        //cleanup
+        paged_tree_destroy(handle);
+        (void)remove(TEST_PAGED_FILE_NAME);
+    }
+
+    TEST_FUNCTION(paged_tree_insert_write_failure_keeps_entries)
+    {
+        //arrange
+        U64_RANGE range = { 0, 0, 0 };
+        struct stat file_stat;
+        struct stat fd_stat;
+        size_t failures = 0;
+        size_t missing = 0;
+        uint64_t value = 0;
+        (void)remove(TEST_PAGED_FILE_NAME);
+        // The tree takes the lowest free descriptor, swapping a read only one
+        // in under it makes every write back fail while reads still work
+        int tree_fd = open(TEST_PAGED_FILE_NAME, O_RDWR | O_CREAT, 0644);
+        ASSERT_IS_TRUE(tree_fd >= 0);
+        (void)close(tree_fd);
+        PAGED_TREE_HANDLE handle = paged_tree_open(TEST_PAGED_FILE_NAME, PAGED_TREE_MIN_CACHE_PAGES);
+        ASSERT_IS_NOT_NULL(handle);
+        ASSERT_ARE_EQUAL(int, 0, stat(TEST_PAGED_FILE_NAME, &file_stat));
+        ASSERT_ARE_EQUAL(int, 0, fstat(tree_fd, &fd_stat));
+        ASSERT_IS_TRUE(file_stat.st_ino == fd_stat.st_ino);
+        int read_only_fd = open(TEST_PAGED_FILE_NAME, O_RDONLY);
+        int read_write_fd = dup(tree_fd);
+        ASSERT_IS_TRUE(read_only_fd >= 0 && read_write_fd >= 0);
+
+        //act
+        // Pages are only claimed when one splits, so the failures land on
+        // the splits, among them ones where the parent needs a new page
+        ASSERT_ARE_EQUAL(int, tree_fd, dup2(read_only_fd, tree_fd));
+        for (uint64_t key = 0; key < 120000; key++)
+        {
+            if (paged_tree_insert(handle, key, key * 2) != 0)
+            {
+                failures++;
+                ASSERT_ARE_EQUAL(int, tree_fd, dup2(read_write_fd, tree_fd));
+                ASSERT_ARE_EQUAL(int, 0, paged_tree_flush(handle));
+                ASSERT_ARE_EQUAL(int, 0, paged_tree_insert(handle, key, key * 2));
+                ASSERT_ARE_EQUAL(int, tree_fd, dup2(read_only_fd, tree_fd));
+            }
+        }
+        ASSERT_ARE_EQUAL(int, tree_fd, dup2(read_write_fd, tree_fd));
+        int result = paged_tree_scan(handle, 0, UINT64_MAX, u64_range_callback, &range);
+
+        //assert
+        ASSERT_IS_TRUE(failures > 0);
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 120000, (int)range.count);
+        ASSERT_ARE_EQUAL(int, 0, range.out_of_order);
+        ASSERT_ARE_EQUAL(int, 120000, (int)paged_tree_item_count(handle));
+        for (uint64_t key = 0; key < 120000; key++)
+        {
+            if (paged_tree_find(handle, key, &value) != 0 || value != key * 2)
+            {
+                missing++;
+            }
+        }
+        ASSERT_ARE_EQUAL(int, 0, (int)missing);
+
+        //cleanup
+        (void)close(read_only_fd);
+        (void)close(read_write_fd);
+        paged_tree_destroy(handle);
+        (void)remove(TEST_PAGED_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_open_paged_succeed)
+    {
+        //arrange
+        U64_RANGE range = { 0, 0, 0 };
+        int enable = 1;
+        (void)remove(TEST_PAGED_FILE_NAME);
+        BINARY_TREE_HANDLE handle = binary_tree_open_paged(TEST_PAGED_FILE_NAME, PAGED_TREE_MIN_CACHE_PAGES);
+        ASSERT_IS_NOT_NULL(handle);
+
+        //act
+        for (uint64_t index = 0; index < 10000; index++)
+        {
+            uint64_t key = get_scattered_key(index, 10000);
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+        g_remove_callback_count = 0;
+        for (uint64_t key = 0; key < 10000; key += 4)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_u64(handle, key, counting_remove_callback));
+        }
+        int result = binary_tree_for_each(handle, u64_entry_callback, &range);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 7500, (int)range.count);
+        ASSERT_ARE_EQUAL(int, 0, range.out_of_order);
+        ASSERT_ARE_EQUAL(int, 2500, (int)g_remove_callback_count);
+        ASSERT_ARE_EQUAL(int, 7500, (int)binary_tree_item_count(handle));
+        ASSERT_IS_TRUE(binary_tree_find_u64(handle, 4321) == (void*)(uintptr_t)8642);
+        ASSERT_IS_NULL(binary_tree_find_u64(handle, 4320));
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable));
+        ASSERT_IS_NULL(binary_tree_txn_begin(handle));
+
+        //cleanup
+        binary_tree_destroy(handle);
+        (void)remove(TEST_PAGED_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_recover_replays_wal_succeed)
+    {
+        //arrange
+        U64_RANGE range = { 0, 0, 0 };
+        (void)remove(TEST_WAL_FILE_NAME);
+        BINARY_TREE_HANDLE handle = create_logged_tree(BINARY_TREE_DURABILITY_SYNC);
+        for (uint64_t index = 0; index < 200; index++)
+        {
+            uint64_t key = get_scattered_key(index, 200);
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+        for (uint64_t key = 0; key < 200; key += 2)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_u64(handle, key, remove_callback));
+        }
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_remove_u64(handle, 0, remove_callback));
+        binary_tree_destroy(handle);
+
+        //act
+        BINARY_TREE_HANDLE recovered = recover_test_tree(NULL);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_for_each(recovered, u64_entry_callback, &range));
+        ASSERT_ARE_EQUAL(int, 100, (int)range.count);
+        ASSERT_ARE_EQUAL(int, 0, range.out_of_order);
+        ASSERT_IS_NULL(binary_tree_find_u64(recovered, 100));
+        ASSERT_IS_TRUE(binary_tree_find_u64(recovered, 101) == (void*)(uintptr_t)202);
+
+        //cleanup
+        binary_tree_destroy(recovered);
+        (void)remove(TEST_WAL_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_checkpoint_then_recover_succeed)
+    {
+        //arrange
+        U64_RANGE range = { 0, 0, 0 };
+        int enable = 1;
+        (void)remove(TEST_WAL_FILE_NAME);
+        (void)remove(TEST_IMAGE_FILE_NAME);
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        BINARY_TREE_WAL_CONFIG config = { TEST_WAL_FILE_NAME, BINARY_TREE_DURABILITY_WRITE, 0, u64_value_serializer, NULL };
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        (void)binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(handle, OPTION_WAL, &config));
+        for (uint64_t key = 0; key < 100; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+
+        //act
+        int result = binary_tree_checkpoint(handle, TEST_IMAGE_FILE_NAME);
+        for (uint64_t key = 100; key < 150; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+        for (uint64_t key = 0; key < 10; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_u64(handle, key, remove_callback));
+        }
+        binary_tree_destroy(handle);
+        BINARY_TREE_HANDLE recovered = recover_test_tree(TEST_IMAGE_FILE_NAME);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_for_each(recovered, u64_entry_callback, &range));
+        ASSERT_ARE_EQUAL(int, 140, (int)range.count);
+        ASSERT_ARE_EQUAL(int, 0, range.out_of_order);
+        ASSERT_IS_NULL(binary_tree_find_u64(recovered, 5));
+        ASSERT_IS_TRUE(binary_tree_find_u64(recovered, 120) == (void*)(uintptr_t)240);
+
+        //cleanup
+        binary_tree_destroy(recovered);
+        (void)remove(TEST_WAL_FILE_NAME);
+        (void)remove(TEST_IMAGE_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_recover_torn_wal_tail_succeed)
+    {
+        //arrange
+        static const unsigned char torn_record[12] = { 64, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8 };
+        BINARY_TREE_WAL_CONFIG config = { TEST_WAL_FILE_NAME, BINARY_TREE_DURABILITY_ASYNC, 1, u64_value_serializer, NULL };
+        (void)remove(TEST_WAL_FILE_NAME);
+        BINARY_TREE_HANDLE handle = create_logged_tree(BINARY_TREE_DURABILITY_ASYNC);
+        for (uint64_t key = 0; key < 10; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+        binary_tree_destroy(handle);
+        int fd = open(TEST_WAL_FILE_NAME, O_WRONLY | O_APPEND);
+        ASSERT_ARE_EQUAL(int, (int)sizeof(torn_record), (int)write(fd, torn_record, sizeof(torn_record)));
+        (void)close(fd);
+
+        //act
+        BINARY_TREE_HANDLE recovered = recover_test_tree(NULL);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(recovered, OPTION_WAL, &config));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(recovered, 10, (void*)(uintptr_t)20));
+        binary_tree_destroy(recovered);
+        recovered = recover_test_tree(NULL);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 11, (int)binary_tree_item_count(recovered));
+        ASSERT_IS_TRUE(binary_tree_find_u64(recovered, 10) == (void*)(uintptr_t)20);
+
+        //cleanup
+        binary_tree_destroy(recovered);
+        (void)remove(TEST_WAL_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_recover_zeroed_wal_tail_succeed)
+    {
+        //arrange
+        static const unsigned char zeroed_tail[4096] = { 0 };
+        BINARY_TREE_WAL_CONFIG config = { TEST_WAL_FILE_NAME, BINARY_TREE_DURABILITY_ASYNC, 1, u64_value_serializer, NULL };
+        (void)remove(TEST_WAL_FILE_NAME);
+        BINARY_TREE_HANDLE handle = create_logged_tree(BINARY_TREE_DURABILITY_ASYNC);
+        for (uint64_t key = 0; key < 10; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+        binary_tree_destroy(handle);
+        // What a file system can leave past the last write after a crash
+        int fd = open(TEST_WAL_FILE_NAME, O_WRONLY | O_APPEND);
+        ASSERT_ARE_EQUAL(int, (int)sizeof(zeroed_tail), (int)write(fd, zeroed_tail, sizeof(zeroed_tail)));
+        (void)close(fd);
+
+        //act
+        BINARY_TREE_HANDLE recovered = recover_test_tree(NULL);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_set_option(recovered, OPTION_WAL, &config));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(recovered, 10, (void*)(uintptr_t)20));
+        binary_tree_destroy(recovered);
+        recovered = recover_test_tree(NULL);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 11, (int)binary_tree_item_count(recovered));
+        ASSERT_IS_TRUE(binary_tree_find_u64(recovered, 10) == (void*)(uintptr_t)20);
+
+        //cleanup
+        binary_tree_destroy(recovered);
+        (void)remove(TEST_WAL_FILE_NAME);
+    }
+
+    TEST_FUNCTION(binary_tree_root_hash_ignores_insert_order_succeed)
+    {
+        //arrange
+        uint64_t hash_1;
+        uint64_t hash_2;
+        uint64_t hash_3;
+        BINARY_TREE_HANDLE handle_1 = create_hashed_tree(0);
+        BINARY_TREE_HANDLE handle_2 = create_hashed_tree(0);
+        for (uint64_t key = 0; key < 300; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle_1, key, (void*)(uintptr_t)(key * 2)));
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle_2, 299 - key, (void*)(uintptr_t)((299 - key) * 2)));
+        }
+
+        //act
+        int result_1 = binary_tree_root_hash(handle_1, &hash_1);
+        int result_2 = binary_tree_root_hash(handle_2, &hash_2);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_u64(handle_2, 150, remove_callback));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle_2, 150, (void*)(uintptr_t)1));
+        int result_3 = binary_tree_root_hash(handle_2, &hash_3);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result_1);
+        ASSERT_ARE_EQUAL(int, 0, result_2);
+        ASSERT_ARE_EQUAL(int, 0, result_3);
+        ASSERT_IS_TRUE(hash_1 == hash_2);
+        ASSERT_IS_TRUE(hash_1 != hash_3);
+
+        //cleanup
+        binary_tree_destroy(handle_1);
+        binary_tree_destroy(handle_2);
+    }
+
+    TEST_FUNCTION(binary_tree_diff_against_snapshot_succeed)
+    {
+        //arrange
+        DIFF_RECORD record = { 0 };
+        BINARY_TREE_HANDLE handle = create_hashed_tree(1);
+        for (uint64_t key = 0; key < 1000; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+        BINARY_TREE_HANDLE snapshot = binary_tree_snapshot(handle);
+        ASSERT_IS_NOT_NULL(snapshot);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_u64(handle, 10, remove_callback));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_u64(handle, 700, remove_callback));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, 700, (void*)(uintptr_t)7));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, 5000, (void*)(uintptr_t)10000));
+
+        //act
+        int result = binary_tree_diff(snapshot, handle, record_diff_callback, &record);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 3, (int)record.count);
+        ASSERT_ARE_EQUAL(int, BINARY_TREE_DIFF_ONLY_IN_A, record.types[0]);
+        ASSERT_IS_TRUE(record.keys[0] == 10);
+        ASSERT_ARE_EQUAL(int, BINARY_TREE_DIFF_CHANGED, record.types[1]);
+        ASSERT_IS_TRUE(record.keys[1] == 700);
+        ASSERT_ARE_EQUAL(int, BINARY_TREE_DIFF_ONLY_IN_B, record.types[2]);
+        ASSERT_IS_TRUE(record.keys[2] == 5000);
+
+        //cleanup
+        binary_tree_destroy(snapshot);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_diff_without_merkle_hash_fail)
+    {
+        //arrange
+        DIFF_RECORD record = { 0 };
+        uint64_t hash;
+        int enable = 1;
+        BINARY_TREE_HANDLE hashed = create_hashed_tree(0);
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_set_option(hashed, OPTION_LAZY_DELETE, &enable));
+
+        //act
+        int result = binary_tree_diff(hashed, handle, record_diff_callback, &record);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_root_hash(handle, &hash));
+        ASSERT_ARE_EQUAL(int, 0, (int)record.count);
+
+        //cleanup
+        binary_tree_destroy(hashed);
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_expire_removes_due_entries_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        uint64_t start_ns = stopwatch_now_ns();
+        for (uint64_t key = 0; key < 300; key++)
+        {
+            if (key % 3 == 0)
+            {
+                ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+            }
+            else
+            {
+                ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64_ttl(handle, key, (void*)(uintptr_t)(key * 2), key % 3 == 1 ? 50 : 3600000));
+            }
+        }
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_u64(handle, 2, remove_callback));
+        g_remove_callback_count = 0;
+
+        //act
+        int result_1 = binary_tree_expire(handle, start_ns, counting_remove_callback);
+        size_t early_count = g_remove_callback_count;
+        int result_2 = binary_tree_expire(handle, start_ns + 60 * 1000000ULL, counting_remove_callback);
+        size_t short_count = g_remove_callback_count;
+        int result_3 = binary_tree_expire(handle, start_ns + 3601ULL * 1000000000ULL, counting_remove_callback);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result_1);
+        ASSERT_ARE_EQUAL(int, 0, result_2);
+        ASSERT_ARE_EQUAL(int, 0, result_3);
+        ASSERT_ARE_EQUAL(int, 0, (int)early_count);
+        ASSERT_ARE_EQUAL(int, 100, (int)short_count);
+        ASSERT_ARE_EQUAL(int, 199, (int)g_remove_callback_count);
+        ASSERT_ARE_EQUAL(int, 100, (int)binary_tree_item_count(handle));
+        ASSERT_IS_TRUE(binary_tree_find_u64(handle, 3) == (void*)(uintptr_t)6);
+        ASSERT_IS_NULL(binary_tree_find_u64(handle, 4));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_expire_skips_replaced_entry_succeed)
+    {
+        //arrange
+        int key_mode = BINARY_TREE_KEY_STRING;
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        (void)binary_tree_set_option(handle, OPTION_PERSISTENT_MODE, &enable);
+        uint64_t start_ns = stopwatch_now_ns();
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_string_ttl(handle, "session/alpha", 13, (void*)(uintptr_t)1, 10));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_string_ttl(handle, "session/bravo", 13, (void*)(uintptr_t)2, 10));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_remove_string(handle, "session/alpha", 13, remove_callback));
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_string(handle, "session/alpha", 13, (void*)(uintptr_t)3));
+        g_remove_callback_count = 0;
+
+        //act
+        int result = binary_tree_expire(handle, start_ns + 20 * 1000000ULL, counting_remove_callback);
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 1, (int)g_remove_callback_count);
+        ASSERT_IS_TRUE(binary_tree_find_string(handle, "session/alpha", 13) == (void*)(uintptr_t)3);
+        ASSERT_IS_NULL(binary_tree_find_string(handle, "session/bravo", 13));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_insert_ttl_lazy_delete_fail)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_HANDLE handle = binary_tree_create();
+        (void)binary_tree_set_option(handle, OPTION_LAZY_DELETE, &enable);
+
+        //act
+        int result = binary_tree_insert_ttl(handle, 1, NULL, 10);
+
+        //assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result);
+        ASSERT_ARE_EQUAL(int, 0, (int)binary_tree_item_count(handle));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_bounded_evicts_unreferenced_entries_succeed)
+    {
+        //arrange
+        BINARY_TREE_BOUNDS bounds = { 100, 0, NULL, NULL, counting_remove_callback };
+        int key_mode = BINARY_TREE_KEY_UINT64;
+        BINARY_TREE_HANDLE handle = binary_tree_create_bounded(&bounds);
+        ASSERT_IS_NOT_NULL(handle);
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        g_remove_callback_count = 0;
+        for (uint64_t key = 0; key <= 100; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+        for (uint64_t key = 1; key <= 50; key++)
+        {
+            ASSERT_IS_NOT_NULL(binary_tree_find_u64(handle, key));
+        }
+
+        //act
+        for (uint64_t key = 101; key <= 150; key++)
+        {
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_u64(handle, key, (void*)(uintptr_t)(key * 2)));
+        }
+
+        //assert
+        ASSERT_ARE_EQUAL(int, 100, (int)binary_tree_item_count(handle));
+        ASSERT_ARE_EQUAL(int, 51, (int)g_remove_callback_count);
+        ASSERT_IS_NULL(binary_tree_find_u64(handle, 0));
+        ASSERT_IS_TRUE(binary_tree_find_u64(handle, 25) == (void*)(uintptr_t)50);
+        ASSERT_IS_NULL(binary_tree_find_u64(handle, 75));
+        ASSERT_IS_TRUE(binary_tree_find_u64(handle, 150) == (void*)(uintptr_t)300);
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_bounded_max_bytes_under_churn_succeed)
+    {
+        //arrange
+        char key[32];
+        BINARY_TREE_MEMORY_USAGE usage;
+        BINARY_TREE_BOUNDS bounds = { 0, 16384, data_size_callback, NULL, counting_remove_callback };
+        int key_mode = BINARY_TREE_KEY_STRING;
+        BINARY_TREE_HANDLE handle = binary_tree_create_bounded(&bounds);
+        (void)binary_tree_set_option(handle, OPTION_KEY_MODE, &key_mode);
+        g_remove_callback_count = 0;
+
+        //act
+        for (int index = 0; index < 5000; index++)
+        {
+            int length = sprintf(key, "cache/entry/%08d", index);
+            ASSERT_ARE_EQUAL(int, 0, binary_tree_insert_string(handle, key, (size_t)length, (void*)(uintptr_t)1024));
+        }
+
+        //assert
+        size_t items = binary_tree_item_count(handle);
+        ASSERT_ARE_EQUAL(int, 0, binary_tree_memory_usage(handle, &usage));
+        ASSERT_IS_TRUE(items > 0 && items < 16);
+        ASSERT_ARE_EQUAL(int, 5000, (int)(g_remove_callback_count + items));
+        ASSERT_IS_TRUE(usage.node_bytes < 4096);
+        ASSERT_IS_NOT_NULL(binary_tree_find_string(handle, "cache/entry/00004999", 20));
+
+        //cleanup
+        binary_tree_destroy(handle);
+    }
+
+    TEST_FUNCTION(binary_tree_create_bounded_without_bounds_fail)
+    {
+        //arrange
+        int enable = 1;
+        BINARY_TREE_BOUNDS bounds = { 0, 0, NULL, NULL, NULL };
+        BINARY_TREE_BOUNDS item_bounds = { 10, 0, NULL, NULL, NULL };
+
+        //act
+        BINARY_TREE_HANDLE handle = binary_tree_create_bounded(&bounds);
+        BINARY_TREE_HANDLE bounded = binary_tree_create_bounded(&item_bounds);
+
+        //assert
+        ASSERT_IS_NULL(handle);
+        ASSERT_IS_NOT_NULL(bounded);
+        ASSERT_ARE_NOT_EQUAL(int, 0, binary_tree_set_option(bounded, OPTION_PERSISTENT_MODE, &enable));
+
+        //cleanup
+        binary_tree_destroy(bounded);
+    }
+
+    TEST_FUNCTION(logger_write_truncates_strings_past_record_text_succeed)
+    {
+        //arrange
+        char long_text[200];
+        char expected[128];
+        char output[512];
+        memset(long_text, 'a', sizeof(long_text) - 1);
+        long_text[sizeof(long_text) - 1] = '\0';
+        // The first string fills the record's text, the second has no room left
+        memset(expected, 'a', 95);
+        (void)strcpy(&expected[95], "||7\n");
+        logger_flush();
+        (void)fflush(stdout);
+        int saved_stdout = dup(STDOUT_FILENO);
+        int log_file = open(TEST_LOG_FILE_NAME, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        ASSERT_IS_TRUE(saved_stdout >= 0 && log_file >= 0);
+        (void)dup2(log_file, STDOUT_FILENO);
+
+        //act
+        logger_write(AZ_LOG_INFO, LOG_NONE, "%s|%s|%d\n", long_text, long_text, 7);
+        logger_flush();
+        (void)fflush(stdout);
+        (void)dup2(saved_stdout, STDOUT_FILENO);
+        (void)close(saved_stdout);
+        (void)close(log_file);
+
+        //assert
+        FILE* file = fopen(TEST_LOG_FILE_NAME, "r");
+        ASSERT_IS_NOT_NULL(file);
+        size_t length = fread(output, 1, sizeof(output) - 1, file);
+        output[length] = '\0';
+        ASSERT_ARE_EQUAL(char_ptr, expected, output);
+
+        //cleanup
+        (void)fclose(file);
+        (void)remove(TEST_LOG_FILE_NAME);
+    }
+
     END_TEST_SUITE(binary_tree_ut)
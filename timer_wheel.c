@@ -0,0 +1,190 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "timer_wheel.h"
+
+// Ticks a slot of the level covers
+static uint64_t get_level_span(uint32_t level)
+{
+    return (uint64_t)1 << (TIMER_WHEEL_SLOT_BITS * level);
+}
+
+static void push_slot(TIMER_WHEEL* wheel, TIMER_WHEEL_ENTRY* entry, uint32_t level, uint32_t slot)
+{
+    entry->level = level;
+    entry->slot = slot;
+    entry->previous = NULL;
+    entry->next = wheel->slots[level][slot];
+    if (entry->next != NULL)
+    {
+        entry->next->previous = entry;
+    }
+    wheel->slots[level][slot] = entry;
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+static TIMER_WHEEL_ENTRY* take_slot(TIMER_WHEEL* wheel, uint32_t level, uint32_t slot)
+{
+    TIMER_WHEEL_ENTRY* result = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+    return result;
+}
+
+// base_tick is the first tick still to be processed, entries already due
+// go into its level 0 slot
+static void link_entry(TIMER_WHEEL* wheel, TIMER_WHEEL_ENTRY* entry, uint64_t base_tick)
+{
+    uint32_t level = 0;
+    uint64_t place_tick = entry->expire_tick < base_tick ? base_tick : entry->expire_tick;
+    if (place_tick - base_tick >= get_level_span(TIMER_WHEEL_LEVELS))
+    {
+        place_tick = base_tick + get_level_span(TIMER_WHEEL_LEVELS) - 1;
+    }
+    while (place_tick - base_tick >= get_level_span(level + 1))
+    {
+        level++;
+    }
+    push_slot(wheel, entry, level, (uint32_t)(place_tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+}
+
+// The first tick after the current one where the level has a slot to
+// process, UINT64_MAX when it is empty.  A level above 0 processes a slot
+// on the tick its span starts
+static uint64_t get_next_level_tick(const TIMER_WHEEL* wheel, uint32_t level)
+{
+    uint64_t result;
+    uint64_t occupied = wheel->occupied[level];
+    if (occupied == 0)
+    {
+        result = UINT64_MAX;
+    }
+    else
+    {
+        uint64_t index = wheel->current_tick >> (TIMER_WHEEL_SLOT_BITS * level);
+        unsigned int start = (unsigned int)((index + 1) & (TIMER_WHEEL_SLOTS - 1));
+        // Rotate so bit 0 is the slot right after the current one
+        uint64_t rotated = start == 0 ? occupied : (occupied >> start) | (occupied << (TIMER_WHEEL_SLOTS - start));
+        result = (index + 1 + (uint64_t)__builtin_ctzll(rotated)) << (TIMER_WHEEL_SLOT_BITS * level);
+    }
+    return result;
+}
+
+static uint64_t get_next_tick(const TIMER_WHEEL* wheel)
+{
+    uint64_t result = UINT64_MAX;
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        uint64_t level_tick = get_next_level_tick(wheel, level);
+        if (level_tick < result)
+        {
+            result = level_tick;
+        }
+    }
+    return result;
+}
+
+void timer_wheel_init(TIMER_WHEEL* wheel, uint64_t current_tick)
+{
+    (void)memset(wheel, 0, sizeof(TIMER_WHEEL));
+    wheel->current_tick = current_tick;
+}
+
+void timer_wheel_add(TIMER_WHEEL* wheel, TIMER_WHEEL_ENTRY* entry, uint64_t expire_tick)
+{
+    entry->expire_tick = expire_tick;
+    link_entry(wheel, entry, wheel->current_tick + 1);
+    wheel->count++;
+}
+
+void timer_wheel_remove(TIMER_WHEEL* wheel, TIMER_WHEEL_ENTRY* entry)
+{
+    if (entry->previous != NULL)
+    {
+        entry->previous->next = entry->next;
+    }
+    else
+    {
+        wheel->slots[entry->level][entry->slot] = entry->next;
+        if (entry->next == NULL)
+        {
+            wheel->occupied[entry->level] &= ~((uint64_t)1 << entry->slot);
+        }
+    }
+    if (entry->next != NULL)
+    {
+        entry->next->previous = entry->previous;
+    }
+    entry->next = NULL;
+    entry->previous = NULL;
+    wheel->count--;
+}
+
+TIMER_WHEEL_ENTRY* timer_wheel_advance(TIMER_WHEEL* wheel, uint64_t now_tick)
+{
+    TIMER_WHEEL_ENTRY* result = NULL;
+    TIMER_WHEEL_ENTRY** tail = &result;
+    while (wheel->current_tick < now_tick)
+    {
+        // Ticks where no slot has anything are skipped rather than walked
+        uint64_t tick = get_next_tick(wheel);
+        if (tick > now_tick)
+        {
+            wheel->current_tick = now_tick;
+        }
+        else
+        {
+            // Higher levels first, what they hand down may land in a slot
+            // of this same tick further down
+            for (uint32_t level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+            {
+                if ((tick & (get_level_span(level) - 1)) == 0)
+                {
+                    TIMER_WHEEL_ENTRY* entry = take_slot(wheel, level, (uint32_t)(tick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1));
+                    while (entry != NULL)
+                    {
+                        TIMER_WHEEL_ENTRY* next_entry = entry->next;
+                        link_entry(wheel, entry, tick);
+                        entry = next_entry;
+                    }
+                }
+            }
+
+            *tail = take_slot(wheel, 0, (uint32_t)tick & (TIMER_WHEEL_SLOTS - 1));
+            while (*tail != NULL)
+            {
+                (*tail)->previous = NULL;
+                wheel->count--;
+                tail = &(*tail)->next;
+            }
+            wheel->current_tick = tick;
+        }
+    }
+    return result;
+}
+
+TIMER_WHEEL_ENTRY* timer_wheel_remove_all(TIMER_WHEEL* wheel)
+{
+    TIMER_WHEEL_ENTRY* result = NULL;
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (uint32_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            TIMER_WHEEL_ENTRY* entry = take_slot(wheel, level, slot);
+            while (entry != NULL)
+            {
+                TIMER_WHEEL_ENTRY* next_entry = entry->next;
+                entry->previous = NULL;
+                entry->next = result;
+                result = entry;
+                entry = next_entry;
+            }
+        }
+    }
+    wheel->count = 0;
+    return result;
+}
@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+// Hierarchical timing wheel over integer ticks.  Like whiskey_node it is
+// intrusive: the caller embeds a TIMER_WHEEL_ENTRY in its own struct, the
+// wheel only links those and never allocates, and it has no lock of its
+// own.  Level 0 has a slot per tick, every level above a slot per 64
+// slots of the one below.  Entries move down a level when the wheel
+// reaches their slot, so adding and removing are O(1) and advancing costs
+// what expires plus the slots that hold something
+#define TIMER_WHEEL_SLOT_BITS   6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_SLOT_BITS)
+// 64^5 ticks, entries further out wait in the top level and are placed
+// again whenever the wheel comes round to them
+#define TIMER_WHEEL_LEVELS      5
+
+typedef struct TIMER_WHEEL_ENTRY_TAG
+{
+    struct TIMER_WHEEL_ENTRY_TAG* next;
+    struct TIMER_WHEEL_ENTRY_TAG* previous;
+    uint64_t expire_tick;
+    uint32_t level;
+    uint32_t slot;
+} TIMER_WHEEL_ENTRY;
+
+typedef struct TIMER_WHEEL_TAG
+{
+    // Every tick up to and including this one was processed
+    uint64_t current_tick;
+    size_t count;
+    // A bit per slot that holds entries
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    TIMER_WHEEL_ENTRY* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TIMER_WHEEL;
+
+extern void timer_wheel_init(TIMER_WHEEL* wheel, uint64_t current_tick);
+// Entries due at or before the current tick expire on the next advance
+extern void timer_wheel_add(TIMER_WHEEL* wheel, TIMER_WHEEL_ENTRY* entry, uint64_t expire_tick);
+// entry must be in the wheel
+extern void timer_wheel_remove(TIMER_WHEEL* wheel, TIMER_WHEEL_ENTRY* entry);
+// Moves the wheel to now_tick and unlinks every entry due by then.  They
+// come back as a list through next, earliest tick first
+extern TIMER_WHEEL_ENTRY* timer_wheel_advance(TIMER_WHEEL* wheel, uint64_t now_tick);
+// Unlinks every entry, due or not, so the caller can free them
+extern TIMER_WHEEL_ENTRY* timer_wheel_remove_all(TIMER_WHEEL* wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TIMER_WHEEL_H */
@@ -0,0 +1,594 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wal.h"
+#include "checksum.h"
+#include "logging.h"
+
+#define WAL_INITIAL_BUFFER_SIZE     65536
+#define WAL_DEFAULT_FLUSH_MS        10
+// Records start on this boundary so readers can use them in place
+#define WAL_ALIGNMENT               8
+
+typedef struct WAL_BUFFER_TAG
+{
+    unsigned char* bytes;
+    size_t used;
+    size_t size;
+} WAL_BUFFER;
+
+typedef struct WAL_WRITER_INFO_TAG
+{
+    int fd;
+    WAL_DURABILITY durability;
+    size_t flush_interval_ms;
+    pthread_mutex_t lock;
+    // Broadcast whenever a batch is done and on close
+    pthread_cond_t flushed;
+    // Wakes the flush thread for close
+    pthread_cond_t wake;
+    // Positions count the bytes appended since the writer was created
+    uint64_t appended_position;
+    uint64_t written_position;
+    uint64_t synced_position;
+    int flushing;
+    int failed;
+    int closed;
+    int flush_thread_running;
+    pthread_t flush_thread;
+    // Appends go to pending while the batch before them is written from writing
+    WAL_BUFFER pending;
+    WAL_BUFFER writing;
+} WAL_WRITER_INFO;
+
+typedef struct WAL_READER_INFO_TAG
+{
+    void* mapping;
+    size_t mapping_size;
+    size_t position;
+    size_t end;
+} WAL_READER_INFO;
+
+static size_t align_record_size(size_t size)
+{
+    return (size + WAL_ALIGNMENT - 1) & ~(size_t)(WAL_ALIGNMENT - 1);
+}
+
+static int validate_header(const unsigned char* mapping, size_t size)
+{
+    int result;
+    WAL_HEADER header;
+    if (size < sizeof(WAL_HEADER))
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        (void)memcpy(&header, mapping, sizeof(WAL_HEADER));
+        result = memcmp(header.magic, WAL_MAGIC, sizeof(WAL_MAGIC)) == 0 && header.version == WAL_VERSION ? 0 : __LINE__;
+    }
+    return result;
+}
+
+// Offset just past the last whole record
+static size_t find_log_end(const unsigned char* mapping, size_t size)
+{
+    size_t result = sizeof(WAL_HEADER);
+    while (size - result >= sizeof(WAL_RECORD_HEADER))
+    {
+        WAL_RECORD_HEADER record_header;
+        (void)memcpy(&record_header, mapping + result, sizeof(WAL_RECORD_HEADER));
+        size_t record_size = align_record_size(sizeof(WAL_RECORD_HEADER) + record_header.size);
+        if (record_header.size == 0 || record_size > size - result ||
+            checksum_update(0, mapping + result + sizeof(WAL_RECORD_HEADER), record_header.size) != record_header.checksum)
+        {
+            break;
+        }
+        result += record_size;
+    }
+    return result;
+}
+
+static int write_fully(int fd, const unsigned char* bytes, size_t size)
+{
+    int result = 0;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+        {
+            // Try again
+        }
+        else if (written <= 0)
+        {
+            LogError("FAILURE: writing log, errno %d", errno);
+            result = __LINE__;
+            break;
+        }
+        else
+        {
+            bytes += written;
+            size -= (size_t)written;
+        }
+    }
+    return result;
+}
+
+static int reserve_buffer(WAL_BUFFER* buffer, size_t size)
+{
+    int result;
+    if (buffer->size - buffer->used >= size)
+    {
+        result = 0;
+    }
+    else
+    {
+        size_t new_size = buffer->size == 0 ? WAL_INITIAL_BUFFER_SIZE : buffer->size;
+        while (new_size - buffer->used < size)
+        {
+            new_size *= 2;
+        }
+        unsigned char* bytes = (unsigned char*)realloc(buffer->bytes, new_size);
+        if (bytes == NULL)
+        {
+            LogError("FAILURE: unable to grow the log buffer to %zu bytes", new_size);
+            result = __LINE__;
+        }
+        else
+        {
+            buffer->bytes = bytes;
+            buffer->size = new_size;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+// Called with the lock held and no batch in flight.  Writes everything
+// pending as one batch with the lock released, so appends keep going
+static int flush_batch(WAL_WRITER_INFO* writer, int sync)
+{
+    int result;
+    WAL_BUFFER swap = writer->writing;
+    uint64_t end_position = writer->appended_position;
+    writer->writing = writer->pending;
+    writer->pending = swap;
+    writer->pending.used = 0;
+    writer->flushing = 1;
+    (void)pthread_mutex_unlock(&writer->lock);
+
+    if ((result = write_fully(writer->fd, writer->writing.bytes, writer->writing.used)) != 0)
+    {
+        // Already logged
+    }
+    else if (sync && fdatasync(writer->fd) != 0)
+    {
+        LogError("FAILURE: syncing log, errno %d", errno);
+        result = __LINE__;
+    }
+
+    (void)pthread_mutex_lock(&writer->lock);
+    writer->flushing = 0;
+    writer->writing.used = 0;
+    if (result != 0)
+    {
+        // Whatever came after the failed batch can't be trusted either
+        writer->failed = 1;
+    }
+    else
+    {
+        writer->written_position = end_position;
+        if (sync)
+        {
+            writer->synced_position = end_position;
+        }
+    }
+    (void)pthread_cond_broadcast(&writer->flushed);
+    return result;
+}
+
+static uint64_t get_durable_position(const WAL_WRITER_INFO* writer)
+{
+    uint64_t result;
+    switch (writer->durability)
+    {
+        case WAL_DURABILITY_WRITE:
+            result = writer->written_position;
+            break;
+        case WAL_DURABILITY_SYNC:
+            result = writer->synced_position;
+            break;
+        default:
+            result = UINT64_MAX;
+            break;
+    }
+    return result;
+}
+
+static void* wal_flush_worker(void* parameter)
+{
+    WAL_WRITER_INFO* writer = (WAL_WRITER_INFO*)parameter;
+    (void)pthread_mutex_lock(&writer->lock);
+    while (!writer->closed)
+    {
+        struct timespec wake_time;
+        (void)clock_gettime(CLOCK_REALTIME, &wake_time);
+        wake_time.tv_sec += (time_t)(writer->flush_interval_ms / 1000);
+        wake_time.tv_nsec += (long)(writer->flush_interval_ms % 1000) * 1000000L;
+        if (wake_time.tv_nsec >= 1000000000L)
+        {
+            wake_time.tv_sec++;
+            wake_time.tv_nsec -= 1000000000L;
+        }
+        (void)pthread_cond_timedwait(&writer->wake, &writer->lock, &wake_time);
+
+        if (!writer->closed && !writer->flushing && !writer->failed && writer->synced_position < writer->appended_position)
+        {
+            (void)flush_batch(writer, 1);
+        }
+    }
+    (void)pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+// Cuts off a record torn by a crash so new ones land right after the last
+// whole one, or writes the header of a new log
+static int prepare_log_file(int fd, const char* path)
+{
+    int result;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+    {
+        LogError("FAILURE: unable to stat log %s", path);
+        result = __LINE__;
+    }
+    else if (file_stat.st_size == 0)
+    {
+        WAL_HEADER header;
+        memset(&header, 0, sizeof(header));
+        (void)memcpy(header.magic, WAL_MAGIC, sizeof(WAL_MAGIC));
+        header.version = WAL_VERSION;
+        if ((result = write_fully(fd, (const unsigned char*)&header, sizeof(header))) == 0 && fdatasync(fd) != 0)
+        {
+            LogError("FAILURE: syncing log %s", path);
+            result = __LINE__;
+        }
+    }
+    else
+    {
+        size_t size = (size_t)file_stat.st_size;
+        void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            LogError("FAILURE: unable to map log %s", path);
+            result = __LINE__;
+        }
+        else
+        {
+            size_t end;
+            if (validate_header((const unsigned char*)mapping, size) != 0)
+            {
+                LogError("FAILURE: %s is not a log", path);
+                result = __LINE__;
+            }
+            else if ((end = find_log_end((const unsigned char*)mapping, size)) < size && ftruncate(fd, (off_t)end) != 0)
+            {
+                LogError("FAILURE: unable to cut the torn end off log %s", path);
+                result = __LINE__;
+            }
+            else
+            {
+                result = 0;
+            }
+            (void)munmap(mapping, size);
+        }
+    }
+    return result;
+}
+
+WAL_WRITER_HANDLE wal_writer_create(const char* path, WAL_DURABILITY durability, size_t flush_interval_ms)
+{
+    WAL_WRITER_INFO* result;
+    if (path == NULL || durability < WAL_DURABILITY_ASYNC || durability > WAL_DURABILITY_SYNC)
+    {
+        LogError("FAILURE: Invalid parameter specified on log writer create");
+        result = NULL;
+    }
+    else if ((result = (WAL_WRITER_INFO*)calloc(1, sizeof(WAL_WRITER_INFO))) == NULL)
+    {
+        LogError("FAILURE: unable to allocate log writer");
+    }
+    else if ((result->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0)
+    {
+        LogError("FAILURE: unable to open log %s", path);
+        free(result);
+        result = NULL;
+    }
+    else if (prepare_log_file(result->fd, path) != 0)
+    {
+        (void)close(result->fd);
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        result->durability = durability;
+        result->flush_interval_ms = flush_interval_ms == 0 ? WAL_DEFAULT_FLUSH_MS : flush_interval_ms;
+        (void)pthread_mutex_init(&result->lock, NULL);
+        (void)pthread_cond_init(&result->flushed, NULL);
+        (void)pthread_cond_init(&result->wake, NULL);
+        if (durability == WAL_DURABILITY_ASYNC)
+        {
+            if (pthread_create(&result->flush_thread, NULL, wal_flush_worker, result) != 0)
+            {
+                LogError("FAILURE: unable to start log flush thread");
+                wal_writer_destroy(result);
+                result = NULL;
+            }
+            else
+            {
+                result->flush_thread_running = 1;
+            }
+        }
+    }
+    return result;
+}
+
+uint64_t wal_writer_append(WAL_WRITER_HANDLE handle, const void* bytes, size_t size)
+{
+    uint64_t result;
+    if (handle == NULL || bytes == NULL || size == 0 || size > UINT32_MAX)
+    {
+        LogError("FAILURE: Invalid parameter specified on log append");
+        result = 0;
+    }
+    else
+    {
+        size_t record_size = align_record_size(sizeof(WAL_RECORD_HEADER) + size);
+        (void)pthread_mutex_lock(&handle->lock);
+        if (handle->closed || handle->failed)
+        {
+            LogError("FAILURE: the log is %s", handle->closed ? "closed" : "broken");
+            result = 0;
+        }
+        else if (reserve_buffer(&handle->pending, record_size) != 0)
+        {
+            result = 0;
+        }
+        else
+        {
+            unsigned char* position = handle->pending.bytes + handle->pending.used;
+            WAL_RECORD_HEADER record_header;
+            record_header.size = (uint32_t)size;
+            record_header.checksum = checksum_update(0, bytes, size);
+            (void)memcpy(position, &record_header, sizeof(WAL_RECORD_HEADER));
+            (void)memcpy(position + sizeof(WAL_RECORD_HEADER), bytes, size);
+            (void)memset(position + sizeof(WAL_RECORD_HEADER) + size, 0, record_size - sizeof(WAL_RECORD_HEADER) - size);
+            handle->pending.used += record_size;
+            handle->appended_position += record_size;
+            result = handle->appended_position;
+        }
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+int wal_writer_commit(WAL_WRITER_HANDLE handle, uint64_t position)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on log commit");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->lock);
+        while (!handle->failed && !handle->closed && position > get_durable_position(handle))
+        {
+            if (handle->flushing)
+            {
+                // Whoever is writing may already be carrying this record
+                (void)pthread_cond_wait(&handle->flushed, &handle->lock);
+            }
+            else
+            {
+                (void)flush_batch(handle, handle->durability == WAL_DURABILITY_SYNC);
+            }
+        }
+        result = handle->failed ? __LINE__ : 0;
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+int wal_writer_reset(WAL_WRITER_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on log reset");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)pthread_mutex_lock(&handle->lock);
+        while (handle->flushing)
+        {
+            (void)pthread_cond_wait(&handle->flushed, &handle->lock);
+        }
+        handle->pending.used = 0;
+        if (ftruncate(handle->fd, (off_t)sizeof(WAL_HEADER)) != 0 || fdatasync(handle->fd) != 0)
+        {
+            LogError("FAILURE: unable to reset log, errno %d", errno);
+            handle->failed = 1;
+            result = __LINE__;
+        }
+        else
+        {
+            // Anyone still waiting had their record dropped on purpose
+            handle->written_position = handle->appended_position;
+            handle->synced_position = handle->appended_position;
+            result = 0;
+        }
+        (void)pthread_cond_broadcast(&handle->flushed);
+        (void)pthread_mutex_unlock(&handle->lock);
+    }
+    return result;
+}
+
+int wal_writer_close(WAL_WRITER_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on log close");
+        result = __LINE__;
+    }
+    else
+    {
+        int join_thread;
+        (void)pthread_mutex_lock(&handle->lock);
+        while (handle->flushing)
+        {
+            (void)pthread_cond_wait(&handle->flushed, &handle->lock);
+        }
+        if (!handle->closed && !handle->failed && handle->synced_position < handle->appended_position)
+        {
+            (void)flush_batch(handle, 1);
+        }
+        handle->closed = 1;
+        join_thread = handle->flush_thread_running;
+        handle->flush_thread_running = 0;
+        result = handle->failed ? __LINE__ : 0;
+        (void)pthread_cond_signal(&handle->wake);
+        (void)pthread_cond_broadcast(&handle->flushed);
+        (void)pthread_mutex_unlock(&handle->lock);
+
+        if (join_thread)
+        {
+            (void)pthread_join(handle->flush_thread, NULL);
+        }
+    }
+    return result;
+}
+
+void wal_writer_destroy(WAL_WRITER_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        if (wal_writer_close(handle) != 0)
+        {
+            LogError("FAILURE: the log is missing records");
+        }
+        (void)close(handle->fd);
+        (void)pthread_mutex_destroy(&handle->lock);
+        (void)pthread_cond_destroy(&handle->flushed);
+        (void)pthread_cond_destroy(&handle->wake);
+        free(handle->pending.bytes);
+        free(handle->writing.bytes);
+        free(handle);
+    }
+}
+
+WAL_READER_HANDLE wal_reader_open(const char* path)
+{
+    WAL_READER_INFO* result = NULL;
+    if (path == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on log reader open");
+    }
+    else
+    {
+        int fd = open(path, O_RDONLY);
+        struct stat file_stat;
+        void* mapping = MAP_FAILED;
+        size_t size = 0;
+        if (fd < 0)
+        {
+            LogError("FAILURE: unable to open log %s", path);
+        }
+        else if (fstat(fd, &file_stat) != 0 || (size = (size_t)file_stat.st_size) < sizeof(WAL_HEADER))
+        {
+            LogError("FAILURE: %s is not a log", path);
+        }
+        else if ((mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        {
+            LogError("FAILURE: unable to map log %s", path);
+        }
+
+        if (fd >= 0)
+        {
+            (void)close(fd);
+        }
+
+        if (mapping == MAP_FAILED)
+        {
+            // Already logged
+        }
+        else if (validate_header((const unsigned char*)mapping, size) != 0)
+        {
+            LogError("FAILURE: %s is not a log", path);
+            (void)munmap(mapping, size);
+        }
+        else if ((result = (WAL_READER_INFO*)malloc(sizeof(WAL_READER_INFO))) == NULL)
+        {
+            LogError("FAILURE: unable to allocate log reader");
+            (void)munmap(mapping, size);
+        }
+        else
+        {
+            result->mapping = mapping;
+            result->mapping_size = size;
+            result->position = sizeof(WAL_HEADER);
+            result->end = find_log_end((const unsigned char*)mapping, size);
+        }
+    }
+    return result;
+}
+
+void wal_reader_close(WAL_READER_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        (void)munmap(handle->mapping, handle->mapping_size);
+        free(handle);
+    }
+}
+
+int wal_reader_next(WAL_READER_HANDLE handle, const void** bytes, size_t* size)
+{
+    int result;
+    if (handle == NULL || bytes == NULL || size == NULL)
+    {
+        LogError("FAILURE: Invalid parameter specified on log reader next");
+        result = __LINE__;
+    }
+    else if (handle->position >= handle->end)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        WAL_RECORD_HEADER record_header;
+        const unsigned char* position = (const unsigned char*)handle->mapping + handle->position;
+        (void)memcpy(&record_header, position, sizeof(WAL_RECORD_HEADER));
+        *bytes = position + sizeof(WAL_RECORD_HEADER);
+        *size = record_header.size;
+        handle->position += align_record_size(sizeof(WAL_RECORD_HEADER) + record_header.size);
+        result = 0;
+    }
+    return result;
+}
@@ -0,0 +1,84 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WAL_H
+#define WAL_H
+
+#ifdef __cplusplus
+#include <cstdio>
+#include <cstdint>
+extern "C" {
+#else // __cplusplus
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct WAL_WRITER_INFO_TAG* WAL_WRITER_HANDLE;
+typedef struct WAL_READER_INFO_TAG* WAL_READER_HANDLE;
+
+// A log file is a WAL_HEADER followed by records, each a WAL_RECORD_HEADER
+// and size bytes the caller gave to append.  A record a crash cut short
+// fails its checksum and ends the log.  Records are never empty, so a size
+// of 0 also ends it: a file system can leave a zeroed tail after a crash
+// and the checksum of no bytes is 0
+#define WAL_MAGIC       "WSKWAL"
+#define WAL_VERSION     1
+
+typedef struct WAL_HEADER_TAG
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} WAL_HEADER;
+
+typedef struct WAL_RECORD_HEADER_TAG
+{
+    uint32_t size;
+    // CRC-32 of the record bytes
+    uint32_t checksum;
+} WAL_RECORD_HEADER;
+
+typedef enum WAL_DURABILITY_TAG
+{
+    // commit returns right away, a background flush writes and syncs every
+    // flush interval, so a crash loses at most that much
+    WAL_DURABILITY_ASYNC,
+    // commit returns once the record was written to the file, a process
+    // crash loses nothing but losing the machine can
+    WAL_DURABILITY_WRITE,
+    // commit returns once the record is synced to the disk
+    WAL_DURABILITY_SYNC
+} WAL_DURABILITY;
+
+// Appends to the log at path, or starts it when the file is missing or
+// empty.  Anything after the last whole record is cut off first
+extern WAL_WRITER_HANDLE wal_writer_create(const char* path, WAL_DURABILITY durability, size_t flush_interval_ms);
+// Adds a record of at least one byte to the pending batch and returns its
+// log position, 0 on failure.  Records are written in the order they were
+// appended
+extern uint64_t wal_writer_append(WAL_WRITER_HANDLE handle, const void* bytes, size_t size);
+// Waits until everything up to position is as durable as the writer was
+// created for.  Whichever waiter finds no write in progress writes the
+// whole pending batch with a single write and fdatasync for everyone
+// that appended meanwhile, which is the group commit
+extern int wal_writer_commit(WAL_WRITER_HANDLE handle, uint64_t position);
+// Drops every record, the caller made sure they are kept elsewhere
+extern int wal_writer_reset(WAL_WRITER_HANDLE handle);
+// Writes and syncs what is pending and stops the flush thread.  Commits
+// that arrive afterwards return right away.  destroy must not race with
+// append
+extern int wal_writer_close(WAL_WRITER_HANDLE handle);
+extern void wal_writer_destroy(WAL_WRITER_HANDLE handle);
+
+extern WAL_READER_HANDLE wal_reader_open(const char* path);
+extern void wal_reader_close(WAL_READER_HANDLE handle);
+// Returns 0 and the next record until the log ends, the bytes are valid
+// until close
+extern int wal_reader_next(WAL_READER_HANDLE handle, const void** bytes, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* WAL_H */
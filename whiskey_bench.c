@@ -0,0 +1,848 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "binary_tree.h"
+#include "stopwatch.h"
+#include "latency_histogram.h"
+#include "perf_counters.h"
+#include "bench_engines.h"
+
+// Every key NODE_KEY can hold, the tree can never be larger than this
+#define MAX_KEY_SPACE           ((size_t)1 << (sizeof(NODE_KEY) * 8))
+#define DEFAULT_OPERATIONS      1000000
+#define DEFAULT_SEED            0x5eed
+#define ZIPFIAN_THETA           0.99
+#define HOTSPOT_KEY_PERCENT     20
+#define HOTSPOT_OP_PERCENT      80
+#define MAX_SCAN_LENGTH         16
+#define MAX_BENCH_THREADS       256
+
+typedef enum KEY_DISTRIBUTION_TAG
+{
+    KEY_DISTRIBUTION_UNIFORM,
+    KEY_DISTRIBUTION_ZIPFIAN,
+    KEY_DISTRIBUTION_SEQUENTIAL,
+    KEY_DISTRIBUTION_HOTSPOT,
+    KEY_DISTRIBUTION_LATEST
+} KEY_DISTRIBUTION;
+
+typedef enum BENCH_OPERATION_TAG
+{
+    BENCH_OPERATION_READ,
+    BENCH_OPERATION_INSERT,
+    BENCH_OPERATION_REMOVE,
+    BENCH_OPERATION_UPSERT,
+    BENCH_OPERATION_SCAN,
+    BENCH_OPERATION_READ_MODIFY_WRITE,
+    BENCH_OPERATION_COUNT
+} BENCH_OPERATION;
+
+static const char* OPERATION_NAMES[BENCH_OPERATION_COUNT] = { "read", "insert", "remove", "upsert", "scan", "rmw" };
+
+typedef struct WORKLOAD_TAG
+{
+    char name;
+    KEY_DISTRIBUTION distribution;
+    // Percentages of each BENCH_OPERATION, they add up to 100
+    unsigned int mix[BENCH_OPERATION_COUNT];
+} WORKLOAD;
+
+// The YCSB core workloads.  E has no range scan to call so a scan is a run
+// of finds over consecutive keys
+static const WORKLOAD YCSB_WORKLOADS[] =
+{
+    { 'A', KEY_DISTRIBUTION_ZIPFIAN, { 50, 0, 0, 50, 0, 0 } },
+    { 'B', KEY_DISTRIBUTION_ZIPFIAN, { 95, 0, 0, 5, 0, 0 } },
+    { 'C', KEY_DISTRIBUTION_ZIPFIAN, { 100, 0, 0, 0, 0, 0 } },
+    { 'D', KEY_DISTRIBUTION_LATEST, { 95, 5, 0, 0, 0, 0 } },
+    { 'E', KEY_DISTRIBUTION_ZIPFIAN, { 0, 5, 0, 0, 95, 0 } },
+    { 'F', KEY_DISTRIBUTION_ZIPFIAN, { 50, 0, 0, 0, 0, 50 } }
+};
+
+typedef struct BENCH_CONFIG_TAG
+{
+    WORKLOAD workload;
+    size_t key_space;
+    size_t preload;
+    size_t operations;
+    uint64_t seed;
+    const char* engine_name;
+    int csv;
+    // Wrap each run in perf_event counters
+    int perf;
+    // Sweep 1..max_threads threads against one instance, 0 runs single threaded
+    size_t max_threads;
+} BENCH_CONFIG;
+
+typedef struct KEY_GENERATOR_TAG
+{
+    uint64_t rng_state;
+    KEY_DISTRIBUTION distribution;
+    size_t key_space;
+    size_t next_sequential;
+    size_t latest;
+    double zipfian_zetan;
+    double zipfian_alpha;
+    double zipfian_eta;
+} KEY_GENERATOR;
+
+// splitmix64, small and good enough for picking keys
+static uint64_t next_random(uint64_t* state)
+{
+    uint64_t result = (*state += 0x9e3779b97f4a7c15ULL);
+    result = (result ^ (result >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    result = (result ^ (result >> 27)) * 0x94d049bb133111ebULL;
+    return result ^ (result >> 31);
+}
+
+static double next_random_unit(uint64_t* state)
+{
+    return (double)(next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void init_key_generator(KEY_GENERATOR* generator, KEY_DISTRIBUTION distribution, size_t key_space, size_t latest, uint64_t seed)
+{
+    memset(generator, 0, sizeof(KEY_GENERATOR));
+    generator->rng_state = seed;
+    generator->distribution = distribution;
+    generator->key_space = key_space;
+    generator->latest = latest;
+    if (distribution == KEY_DISTRIBUTION_ZIPFIAN || distribution == KEY_DISTRIBUTION_LATEST)
+    {
+        // Gray et al. "Quickly generating billion-record synthetic databases",
+        // the same generator YCSB uses
+        double zeta_2 = 1.0 + pow(0.5, ZIPFIAN_THETA);
+        for (size_t index = 1; index <= key_space; index++)
+        {
+            generator->zipfian_zetan += 1.0 / pow((double)index, ZIPFIAN_THETA);
+        }
+        generator->zipfian_alpha = 1.0 / (1.0 - ZIPFIAN_THETA);
+        generator->zipfian_eta = (1.0 - pow(2.0 / (double)key_space, 1.0 - ZIPFIAN_THETA)) / (1.0 - zeta_2 / generator->zipfian_zetan);
+    }
+}
+
+static size_t next_zipfian_rank(KEY_GENERATOR* generator)
+{
+    size_t result;
+    double unit = next_random_unit(&generator->rng_state);
+    double scaled = unit * generator->zipfian_zetan;
+    if (scaled < 1.0)
+    {
+        result = 0;
+    }
+    else if (scaled < 1.0 + pow(0.5, ZIPFIAN_THETA))
+    {
+        result = 1;
+    }
+    else
+    {
+        result = (size_t)((double)generator->key_space * pow(generator->zipfian_eta * unit - generator->zipfian_eta + 1.0, generator->zipfian_alpha));
+    }
+    return result < generator->key_space ? result : generator->key_space - 1;
+}
+
+static NODE_KEY next_key(KEY_GENERATOR* generator)
+{
+    size_t result;
+    switch (generator->distribution)
+    {
+        case KEY_DISTRIBUTION_ZIPFIAN:
+            // Scrambled so the popular keys are spread over the tree
+            result = (size_t)((next_zipfian_rank(generator) * 0x9e3779b97f4a7c15ULL) >> 17) % generator->key_space;
+            break;
+        case KEY_DISTRIBUTION_LATEST:
+            result = (generator->latest + generator->key_space - next_zipfian_rank(generator)) % generator->key_space;
+            break;
+        case KEY_DISTRIBUTION_SEQUENTIAL:
+            result = generator->next_sequential++ % generator->key_space;
+            break;
+        case KEY_DISTRIBUTION_HOTSPOT:
+        {
+            size_t hot_keys = generator->key_space * HOTSPOT_KEY_PERCENT / 100;
+            if (hot_keys == 0)
+            {
+                hot_keys = 1;
+            }
+            if (next_random(&generator->rng_state) % 100 < HOTSPOT_OP_PERCENT || hot_keys == generator->key_space)
+            {
+                result = (size_t)(next_random(&generator->rng_state) % hot_keys);
+            }
+            else
+            {
+                result = hot_keys + (size_t)(next_random(&generator->rng_state) % (generator->key_space - hot_keys));
+            }
+            break;
+        }
+        case KEY_DISTRIBUTION_UNIFORM:
+        default:
+            result = (size_t)(next_random(&generator->rng_state) % generator->key_space);
+            break;
+    }
+    return (NODE_KEY)result;
+}
+
+static BENCH_OPERATION next_operation(KEY_GENERATOR* generator, const WORKLOAD* workload)
+{
+    BENCH_OPERATION result = BENCH_OPERATION_READ;
+    unsigned int roll = (unsigned int)(next_random(&generator->rng_state) % 100);
+    for (size_t index = 0; index < BENCH_OPERATION_COUNT; index++)
+    {
+        if (roll < workload->mix[index])
+        {
+            result = (BENCH_OPERATION)index;
+            break;
+        }
+        roll -= workload->mix[index];
+    }
+    return result;
+}
+
+static STOPWATCH_HANDLE create_bench_stopwatch(void)
+{
+    STOPWATCH_HANDLE result = stopwatch_create_with_clock(STOPWATCH_CLOCK_TSC);
+    if (result == NULL)
+    {
+        result = stopwatch_create_with_clock(STOPWATCH_CLOCK_MONOTONIC);
+    }
+    return result;
+}
+
+// Inserts preload keys picked at random from the key space
+static int preload_engine(const BENCH_ENGINE* engine, void* instance, const BENCH_CONFIG* config)
+{
+    int result = 0;
+    uint64_t rng_state = config->seed ^ 0xa5a5a5a5a5a5a5a5ULL;
+    NODE_KEY* keys = (NODE_KEY*)malloc(config->key_space * sizeof(NODE_KEY));
+    if (keys == NULL)
+    {
+        (void)printf("FAILURE: allocating preload keys\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        for (size_t index = 0; index < config->key_space; index++)
+        {
+            keys[index] = (NODE_KEY)index;
+        }
+        for (size_t index = config->key_space - 1; index > 0; index--)
+        {
+            size_t other = (size_t)(next_random(&rng_state) % (index + 1));
+            NODE_KEY swap = keys[index];
+            keys[index] = keys[other];
+            keys[other] = swap;
+        }
+        for (size_t index = 0; index < config->preload; index++)
+        {
+            if (engine->insert(instance, keys[index], bench_key_to_data(keys[index])) != 0)
+            {
+                (void)printf("FAILURE: preloading key %d\r\n", (int)keys[index]);
+                result = __LINE__;
+                break;
+            }
+        }
+        free(keys);
+    }
+    return result;
+}
+
+static void run_operation(const BENCH_ENGINE* engine, void* instance, BENCH_OPERATION operation, NODE_KEY key)
+{
+    switch (operation)
+    {
+        case BENCH_OPERATION_READ:
+            (void)engine->find(instance, key);
+            break;
+        case BENCH_OPERATION_INSERT:
+            (void)engine->insert(instance, key, bench_key_to_data(key));
+            break;
+        case BENCH_OPERATION_REMOVE:
+            (void)engine->remove(instance, key);
+            break;
+        case BENCH_OPERATION_UPSERT:
+            // None of the engines update in place, replace the entry
+            if (engine->insert(instance, key, bench_key_to_data(key)) != 0)
+            {
+                (void)engine->remove(instance, key);
+                (void)engine->insert(instance, key, bench_key_to_data(key));
+            }
+            break;
+        case BENCH_OPERATION_SCAN:
+        {
+            size_t length = 1 + (size_t)key % MAX_SCAN_LENGTH;
+            for (size_t index = 0; index < length; index++)
+            {
+                (void)engine->find(instance, (NODE_KEY)(key + index));
+            }
+            break;
+        }
+        case BENCH_OPERATION_READ_MODIFY_WRITE:
+            if (engine->find(instance, key) != NULL)
+            {
+                (void)engine->remove(instance, key);
+            }
+            (void)engine->insert(instance, key, bench_key_to_data(key));
+            break;
+        default:
+            break;
+    }
+}
+
+// Runs operations against one engine instance, each one timed into the
+// histogram for its operation type.  Returns the wall time of the run
+static uint64_t run_workload(const BENCH_ENGINE* engine, void* instance, const BENCH_CONFIG* config, size_t thread_index, size_t thread_count, LATENCY_HISTOGRAM_HANDLE histograms[BENCH_OPERATION_COUNT], STOPWATCH_HANDLE stopwatch)
+{
+    KEY_GENERATOR generator;
+    KEY_GENERATOR insert_generator;
+    uint64_t start_ns;
+    size_t operations = config->operations;
+    uint64_t seed = config->seed + thread_index * 0x9e3779b97f4a7c15ULL;
+    init_key_generator(&generator, config->workload.distribution, config->key_space, config->preload, seed);
+    // Inserts walk forward through the key space so 'latest' has something
+    // to follow, each thread from its own starting point
+    init_key_generator(&insert_generator, KEY_DISTRIBUTION_SEQUENTIAL, config->key_space, 0, seed);
+    insert_generator.next_sequential = config->preload + thread_index * config->key_space / thread_count;
+
+    start_ns = stopwatch_now_ns();
+    (void)stopwatch_start(stopwatch);
+    for (size_t index = 0; index < operations; index++)
+    {
+        BENCH_OPERATION operation = next_operation(&generator, &config->workload);
+        NODE_KEY key;
+        if (operation == BENCH_OPERATION_INSERT)
+        {
+            key = next_key(&insert_generator);
+            generator.latest = key;
+        }
+        else
+        {
+            key = next_key(&generator);
+        }
+
+        (void)stopwatch_lap_ns(stopwatch);
+        run_operation(engine, instance, operation, key);
+        latency_histogram_record(histograms[operation], stopwatch_lap_ns(stopwatch));
+    }
+    stopwatch_stop(stopwatch);
+    return stopwatch_now_ns() - start_ns;
+}
+
+static int run_engine(const BENCH_ENGINE* engine, const BENCH_CONFIG* config)
+{
+    int result = 0;
+    LATENCY_HISTOGRAM_HANDLE histograms[BENCH_OPERATION_COUNT] = { NULL };
+    STOPWATCH_HANDLE stopwatch = create_bench_stopwatch();
+    PERF_COUNTERS_HANDLE perf_counters = config->perf ? perf_counters_create() : NULL;
+    void* instance = engine->create(config->key_space);
+    for (size_t index = 0; index < BENCH_OPERATION_COUNT && result == 0; index++)
+    {
+        if ((histograms[index] = latency_histogram_create()) == NULL)
+        {
+            result = __LINE__;
+        }
+    }
+
+    if (result != 0 || stopwatch == NULL || instance == NULL)
+    {
+        (void)printf("FAILURE: creating %s engine\r\n", engine->name);
+        result = __LINE__;
+    }
+    else if ((result = preload_engine(engine, instance, config)) == 0)
+    {
+        uint64_t elapsed_ns;
+        if (perf_counters != NULL)
+        {
+            (void)perf_counters_start(perf_counters);
+        }
+        elapsed_ns = run_workload(engine, instance, config, 0, 1, histograms, stopwatch);
+        if (perf_counters != NULL)
+        {
+            (void)perf_counters_stop(perf_counters);
+        }
+        (void)printf("%s: %zu ops in %.3f s, %.0f ops/s\r\n", engine->name, config->operations,
+            (double)elapsed_ns / 1e9, elapsed_ns == 0 ? 0.0 : (double)config->operations * 1e9 / (double)elapsed_ns);
+        for (size_t index = 0; index < BENCH_OPERATION_COUNT; index++)
+        {
+            if (latency_histogram_count(histograms[index]) != 0)
+            {
+                (void)latency_histogram_export(histograms[index], stdout, OPERATION_NAMES[index], config->csv ? LATENCY_HISTOGRAM_FORMAT_CSV : LATENCY_HISTOGRAM_FORMAT_TEXT);
+            }
+        }
+        if (perf_counters != NULL)
+        {
+            (void)perf_counters_print(perf_counters, stdout, "counters", config->operations);
+        }
+    }
+
+    if (instance != NULL)
+    {
+        engine->destroy(instance);
+    }
+    for (size_t index = 0; index < BENCH_OPERATION_COUNT; index++)
+    {
+        latency_histogram_destroy(histograms[index]);
+    }
+    stopwatch_destroy(stopwatch);
+    perf_counters_destroy(perf_counters);
+    return result;
+}
+
+// Holds every thread until all of them exist so they start together
+typedef struct BENCH_START_TAG
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int go;
+    int abort;
+} BENCH_START;
+
+typedef struct BENCH_THREAD_TAG
+{
+    const BENCH_ENGINE* engine;
+    void* instance;
+    const BENCH_CONFIG* config;
+    size_t thread_index;
+    size_t thread_count;
+    int cpu;
+    BENCH_START* start;
+    LATENCY_HISTOGRAM_HANDLE histograms[BENCH_OPERATION_COUNT];
+    STOPWATCH_HANDLE stopwatch;
+    // Opened by the thread itself, counters follow the thread that opens them
+    PERF_COUNTERS_HANDLE perf_counters;
+    uint64_t start_ns;
+    uint64_t end_ns;
+} BENCH_THREAD;
+
+// Lists the cpus this process may run on, threads are pinned round robin
+static size_t get_allowed_cpus(int cpus[], size_t max_cpus)
+{
+    size_t result = 0;
+    cpu_set_t cpu_set;
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE && result < max_cpus; cpu++)
+        {
+            if (CPU_ISSET(cpu, &cpu_set))
+            {
+                cpus[result++] = cpu;
+            }
+        }
+    }
+    return result;
+}
+
+static void* bench_thread_worker(void* parameter)
+{
+    BENCH_THREAD* bench_thread = (BENCH_THREAD*)parameter;
+    if (bench_thread->cpu >= 0)
+    {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(bench_thread->cpu, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0)
+        {
+            (void)printf("FAILURE: pinning thread %zu to cpu %d\r\n", bench_thread->thread_index, bench_thread->cpu);
+        }
+    }
+
+    if (bench_thread->config->perf)
+    {
+        bench_thread->perf_counters = perf_counters_create();
+    }
+
+    (void)pthread_mutex_lock(&bench_thread->start->lock);
+    while (!bench_thread->start->go)
+    {
+        (void)pthread_cond_wait(&bench_thread->start->cond, &bench_thread->start->lock);
+    }
+    (void)pthread_mutex_unlock(&bench_thread->start->lock);
+
+    if (!bench_thread->start->abort)
+    {
+        bench_thread->start_ns = stopwatch_now_ns();
+        if (bench_thread->perf_counters != NULL)
+        {
+            (void)perf_counters_start(bench_thread->perf_counters);
+        }
+        (void)run_workload(bench_thread->engine, bench_thread->instance, bench_thread->config, bench_thread->thread_index, bench_thread->thread_count, bench_thread->histograms, bench_thread->stopwatch);
+        if (bench_thread->perf_counters != NULL)
+        {
+            (void)perf_counters_stop(bench_thread->perf_counters);
+        }
+        bench_thread->end_ns = stopwatch_now_ns();
+    }
+    return NULL;
+}
+
+static void release_bench_threads(BENCH_THREAD* bench_threads, size_t thread_count)
+{
+    for (size_t index = 0; index < thread_count; index++)
+    {
+        for (size_t operation = 0; operation < BENCH_OPERATION_COUNT; operation++)
+        {
+            latency_histogram_destroy(bench_threads[index].histograms[operation]);
+        }
+        stopwatch_destroy(bench_threads[index].stopwatch);
+        perf_counters_destroy(bench_threads[index].perf_counters);
+    }
+    free(bench_threads);
+}
+
+// One step of the sweep, every thread runs config->operations against the
+// same instance.  Returns the throughput or 0 on failure
+static double run_threads(const BENCH_ENGINE* engine, const BENCH_CONFIG* config, size_t thread_count, const int cpus[], size_t cpu_count, double single_thread_throughput)
+{
+    double result = 0.0;
+    pthread_t threads[MAX_BENCH_THREADS];
+    BENCH_START start = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0 };
+    size_t started;
+    void* instance = engine->create(config->key_space);
+    BENCH_THREAD* bench_threads = (BENCH_THREAD*)calloc(thread_count, sizeof(BENCH_THREAD));
+    int failed = instance == NULL || bench_threads == NULL || preload_engine(engine, instance, config) != 0;
+    for (size_t index = 0; index < thread_count && !failed; index++)
+    {
+        BENCH_THREAD* bench_thread = &bench_threads[index];
+        bench_thread->engine = engine;
+        bench_thread->instance = instance;
+        bench_thread->config = config;
+        bench_thread->thread_index = index;
+        bench_thread->thread_count = thread_count;
+        bench_thread->cpu = cpu_count == 0 ? -1 : cpus[index % cpu_count];
+        bench_thread->start = &start;
+        if ((bench_thread->stopwatch = create_bench_stopwatch()) == NULL)
+        {
+            failed = 1;
+        }
+        for (size_t operation = 0; operation < BENCH_OPERATION_COUNT && !failed; operation++)
+        {
+            if ((bench_thread->histograms[operation] = latency_histogram_create()) == NULL)
+            {
+                failed = 1;
+            }
+        }
+    }
+
+    if (failed)
+    {
+        (void)printf("FAILURE: setting up %zu threads on %s\r\n", thread_count, engine->name);
+    }
+    else
+    {
+        uint64_t first_start = UINT64_MAX;
+        uint64_t last_end = 0;
+        for (started = 0; started < thread_count; started++)
+        {
+            if (pthread_create(&threads[started], NULL, bench_thread_worker, &bench_threads[started]) != 0)
+            {
+                (void)printf("FAILURE: starting thread %zu of %zu\r\n", started, thread_count);
+                start.abort = 1;
+                break;
+            }
+        }
+
+        (void)pthread_mutex_lock(&start.lock);
+        start.go = 1;
+        (void)pthread_cond_broadcast(&start.cond);
+        (void)pthread_mutex_unlock(&start.lock);
+
+        for (size_t index = 0; index < started; index++)
+        {
+            (void)pthread_join(threads[index], NULL);
+            if (bench_threads[index].start_ns < first_start)
+            {
+                first_start = bench_threads[index].start_ns;
+            }
+            if (bench_threads[index].end_ns > last_end)
+            {
+                last_end = bench_threads[index].end_ns;
+            }
+        }
+
+        if (!start.abort && last_end > first_start)
+        {
+            result = (double)(config->operations * thread_count) * 1e9 / (double)(last_end - first_start);
+        }
+    }
+
+    if (result != 0.0)
+    {
+        (void)printf("%s %3zu threads: %12.0f ops/s, scaling efficiency %5.1f%%\r\n", engine->name, thread_count, result,
+            single_thread_throughput == 0.0 ? 100.0 : 100.0 * result / ((double)thread_count * single_thread_throughput));
+
+        // Per thread percentiles over all of its operations
+        for (size_t index = 0; index < thread_count; index++)
+        {
+            char name[32];
+            for (size_t operation = 1; operation < BENCH_OPERATION_COUNT; operation++)
+            {
+                (void)latency_histogram_merge(bench_threads[index].histograms[0], bench_threads[index].histograms[operation]);
+            }
+            (void)snprintf(name, sizeof(name), "  thread %zu", index);
+            (void)latency_histogram_export(bench_threads[index].histograms[0], stdout, name, config->csv ? LATENCY_HISTOGRAM_FORMAT_CSV : LATENCY_HISTOGRAM_FORMAT_TEXT);
+            if (bench_threads[index].perf_counters != NULL)
+            {
+                (void)perf_counters_print(bench_threads[index].perf_counters, stdout, name, config->operations);
+            }
+        }
+    }
+
+    if (instance != NULL)
+    {
+        engine->destroy(instance);
+    }
+    if (bench_threads != NULL)
+    {
+        release_bench_threads(bench_threads, thread_count);
+    }
+    return result;
+}
+
+// Doubles the thread count up to max_threads, always ending on max_threads
+static size_t next_thread_count(size_t thread_count, size_t max_threads)
+{
+    return thread_count < max_threads && thread_count * 2 > max_threads ? max_threads : thread_count * 2;
+}
+
+static int run_scalability(const BENCH_ENGINE* engine, const BENCH_CONFIG* config)
+{
+    int result = 0;
+    int cpus[MAX_BENCH_THREADS];
+    size_t cpu_count = get_allowed_cpus(cpus, MAX_BENCH_THREADS);
+    double single_thread_throughput = 0.0;
+    for (size_t thread_count = 1; thread_count <= config->max_threads; thread_count = next_thread_count(thread_count, config->max_threads))
+    {
+        double throughput = run_threads(engine, config, thread_count, cpus, cpu_count, single_thread_throughput);
+        if (throughput == 0.0)
+        {
+            result = __LINE__;
+            break;
+        }
+        if (thread_count == 1)
+        {
+            single_thread_throughput = throughput;
+        }
+    }
+    return result;
+}
+
+static void print_usage(const char* program)
+{
+    (void)printf("usage: %s [options]\r\n"
+        "  --workload A-F          YCSB core workload (default A)\r\n"
+        "  --mix R,I,D,U           custom read/insert/remove/upsert percentages\r\n"
+        "  --distribution NAME     uniform, zipfian, sequential, hotspot or latest\r\n"
+        "  --keys N                key space, at most %zu\r\n"
+        "  --size N                keys loaded before the run (default half the key space)\r\n"
+        "  --ops N                 operations to run (default %d)\r\n"
+        "  --seed N                random seed (default %d)\r\n"
+        "  --engine NAME           tree, tree_mutex, tree_typed, sorted_array,\r\n"
+        "                          hash_table or all (default all)\r\n"
+        "  --threads N             sweep 1..N pinned threads on one shared instance, ops are per thread\r\n"
+        "  --csv                   print latency histograms as csv\r\n"
+        "  --perf                  report perf_event counters per operation\r\n",
+        program, MAX_KEY_SPACE, DEFAULT_OPERATIONS, DEFAULT_SEED);
+}
+
+static int parse_distribution(const char* name, KEY_DISTRIBUTION* distribution)
+{
+    static const char* DISTRIBUTION_NAMES[] = { "uniform", "zipfian", "sequential", "hotspot", "latest" };
+    int result = __LINE__;
+    for (size_t index = 0; index < sizeof(DISTRIBUTION_NAMES) / sizeof(DISTRIBUTION_NAMES[0]); index++)
+    {
+        if (strcmp(name, DISTRIBUTION_NAMES[index]) == 0)
+        {
+            *distribution = (KEY_DISTRIBUTION)index;
+            result = 0;
+            break;
+        }
+    }
+    return result;
+}
+
+static int parse_arguments(int argc, char* argv[], BENCH_CONFIG* config)
+{
+    int result = 0;
+    int preload_set = 0;
+    KEY_DISTRIBUTION distribution = KEY_DISTRIBUTION_UNIFORM;
+    int distribution_set = 0;
+
+    memset(config, 0, sizeof(BENCH_CONFIG));
+    config->workload = YCSB_WORKLOADS[0];
+    config->key_space = MAX_KEY_SPACE;
+    config->operations = DEFAULT_OPERATIONS;
+    config->seed = DEFAULT_SEED;
+    config->engine_name = "all";
+
+    for (int index = 1; index < argc && result == 0; index++)
+    {
+        const char* value = index + 1 < argc ? argv[index + 1] : NULL;
+        if (strcmp(argv[index], "--csv") == 0)
+        {
+            config->csv = 1;
+        }
+        else if (strcmp(argv[index], "--perf") == 0)
+        {
+            config->perf = 1;
+        }
+        else if (value == NULL)
+        {
+            result = __LINE__;
+        }
+        else
+        {
+            index++;
+            if (strcmp(argv[index - 1], "--workload") == 0)
+            {
+                size_t workload_index = (size_t)(value[0] - 'A');
+                if (value[1] != '\0' || workload_index >= sizeof(YCSB_WORKLOADS) / sizeof(YCSB_WORKLOADS[0]))
+                {
+                    result = __LINE__;
+                }
+                else
+                {
+                    config->workload = YCSB_WORKLOADS[workload_index];
+                }
+            }
+            else if (strcmp(argv[index - 1], "--mix") == 0)
+            {
+                unsigned int mix[4];
+                if (sscanf(value, "%u,%u,%u,%u", &mix[0], &mix[1], &mix[2], &mix[3]) != 4 || mix[0] + mix[1] + mix[2] + mix[3] != 100)
+                {
+                    result = __LINE__;
+                }
+                else
+                {
+                    memset(config->workload.mix, 0, sizeof(config->workload.mix));
+                    config->workload.name = '-';
+                    config->workload.mix[BENCH_OPERATION_READ] = mix[0];
+                    config->workload.mix[BENCH_OPERATION_INSERT] = mix[1];
+                    config->workload.mix[BENCH_OPERATION_REMOVE] = mix[2];
+                    config->workload.mix[BENCH_OPERATION_UPSERT] = mix[3];
+                }
+            }
+            else if (strcmp(argv[index - 1], "--distribution") == 0)
+            {
+                result = parse_distribution(value, &distribution);
+                distribution_set = 1;
+            }
+            else if (strcmp(argv[index - 1], "--keys") == 0)
+            {
+                config->key_space = (size_t)strtoull(value, NULL, 10);
+            }
+            else if (strcmp(argv[index - 1], "--size") == 0)
+            {
+                config->preload = (size_t)strtoull(value, NULL, 10);
+                preload_set = 1;
+            }
+            else if (strcmp(argv[index - 1], "--ops") == 0)
+            {
+                config->operations = (size_t)strtoull(value, NULL, 10);
+            }
+            else if (strcmp(argv[index - 1], "--seed") == 0)
+            {
+                config->seed = strtoull(value, NULL, 0);
+            }
+            else if (strcmp(argv[index - 1], "--threads") == 0)
+            {
+                config->max_threads = (size_t)strtoull(value, NULL, 10);
+            }
+            else if (strcmp(argv[index - 1], "--engine") == 0)
+            {
+                config->engine_name = value;
+            }
+            else
+            {
+                result = __LINE__;
+            }
+        }
+    }
+
+    if (result != 0)
+    {
+        // Bad argument
+    }
+    else if (config->key_space == 0 || config->key_space > MAX_KEY_SPACE)
+    {
+        (void)printf("FAILURE: key space must be between 1 and %zu\r\n", MAX_KEY_SPACE);
+        result = __LINE__;
+    }
+    else if (config->max_threads > MAX_BENCH_THREADS)
+    {
+        (void)printf("FAILURE: at most %d threads\r\n", MAX_BENCH_THREADS);
+        result = __LINE__;
+    }
+    else
+    {
+        if (distribution_set)
+        {
+            config->workload.distribution = distribution;
+        }
+        if (!preload_set)
+        {
+            config->preload = config->key_space / 2;
+        }
+        else if (config->preload > config->key_space)
+        {
+            config->preload = config->key_space;
+        }
+    }
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    int result;
+    BENCH_CONFIG config;
+    if (parse_arguments(argc, argv, &config) != 0)
+    {
+        print_usage(argv[0]);
+        result = 1;
+    }
+    else
+    {
+        int engine_found = 0;
+        result = 0;
+        (void)printf("workload %c, %zu keys, %zu preloaded, %zu ops, seed %llu\r\n",
+            config.workload.name, config.key_space, config.preload, config.operations, (unsigned long long)config.seed);
+        for (size_t index = 0; index < BENCH_ENGINE_COUNT; index++)
+        {
+            if (strcmp(config.engine_name, "all") == 0 || strcmp(config.engine_name, BENCH_ENGINES[index].name) == 0)
+            {
+                engine_found = 1;
+                if (config.max_threads == 0)
+                {
+                    if (run_engine(&BENCH_ENGINES[index], &config) != 0)
+                    {
+                        result = 1;
+                    }
+                }
+                else if (!BENCH_ENGINES[index].thread_safe)
+                {
+                    (void)printf("%s is not thread safe, skipped in the thread sweep\r\n", BENCH_ENGINES[index].name);
+                }
+                else if (run_scalability(&BENCH_ENGINES[index], &config) != 0)
+                {
+                    result = 1;
+                }
+            }
+        }
+
+        if (!engine_found)
+        {
+            (void)printf("FAILURE: unknown engine %s\r\n", config.engine_name);
+            result = 1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,305 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "whiskey_node.h"
+
+static int get_height(const whiskey_node* node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+static int get_balance_factor(const whiskey_node* node)
+{
+    return get_height(node->left) - get_height(node->right);
+}
+
+static void update_height(whiskey_node* node)
+{
+    int left_height = get_height(node->left);
+    int right_height = get_height(node->right);
+    node->height = (left_height > right_height ? left_height : right_height) + 1;
+}
+
+// Points whatever linked to old_child, parent or the root, at new_child
+static void replace_child(whiskey_root* root, whiskey_node* parent, const whiskey_node* old_child, whiskey_node* new_child)
+{
+    if (parent == NULL)
+    {
+        root->node = new_child;
+    }
+    else if (parent->left == old_child)
+    {
+        parent->left = new_child;
+    }
+    else
+    {
+        parent->right = new_child;
+    }
+}
+
+static whiskey_node* rotate_right(whiskey_root* root, whiskey_node* node)
+{
+    whiskey_node* pivot = node->left;
+
+    node->left = pivot->right;
+    if (pivot->right != NULL)
+    {
+        pivot->right->parent = node;
+    }
+    pivot->parent = node->parent;
+    replace_child(root, node->parent, node, pivot);
+    pivot->right = node;
+    node->parent = pivot;
+    update_height(node);
+    update_height(pivot);
+    return pivot;
+}
+
+static whiskey_node* rotate_left(whiskey_root* root, whiskey_node* node)
+{
+    whiskey_node* pivot = node->right;
+
+    node->right = pivot->left;
+    if (pivot->left != NULL)
+    {
+        pivot->left->parent = node;
+    }
+    pivot->parent = node->parent;
+    replace_child(root, node->parent, node, pivot);
+    pivot->left = node;
+    node->parent = pivot;
+    update_height(node);
+    update_height(pivot);
+    return pivot;
+}
+
+// Returns whatever ends up at node's place once its children are balanced
+static whiskey_node* rebalance(whiskey_root* root, whiskey_node* node)
+{
+    whiskey_node* result;
+    int balance_factor = get_balance_factor(node);
+    if (balance_factor > 1)
+    {
+        if (get_balance_factor(node->left) < 0)
+        {
+            // Left right case
+            (void)rotate_left(root, node->left);
+        }
+        result = rotate_right(root, node);
+    }
+    else if (balance_factor < -1)
+    {
+        if (get_balance_factor(node->right) > 0)
+        {
+            // Right left case
+            (void)rotate_right(root, node->right);
+        }
+        result = rotate_left(root, node);
+    }
+    else
+    {
+        update_height(node);
+        result = node;
+    }
+    return result;
+}
+
+// Once a subtree comes out as high as it was nothing above it changed
+static void rebalance_upwards(whiskey_root* root, whiskey_node* node)
+{
+    while (node != NULL)
+    {
+        int old_height = node->height;
+        node = rebalance(root, node);
+        if (node->height == old_height)
+        {
+            break;
+        }
+        node = node->parent;
+    }
+}
+
+void whiskey_insert_rebalance(whiskey_root* root, whiskey_node* node)
+{
+    if (root != NULL && node != NULL)
+    {
+        rebalance_upwards(root, node->parent);
+    }
+}
+
+int whiskey_insert(whiskey_root* root, whiskey_node* node, whiskey_node_compare compare)
+{
+    int result = 0;
+    if (root == NULL || node == NULL || compare == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        whiskey_node* parent = NULL;
+        whiskey_node** link = &root->node;
+        while (*link != NULL)
+        {
+            int compare_result = compare(node, *link);
+            if (compare_result == 0)
+            {
+                result = __LINE__;
+                break;
+            }
+            parent = *link;
+            link = compare_result < 0 ? &parent->left : &parent->right;
+        }
+
+        if (result == 0)
+        {
+            whiskey_link_node(node, parent, link);
+            rebalance_upwards(root, parent);
+        }
+    }
+    return result;
+}
+
+whiskey_node* whiskey_find(const whiskey_root* root, const void* key, whiskey_key_compare compare)
+{
+    whiskey_node* result = root == NULL || compare == NULL ? NULL : root->node;
+    while (result != NULL)
+    {
+        int compare_result = compare(key, result);
+        if (compare_result == 0)
+        {
+            break;
+        }
+        result = compare_result < 0 ? result->left : result->right;
+    }
+    return result;
+}
+
+void whiskey_erase(whiskey_root* root, whiskey_node* node)
+{
+    if (root != NULL && node != NULL)
+    {
+        whiskey_node* rebalance_from;
+        if (node->left != NULL && node->right != NULL)
+        {
+            // The entries belong to the caller and can't be copied, so the
+            // successor node itself moves into node's place
+            whiskey_node* successor = node->right;
+            while (successor->left != NULL)
+            {
+                successor = successor->left;
+            }
+
+            if (successor->parent == node)
+            {
+                rebalance_from = successor;
+            }
+            else
+            {
+                rebalance_from = successor->parent;
+                rebalance_from->left = successor->right;
+                if (successor->right != NULL)
+                {
+                    successor->right->parent = rebalance_from;
+                }
+                successor->right = node->right;
+                node->right->parent = successor;
+            }
+            successor->left = node->left;
+            node->left->parent = successor;
+            successor->parent = node->parent;
+            successor->height = node->height;
+            replace_child(root, node->parent, node, successor);
+        }
+        else
+        {
+            whiskey_node* child = node->left != NULL ? node->left : node->right;
+            if (child != NULL)
+            {
+                child->parent = node->parent;
+            }
+            replace_child(root, node->parent, node, child);
+            rebalance_from = node->parent;
+        }
+
+        rebalance_upwards(root, rebalance_from);
+        node->parent = NULL;
+        node->left = NULL;
+        node->right = NULL;
+    }
+}
+
+whiskey_node* whiskey_first(const whiskey_root* root)
+{
+    whiskey_node* result = root == NULL ? NULL : root->node;
+    while (result != NULL && result->left != NULL)
+    {
+        result = result->left;
+    }
+    return result;
+}
+
+whiskey_node* whiskey_last(const whiskey_root* root)
+{
+    whiskey_node* result = root == NULL ? NULL : root->node;
+    while (result != NULL && result->right != NULL)
+    {
+        result = result->right;
+    }
+    return result;
+}
+
+whiskey_node* whiskey_next(const whiskey_node* node)
+{
+    whiskey_node* result;
+    if (node == NULL)
+    {
+        result = NULL;
+    }
+    else if (node->right != NULL)
+    {
+        result = node->right;
+        while (result->left != NULL)
+        {
+            result = result->left;
+        }
+    }
+    else
+    {
+        // Up until we arrive from a left child
+        while (node->parent != NULL && node == node->parent->right)
+        {
+            node = node->parent;
+        }
+        result = node->parent;
+    }
+    return result;
+}
+
+whiskey_node* whiskey_prev(const whiskey_node* node)
+{
+    whiskey_node* result;
+    if (node == NULL)
+    {
+        result = NULL;
+    }
+    else if (node->left != NULL)
+    {
+        result = node->left;
+        while (result->right != NULL)
+        {
+            result = result->right;
+        }
+    }
+    else
+    {
+        while (node->parent != NULL && node == node->parent->left)
+        {
+            node = node->parent;
+        }
+        result = node->parent;
+    }
+    return result;
+}
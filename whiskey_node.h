@@ -0,0 +1,92 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WHISKEY_NODE_H
+#define WHISKEY_NODE_H
+
+#ifdef __cplusplus
+#include <cstddef>
+extern "C" {
+#else // __cplusplus
+#include <stddef.h>
+#endif // __cplusplus
+
+// Intrusive AVL tree.  The caller embeds a whiskey_node in its own struct
+// and the tree links those directly, it never allocates, copies or frees
+// anything and has no lock of its own.  whiskey_entry turns a node back
+// into the struct around it:
+//
+//   typedef struct ORDER_TAG
+//   {
+//       uint64_t id;
+//       whiskey_node by_id;
+//   } ORDER;
+//
+//   static int compare_orders(const whiskey_node* node_1, const whiskey_node* node_2)
+//   {
+//       uint64_t id_1 = whiskey_entry(node_1, ORDER, by_id)->id;
+//       uint64_t id_2 = whiskey_entry(node_2, ORDER, by_id)->id;
+//       return id_1 < id_2 ? -1 : id_1 > id_2 ? 1 : 0;
+//   }
+//
+//   whiskey_root orders = WHISKEY_ROOT_INIT;
+//   (void)whiskey_insert(&orders, &order->by_id, compare_orders);
+//
+// Callers that want their search loop inlined can walk the links
+// themselves, then whiskey_link_node and whiskey_insert_rebalance, the
+// same split as the Linux rbtree.  One struct can sit in several trees
+// through several embedded nodes.
+
+typedef struct whiskey_node_TAG
+{
+    struct whiskey_node_TAG* parent;
+    struct whiskey_node_TAG* left;
+    struct whiskey_node_TAG* right;
+    int height;
+} whiskey_node;
+
+typedef struct whiskey_root_TAG
+{
+    whiskey_node* node;
+} whiskey_root;
+
+#define WHISKEY_ROOT_INIT   { NULL }
+
+#define whiskey_entry(ptr, type, member)    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+// Returns less than, equal to or greater than zero like memcmp
+typedef int (*whiskey_node_compare)(const whiskey_node* node_1, const whiskey_node* node_2);
+typedef int (*whiskey_key_compare)(const void* key, const whiskey_node* node);
+
+// Puts node at *link, a NULL child link of parent or the root link
+static inline void whiskey_link_node(whiskey_node* node, whiskey_node* parent, whiskey_node** link)
+{
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->height = 1;
+    *link = node;
+}
+
+// Restores the balance above a node just placed with whiskey_link_node
+extern void whiskey_insert_rebalance(whiskey_root* root, whiskey_node* node);
+
+// Links node unless an equal one is already in the tree, fails then and
+// leaves node untouched
+extern int whiskey_insert(whiskey_root* root, whiskey_node* node, whiskey_node_compare compare);
+extern whiskey_node* whiskey_find(const whiskey_root* root, const void* key, whiskey_key_compare compare);
+// Unlinks node, which must be in the tree.  Nothing is freed, the caller
+// owns the struct around it
+extern void whiskey_erase(whiskey_root* root, whiskey_node* node);
+
+// In order iteration, NULL past either end
+extern whiskey_node* whiskey_first(const whiskey_root* root);
+extern whiskey_node* whiskey_last(const whiskey_root* root);
+extern whiskey_node* whiskey_next(const whiskey_node* node);
+extern whiskey_node* whiskey_prev(const whiskey_node* node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* WHISKEY_NODE_H */
@@ -0,0 +1,298 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Replays a trace recorded with OPTION_TRACE_FILE against the bench engines
+// and reports throughput and latency per operation.  The engines take
+// NODE_KEY keys so only traces of byte key trees can be replayed
+//
+//   whiskey_replay TRACE [--engine NAME] [--timing] [--csv]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "op_trace.h"
+#include "stopwatch.h"
+#include "latency_histogram.h"
+#include "bench_engines.h"
+
+// Every key NODE_KEY can hold
+#define MAX_KEY_SPACE           ((size_t)1 << (sizeof(NODE_KEY) * 8))
+// With --timing, gaps longer than this are slept through and the rest spun
+#define SPIN_THRESHOLD_NS       50000
+#define REPLAY_OPERATION_COUNT  3
+
+static const char* OPERATION_NAMES[REPLAY_OPERATION_COUNT] = { "insert", "remove", "find" };
+
+typedef struct REPLAY_CONFIG_TAG
+{
+    const char* trace_path;
+    const char* engine_name;
+    int timing;
+    int csv;
+} REPLAY_CONFIG;
+
+static void print_usage(const char* program)
+{
+    (void)printf("usage: %s TRACE [options]\r\n"
+        "  TRACE                   file recorded with the tree's trace_file option\r\n"
+        "  --engine NAME           tree, tree_mutex, tree_typed, sorted_array,\r\n"
+        "                          hash_table or all (default all)\r\n"
+        "  --timing                keep the recorded gaps between calls instead of running flat out\r\n"
+        "  --csv                   print latency histograms as csv\r\n",
+        program);
+}
+
+static int parse_arguments(int argc, char* argv[], REPLAY_CONFIG* config)
+{
+    int result = 0;
+    memset(config, 0, sizeof(REPLAY_CONFIG));
+    config->engine_name = "all";
+
+    for (int index = 1; index < argc && result == 0; index++)
+    {
+        if (strcmp(argv[index], "--timing") == 0)
+        {
+            config->timing = 1;
+        }
+        else if (strcmp(argv[index], "--csv") == 0)
+        {
+            config->csv = 1;
+        }
+        else if (strcmp(argv[index], "--engine") == 0 && index + 1 < argc)
+        {
+            config->engine_name = argv[++index];
+        }
+        else if (argv[index][0] != '-' && config->trace_path == NULL)
+        {
+            config->trace_path = argv[index];
+        }
+        else
+        {
+            result = __LINE__;
+        }
+    }
+
+    if (result == 0 && config->trace_path == NULL)
+    {
+        result = __LINE__;
+    }
+    return result;
+}
+
+static int compare_timestamps(const void* value_1, const void* value_2)
+{
+    uint64_t timestamp_1 = ((const OP_TRACE_RECORD*)value_1)->timestamp_ns;
+    uint64_t timestamp_2 = ((const OP_TRACE_RECORD*)value_2)->timestamp_ns;
+    return timestamp_1 < timestamp_2 ? -1 : timestamp_1 > timestamp_2 ? 1 : 0;
+}
+
+// Calls from several threads reach the file in the order they were queued,
+// which can differ slightly from the order they started in.  Returns the
+// records in start order, a sorted copy the caller frees in *sorted_copy
+// when the file isn't already
+static const OP_TRACE_RECORD* get_ordered_records(const OP_TRACE_RECORD* records, size_t count, OP_TRACE_RECORD** sorted_copy)
+{
+    const OP_TRACE_RECORD* result = records;
+    *sorted_copy = NULL;
+    for (size_t index = 1; index < count; index++)
+    {
+        if (records[index].timestamp_ns < records[index - 1].timestamp_ns)
+        {
+            if ((*sorted_copy = (OP_TRACE_RECORD*)malloc(count * sizeof(OP_TRACE_RECORD))) == NULL)
+            {
+                (void)printf("FAILURE: allocating %zu records to sort\r\n", count);
+                result = NULL;
+            }
+            else
+            {
+                memcpy(*sorted_copy, records, count * sizeof(OP_TRACE_RECORD));
+                qsort(*sorted_copy, count, sizeof(OP_TRACE_RECORD), compare_timestamps);
+                result = *sorted_copy;
+            }
+            break;
+        }
+    }
+    return result;
+}
+
+static void wait_until(uint64_t deadline_ns)
+{
+    uint64_t now_ns = stopwatch_now_ns();
+    if (deadline_ns > now_ns + SPIN_THRESHOLD_NS)
+    {
+        uint64_t sleep_ns = deadline_ns - now_ns - SPIN_THRESHOLD_NS;
+        struct timespec sleep_time;
+        sleep_time.tv_sec = (time_t)(sleep_ns / 1000000000);
+        sleep_time.tv_nsec = (long)(sleep_ns % 1000000000);
+        (void)nanosleep(&sleep_time, NULL);
+    }
+    while (stopwatch_now_ns() < deadline_ns)
+    {
+    }
+}
+
+// Returns 0 when the call came out the way it did in the recording
+static int replay_record(const BENCH_ENGINE* engine, void* instance, const OP_TRACE_RECORD* record)
+{
+    // main only lets through traces recorded in BINARY_TREE_KEY_BYTE mode
+    NODE_KEY key = (NODE_KEY)record->key;
+    int failed;
+    switch (record->operation)
+    {
+        case OP_TRACE_INSERT:
+            failed = engine->insert(instance, key, bench_key_to_data(key)) != 0;
+            break;
+        case OP_TRACE_REMOVE:
+            failed = engine->remove(instance, key) != 0;
+            break;
+        default:
+            failed = engine->find(instance, key) == NULL;
+            break;
+    }
+    return failed == (record->result != 0) ? 0 : __LINE__;
+}
+
+static int replay_engine(const BENCH_ENGINE* engine, const OP_TRACE_RECORD* records, size_t count, const REPLAY_CONFIG* config)
+{
+    int result = 0;
+    LATENCY_HISTOGRAM_HANDLE histograms[REPLAY_OPERATION_COUNT] = { NULL };
+    STOPWATCH_HANDLE stopwatch = stopwatch_create_with_clock(STOPWATCH_CLOCK_TSC);
+    void* instance = engine->create(MAX_KEY_SPACE);
+    if (stopwatch == NULL)
+    {
+        stopwatch = stopwatch_create_with_clock(STOPWATCH_CLOCK_MONOTONIC);
+    }
+    for (size_t index = 0; index < REPLAY_OPERATION_COUNT && result == 0; index++)
+    {
+        if ((histograms[index] = latency_histogram_create()) == NULL)
+        {
+            result = __LINE__;
+        }
+    }
+
+    if (result != 0 || stopwatch == NULL || instance == NULL)
+    {
+        (void)printf("FAILURE: creating %s engine\r\n", engine->name);
+        result = __LINE__;
+    }
+    else
+    {
+        size_t mismatches = 0;
+        uint64_t max_lag_ns = 0;
+        uint64_t first_ns = count > 0 ? records[0].timestamp_ns : 0;
+        uint64_t start_ns = stopwatch_now_ns();
+        uint64_t elapsed_ns;
+        (void)stopwatch_start(stopwatch);
+        for (size_t index = 0; index < count; index++)
+        {
+            const OP_TRACE_RECORD* record = &records[index];
+            if (config->timing)
+            {
+                uint64_t deadline_ns = start_ns + (record->timestamp_ns - first_ns);
+                uint64_t now_ns = stopwatch_now_ns();
+                if (now_ns > deadline_ns)
+                {
+                    max_lag_ns = now_ns - deadline_ns > max_lag_ns ? now_ns - deadline_ns : max_lag_ns;
+                }
+                else
+                {
+                    wait_until(deadline_ns);
+                }
+            }
+
+            (void)stopwatch_lap_ns(stopwatch);
+            if (replay_record(engine, instance, record) != 0)
+            {
+                mismatches++;
+            }
+            latency_histogram_record(histograms[record->operation < REPLAY_OPERATION_COUNT ? record->operation : OP_TRACE_FIND], stopwatch_lap_ns(stopwatch));
+        }
+        stopwatch_stop(stopwatch);
+        elapsed_ns = stopwatch_now_ns() - start_ns;
+
+        (void)printf("%s: %zu ops in %.3f s, %.0f ops/s, %zu results differ from the recording\r\n", engine->name, count,
+            (double)elapsed_ns / 1e9, elapsed_ns == 0 ? 0.0 : (double)count * 1e9 / (double)elapsed_ns, mismatches);
+        if (config->timing)
+        {
+            (void)printf("%s: fell behind the recorded timing by up to %.3f ms\r\n", engine->name, (double)max_lag_ns / 1e6);
+        }
+        for (size_t index = 0; index < REPLAY_OPERATION_COUNT; index++)
+        {
+            if (latency_histogram_count(histograms[index]) != 0)
+            {
+                (void)latency_histogram_export(histograms[index], stdout, OPERATION_NAMES[index], config->csv ? LATENCY_HISTOGRAM_FORMAT_CSV : LATENCY_HISTOGRAM_FORMAT_TEXT);
+            }
+        }
+    }
+
+    if (instance != NULL)
+    {
+        engine->destroy(instance);
+    }
+    for (size_t index = 0; index < REPLAY_OPERATION_COUNT; index++)
+    {
+        latency_histogram_destroy(histograms[index]);
+    }
+    stopwatch_destroy(stopwatch);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    int result;
+    REPLAY_CONFIG config;
+    OP_TRACE_READER_HANDLE reader;
+    if (parse_arguments(argc, argv, &config) != 0)
+    {
+        print_usage(argv[0]);
+        result = 1;
+    }
+    else if (strcmp(config.engine_name, "all") != 0 && bench_engine_find(config.engine_name) == NULL)
+    {
+        (void)printf("FAILURE: unknown engine %s\r\n", config.engine_name);
+        result = 1;
+    }
+    else if ((reader = op_trace_reader_open(config.trace_path)) == NULL)
+    {
+        (void)printf("FAILURE: unable to read trace %s\r\n", config.trace_path);
+        result = 1;
+    }
+    else if (op_trace_reader_key_mode(reader) != BINARY_TREE_KEY_BYTE)
+    {
+        (void)printf("FAILURE: %s was recorded from a tree in %s key mode, only byte key traces can be replayed\r\n", config.trace_path,
+            op_trace_reader_key_mode(reader) == BINARY_TREE_KEY_UINT64 ? "uint64" : op_trace_reader_key_mode(reader) == BINARY_TREE_KEY_STRING ? "string" : "an unknown");
+        op_trace_reader_close(reader);
+        result = 1;
+    }
+    else
+    {
+        OP_TRACE_RECORD* sorted_copy;
+        size_t count = op_trace_reader_count(reader);
+        const OP_TRACE_RECORD* records = get_ordered_records(op_trace_reader_records(reader), count, &sorted_copy);
+        if (records == NULL)
+        {
+            result = 1;
+        }
+        else
+        {
+            result = 0;
+            (void)printf("%s: %zu calls over %.3f s%s\r\n", config.trace_path, count,
+                count == 0 ? 0.0 : (double)(records[count - 1].timestamp_ns - records[0].timestamp_ns) / 1e9,
+                config.timing ? ", replayed with the recorded timing" : "");
+            for (size_t index = 0; index < BENCH_ENGINE_COUNT; index++)
+            {
+                if ((strcmp(config.engine_name, "all") == 0 || strcmp(config.engine_name, BENCH_ENGINES[index].name) == 0) &&
+                    replay_engine(&BENCH_ENGINES[index], records, count, &config) != 0)
+                {
+                    result = 1;
+                }
+            }
+        }
+        free(sorted_copy);
+        op_trace_reader_close(reader);
+    }
+    return result;
+}
@@ -0,0 +1,143 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Attaches to the stat page a tree publishes with OPTION_STATS_EXPORT and
+// prints a line of rates every interval, like vmstat
+//
+//   whiskey-stat NAME [INTERVAL_SECONDS [COUNT]]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+
+#include "stat_page.h"
+#include "stopwatch.h"
+#include "logging.h"
+
+#define DEFAULT_INTERVAL_SECONDS    1.0
+#define HEADER_EVERY_LINES          20
+// A page that hasn't been published to for this long belongs to a tree that is gone
+#define STALE_AFTER_NS              3000000000ULL
+
+static volatile sig_atomic_t g_stop;
+
+static void handle_signal(int signal_number)
+{
+    (void)signal_number;
+    g_stop = 1;
+}
+
+static void print_usage(const char* program)
+{
+    (void)printf("usage: %s NAME [INTERVAL_SECONDS [COUNT]]\r\n"
+        "  NAME                    stat page the tree exports to (OPTION_STATS_EXPORT)\r\n"
+        "  INTERVAL_SECONDS        time between lines (default %.0f)\r\n"
+        "  COUNT                   lines to print, runs until interrupted when left out\r\n",
+        program, DEFAULT_INTERVAL_SECONDS);
+}
+
+static void print_header(void)
+{
+    (void)printf("%10s %6s %10s %10s %10s %10s %10s %9s %9s %9s %9s\r\n",
+        "items", "height", "memory", "insert/s", "remove/s", "find/s", "rotate/s", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)");
+}
+
+static double get_rate(uint64_t current, uint64_t previous, double seconds)
+{
+    return seconds <= 0.0 || current < previous ? 0.0 : (double)(current - previous) / seconds;
+}
+
+static void print_line(const STAT_PAGE_VALUES* current, const STAT_PAGE_VALUES* previous)
+{
+    double seconds = (double)(current->publish_ns - previous->publish_ns) / 1e9;
+    char rotation_rate[32];
+    if (current->rotation_stats)
+    {
+        (void)snprintf(rotation_rate, sizeof(rotation_rate), "%.0f", get_rate(current->single_rotations + current->double_rotations + current->subtree_rebuilds,
+            previous->single_rotations + previous->double_rotations + previous->subtree_rebuilds, seconds));
+    }
+    else
+    {
+        // The library was built without ENABLE_TREE_STATS
+        (void)snprintf(rotation_rate, sizeof(rotation_rate), "-");
+    }
+
+    (void)printf("%10llu %6llu %10llu %10.0f %10.0f %10.0f %10s %9llu %9llu %9llu %9llu\r\n",
+        (unsigned long long)current->items, (unsigned long long)current->height, (unsigned long long)current->memory_bytes,
+        get_rate(current->inserts, previous->inserts, seconds), get_rate(current->removes, previous->removes, seconds),
+        get_rate(current->finds, previous->finds, seconds), rotation_rate,
+        (unsigned long long)current->latency_p50_ns, (unsigned long long)current->latency_p99_ns,
+        (unsigned long long)current->latency_p999_ns, (unsigned long long)current->latency_max_ns);
+}
+
+static void sleep_seconds(double seconds)
+{
+    struct timespec sleep_time;
+    sleep_time.tv_sec = (time_t)seconds;
+    sleep_time.tv_nsec = (long)((seconds - (double)sleep_time.tv_sec) * 1e9);
+    (void)nanosleep(&sleep_time, NULL);
+}
+
+int main(int argc, char* argv[])
+{
+    int result;
+    STAT_PAGE_HANDLE stat_page;
+    double interval = argc > 2 ? strtod(argv[2], NULL) : DEFAULT_INTERVAL_SECONDS;
+    long count = argc > 3 ? strtol(argv[3], NULL, 10) : -1;
+
+    if (argc < 2 || argc > 4 || strcmp(argv[1], "--help") == 0 || interval <= 0.0 || (argc > 3 && count <= 0))
+    {
+        print_usage(argv[0]);
+        result = __LINE__;
+    }
+    else if ((stat_page = stat_page_open(argv[1])) == NULL)
+    {
+        (void)printf("unable to attach to %s, is the tree exporting to it?\r\n", argv[1]);
+        result = __LINE__;
+    }
+    else
+    {
+        STAT_PAGE_VALUES previous;
+        STAT_PAGE_VALUES current;
+        size_t lines = 0;
+        (void)signal(SIGINT, handle_signal);
+        (void)signal(SIGTERM, handle_signal);
+
+        result = stat_page_read(stat_page, &previous);
+        while (result == 0 && !g_stop && count != 0)
+        {
+            sleep_seconds(interval);
+            if ((result = stat_page_read(stat_page, &current)) != 0)
+            {
+                break;
+            }
+
+            if (lines % HEADER_EVERY_LINES == 0)
+            {
+                print_header();
+            }
+            lines++;
+
+            if (current.publish_ns == 0)
+            {
+                (void)printf("waiting for the first publish\r\n");
+            }
+            else if (current.publish_ns == previous.publish_ns && stopwatch_now_ns() - current.publish_ns > STALE_AFTER_NS)
+            {
+                (void)printf("no update from pid %llu for %.1f s\r\n", (unsigned long long)current.pid, (double)(stopwatch_now_ns() - current.publish_ns) / 1e9);
+            }
+            else
+            {
+                print_line(&current, previous.publish_ns == 0 ? &current : &previous);
+            }
+            (void)fflush(stdout);
+            previous = current;
+            count = count > 0 ? count - 1 : count;
+        }
+        stat_page_destroy(stat_page);
+    }
+    return result == 0 ? 0 : 1;
+}
@@ -0,0 +1,311 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WHISKEY_TREE_H
+#define WHISKEY_TREE_H
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#else // __cplusplus
+#include <stdlib.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+// Generates an AVL tree specialized for one key and value type.  Unlike
+// binary_tree.h there is no handle, no lock and no modes: the caller owns
+// the name##_tree struct, values are stored in the node rather than boxed
+// behind a void* and the comparison is expanded inline.  The result is
+// only as thread safe as a plain struct.
+//
+//   WHISKEY_TREE_DEFINE(order_tree, uint64_t, ORDER, WHISKEY_TREE_COMPARE_SCALAR)
+//
+// defines order_tree_tree and order_tree_node and these functions:
+//
+//   void name##_init(name##_tree* tree)
+//   void name##_clear(name##_tree* tree)
+//   int name##_insert(name##_tree* tree, key_t key, value_t value)
+//   int name##_remove(name##_tree* tree, key_t key, value_t* removed_value)
+//   value_t* name##_find(const name##_tree* tree, key_t key)
+//   size_t name##_count(const name##_tree* tree)
+//   size_t name##_height(const name##_tree* tree)
+//   void name##_for_each(const name##_tree* tree, visitor, void* context)
+//
+// insert and remove return 0 on success like binary_tree_insert, find
+// returns a pointer to the value in the node, valid until that key is
+// removed, and for_each visits in key order with
+// void visitor(key_t key, value_t* value, void* context).
+// cmp(a, b) is called as a function or expanded as a macro and returns
+// less than, equal to or greater than zero like memcmp.  Keys and values
+// are copied by assignment, remove moves the successor's into the node.
+
+// Define before including to allocate nodes elsewhere
+#ifndef WHISKEY_TREE_MALLOC
+#define WHISKEY_TREE_MALLOC(size)   malloc(size)
+#endif
+#ifndef WHISKEY_TREE_FREE
+#define WHISKEY_TREE_FREE(ptr)      free(ptr)
+#endif
+
+// An AVL tree is at most 1.44 log2(n) high, this covers any 64-bit count
+#define WHISKEY_TREE_MAX_HEIGHT     96
+
+#define WHISKEY_TREE_COMPARE_SCALAR(value_1, value_2)   (((value_1) > (value_2)) - ((value_1) < (value_2)))
+
+#define WHISKEY_TREE_DEFINE(name, key_t, value_t, cmp) \
+    typedef struct name##_node_TAG \
+    { \
+        struct name##_node_TAG* left; \
+        struct name##_node_TAG* right; \
+        int height; \
+        key_t key; \
+        value_t value; \
+    } name##_node; \
+    \
+    typedef struct name##_tree_TAG \
+    { \
+        name##_node* root; \
+        size_t count; \
+    } name##_tree; \
+    \
+    static inline void name##_init(name##_tree* tree) \
+    { \
+        tree->root = NULL; \
+        tree->count = 0; \
+    } \
+    \
+    static inline int name##_node_height(const name##_node* node) \
+    { \
+        return node == NULL ? 0 : node->height; \
+    } \
+    \
+    static inline int name##_balance_factor(const name##_node* node) \
+    { \
+        return name##_node_height(node->left) - name##_node_height(node->right); \
+    } \
+    \
+    static inline void name##_update_height(name##_node* node) \
+    { \
+        int left_height = name##_node_height(node->left); \
+        int right_height = name##_node_height(node->right); \
+        node->height = (left_height > right_height ? left_height : right_height) + 1; \
+    } \
+    \
+    static inline name##_node* name##_rotate_right(name##_node* node) \
+    { \
+        name##_node* pivot = node->left; \
+        node->left = pivot->right; \
+        pivot->right = node; \
+        name##_update_height(node); \
+        name##_update_height(pivot); \
+        return pivot; \
+    } \
+    \
+    static inline name##_node* name##_rotate_left(name##_node* node) \
+    { \
+        name##_node* pivot = node->right; \
+        node->right = pivot->left; \
+        pivot->left = node; \
+        name##_update_height(node); \
+        name##_update_height(pivot); \
+        return pivot; \
+    } \
+    \
+    /* Returns the new root of the subtree once its children are balanced */ \
+    static inline name##_node* name##_rebalance(name##_node* node) \
+    { \
+        name##_node* result = node; \
+        int balance_factor = name##_balance_factor(node); \
+        if (balance_factor > 1) \
+        { \
+            if (name##_balance_factor(node->left) < 0) \
+            { \
+                node->left = name##_rotate_left(node->left); \
+            } \
+            result = name##_rotate_right(node); \
+        } \
+        else if (balance_factor < -1) \
+        { \
+            if (name##_balance_factor(node->right) > 0) \
+            { \
+                node->right = name##_rotate_right(node->right); \
+            } \
+            result = name##_rotate_left(node); \
+        } \
+        else \
+        { \
+            name##_update_height(node); \
+        } \
+        return result; \
+    } \
+    \
+    /* Walks back up the links a write descended through until a subtree */ \
+    /* comes out as high as it was, nothing above it can have changed */ \
+    static inline void name##_rebalance_path(name##_node** path[], size_t depth) \
+    { \
+        while (depth > 0) \
+        { \
+            name##_node** link = path[--depth]; \
+            int old_height = (*link)->height; \
+            *link = name##_rebalance(*link); \
+            if ((*link)->height == old_height) \
+            { \
+                break; \
+            } \
+        } \
+    } \
+    \
+    static inline value_t* name##_find(const name##_tree* tree, key_t key) \
+    { \
+        value_t* result = NULL; \
+        name##_node* node = tree->root; \
+        while (node != NULL) \
+        { \
+            int compare_result = cmp(key, node->key); \
+            if (compare_result == 0) \
+            { \
+                result = &node->value; \
+                break; \
+            } \
+            node = compare_result < 0 ? node->left : node->right; \
+        } \
+        return result; \
+    } \
+    \
+    static inline int name##_insert(name##_tree* tree, key_t key, value_t value) \
+    { \
+        int result = 0; \
+        name##_node** path[WHISKEY_TREE_MAX_HEIGHT]; \
+        size_t depth = 0; \
+        name##_node** link = &tree->root; \
+        while (*link != NULL) \
+        { \
+            int compare_result = cmp(key, (*link)->key); \
+            if (compare_result == 0) \
+            { \
+                result = __LINE__; \
+                break; \
+            } \
+            path[depth++] = link; \
+            link = compare_result < 0 ? &(*link)->left : &(*link)->right; \
+        } \
+        \
+        if (result == 0) \
+        { \
+            name##_node* node = (name##_node*)WHISKEY_TREE_MALLOC(sizeof(name##_node)); \
+            if (node == NULL) \
+            { \
+                result = __LINE__; \
+            } \
+            else \
+            { \
+                node->left = NULL; \
+                node->right = NULL; \
+                node->height = 1; \
+                node->key = key; \
+                node->value = value; \
+                *link = node; \
+                tree->count++; \
+                name##_rebalance_path(path, depth); \
+            } \
+        } \
+        return result; \
+    } \
+    \
+    /* removed_value may be NULL */ \
+    static inline int name##_remove(name##_tree* tree, key_t key, value_t* removed_value) \
+    { \
+        int result; \
+        name##_node** path[WHISKEY_TREE_MAX_HEIGHT]; \
+        size_t depth = 0; \
+        name##_node** link = &tree->root; \
+        int compare_result; \
+        while (*link != NULL && (compare_result = cmp(key, (*link)->key)) != 0) \
+        { \
+            path[depth++] = link; \
+            link = compare_result < 0 ? &(*link)->left : &(*link)->right; \
+        } \
+        \
+        if (*link == NULL) \
+        { \
+            result = __LINE__; \
+        } \
+        else \
+        { \
+            name##_node* node = *link; \
+            name##_node* unlinked; \
+            if (removed_value != NULL) \
+            { \
+                *removed_value = node->value; \
+            } \
+            if (node->left != NULL && node->right != NULL) \
+            { \
+                /* Take over the successor's entry and unlink its node instead */ \
+                name##_node** successor_link = &node->right; \
+                path[depth++] = link; \
+                while ((*successor_link)->left != NULL) \
+                { \
+                    path[depth++] = successor_link; \
+                    successor_link = &(*successor_link)->left; \
+                } \
+                unlinked = *successor_link; \
+                node->key = unlinked->key; \
+                node->value = unlinked->value; \
+                *successor_link = unlinked->right; \
+            } \
+            else \
+            { \
+                unlinked = node; \
+                *link = node->left != NULL ? node->left : node->right; \
+            } \
+            WHISKEY_TREE_FREE(unlinked); \
+            tree->count--; \
+            name##_rebalance_path(path, depth); \
+            result = 0; \
+        } \
+        return result; \
+    } \
+    \
+    static inline void name##_free_subtree(name##_node* node) \
+    { \
+        while (node != NULL) \
+        { \
+            name##_node* right = node->right; \
+            name##_free_subtree(node->left); \
+            WHISKEY_TREE_FREE(node); \
+            node = right; \
+        } \
+    } \
+    \
+    static inline void name##_clear(name##_tree* tree) \
+    { \
+        name##_free_subtree(tree->root); \
+        name##_init(tree); \
+    } \
+    \
+    static inline size_t name##_count(const name##_tree* tree) \
+    { \
+        return tree->count; \
+    } \
+    \
+    static inline size_t name##_height(const name##_tree* tree) \
+    { \
+        return (size_t)name##_node_height(tree->root); \
+    } \
+    \
+    static inline void name##_visit_subtree(const name##_node* node, void (*visitor)(key_t key, value_t* value, void* context), void* context) \
+    { \
+        while (node != NULL) \
+        { \
+            name##_visit_subtree(node->left, visitor, context); \
+            visitor(node->key, (value_t*)&node->value, context); \
+            node = node->right; \
+        } \
+    } \
+    \
+    static inline void name##_for_each(const name##_tree* tree, void (*visitor)(key_t key, value_t* value, void* context), void* context) \
+    { \
+        name##_visit_subtree(tree->root, visitor, context); \
+    }
+
+#endif  /* WHISKEY_TREE_H */